@@ -36,6 +36,7 @@
 #include <winpr/wtsapi.h>
 #include <winpr/wtypes.h>
 
+#include <freerds/fdsapi.h>
 #include <freerds/channel_plugin.h>
 
 #include "channel_utils.h"
@@ -422,6 +423,12 @@ static void process_ts_events()
 	fire_session_event(WTS_EVENT_CREATE);
 	fire_session_event(WTS_EVENT_CONNECT);
 
+	/* Only wake up for events of our own session. */
+	if (!FreeRDS_WTSFilterSessionEvents(g_ulSessionId))
+	{
+		WLog_Print(g_logger, WLOG_WARN, "Unable to filter session events for session %lu", g_ulSessionId);
+	}
+
 	for (;;)
 	{
 		static DWORD dwEventMask =
@@ -37,6 +37,17 @@
 
 #include <freerds/rpc.h>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
 #include "FDSApiMessages.h"
 
 static DWORD g_currentSessionId = 0xFFFFFFFF;
@@ -45,12 +56,28 @@ static rdsRpcClient* g_RpcClient = NULL;
 
 static wLog* g_logger = NULL;
 
+#define FDSAPI_CHANNEL_MAX_COMBINE_SIZE	0x100000
+#define FDSAPI_CHANNEL_COMBINE_DELAY		5
+#define FDSAPI_CHANNEL_IOV_COUNT		16
+
 struct _FDSAPI_CHANNEL
 {
 	char* guid;
 	UINT32 port;
 	SOCKET socket;
 	HANDLE event;
+
+	/* write combining */
+	CRITICAL_SECTION writeLock;
+	BYTE* writeBuffer;
+	UINT32 writeSize;
+	UINT32 writeLength;
+	DWORD writeDelay;
+	UINT64 writeDeadline;
+	BOOL writeFailed;
+	HANDLE hFlushThread;
+	HANDLE hFlushEvent;
+	HANDLE hStopEvent;
 };
 typedef struct _FDSAPI_CHANNEL FDSAPI_CHANNEL;
 
@@ -62,216 +89,1366 @@ static FDSAPI_CHANNEL* FDSAPI_Channel_New()
 
 	if (pChannel)
 	{
+		InitializeCriticalSectionAndSpinCount(&pChannel->writeLock, 4000);
+	}
+
+	return pChannel;
+}
+
+static int FDSAPI_Channel_Connect(FDSAPI_CHANNEL* pChannel, const char* guid, UINT32 port)
+{
+	int status;
+	int optlen = 0;
+	UINT32 optval = 0;
+	unsigned long addr;
+	struct sockaddr_in sockAddr;
+
+	if (strlen(guid) != 36)
+		return -1001;
+
+	pChannel->port = port;
+
+	pChannel->guid = _strdup(guid);
+
+	if (!pChannel->guid)
+		return -1002;
+
+	if (!port)
+	{
+#ifndef _WIN32
+		char* path;
+		struct sockaddr_un unixAddr;
+
+		/* the channel server listens on a local socket */
+		path = GetNamedPipeUnixDomainSocketFilePathA(FREERDS_CHANNEL_PIPE_NAME);
+
+		if (!path)
+			return -1004;
+
+		if (strlen(path) >= sizeof(unixAddr.sun_path))
+		{
+			free(path);
+			return -1004;
+		}
+
+		ZeroMemory(&unixAddr, sizeof(unixAddr));
+		unixAddr.sun_family = AF_UNIX;
+		strcpy(unixAddr.sun_path, path);
+		free(path);
+
+		pChannel->socket = _socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (pChannel->socket == INVALID_SOCKET)
+			return -1003;
+
+		status = _connect(pChannel->socket, (struct sockaddr*) &unixAddr, sizeof(unixAddr));
+#else
+		return -1004;
+#endif
+	}
+	else
+	{
+		pChannel->socket = _socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+		if (pChannel->socket == INVALID_SOCKET)
+			return -1003;
+
+		addr = _inet_addr("127.0.0.1");
+
+		sockAddr.sin_family = AF_INET;
+		sockAddr.sin_addr.s_addr = addr;
+		sockAddr.sin_port = htons(port);
+
+		status = _connect(pChannel->socket, (struct sockaddr*) &sockAddr, sizeof(sockAddr));
+	}
+
+	if (status != 0)
+	{
+		closesocket(pChannel->socket);
+		pChannel->socket = 0;
+		return -1004;
+	}
+
+	status = _send(pChannel->socket, guid, 36, 0);
+
+	if (status != 36)
+	{
+		closesocket(pChannel->socket);
+		pChannel->socket = 0;
+		return -1005;
+	}
+
+	if (port)
+	{
+		optval = TRUE;
+		optlen = sizeof(optval);
+
+		_setsockopt(pChannel->socket, IPPROTO_TCP, TCP_NODELAY, (char*) &optval, optlen);
+	}
+
+	pChannel->event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, (int) pChannel->socket);
+
+	return 1;
+}
+
+#ifdef _WIN32
+static int FDSAPI_Channel_Send(FDSAPI_CHANNEL* pChannel, const BYTE* buffer, UINT32 length)
+{
+	int status;
+	UINT32 offset = 0;
+
+	while (offset < length)
+	{
+		status = _send(pChannel->socket, (const char*) &buffer[offset], length - offset, 0);
+
+		if (status < 1)
+			return -1;
+
+		offset += status;
+	}
+
+	return 1;
+}
+#endif
+
+/**
+ * Sends the pending bytes followed by the buffers as a single frame,
+ * the length prefix and all parts leave in as few syscalls as possible.
+ */
+static int FDSAPI_Channel_WriteFrameV(FDSAPI_CHANNEL* pChannel, const BYTE* pending, UINT32 pendingLength,
+	const FREERDS_WTS_BUFFER* pBuffers, ULONG BufferCount)
+{
+	ULONG index;
+	UINT32 length;
+	UINT64 total = pendingLength;
+
+	for (index = 0; index < BufferCount; index++)
+		total += pBuffers[index].Length;
+
+	/* the server drops the channel on a larger frame */
+	if (total > FREERDS_CHANNEL_MAX_FRAME_SIZE)
+		return -1;
+
+	length = (UINT32) total;
+
+#ifndef _WIN32
+	int iovcnt = 0;
+	ssize_t status;
+	struct iovec* pIov;
+	struct iovec* iov;
+	struct iovec iovStack[FDSAPI_CHANNEL_IOV_COUNT];
+
+	iov = iovStack;
+
+	if ((BufferCount + 2) > FDSAPI_CHANNEL_IOV_COUNT)
+	{
+		iov = (struct iovec*) calloc(BufferCount + 2, sizeof(struct iovec));
+
+		if (!iov)
+			return -1;
+	}
+
+	iov[iovcnt].iov_base = (void*) &length;
+	iov[iovcnt++].iov_len = sizeof(length);
+
+	if (pendingLength)
+	{
+		iov[iovcnt].iov_base = (void*) pending;
+		iov[iovcnt++].iov_len = pendingLength;
+	}
+
+	for (index = 0; index < BufferCount; index++)
+	{
+		if (!pBuffers[index].Length)
+			continue;
+
+		iov[iovcnt].iov_base = (void*) pBuffers[index].Buffer;
+		iov[iovcnt++].iov_len = pBuffers[index].Length;
+	}
+
+	pIov = iov;
+
+	while (iovcnt)
+	{
+		status = writev(pChannel->socket, pIov, (iovcnt < IOV_MAX) ? iovcnt : IOV_MAX);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		while (iovcnt && ((size_t) status >= pIov->iov_len))
+		{
+			status -= pIov->iov_len;
+			pIov++;
+			iovcnt--;
+		}
+
+		if (iovcnt)
+		{
+			pIov->iov_base = ((BYTE*) pIov->iov_base) + status;
+			pIov->iov_len -= status;
+		}
+	}
+
+	if (iov != iovStack)
+		free(iov);
+
+	if (iovcnt)
+		return -1;
+#else
+	if (FDSAPI_Channel_Send(pChannel, (const BYTE*) &length, sizeof(length)) < 0)
+		return -1;
+
+	if (FDSAPI_Channel_Send(pChannel, pending, pendingLength) < 0)
+		return -1;
+
+	for (index = 0; index < BufferCount; index++)
+	{
+		if (FDSAPI_Channel_Send(pChannel, (const BYTE*) pBuffers[index].Buffer, pBuffers[index].Length) < 0)
+			return -1;
+	}
+#endif
+
+	return 1;
+}
+
+/* Must be called with the write lock held. */
+static int FDSAPI_Channel_FlushPending(FDSAPI_CHANNEL* pChannel)
+{
+	int status;
+
+	if (!pChannel->writeLength)
+		return 1;
+
+	status = FDSAPI_Channel_WriteFrameV(pChannel, pChannel->writeBuffer, pChannel->writeLength, NULL, 0);
+
+	pChannel->writeLength = 0;
+
+	if (status < 0)
+		pChannel->writeFailed = TRUE;
+
+	return status;
+}
+
+static void* FDSAPI_Channel_FlushThread(void* arg)
+{
+	DWORD status;
+	UINT64 now;
+	DWORD dwTimeout = INFINITE;
+	FDSAPI_CHANNEL* pChannel = (FDSAPI_CHANNEL*) arg;
+	HANDLE events[2];
+
+	events[0] = pChannel->hStopEvent;
+	events[1] = pChannel->hFlushEvent;
+
+	while (1)
+	{
+		status = WaitForMultipleObjects(2, events, FALSE, dwTimeout);
+
+		if (status == WAIT_OBJECT_0)
+			break;
+
+		EnterCriticalSection(&pChannel->writeLock);
+
+		dwTimeout = INFINITE;
+
+		if (pChannel->writeLength)
+		{
+			now = GetTickCount64();
+
+			/* flush once the oldest pending byte is writeDelay old */
+			if (now >= pChannel->writeDeadline)
+				FDSAPI_Channel_FlushPending(pChannel);
+			else
+				dwTimeout = (DWORD) (pChannel->writeDeadline - now);
+		}
+
+		LeaveCriticalSection(&pChannel->writeLock);
+	}
+
+	return NULL;
+}
+
+static int FDSAPI_Channel_Write(FDSAPI_CHANNEL* pChannel, const FREERDS_WTS_BUFFER* pBuffers, ULONG BufferCount)
+{
+	int status = 1;
+	ULONG index;
+	UINT64 length = 0;
+
+	for (index = 0; index < BufferCount; index++)
+		length += pBuffers[index].Length;
+
+	EnterCriticalSection(&pChannel->writeLock);
+
+	if (pChannel->writeFailed)
+	{
+		LeaveCriticalSection(&pChannel->writeLock);
+		return -1;
+	}
+
+	if (!pChannel->writeSize)
+	{
+		status = FDSAPI_Channel_WriteFrameV(pChannel, NULL, 0, pBuffers, BufferCount);
+	}
+	else if ((pChannel->writeLength + length) > FREERDS_CHANNEL_MAX_FRAME_SIZE)
+	{
+		/* too large to share a frame, the pending bytes go first */
+		status = FDSAPI_Channel_FlushPending(pChannel);
+
+		if (status >= 0)
+			status = FDSAPI_Channel_WriteFrameV(pChannel, NULL, 0, pBuffers, BufferCount);
+	}
+	else if ((pChannel->writeLength + length) >= pChannel->writeSize)
+	{
+		/* the size threshold is reached, pending and new bytes share one frame */
+		status = FDSAPI_Channel_WriteFrameV(pChannel, pChannel->writeBuffer, pChannel->writeLength,
+				pBuffers, BufferCount);
+
+		pChannel->writeLength = 0;
+	}
+	else if (length)
+	{
+		if (!pChannel->writeLength)
+		{
+			pChannel->writeDeadline = GetTickCount64() + pChannel->writeDelay;
+			SetEvent(pChannel->hFlushEvent);
+		}
+
+		for (index = 0; index < BufferCount; index++)
+		{
+			CopyMemory(&pChannel->writeBuffer[pChannel->writeLength], pBuffers[index].Buffer, pBuffers[index].Length);
+			pChannel->writeLength += pBuffers[index].Length;
+		}
+	}
+
+	if (status < 0)
+		pChannel->writeFailed = TRUE;
+
+	LeaveCriticalSection(&pChannel->writeLock);
+
+	return status;
+}
+
+static int FDSAPI_Channel_SetWriteCombining(FDSAPI_CHANNEL* pChannel, UINT32 maxBytes, DWORD maxDelay)
+{
+	int status = 1;
+	BYTE* buffer = NULL;
+
+	if (maxBytes > FDSAPI_CHANNEL_MAX_COMBINE_SIZE)
+		maxBytes = FDSAPI_CHANNEL_MAX_COMBINE_SIZE;
+
+	if (maxBytes)
+	{
+		buffer = (BYTE*) malloc(maxBytes);
+
+		if (!buffer)
+			return -1;
+	}
+
+	EnterCriticalSection(&pChannel->writeLock);
+
+	if (maxBytes && !pChannel->hFlushThread)
+	{
+		pChannel->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		pChannel->hFlushEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		if (pChannel->hStopEvent && pChannel->hFlushEvent)
+		{
+			pChannel->hFlushThread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) FDSAPI_Channel_FlushThread, pChannel, 0, NULL);
+		}
+
+		if (!pChannel->hFlushThread)
+			status = -1;
+	}
+
+	if (status > 0)
+	{
+		/* bytes combined under the old settings go out first */
+		status = FDSAPI_Channel_FlushPending(pChannel);
+
+		free(pChannel->writeBuffer);
+		pChannel->writeBuffer = buffer;
+		pChannel->writeSize = maxBytes;
+		pChannel->writeDelay = maxDelay ? maxDelay : FDSAPI_CHANNEL_COMBINE_DELAY;
+		buffer = NULL;
+	}
+
+	LeaveCriticalSection(&pChannel->writeLock);
+
+	free(buffer);
+
+	return status;
+}
+
+static void FDSAPI_Channel_Free(FDSAPI_CHANNEL* pChannel)
+{
+	if (!pChannel)
+		return;
+
+	if (pChannel->hFlushThread)
+	{
+		SetEvent(pChannel->hStopEvent);
+		WaitForSingleObject(pChannel->hFlushThread, INFINITE);
+		CloseHandle(pChannel->hFlushThread);
+		pChannel->hFlushThread = NULL;
+	}
+
+	if (pChannel->hStopEvent)
+		CloseHandle(pChannel->hStopEvent);
+
+	if (pChannel->hFlushEvent)
+		CloseHandle(pChannel->hFlushEvent);
+
+	/* nothing combined is lost on close */
+	if (pChannel->socket && !pChannel->writeFailed)
+		FDSAPI_Channel_FlushPending(pChannel);
+
+	free(pChannel->writeBuffer);
+	DeleteCriticalSection(&pChannel->writeLock);
+
+	if (pChannel->socket)
+	{
+		closesocket(pChannel->socket);
+		pChannel->socket = 0;
+	}
+
+	if (pChannel->event)
+	{
+		CloseHandle(pChannel->event);
+		pChannel->event = NULL;
+	}
+
+	free(pChannel->guid);
+
+	free(pChannel);
+}
+
+/*
+ * Most calls result in a request/response message being sent and
+ * received from the FreeRDS server.  The following code handles
+ * the blocking nature of these calls in a thread-safe manner.
+ * Each request is tagged with a unique request id and a response
+ * is paired with the request.
+ *
+ * Pending requests live in a fixed table indexed by the low bits of
+ * their request id, so pairing a response is a single lookup. Every
+ * request carries a timeout and fails with ERROR_TIMEOUT instead of
+ * hanging on an unresponsive server, or with RPC_S_SERVER_UNAVAILABLE
+ * once the connection drops. Asynchronous requests complete through
+ * a callback instead of a wait event.
+ */
+
+#define FDSAPI_MAX_PENDING_REQUESTS		4096
+#define FDSAPI_WAIT_EVENT_POOL_SIZE		32
+
+#define FDSAPI_REQUEST_TIMEOUT			30000
+#define FDSAPI_REQUEST_TIMEOUT_LONG		120000
+
+typedef void (*FDSAPI_REQUEST_COMPLETION)(void* context, DWORD dwError, FDSAPI_MESSAGE* responseMsg);
+
+typedef struct
+{
+	BOOL busy;
+	UINT16 requestId;
+	DWORD dwError;
+
+	/* synchronous requests */
+	HANDLE hWaitEvent;
+	FDSAPI_MESSAGE* responseMsg;
+
+	/* asynchronous requests */
+	FDSAPI_REQUEST_COMPLETION completion;
+	void* context;
+	UINT64 deadline;
+}
+FDSAPI_REQUEST_SLOT;
+
+static CRITICAL_SECTION g_requestLock;
+static UINT16 g_nextRequestId = 1;
+static FDSAPI_REQUEST_SLOT g_requestSlots[FDSAPI_MAX_PENDING_REQUESTS];
+
+static HANDLE g_waitEventPool[FDSAPI_WAIT_EVENT_POOL_SIZE];
+static int g_waitEventPoolCount = 0;
+
+static HANDLE g_hTimeoutThread = NULL;
+static HANDLE g_hTimeoutStopEvent = NULL;
+
+static DWORD FDSAPI_GetRequestTimeout(FDSAPI_MESSAGE* requestMsg)
+{
+	/* Calls which wait for the session manager to finish some work. */
+	switch (requestMsg->messageId)
+	{
+		case FDSAPI_DISCONNECT_SESSION_REQUEST_ID:
+			return requestMsg->u.disconnectSessionRequest.wait ? FDSAPI_REQUEST_TIMEOUT_LONG : FDSAPI_REQUEST_TIMEOUT;
+
+		case FDSAPI_LOGOFF_SESSION_REQUEST_ID:
+			return requestMsg->u.logoffSessionRequest.wait ? FDSAPI_REQUEST_TIMEOUT_LONG : FDSAPI_REQUEST_TIMEOUT;
+
+		case FDSAPI_SHUTDOWN_SYSTEM_REQUEST_ID:
+		case FDSAPI_AUTHENTICATE_USER_REQUEST_ID:
+			return FDSAPI_REQUEST_TIMEOUT_LONG;
+
+		default:
+			return FDSAPI_REQUEST_TIMEOUT;
+	}
+}
+
+/* Must be called with the request lock held. */
+static FDSAPI_REQUEST_SLOT* FDSAPI_AllocateRequestSlot()
+{
+	int count;
+	UINT16 requestId;
+	FDSAPI_REQUEST_SLOT* slot;
+
+	for (count = 0; count < FDSAPI_MAX_PENDING_REQUESTS; count++)
+	{
+		/* Request id 0 is reserved for requests without a response. */
+		if (!g_nextRequestId)
+			g_nextRequestId++;
+
+		requestId = g_nextRequestId++;
+		slot = &g_requestSlots[requestId % FDSAPI_MAX_PENDING_REQUESTS];
+
+		if (slot->busy)
+			continue;
+
+		ZeroMemory(slot, sizeof(FDSAPI_REQUEST_SLOT));
+		slot->busy = TRUE;
+		slot->requestId = requestId;
+		slot->dwError = ERROR_IO_PENDING;
+
+		return slot;
+	}
+
+	return NULL;
+}
+
+/* Must be called with the request lock held. */
+static FDSAPI_REQUEST_SLOT* FDSAPI_FindRequestSlot(UINT16 requestId)
+{
+	FDSAPI_REQUEST_SLOT* slot = &g_requestSlots[requestId % FDSAPI_MAX_PENDING_REQUESTS];
+
+	if (!requestId || !slot->busy || (slot->requestId != requestId) || (slot->dwError != ERROR_IO_PENDING))
+		return NULL;
+
+	return slot;
+}
+
+static HANDLE FDSAPI_AcquireWaitEvent()
+{
+	HANDLE hEvent = NULL;
+
+	EnterCriticalSection(&g_requestLock);
+
+	if (g_waitEventPoolCount > 0)
+		hEvent = g_waitEventPool[--g_waitEventPoolCount];
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (hEvent)
+		ResetEvent(hEvent);
+	else
+		hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	return hEvent;
+}
+
+static void FDSAPI_ReleaseWaitEvent(HANDLE hEvent)
+{
+	EnterCriticalSection(&g_requestLock);
+
+	if (g_waitEventPoolCount < FDSAPI_WAIT_EVENT_POOL_SIZE)
+	{
+		g_waitEventPool[g_waitEventPoolCount++] = hEvent;
+		hEvent = NULL;
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (hEvent)
+		CloseHandle(hEvent);
+}
+
+static int FDSAPI_SendMessage(FDSAPI_MESSAGE* msg)
+{
+	wStream* s;
+	int status;
+
+	s = FDSAPI_EncodeMessage(msg);
+
+	if (!s)
+	{
+		WLog_Print(g_logger, WLOG_ERROR, "failed to encode request");
+		return -1;
+	}
+
+	status = freerds_rpc_client_send_message(g_RpcClient, Stream_Buffer(s), Stream_Length(s));
+
+	if (status != (int) Stream_Length(s))
+		status = -1;
+
+	Stream_Free(s, TRUE);
+
+	return status;
+}
+
+static BOOL FDSAPI_SendRequestTimeout(FDSAPI_MESSAGE* requestMsg, FDSAPI_MESSAGE* responseMsg, DWORD dwTimeout)
+{
+	HANDLE hWaitEvent;
+	FDSAPI_REQUEST_SLOT* slot;
+	DWORD dwError;
+
+	hWaitEvent = FDSAPI_AcquireWaitEvent();
+
+	if (!hWaitEvent)
+	{
+		WLog_Print(g_logger, WLOG_ERROR, "failed to create event");
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+
+	/* Reserve a slot, which also assigns the request id. */
+	EnterCriticalSection(&g_requestLock);
+
+	slot = FDSAPI_AllocateRequestSlot();
+
+	if (slot)
+	{
+		slot->hWaitEvent = hWaitEvent;
+		slot->responseMsg = responseMsg;
+		requestMsg->requestId = slot->requestId;
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (!slot)
+	{
+		WLog_Print(g_logger, WLOG_ERROR, "too many pending requests");
+		FDSAPI_ReleaseWaitEvent(hWaitEvent);
+		SetLastError(ERROR_BUSY);
+		return FALSE;
+	}
+
+	WLog_Print(g_logger, WLOG_DEBUG, "sending request %d", requestMsg->requestId);
+
+	/* Send the request to the FreeRDS server and wait for the response. */
+	if (FDSAPI_SendMessage(requestMsg) < 0)
+	{
+		WLog_Print(g_logger, WLOG_ERROR, "failed to send request");
+		dwError = RPC_S_SERVER_UNAVAILABLE;
+	}
+	else if (WaitForSingleObject(hWaitEvent, dwTimeout) != WAIT_OBJECT_0)
+	{
+		WLog_Print(g_logger, WLOG_WARN, "request %d timed out", requestMsg->requestId);
+		dwError = ERROR_TIMEOUT;
+	}
+	else
+	{
+		dwError = ERROR_SUCCESS;
+	}
+
+	/* A response may still have raced in, so check under the lock. */
+	EnterCriticalSection(&g_requestLock);
+
+	if (slot->dwError != ERROR_IO_PENDING)
+		dwError = slot->dwError;
+
+	slot->busy = FALSE;
+
+	LeaveCriticalSection(&g_requestLock);
+
+	FDSAPI_ReleaseWaitEvent(hWaitEvent);
+
+	if (dwError != ERROR_SUCCESS)
+	{
+		SetLastError(dwError);
+		return FALSE;
+	}
+
+	WLog_Print(g_logger, WLOG_DEBUG, "received response %d", responseMsg->requestId);
+
+	return TRUE;
+}
+
+static BOOL FDSAPI_SendRequest(FDSAPI_MESSAGE* requestMsg, FDSAPI_MESSAGE* responseMsg)
+{
+	return FDSAPI_SendRequestTimeout(requestMsg, responseMsg, FDSAPI_GetRequestTimeout(requestMsg));
+}
+
+/* Completes the first expired (or with bAll, any) asynchronous request. */
+static BOOL FDSAPI_ExpireAsyncRequest(BOOL bAll, DWORD dwError)
+{
+	int index;
+	void* context = NULL;
+	FDSAPI_REQUEST_SLOT* slot;
+	FDSAPI_REQUEST_COMPLETION completion = NULL;
+	UINT64 now = GetTickCount64();
+
+	EnterCriticalSection(&g_requestLock);
+
+	for (index = 0; index < FDSAPI_MAX_PENDING_REQUESTS; index++)
+	{
+		slot = &g_requestSlots[index];
+
+		if (!slot->busy || !slot->completion || (slot->dwError != ERROR_IO_PENDING))
+			continue;
+
+		if (!bAll && (slot->deadline > now))
+			continue;
+
+		completion = slot->completion;
+		context = slot->context;
+		slot->busy = FALSE;
+		break;
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (!completion)
+		return FALSE;
+
+	completion(context, dwError, NULL);
+
+	return TRUE;
+}
+
+static void* FDSAPI_TimeoutThread(void* arg)
+{
+	while (WaitForSingleObject(g_hTimeoutStopEvent, 1000) == WAIT_TIMEOUT)
+	{
+		while (FDSAPI_ExpireAsyncRequest(FALSE, ERROR_TIMEOUT));
+	}
+
+	return NULL;
+}
+
+static void FDSAPI_StopTimeoutThread()
+{
+	if (!g_hTimeoutThread)
+		return;
+
+	SetEvent(g_hTimeoutStopEvent);
+	WaitForSingleObject(g_hTimeoutThread, INFINITE);
+
+	CloseHandle(g_hTimeoutThread);
+	CloseHandle(g_hTimeoutStopEvent);
+	g_hTimeoutThread = NULL;
+	g_hTimeoutStopEvent = NULL;
+}
+
+/**
+ * Joins the timeout thread when the library is unloaded or the process
+ * exits, so it never runs on after the code it executes is gone.
+ */
+
+class FDSAPI_Library
+{
+public:
+	~FDSAPI_Library()
+	{
+		FDSAPI_StopTimeoutThread();
+	}
+};
+
+static FDSAPI_Library g_library;
+
+static BOOL FDSAPI_SendRequestAsync(FDSAPI_MESSAGE* requestMsg, DWORD dwTimeout,
+	FDSAPI_REQUEST_COMPLETION completion, void* context)
+{
+	FDSAPI_REQUEST_SLOT* slot;
+	UINT16 requestId;
+
+	EnterCriticalSection(&g_requestLock);
+
+	/* Async requests are expired by a thread of their own. */
+	if (!g_hTimeoutThread)
+	{
+		if (!g_hTimeoutStopEvent)
+			g_hTimeoutStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (g_hTimeoutStopEvent)
+		{
+			g_hTimeoutThread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) FDSAPI_TimeoutThread, NULL, 0, NULL);
+		}
+	}
+
+	slot = FDSAPI_AllocateRequestSlot();
+
+	if (slot)
+	{
+		slot->completion = completion;
+		slot->context = context;
+		slot->deadline = GetTickCount64() + dwTimeout;
+		requestMsg->requestId = requestId = slot->requestId;
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (!slot)
+	{
+		SetLastError(ERROR_BUSY);
+		return FALSE;
+	}
+
+	if (FDSAPI_SendMessage(requestMsg) < 0)
+	{
+		/* Unless the connection loss already completed it, withdraw the request. */
+		EnterCriticalSection(&g_requestLock);
+
+		slot = FDSAPI_FindRequestSlot(requestId);
+
+		if (slot)
+		{
+			slot->busy = FALSE;
+		}
+
+		LeaveCriticalSection(&g_requestLock);
+
+		if (slot)
+		{
+			SetLastError(RPC_S_SERVER_UNAVAILABLE);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static int FDSAPI_HandleResponse(rdsRpcClient* rpcClient, FDSAPI_MESSAGE* msg)
+{
+	void* context = NULL;
+	FDSAPI_REQUEST_SLOT* slot;
+	FDSAPI_REQUEST_COMPLETION completion = NULL;
+
+	/* Find the matching request. */
+	EnterCriticalSection(&g_requestLock);
+
+	slot = FDSAPI_FindRequestSlot(msg->requestId);
+
+	if (slot && slot->completion)
+	{
+		completion = slot->completion;
+		context = slot->context;
+		slot->busy = FALSE;
+	}
+	else if (slot)
+	{
+		/* Wake up the requesting thread, which now owns the message. */
+		CopyMemory(slot->responseMsg, msg, sizeof(FDSAPI_MESSAGE));
+		slot->dwError = ERROR_SUCCESS;
+		SetEvent(slot->hWaitEvent);
+		msg = NULL;
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	if (completion)
+		completion(context, ERROR_SUCCESS, msg);
+
+	/* Late responses to timed out requests end up here as well. */
+	if (msg)
+		FDSAPI_FreeMessage(msg);
+
+	return 0;
+}
+
+static void FDSAPI_FailPendingRequests(DWORD dwError)
+{
+	int index;
+	FDSAPI_REQUEST_SLOT* slot;
+
+	EnterCriticalSection(&g_requestLock);
+
+	for (index = 0; index < FDSAPI_MAX_PENDING_REQUESTS; index++)
+	{
+		slot = &g_requestSlots[index];
+
+		if (slot->busy && !slot->completion && (slot->dwError == ERROR_IO_PENDING))
+		{
+			slot->dwError = dwError;
+			SetEvent(slot->hWaitEvent);
+		}
+	}
+
+	LeaveCriticalSection(&g_requestLock);
+
+	while (FDSAPI_ExpireAsyncRequest(TRUE, dwError));
+}
+
+/**
+ * The server only delivers the session events a connection subscribed
+ * to. A fresh connection asks for none, the subscription then grows
+ * with the observers registered below and never shrinks, so an event
+ * arriving between two WTSWaitSystemEvent calls is not lost. If the
+ * connection is re-established the server falls back to sending every
+ * event, which the observers filter just as well.
+ */
+
+static CRITICAL_SECTION g_subscriptionLock;
+static UINT32 g_sessionEventFilter = FDSAPI_SESSION_ANY;
+static UINT32 g_subscribedSessionId = FDSAPI_SESSION_ANY;
+static UINT32 g_subscribedEventMask = 0;
+static LONG g_subscriptionEpoch = 0;
+
+/* bumped whenever the connection drops, the server forgets the client */
+static LONG g_connectionEpoch = 0;
+
+static UINT32 FDSAPI_EventFlagsToEventMask(DWORD dwEventFlags)
+{
+	UINT32 eventMask = 0;
+	UINT32 connectMask = FDSAPI_SESSION_EVENT_BIT(WTS_CONSOLE_CONNECT) | FDSAPI_SESSION_EVENT_BIT(WTS_REMOTE_CONNECT);
+	UINT32 disconnectMask = FDSAPI_SESSION_EVENT_BIT(WTS_CONSOLE_DISCONNECT) | FDSAPI_SESSION_EVENT_BIT(WTS_REMOTE_DISCONNECT);
+
+	if (dwEventFlags & WTS_EVENT_CREATE)
+		eventMask |= FDSAPI_SESSION_EVENT_BIT(WTS_SESSION_CREATE);
+
+	if (dwEventFlags & WTS_EVENT_DELETE)
+		eventMask |= FDSAPI_SESSION_EVENT_BIT(WTS_SESSION_TERMINATE);
+
+	if (dwEventFlags & (WTS_EVENT_CONNECT | WTS_EVENT_STATECHANGE))
+		eventMask |= connectMask;
+
+	if (dwEventFlags & (WTS_EVENT_DISCONNECT | WTS_EVENT_STATECHANGE))
+		eventMask |= disconnectMask;
+
+	if (dwEventFlags & (WTS_EVENT_LOGON | WTS_EVENT_STATECHANGE))
+		eventMask |= FDSAPI_SESSION_EVENT_BIT(WTS_SESSION_LOGON);
+
+	if (dwEventFlags & (WTS_EVENT_LOGOFF | WTS_EVENT_STATECHANGE))
+		eventMask |= FDSAPI_SESSION_EVENT_BIT(WTS_SESSION_LOGOFF);
+
+	return eventMask;
+}
+
+static BOOL FDSAPI_PostRequest(FDSAPI_MESSAGE* requestMsg)
+{
+	/* The response is not waited for, FDSAPI_HandleResponse drops it. */
+	requestMsg->requestId = 0;
+
+	return (FDSAPI_SendMessage(requestMsg) < 0) ? FALSE : TRUE;
+}
+
+static BOOL FDSAPI_SubscribeSessionEvents(UINT32 sessionId, UINT32 eventMask)
+{
+	FDSAPI_MESSAGE requestMsg;
+	FDSAPI_MESSAGE responseMsg;
+	UINT32 subscribedSessionId;
+	UINT32 subscribedEventMask;
+	BOOL bSuccess = TRUE;
+
+	EnterCriticalSection(&g_subscriptionLock);
+
+	/* A new connection starts out subscribed to every event. */
+	if (g_subscriptionEpoch != g_connectionEpoch)
+	{
+		g_subscriptionEpoch = g_connectionEpoch;
+		g_subscribedSessionId = FDSAPI_SESSION_ANY;
+		g_subscribedEventMask = FDSAPI_SESSION_EVENT_ALL;
+	}
+
+	if (g_sessionEventFilter != FDSAPI_SESSION_ANY)
+		sessionId = g_sessionEventFilter;
+
+	/* Widen the current subscription, two different sessions mean any. */
+	subscribedEventMask = g_subscribedEventMask | eventMask;
+
+	if (!g_subscribedEventMask || (g_subscribedSessionId == sessionId) || (g_sessionEventFilter != FDSAPI_SESSION_ANY))
+		subscribedSessionId = sessionId;
+	else
+		subscribedSessionId = FDSAPI_SESSION_ANY;
+
+	if ((subscribedEventMask != g_subscribedEventMask) ||
+			(subscribedEventMask && (subscribedSessionId != g_subscribedSessionId)))
+	{
+		ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
+		ZeroMemory(&responseMsg, sizeof(FDSAPI_MESSAGE));
+
+		requestMsg.messageId = FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID;
+		requestMsg.u.subscribeSessionEventsRequest.sessionId = subscribedSessionId;
+		requestMsg.u.subscribeSessionEventsRequest.eventMask = subscribedEventMask;
+
+		bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg) &&
+				responseMsg.u.subscribeSessionEventsResponse.result;
+
+		if (bSuccess)
+		{
+			g_subscribedSessionId = subscribedSessionId;
+			g_subscribedEventMask = subscribedEventMask;
+		}
+		else
+		{
+			WLog_Print(g_logger, WLOG_WARN, "failed to subscribe to session events");
+		}
+
+		FDSAPI_FreeMessage(&requestMsg);
+		FDSAPI_FreeMessage(&responseMsg);
+	}
+
+	LeaveCriticalSection(&g_subscriptionLock);
+
+	return bSuccess;
+}
+
+
+/**
+ * Session cache
+ *
+ * The session table is mirrored locally for processes which enumerate
+ * sessions over and over. The first enumeration subscribes to the
+ * FDSAPI_SESSION_CHANGES feed and fetches the whole table, later ones
+ * are served from the mirror as long as no change notification with a
+ * newer sequence came in, and otherwise fetch only what changed since.
+ * Notifications are handled on the rpc thread without taking the cache
+ * lock, updates hold it across their request.
+ *
+ * The notification for a change made by this process may arrive after
+ * the call making it has returned, so such calls mark the cache stale
+ * and the next use fetches the changes right away.
+ */
+
+typedef struct
+{
+	DWORD sessionId;
+	WTS_CONNECTSTATE_CLASS connectState;
+	char* winStationName;
+	char* userName;
+	char* domain;
+}
+FDSAPI_SESSION_CACHE_ENTRY;
+
+static CRITICAL_SECTION g_sessionCacheLock;
+static FDSAPI_SESSION_CACHE_ENTRY* g_sessionCache = NULL;
+static DWORD g_sessionCacheCount = 0;
+static DWORD g_sessionCacheSize = 0;
+static UINT32 g_sessionCacheSequence = 0;
+static LONG g_sessionCacheEpoch = -1;
+
+/* latest sequence announced by the server */
+static LONG g_sessionChangeSequence = 0;
+
+/* set by calls of this process that change sessions */
+static LONG g_sessionCacheStale = 0;
+
+static void FDSAPI_InvalidateSessionCache()
+{
+	InterlockedExchange(&g_sessionCacheStale, 1);
+}
+
+static void FDSAPI_FreeSessionCacheEntry(FDSAPI_SESSION_CACHE_ENTRY* entry)
+{
+	free(entry->winStationName);
+	free(entry->userName);
+	free(entry->domain);
+}
+
+static FDSAPI_SESSION_CACHE_ENTRY* FDSAPI_FindSessionCacheEntry(DWORD sessionId)
+{
+	DWORD index;
+
+	for (index = 0; index < g_sessionCacheCount; index++)
+	{
+		if (g_sessionCache[index].sessionId == sessionId)
+			return &g_sessionCache[index];
+	}
+
+	return NULL;
+}
+
+static void FDSAPI_ClearSessionCache()
+{
+	DWORD index;
+
+	for (index = 0; index < g_sessionCacheCount; index++)
+		FDSAPI_FreeSessionCacheEntry(&g_sessionCache[index]);
+
+	g_sessionCacheCount = 0;
+}
+
+static BOOL FDSAPI_ApplySessionChange(FDSAPI_SESSION_CHANGE* change)
+{
+	FDSAPI_SESSION_CACHE_ENTRY* entry = FDSAPI_FindSessionCacheEntry(change->sessionId);
+
+	if (change->removed)
+	{
+		if (entry)
+		{
+			FDSAPI_FreeSessionCacheEntry(entry);
+			*entry = g_sessionCache[--g_sessionCacheCount];
+		}
+
+		return TRUE;
+	}
+
+	if (!entry)
+	{
+		if (g_sessionCacheCount == g_sessionCacheSize)
+		{
+			DWORD size = g_sessionCacheSize ? (g_sessionCacheSize * 2) : 16;
+			FDSAPI_SESSION_CACHE_ENTRY* cache;
+
+			cache = (FDSAPI_SESSION_CACHE_ENTRY*) realloc(g_sessionCache, size * sizeof(FDSAPI_SESSION_CACHE_ENTRY));
+
+			if (!cache)
+				return FALSE;
 
+			g_sessionCache = cache;
+			g_sessionCacheSize = size;
+		}
+
+		entry = &g_sessionCache[g_sessionCacheCount++];
+		ZeroMemory(entry, sizeof(FDSAPI_SESSION_CACHE_ENTRY));
+		entry->sessionId = change->sessionId;
 	}
 
-	return pChannel;
-}
+	FDSAPI_FreeSessionCacheEntry(entry);
 
-static int FDSAPI_Channel_Connect(FDSAPI_CHANNEL* pChannel, const char* guid, UINT32 port)
-{
-	int status;
-	int optlen = 0;
-	UINT32 optval = 0;
-	unsigned long addr;
-	struct sockaddr_in sockAddr;
+	entry->connectState = (WTS_CONNECTSTATE_CLASS) change->connectState;
+	entry->winStationName = _strdup(change->winStationName ? change->winStationName : "");
+	entry->userName = _strdup(change->userName ? change->userName : "");
+	entry->domain = _strdup(change->domain ? change->domain : "");
 
-	if (strlen(guid) != 36)
-		return -1001;
+	return (entry->winStationName && entry->userName && entry->domain) ? TRUE : FALSE;
+}
 
-	pChannel->port = port;
+/**
+ * Brings the cache up to date, called with the cache lock held.
+ * Returns FALSE if the cache cannot be used and the caller has to
+ * ask the server directly.
+ */
+static BOOL FDSAPI_UpdateSessionCache()
+{
+	FDSAPI_MESSAGE requestMsg;
+	FDSAPI_MESSAGE responseMsg;
+	FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE* response;
+	LONG connectionEpoch = g_connectionEpoch;
+	UINT32 sequence = g_sessionCacheSequence;
+	BOOL bSuccess = TRUE;
+	UINT32 index;
+
+	/* A filtered process never sees the changes of other sessions. */
+	if (g_sessionEventFilter != FDSAPI_SESSION_ANY)
+		return FALSE;
 
-	pChannel->guid = _strdup(guid);
+	if (g_sessionCacheEpoch != connectionEpoch)
+	{
+		if (!FDSAPI_SubscribeSessionEvents(FDSAPI_SESSION_ANY, FDSAPI_SESSION_EVENT_CHANGES))
+			return FALSE;
 
-	if (!pChannel->guid)
-		return -1002;
+		sequence = 0;
+	}
+	else if (((LONG) g_sessionCacheSequence >= g_sessionChangeSequence) && !g_sessionCacheStale)
+	{
+		return TRUE;
+	}
 
-	pChannel->socket = _socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	/* a change made after this point marks the cache stale again */
+	InterlockedExchange(&g_sessionCacheStale, 0);
 
-	if (pChannel->socket == INVALID_SOCKET)
-		return -1003;
+	ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
+	ZeroMemory(&responseMsg, sizeof(FDSAPI_MESSAGE));
 
-	addr = _inet_addr("127.0.0.1");
+	requestMsg.messageId = FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID;
+	requestMsg.u.enumerateSessionChangesRequest.sequence = sequence;
 
-	sockAddr.sin_family = AF_INET;
-	sockAddr.sin_addr.s_addr = addr;
-	sockAddr.sin_port = htons(port);
+	if (!FDSAPI_SendRequest(&requestMsg, &responseMsg))
+	{
+		FDSAPI_InvalidateSessionCache();
+		return FALSE;
+	}
 
-	status = _connect(pChannel->socket, (struct sockaddr*) &sockAddr, sizeof(sockAddr));
+	response = &responseMsg.u.enumerateSessionChangesResponse;
 
-	if (status != 0)
+	if (response->result && (connectionEpoch == g_connectionEpoch))
 	{
-		closesocket(pChannel->socket);
-		pChannel->socket = 0;
-		return -1004;
-	}
+		if (response->reset || !sequence)
+			FDSAPI_ClearSessionCache();
 
-	status = _send(pChannel->socket, guid, 36, 0);
+		for (index = 0; (index < response->cChanges) && bSuccess; index++)
+			bSuccess = FDSAPI_ApplySessionChange(&response->pChanges[index]);
 
-	if (status != 36)
+		WLog_Print(g_logger, WLOG_DEBUG, "session cache at sequence %u, %u changes since %u",
+			response->sequence, response->cChanges, sequence);
+
+		g_sessionCacheSequence = response->sequence;
+		g_sessionCacheEpoch = bSuccess ? connectionEpoch : -1;
+	}
+	else
 	{
-		closesocket(pChannel->socket);
-		pChannel->socket = 0;
-		return -1005;
+		bSuccess = FALSE;
 	}
 
-	optval = TRUE;
-	optlen = sizeof(optval);
-
-	_setsockopt(pChannel->socket, IPPROTO_TCP, TCP_NODELAY, (char*) &optval, optlen);
+	if (!bSuccess)
+		FDSAPI_InvalidateSessionCache();
 
-	pChannel->event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, (int) pChannel->socket);
+	FDSAPI_FreeMessage(&responseMsg);
 
-	return 1;
+	return bSuccess;
 }
 
-static void FDSAPI_Channel_Free(FDSAPI_CHANNEL* pChannel)
+static int FDSAPI_HandleSessionChanges(rdsRpcClient* rpcClient, FDSAPI_SESSION_CHANGES* sessionChanges)
 {
-	if (!pChannel)
-		return;
+	LONG sequence;
 
-	if (pChannel->socket)
+	/* notifications may overtake each other, keep the highest */
+	do
 	{
-		closesocket(pChannel->socket);
-		pChannel->socket = 0;
-	}
+		sequence = g_sessionChangeSequence;
 
-	if (pChannel->event)
-	{
-		CloseHandle(pChannel->event);
-		pChannel->event = NULL;
+		if ((LONG) sessionChanges->sequence <= sequence)
+			break;
 	}
+	while (InterlockedCompareExchange(&g_sessionChangeSequence, (LONG) sessionChanges->sequence, sequence) != sequence);
 
-	free(pChannel->guid);
-
-	free(pChannel);
-}
-
-/*
- * Most calls result in a request/response message being sent and
- * received from the FreeRDS server.  The following code handles
- * the blocking nature of these calls in a thread-safe manner.
- * Each request is tagged with a unique request id and a response
- * is paired with the request.
- */
-
-typedef struct
-{
-	HANDLE hWaitEvent;
-	FDSAPI_MESSAGE* requestMsg;
-	FDSAPI_MESSAGE* responseMsg;
+	return 0;
 }
-FDSAPI_REQUEST_ITEM;
 
-static UINT16 g_nextRequestId;
-static wArrayList* g_activeRequestList;
-
-static BOOL FDSAPI_SendRequest(FDSAPI_MESSAGE* requestMsg, FDSAPI_MESSAGE* responseMsg)
+static BOOL FDSAPI_EnumerateCachedSessions(PWTS_SESSION_INFOA* ppSessionInfo, DWORD* pCount)
 {
-	FDSAPI_REQUEST_ITEM requestItem;
-	BOOL success = FALSE;
-	wStream* s = NULL;
-	int status;
-
-	ZeroMemory(&requestItem, sizeof(requestItem));
+	PWTS_SESSION_INFOA pSessionInfoA;
+	LPBYTE pExtra;
+	DWORD cbExtra;
+	DWORD index;
+	DWORD size;
 
-	/* Enter critical section. */
-	ArrayList_Lock(g_activeRequestList);
+	EnterCriticalSection(&g_sessionCacheLock);
 
-	/* Set the request id. */
-	requestMsg->requestId = g_nextRequestId++;
+	if (!FDSAPI_UpdateSessionCache())
+	{
+		LeaveCriticalSection(&g_sessionCacheLock);
+		return FALSE;
+	}
 
-	/* Leave critical section. */
-	ArrayList_Unlock(g_activeRequestList);
+	if (g_sessionCacheCount == 0)
+	{
+		LeaveCriticalSection(&g_sessionCacheLock);
+		return TRUE;
+	}
 
-	WLog_Print(g_logger, WLOG_DEBUG, "sending request %d", requestMsg->requestId);
+	/* Allocate memory (including space for strings). */
+	cbExtra = 0;
+	for (index = 0; index < g_sessionCacheCount; index++)
+		cbExtra += strlen(g_sessionCache[index].winStationName) + 1;
 
-	/* Encode the request. */
-	s = FDSAPI_EncodeMessage(requestMsg);
+	size = (g_sessionCacheCount * sizeof(WTS_SESSION_INFOA)) + cbExtra;
+	pSessionInfoA = (PWTS_SESSION_INFOA) calloc(1, size);
 
-	if (!s)
+	if (!pSessionInfoA)
 	{
-		WLog_Print(g_logger, WLOG_ERROR, "failed to encode request");
+		LeaveCriticalSection(&g_sessionCacheLock);
 		return FALSE;
 	}
 
-	/* Add the request to the list. */
-	requestItem.hWaitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	pExtra = (LPBYTE) pSessionInfoA + (g_sessionCacheCount * sizeof(WTS_SESSION_INFOA));
 
-	if (!requestItem.hWaitEvent)
+	for (index = 0; index < g_sessionCacheCount; index++)
 	{
-		WLog_Print(g_logger, WLOG_ERROR, "failed to create event");
-		goto EXCEPTION;
-	}
+		FDSAPI_SESSION_CACHE_ENTRY* entry = &g_sessionCache[index];
 
-	requestItem.requestMsg = requestMsg;
-	requestItem.responseMsg = responseMsg;
+		pSessionInfoA[index].SessionId = entry->sessionId;
+		pSessionInfoA[index].pWinStationName = (LPSTR) pExtra;
+		pSessionInfoA[index].State = entry->connectState;
 
-	ArrayList_Add(g_activeRequestList, &requestItem);
+		strcpy((LPSTR) pExtra, entry->winStationName);
+		pExtra += strlen(entry->winStationName) + 1;
+	}
 
-	/* Send the request to the FreeRDS server. */
-	status = freerds_rpc_client_send_message(g_RpcClient, Stream_Buffer(s), Stream_Length(s));
+	*ppSessionInfo = pSessionInfoA;
+	*pCount = g_sessionCacheCount;
 
-	if (status == Stream_Length(s))
-	{
-		WLog_Print(g_logger, WLOG_DEBUG, "waiting for response");
+	LeaveCriticalSection(&g_sessionCacheLock);
 
-		/* Wait for the response. */
-		WaitForSingleObject(requestItem.hWaitEvent, INFINITE);
+	return TRUE;
+}
 
-		WLog_Print(g_logger, WLOG_DEBUG, "received response %d", responseMsg->requestId);
+/**
+ * Answers the session table classes of WTSQuerySessionInformation from
+ * an up to date cache. Returns ERROR_NOT_FOUND if the server has to be
+ * asked instead.
+ */
+static DWORD FDSAPI_QueryCachedSessionInformation(DWORD SessionId, WTS_INFO_CLASS WTSInfoClass,
+	LPSTR* ppBuffer, DWORD* pBytesReturned)
+{
+	FDSAPI_SESSION_CACHE_ENTRY* entry;
+	const char* stringValue = NULL;
+	ULONG ulValue = 0;
+	DWORD dwError = ERROR_SUCCESS;
 
-		/* Check for the expected response. */
-		if (requestMsg->requestId == responseMsg->requestId)
-		{
-			success = TRUE;
-		}
-	}
-	else
+	switch (WTSInfoClass)
 	{
-		WLog_Print(g_logger, WLOG_ERROR, "failed to send request");
-	}
+		case WTSSessionId:
+		case WTSConnectState:
+		case WTSUserName:
+		case WTSWinStationName:
+		case WTSDomainName:
+			break;
 
-	/* Remove the request from the list. */	
-	ArrayList_Remove(g_activeRequestList, &requestItem);
+		default:
+			return ERROR_NOT_FOUND;
+	}
 
-	CloseHandle(requestItem.hWaitEvent);
+	EnterCriticalSection(&g_sessionCacheLock);
 
-EXCEPTION:
-	if (s)
+	/* Only a cache which is in use already is trusted, a query alone does not set one up. */
+	if ((g_sessionCacheEpoch != g_connectionEpoch) || !FDSAPI_UpdateSessionCache() ||
+			!(entry = FDSAPI_FindSessionCacheEntry(SessionId)))
 	{
-		Stream_Free(s, TRUE);
+		LeaveCriticalSection(&g_sessionCacheLock);
+		return ERROR_NOT_FOUND;
 	}
 
-	return success;
-}
+	switch (WTSInfoClass)
+	{
+		case WTSSessionId:
+			ulValue = entry->sessionId;
+			break;
 
-static int FDSAPI_HandleResponse(rdsRpcClient* rpcClient, FDSAPI_MESSAGE* msg)
-{
-	int index;
-	FDSAPI_REQUEST_ITEM* requestItem;
+		case WTSConnectState:
+			ulValue = entry->connectState;
+			break;
 
-	/* Find the matching request. */
-	ArrayList_Lock(g_activeRequestList);
+		case WTSUserName:
+			stringValue = entry->userName;
+			break;
 
-	for (index = 0; index < ArrayList_Count(g_activeRequestList); index++)
-	{
-		requestItem = (FDSAPI_REQUEST_ITEM*) ArrayList_GetItem(g_activeRequestList, index);
+		case WTSWinStationName:
+			stringValue = entry->winStationName;
+			break;
 
-		if (msg->requestId == requestItem->requestMsg->requestId)
-		{
-			/* Wake up the requesting thread. */
-			CopyMemory(requestItem->responseMsg, msg, sizeof(FDSAPI_MESSAGE));
-			SetEvent(requestItem->hWaitEvent);
+		default:
+			stringValue = entry->domain;
 			break;
-		}
 	}
 
-	ArrayList_Unlock(g_activeRequestList);
+	if (stringValue)
+	{
+		*ppBuffer = _strdup(stringValue);
+		*pBytesReturned = strlen(stringValue) + 1;
+	}
+	else
+	{
+		*ppBuffer = (LPSTR) malloc(sizeof(ULONG));
+		*pBytesReturned = sizeof(ULONG);
 
-	return 0;
-}
+		if (*ppBuffer)
+			*((ULONG*) *ppBuffer) = ulValue;
+	}
+
+	LeaveCriticalSection(&g_sessionCacheLock);
+
+	if (!*ppBuffer)
+	{
+		*pBytesReturned = 0;
+		dwError = ERROR_NOT_ENOUGH_MEMORY;
+	}
 
+	return dwError;
+}
 
 /**
  * As calls to WTSWaitSystemEvent and WTSRegisterSessionNotification
@@ -323,6 +1500,10 @@ static int FDSAPI_HandleSessionEvent(rdsRpcClient* rpcClient, FDSAPI_SESSION_EVE
 	DWORD sleepTime;
 	FDSAPI_SESSION_EVENT_OBSERVER* observer;
 
+	/* Ignore other sessions if the process asked for its own only. */
+	if ((g_sessionEventFilter != FDSAPI_SESSION_ANY) && (sessionEvent->sessionId != g_sessionEventFilter))
+		return 0;
+
 	/* Enter critical section. */
 	ArrayList_Lock(g_sessionEventObserverList);
 
@@ -430,6 +1611,13 @@ int FDSAPI_RpcConnectionClosed(rdsRpcClient* rpcClient)
 {
 	WLog_Print(g_logger, WLOG_DEBUG, "connection closed");
 
+	/* Responses will never arrive for what is in flight. */
+	FDSAPI_FailPendingRequests(RPC_S_SERVER_UNAVAILABLE);
+
+	/* Subscriptions and the session cache start over on the next connection. */
+	InterlockedExchange(&g_sessionChangeSequence, 0);
+	InterlockedIncrement(&g_connectionEpoch);
+
 	return 0;
 }
 
@@ -461,6 +1649,10 @@ int FDSAPI_RpcMessageReceived(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 leng
 				status = FDSAPI_HandleSessionEvent(rpcClient, &msg.u.sessionEvent);
 				break;
 
+			case FDSAPI_SESSION_CHANGES_ID:
+				status = FDSAPI_HandleSessionChanges(rpcClient, &msg.u.sessionChanges);
+				break;
+
 			default:
 				status = FDSAPI_HandleResponse(rpcClient, &msg);
 				break;
@@ -488,14 +1680,28 @@ static BOOL ConnectClient()
 	{
 		WLog_Print(g_logger, WLOG_DEBUG, "connecting to FDSAPI server");
 
-		g_activeRequestList = ArrayList_New(TRUE);
+		InitializeCriticalSectionAndSpinCount(&g_requestLock, 0x00000400);
 		g_sessionEventObserverList = ArrayList_New(TRUE);
 
+		InitializeCriticalSectionAndSpinCount(&g_subscriptionLock, 0x00000400);
+		InitializeCriticalSectionAndSpinCount(&g_sessionCacheLock, 0x00000400);
+
 		g_RpcClient = freerds_rpc_client_new("FDSAPI");
 		g_RpcClient->ConnectionClosed = FDSAPI_RpcConnectionClosed;
 		g_RpcClient->MessageReceived = FDSAPI_RpcMessageReceived;
 
-		freerds_rpc_client_start(g_RpcClient);
+		if (freerds_rpc_client_start(g_RpcClient) >= 0)
+		{
+			FDSAPI_MESSAGE requestMsg;
+
+			/* No session events until an observer asks for them. */
+			ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
+			requestMsg.messageId = FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID;
+			requestMsg.u.subscribeSessionEventsRequest.sessionId = FDSAPI_SESSION_ANY;
+			requestMsg.u.subscribeSessionEventsRequest.eventMask = 0;
+
+			FDSAPI_PostRequest(&requestMsg);
+		}
 	}
 
 	return TRUE;
@@ -695,6 +1901,9 @@ FreeRDS_WTSEnumerateSessionsA(
 	*ppSessionInfo = NULL;
 	*pCount = 0;
 
+	if (FDSAPI_EnumerateCachedSessions(ppSessionInfo, pCount))
+		return TRUE;
+
 	/* Execute session manager RPC. */
 	ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
 	ZeroMemory(&responseMsg, sizeof(FDSAPI_MESSAGE));
@@ -715,12 +1924,18 @@ FreeRDS_WTSEnumerateSessionsA(
 	}
 
 	if (!bSuccess)
+	{
+		FDSAPI_FreeMessage(&responseMsg);
 		return FALSE;
+	}
 
 	count = responseMsg.u.enumerateSessionsResponse.cSessions;
 
 	if (count == 0)
+	{
+		FDSAPI_FreeMessage(&responseMsg);
 		return TRUE;
+	}
 
 	/* Allocate memory (including space for strings). */
 	cbExtra = 0;
@@ -734,7 +1949,10 @@ FreeRDS_WTSEnumerateSessionsA(
 	pSessionInfoA = (PWTS_SESSION_INFOA) calloc(1, size);
 
 	if (!pSessionInfoA)
+	{
+		FDSAPI_FreeMessage(&responseMsg);
 		return FALSE;
+	}
 
 	pExtra = (LPBYTE) pSessionInfoA + (count * sizeof(WTS_SESSION_INFOA));
 
@@ -755,6 +1973,8 @@ FreeRDS_WTSEnumerateSessionsA(
 		pExtra += size + 1;
 	}
 
+	FDSAPI_FreeMessage(&responseMsg);
+
 	*ppSessionInfo = pSessionInfoA;
 	*pCount = count;
 
@@ -900,77 +2120,20 @@ FreeRDS_WTSTerminateProcess(
 	return FALSE;
 }
 
-BOOL WINAPI
-FreeRDS_WTSQuerySessionInformationA(
-	HANDLE hServer,
-	DWORD SessionId,
-	WTS_INFO_CLASS WTSInfoClass,
-	LPSTR* ppBuffer,
-	DWORD* pBytesReturned
-)
+/**
+ * Copies a QUERY_SESSION_INFORMATION response into a buffer that the
+ * caller releases with WTSFreeMemory.
+ */
+static DWORD FDSAPI_CopySessionInformation(WTS_INFO_CLASS WTSInfoClass, FDSAPI_MESSAGE* responseMsg,
+	LPSTR* ppBuffer, DWORD* pBytesReturned)
 {
-	BOOL bSuccess;
-	FDSAPI_MESSAGE requestMsg;
-	FDSAPI_MESSAGE responseMsg;
 	FDSAPI_SESSION_INFO_VALUE* infoValue;
 
-	/* Check parameters. */
-	if (hServer != WTS_CURRENT_SERVER_HANDLE)
-	{
-		SetLastError(ERROR_INVALID_PARAMETER);
-		return FALSE;
-	}
-
-	if (!CheckSessionId(&SessionId))
-		return FALSE;
-
-	if (!ppBuffer)
-	{
-		SetLastError(ERROR_INVALID_PARAMETER);
-		return FALSE;
-	}
-
-	if (!pBytesReturned)
-	{
-		SetLastError(ERROR_INVALID_PARAMETER);
-		return FALSE;
-	}
-
-	/* Connect to the session manager. */
-	if (!ConnectClient())
-	{
-		SetLastError(ERROR_INTERNAL_ERROR);
-		return FALSE;
-	}
-
-	*ppBuffer = NULL;
-	*pBytesReturned = 0;
-
-	ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
-	ZeroMemory(&responseMsg, sizeof(FDSAPI_MESSAGE));
-
-	requestMsg.messageId = FDSAPI_QUERY_SESSION_INFORMATION_REQUEST_ID;
-	requestMsg.u.querySessionInformationRequest.sessionId = SessionId;
-	requestMsg.u.querySessionInformationRequest.infoClass = WTSInfoClass;
+	if (!responseMsg->u.querySessionInformationResponse.result)
+		return ERROR_INTERNAL_ERROR;
 
-	infoValue = &responseMsg.u.querySessionInformationResponse.infoValue;
+	infoValue = &responseMsg->u.querySessionInformationResponse.infoValue;
 
-	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
-
-	if (!bSuccess)
-	{
-		SetLastError(ERROR_INTERNAL_ERROR);
-		return FALSE;
-	}
-
-	if (!responseMsg.u.querySessionInformationResponse.result)
-	{
-		FDSAPI_FreeMessage(&responseMsg);
-		SetLastError(ERROR_INTERNAL_ERROR);
-		return FALSE;
-	}
-
-	/* Return the result. */
 	switch (WTSInfoClass)
 	{
 		case WTSSessionId:
@@ -983,9 +2146,7 @@ FreeRDS_WTSQuerySessionInformationA(
 			if (!pulValue)
 			{
 				WLog_Print(g_logger, WLOG_ERROR, "memory allocation error");
-				FDSAPI_FreeMessage(&responseMsg);
-				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
-				return FALSE;
+				return ERROR_NOT_ENOUGH_MEMORY;
 			}
 
 			*pulValue = (ULONG) infoValue->u.uint32Value;
@@ -1004,9 +2165,7 @@ FreeRDS_WTSQuerySessionInformationA(
 			if (!pusValue)
 			{
 				WLog_Print(g_logger, WLOG_ERROR, "memory allocation error");
-				FDSAPI_FreeMessage(&responseMsg);
-				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
-				return FALSE;
+				return ERROR_NOT_ENOUGH_MEMORY;
 			}
 
 			*pusValue = (USHORT) infoValue->u.uint16Value;
@@ -1030,9 +2189,7 @@ FreeRDS_WTSQuerySessionInformationA(
 			if (!pszValue)
 			{
 				WLog_Print(g_logger, WLOG_ERROR, "memory allocation error");
-				FDSAPI_FreeMessage(&responseMsg);
-				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
-				return FALSE;
+				return ERROR_NOT_ENOUGH_MEMORY;
 			}
 
 			strncpy(pszValue, stringValue, size);
@@ -1054,9 +2211,7 @@ FreeRDS_WTSQuerySessionInformationA(
 			if (!pClientAddress)
 			{
 				WLog_Print(g_logger, WLOG_ERROR, "memory allocation error");
-				FDSAPI_FreeMessage(&responseMsg);
-				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
-				return FALSE;
+				return ERROR_NOT_ENOUGH_MEMORY;
 			}
 
 			/* TODO: Need to convert IPV4 or IPV6 address from string to binary. */
@@ -1085,9 +2240,7 @@ FreeRDS_WTSQuerySessionInformationA(
 			if (!pClientDisplay)
 			{
 				WLog_Print(g_logger, WLOG_ERROR, "memory allocation error");
-				FDSAPI_FreeMessage(&responseMsg);
-				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
-				return FALSE;
+				return ERROR_NOT_ENOUGH_MEMORY;
 			}
 
 			pClientDisplay->HorizontalResolution = infoValue->u.displayValue.displayWidth;
@@ -1099,15 +2252,98 @@ FreeRDS_WTSQuerySessionInformationA(
 
 			break;
 		}
-	
+
 		default:
-			bSuccess = FALSE;
-			break;
+			return ERROR_INVALID_PARAMETER;
+	}
+
+
+	return ERROR_SUCCESS;
+}
+
+BOOL WINAPI
+FreeRDS_WTSQuerySessionInformationA(
+	HANDLE hServer,
+	DWORD SessionId,
+	WTS_INFO_CLASS WTSInfoClass,
+	LPSTR* ppBuffer,
+	DWORD* pBytesReturned
+)
+{
+	BOOL bSuccess;
+	DWORD dwError;
+	FDSAPI_MESSAGE requestMsg;
+	FDSAPI_MESSAGE responseMsg;
+
+	/* Check parameters. */
+	if (hServer != WTS_CURRENT_SERVER_HANDLE)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if (!CheckSessionId(&SessionId))
+		return FALSE;
+
+	if (!ppBuffer)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if (!pBytesReturned)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	/* Connect to the session manager. */
+	if (!ConnectClient())
+	{
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return FALSE;
+	}
+
+	*ppBuffer = NULL;
+	*pBytesReturned = 0;
+
+	dwError = FDSAPI_QueryCachedSessionInformation(SessionId, WTSInfoClass, ppBuffer, pBytesReturned);
+
+	if (dwError != ERROR_NOT_FOUND)
+	{
+		if (dwError != ERROR_SUCCESS)
+		{
+			SetLastError(dwError);
+			return FALSE;
+		}
+
+		return TRUE;
 	}
 
+	ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
+	ZeroMemory(&responseMsg, sizeof(FDSAPI_MESSAGE));
+
+	requestMsg.messageId = FDSAPI_QUERY_SESSION_INFORMATION_REQUEST_ID;
+	requestMsg.u.querySessionInformationRequest.sessionId = SessionId;
+	requestMsg.u.querySessionInformationRequest.infoClass = WTSInfoClass;
+
+	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
+
+	/* FDSAPI_SendRequest sets the error. */
+	if (!bSuccess)
+		return FALSE;
+
+	dwError = FDSAPI_CopySessionInformation(WTSInfoClass, &responseMsg, ppBuffer, pBytesReturned);
+
 	FDSAPI_FreeMessage(&responseMsg);
 
-	return bSuccess;
+	if (dwError != ERROR_SUCCESS)
+	{
+		SetLastError(dwError);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 BOOL WINAPI
@@ -1288,6 +2524,8 @@ FreeRDS_WTSDisconnectSession(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	FDSAPI_InvalidateSessionCache();
+
 	if (bSuccess)
 	{
 		bSuccess = responseMsg.u.disconnectSessionResponse.result;
@@ -1340,6 +2578,8 @@ FreeRDS_WTSLogoffSession(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	FDSAPI_InvalidateSessionCache();
+
 	if (bSuccess)
 	{
 		bSuccess = responseMsg.u.logoffSessionResponse.result;
@@ -1384,6 +2624,8 @@ FreeRDS_WTSShutdownSystem(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	FDSAPI_InvalidateSessionCache();
+
 	if (bSuccess)
 	{
 		bSuccess = responseMsg.u.shutdownSystemResponse.result;
@@ -1450,6 +2692,9 @@ FreeRDS_WTSWaitSystemEvent(
 	ArrayList_Add(g_sessionEventObserverList, pSessionEventObserver);
 	ArrayList_Unlock(g_sessionEventObserverList);
 
+	/* Make sure the server delivers the events being waited for. */
+	FDSAPI_SubscribeSessionEvents(FDSAPI_SESSION_ANY, FDSAPI_EventFlagsToEventMask(EventMask));
+
 	/* Wait for the event. */
 	if (WaitForSingleObject(hEvent, INFINITE) == WAIT_OBJECT_0)
 	{
@@ -1541,18 +2786,16 @@ FreeRDS_WTSVirtualChannelOpen(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	/* FDSAPI_SendRequest sets the error. */
 	if (!bSuccess)
-	{
-		SetLastError(ERROR_INTERNAL_ERROR);
 		return NULL;
-	}
 
 	channelPort = responseMsg.u.virtualChannelOpenResponse.channelPort;
 	channelGuid = responseMsg.u.virtualChannelOpenResponse.channelGuid;
 
 	WLog_Print(g_logger, WLOG_DEBUG, "WTSVirtualChannelOpen: %s:%d", channelGuid, channelPort);
 
-	if (!channelGuid || !channelPort)
+	if (!channelGuid)
 	{
 		dwErrorCode = ERROR_INTERNAL_ERROR;
 		goto CLEANUP;
@@ -1640,18 +2883,16 @@ FreeRDS_WTSVirtualChannelOpenEx(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	/* FDSAPI_SendRequest sets the error. */
 	if (!bSuccess)
-	{
-		SetLastError(ERROR_INTERNAL_ERROR);
 		return NULL;
-	}
 
 	channelPort = responseMsg.u.virtualChannelOpenExResponse.channelPort;
 	channelGuid = responseMsg.u.virtualChannelOpenExResponse.channelGuid;
 
 	WLog_Print(g_logger, WLOG_DEBUG, "WTSVirtualChannelOpenEx: %s:%d", channelGuid, channelPort);
 
-	if (!channelGuid || !channelPort)
+	if (!channelGuid)
 	{
 		dwErrorCode = ERROR_INTERNAL_ERROR;
 		goto CLEANUP;
@@ -1789,7 +3030,7 @@ FreeRDS_WTSVirtualChannelWrite(
 	PULONG pBytesWritten
 )
 {
-	int status;
+	FREERDS_WTS_BUFFER buffer;
 	FDSAPI_CHANNEL* pChannel;
 
 	WLog_Print(g_logger, WLOG_DEBUG, "WTSVirtualChannelWrite: %p %p %lu %p", hChannelHandle, Buffer, Length, pBytesWritten);
@@ -1806,7 +3047,7 @@ FreeRDS_WTSVirtualChannelWrite(
 		return FALSE;
 	}
 
-	if (!pBytesWritten)
+	if (!pBytesWritten || (Length > FREERDS_CHANNEL_MAX_FRAME_SIZE))
 	{
 		SetLastError(ERROR_INVALID_PARAMETER);
 		return FALSE;
@@ -1816,23 +3057,16 @@ FreeRDS_WTSVirtualChannelWrite(
 
 	*pBytesWritten = 0;
 
-	status = _send(pChannel->socket, (const char *) &Length, sizeof(Length), 0);
-
-	if (status < 0)
-	{
-		SetLastError(ERROR_BROKEN_PIPE);
-		return FALSE;
-	}
-
-	status = _send(pChannel->socket, Buffer, Length, 0);
+	buffer.Buffer = Buffer;
+	buffer.Length = Length;
 
-	if (status < 0)
+	if (FDSAPI_Channel_Write(pChannel, &buffer, 1) < 0)
 	{
 		SetLastError(ERROR_BROKEN_PIPE);
 		return FALSE;
 	}
 
-	*pBytesWritten = (ULONG) status;
+	*pBytesWritten = Length;
 
 	return TRUE;
 }
@@ -1954,6 +3188,7 @@ FreeRDS_WTSRegisterSessionNotification(
 	DWORD dwFlags
 )
 {
+	DWORD sessionId;
 	FDSAPI_SESSION_EVENT_OBSERVER* pSessionEventObserver = NULL;
 
 	if (!ConnectClient())
@@ -1974,6 +3209,11 @@ FreeRDS_WTSRegisterSessionNotification(
 	ArrayList_Add(g_sessionEventObserverList, pSessionEventObserver);
 	ArrayList_Unlock(g_sessionEventObserverList);
 
+	if ((dwFlags != NOTIFY_FOR_THIS_SESSION) || !GetCurrentSessionId(&sessionId))
+		sessionId = FDSAPI_SESSION_ANY;
+
+	FDSAPI_SubscribeSessionEvents(sessionId, FDSAPI_SESSION_EVENT_ALL);
+
 	return TRUE;
 }
 
@@ -2372,6 +3612,9 @@ FreeRDS_AuthenticateUser(
 
 	bSuccess = FDSAPI_SendRequest(&requestMsg, &responseMsg);
 
+	/* a successful logon moves the connection to the user's session */
+	FDSAPI_InvalidateSessionCache();
+
 	if (bSuccess)
 	{
 		authStatus = responseMsg.u.authenticateUserResponse.result;
@@ -2383,3 +3626,214 @@ FreeRDS_AuthenticateUser(
 
 	return authStatus;
 }
+
+BOOL WINAPI
+FreeRDS_WTSFilterSessionEvents(
+	DWORD SessionId
+)
+{
+	if (!ConnectClient())
+		return FALSE;
+
+	/* Check parameters. */
+	if (!CheckSessionId(&SessionId))
+		return FALSE;
+
+	EnterCriticalSection(&g_subscriptionLock);
+	g_sessionEventFilter = SessionId;
+	LeaveCriticalSection(&g_subscriptionLock);
+
+	/* Narrow an existing subscription to the session. */
+	return FDSAPI_SubscribeSessionEvents(SessionId, 0);
+}
+
+typedef struct
+{
+	DWORD SessionId;
+	WTS_INFO_CLASS WTSInfoClass;
+	PFREERDS_WTS_QUERY_COMPLETION Completion;
+	PVOID Context;
+}
+FDSAPI_QUERY_SESSION_INFORMATION_ASYNC;
+
+static void FDSAPI_QuerySessionInformationCompleted(void* context, DWORD dwError, FDSAPI_MESSAGE* responseMsg)
+{
+	FDSAPI_QUERY_SESSION_INFORMATION_ASYNC* query = (FDSAPI_QUERY_SESSION_INFORMATION_ASYNC*) context;
+	LPSTR pBuffer = NULL;
+	DWORD BytesReturned = 0;
+
+	if (dwError == ERROR_SUCCESS)
+		dwError = FDSAPI_CopySessionInformation(query->WTSInfoClass, responseMsg, &pBuffer, &BytesReturned);
+
+	query->Completion(query->Context, query->SessionId, query->WTSInfoClass, dwError, pBuffer, BytesReturned);
+
+	free(query);
+}
+
+BOOL WINAPI
+FreeRDS_WTSQuerySessionInformationAsyncA(
+	DWORD SessionId,
+	WTS_INFO_CLASS WTSInfoClass,
+	DWORD dwTimeout,
+	PFREERDS_WTS_QUERY_COMPLETION Completion,
+	PVOID Context
+)
+{
+	FDSAPI_MESSAGE requestMsg;
+	FDSAPI_QUERY_SESSION_INFORMATION_ASYNC* query;
+
+	/* Check parameters. */
+	if (!Completion)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if (!CheckSessionId(&SessionId))
+		return FALSE;
+
+	/* Connect to the session manager. */
+	if (!ConnectClient())
+	{
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return FALSE;
+	}
+
+	query = (FDSAPI_QUERY_SESSION_INFORMATION_ASYNC*) calloc(1, sizeof(FDSAPI_QUERY_SESSION_INFORMATION_ASYNC));
+
+	if (!query)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+
+	query->SessionId = SessionId;
+	query->WTSInfoClass = WTSInfoClass;
+	query->Completion = Completion;
+	query->Context = Context;
+
+	ZeroMemory(&requestMsg, sizeof(FDSAPI_MESSAGE));
+
+	requestMsg.messageId = FDSAPI_QUERY_SESSION_INFORMATION_REQUEST_ID;
+	requestMsg.u.querySessionInformationRequest.sessionId = SessionId;
+	requestMsg.u.querySessionInformationRequest.infoClass = WTSInfoClass;
+
+	if (!dwTimeout)
+		dwTimeout = FDSAPI_GetRequestTimeout(&requestMsg);
+
+	/* On failure the completion is not called, FDSAPI_SendRequestAsync sets the error. */
+	if (!FDSAPI_SendRequestAsync(&requestMsg, dwTimeout, FDSAPI_QuerySessionInformationCompleted, query))
+	{
+		free(query);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL WINAPI
+FreeRDS_WTSVirtualChannelWriteV(
+	HANDLE hChannelHandle,
+	const FREERDS_WTS_BUFFER* pBuffers,
+	ULONG BufferCount,
+	PULONG pBytesWritten
+)
+{
+	ULONG index;
+	UINT64 length = 0;
+	FDSAPI_CHANNEL* pChannel;
+
+	if (!hChannelHandle)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if ((!pBuffers && BufferCount) || !pBytesWritten)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	for (index = 0; index < BufferCount; index++)
+	{
+		if (!pBuffers[index].Buffer && pBuffers[index].Length)
+		{
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+
+		length += pBuffers[index].Length;
+	}
+
+	if (length > FREERDS_CHANNEL_MAX_FRAME_SIZE)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	pChannel = (FDSAPI_CHANNEL*) hChannelHandle;
+
+	*pBytesWritten = 0;
+
+	if (FDSAPI_Channel_Write(pChannel, pBuffers, BufferCount) < 0)
+	{
+		SetLastError(ERROR_BROKEN_PIPE);
+		return FALSE;
+	}
+
+	*pBytesWritten = (ULONG) length;
+
+	return TRUE;
+}
+
+BOOL WINAPI
+FreeRDS_WTSVirtualChannelSetWriteCombining(
+	HANDLE hChannelHandle,
+	ULONG MaxBytes,
+	ULONG MaxDelay
+)
+{
+	if (!hChannelHandle)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if (FDSAPI_Channel_SetWriteCombining((FDSAPI_CHANNEL*) hChannelHandle, MaxBytes, MaxDelay) < 0)
+	{
+		SetLastError(ERROR_BROKEN_PIPE);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL WINAPI
+FreeRDS_WTSVirtualChannelFlush(
+	HANDLE hChannelHandle
+)
+{
+	int status;
+	FDSAPI_CHANNEL* pChannel;
+
+	if (!hChannelHandle)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pChannel = (FDSAPI_CHANNEL*) hChannelHandle;
+
+	EnterCriticalSection(&pChannel->writeLock);
+	status = pChannel->writeFailed ? -1 : FDSAPI_Channel_FlushPending(pChannel);
+	LeaveCriticalSection(&pChannel->writeLock);
+
+	if (status < 0)
+	{
+		SetLastError(ERROR_BROKEN_PIPE);
+		return FALSE;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,64 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * Benchmark authentication module
+ *
+ * Accepts every logon without touching PAM so that load tests
+ * measure the manager and not the authentication backend.
+ * Never install this module on a production host.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include "bench_auth.h"
+
+struct rds_auth_module_bench
+{
+	rdsAuthModule common;
+};
+typedef struct rds_auth_module_bench rdsAuthModuleBench;
+
+rdsAuthModuleBench* rds_auth_module_new(void)
+{
+	return (rdsAuthModuleBench*) calloc(1, sizeof(rdsAuthModuleBench));
+}
+
+void rds_auth_module_free(rdsAuthModuleBench* bench)
+{
+	free(bench);
+}
+
+int rds_auth_logon_user(rdsAuthModuleBench* bench, char* username, char* domain, char* password)
+{
+	if (!bench || !username)
+		return -1;
+
+	return 0;
+}
+
+int RdsAuthModuleEntry(RDS_AUTH_MODULE_ENTRY_POINTS* pEntryPoints)
+{
+	pEntryPoints->Version = 1;
+
+	pEntryPoints->New = (pRdsAuthModuleNew) rds_auth_module_new;
+	pEntryPoints->Free = (pRdsAuthModuleFree) rds_auth_module_free;
+
+	pEntryPoints->LogonUser = (pRdsAuthLogonUser) rds_auth_logon_user;
+
+	return 0;
+}
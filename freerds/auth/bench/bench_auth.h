@@ -0,0 +1,33 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * Benchmark authentication module
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDS_AUTH_BENCH_H
+#define FREERDS_AUTH_BENCH_H
+
+#include <freerds/auth.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int RdsAuthModuleEntry(RDS_AUTH_MODULE_ENTRY_POINTS* pEntryPoints);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDS_AUTH_BENCH_H */
@@ -28,6 +28,13 @@ typedef int (*pRdsMessageRead)(wStream* s, RDS_MSG_COMMON* msg);
 typedef int (*pRdsMessageWrite)(wStream* s, RDS_MSG_COMMON* msg);
 typedef void* (*pRdsMessageCopy)(RDS_MSG_COMMON* msg);
 typedef void (*pRdsMessageFree)(RDS_MSG_COMMON* msg);
+typedef void (*pRdsMessagePoolCopy)(rdsMessagePool* pool, RDS_MSG_COMMON* dup, RDS_MSG_COMMON* msg);
+typedef void (*pRdsMessagePoolFree)(rdsMessagePool* pool, RDS_MSG_COMMON* msg);
+
+/**
+ * PoolCopy and PoolFree are only needed for messages carrying payload
+ * pointers, all other messages are copied from the pool as a flat struct.
+ */
 
 struct _RDS_MSG_DEFINITION
 {
@@ -37,9 +44,42 @@ struct _RDS_MSG_DEFINITION
 	pRdsMessageWrite Write;
 	pRdsMessageCopy Copy;
 	pRdsMessageFree Free;
+	pRdsMessagePoolCopy PoolCopy;
+	pRdsMessagePoolFree PoolFree;
 };
 typedef struct _RDS_MSG_DEFINITION RDS_MSG_DEFINITION;
 
+#define RDS_MSG_POOL_TYPES		32
+#define RDS_MSG_POOL_MAX_OBJECTS	64
+
+#define RDS_BUFFER_POOL_MIN_SHIFT	6
+#define RDS_BUFFER_POOL_CLASSES		16
+#define RDS_BUFFER_POOL_MAX_BUFFERS	8
+
+/**
+ * Pooled buffers are preceded by a header recording their size class,
+ * buffers above the largest class are allocated and freed directly.
+ */
+
+union _RDS_BUFFER_HEADER
+{
+	int sizeClass;
+	void* next;
+	UINT64 align;
+};
+typedef union _RDS_BUFFER_HEADER RDS_BUFFER_HEADER;
+
+struct rds_message_pool
+{
+	CRITICAL_SECTION lock;
+
+	void* objects[RDS_MSG_POOL_TYPES];
+	int objectCount[RDS_MSG_POOL_TYPES];
+
+	RDS_BUFFER_HEADER* buffers[RDS_BUFFER_POOL_CLASSES];
+	int bufferCount[RDS_BUFFER_POOL_CLASSES];
+};
+
 UINT32 freerds_peek_common_header_length(BYTE* data)
 {
 	UINT32 length;
@@ -775,13 +815,30 @@ void freerds_paint_rect_free(RDS_MSG_PAINT_RECT* msg)
 	free(msg);
 }
 
+void freerds_paint_rect_pool_copy(rdsMessagePool* pool, RDS_MSG_PAINT_RECT* dup, RDS_MSG_PAINT_RECT* msg)
+{
+	if (msg->bitmapDataLength)
+	{
+		dup->bitmapData = (BYTE*) freerds_message_pool_take_buffer(pool, msg->bitmapDataLength);
+		CopyMemory(dup->bitmapData, msg->bitmapData, msg->bitmapDataLength);
+	}
+}
+
+void freerds_paint_rect_pool_free(rdsMessagePool* pool, RDS_MSG_PAINT_RECT* msg)
+{
+	if (msg->bitmapDataLength)
+		freerds_message_pool_return_buffer(pool, msg->bitmapData);
+}
+
 static RDS_MSG_DEFINITION RDS_MSG_PAINT_RECT_DEFINITION =
 {
 	sizeof(RDS_MSG_PAINT_RECT), "PaintRect",
 	(pRdsMessageRead) freerds_read_paint_rect,
 	(pRdsMessageWrite) freerds_write_paint_rect,
 	(pRdsMessageCopy) freerds_paint_rect_copy,
-	(pRdsMessageFree) freerds_paint_rect_free
+	(pRdsMessageFree) freerds_paint_rect_free,
+	(pRdsMessagePoolCopy) freerds_paint_rect_pool_copy,
+	(pRdsMessagePoolFree) freerds_paint_rect_pool_free
 };
 
 /**
@@ -1448,13 +1505,39 @@ void freerds_set_pointer_free(RDS_MSG_SET_POINTER* msg)
 	free(msg);
 }
 
+void freerds_set_pointer_pool_copy(rdsMessagePool* pool, RDS_MSG_SET_POINTER* dup, RDS_MSG_SET_POINTER* msg)
+{
+	if (msg->andMaskData)
+	{
+		dup->andMaskData = (BYTE*) freerds_message_pool_take_buffer(pool, msg->lengthAndMask);
+		CopyMemory(dup->andMaskData, msg->andMaskData, msg->lengthAndMask);
+	}
+
+	if (msg->xorMaskData)
+	{
+		dup->xorMaskData = (BYTE*) freerds_message_pool_take_buffer(pool, msg->lengthXorMask);
+		CopyMemory(dup->xorMaskData, msg->xorMaskData, msg->lengthXorMask);
+	}
+}
+
+void freerds_set_pointer_pool_free(rdsMessagePool* pool, RDS_MSG_SET_POINTER* msg)
+{
+	if (msg->andMaskData)
+		freerds_message_pool_return_buffer(pool, msg->andMaskData);
+
+	if (msg->xorMaskData)
+		freerds_message_pool_return_buffer(pool, msg->xorMaskData);
+}
+
 static RDS_MSG_DEFINITION RDS_MSG_SET_POINTER_DEFINITION =
 {
 	sizeof(RDS_MSG_SET_POINTER), "SetPointer",
 	(pRdsMessageRead) freerds_read_set_pointer,
 	(pRdsMessageWrite) freerds_write_set_pointer,
 	(pRdsMessageCopy) freerds_set_pointer_copy,
-	(pRdsMessageFree) freerds_set_pointer_free
+	(pRdsMessageFree) freerds_set_pointer_free,
+	(pRdsMessagePoolCopy) freerds_set_pointer_pool_copy,
+	(pRdsMessagePoolFree) freerds_set_pointer_pool_free
 };
 
 /**
@@ -2050,13 +2133,53 @@ void freerds_logon_user_free(RDS_MSG_LOGON_USER* msg)
 	free(msg);
 }
 
+static char* freerds_logon_user_pool_string(rdsMessagePool* pool, const char* str, UINT32 length)
+{
+	char* dup;
+
+	dup = (char*) freerds_message_pool_take_buffer(pool, length + 1);
+	CopyMemory(dup, str, length);
+	dup[length] = '\0';
+
+	return dup;
+}
+
+void freerds_logon_user_pool_copy(rdsMessagePool* pool, RDS_MSG_LOGON_USER* dup, RDS_MSG_LOGON_USER* msg)
+{
+	if (msg->UserLength)
+		dup->User = freerds_logon_user_pool_string(pool, msg->User, msg->UserLength);
+
+	if (msg->DomainLength)
+		dup->Domain = freerds_logon_user_pool_string(pool, msg->Domain, msg->DomainLength);
+
+	if (msg->PasswordLength)
+		dup->Password = freerds_logon_user_pool_string(pool, msg->Password, msg->PasswordLength);
+}
+
+void freerds_logon_user_pool_free(rdsMessagePool* pool, RDS_MSG_LOGON_USER* msg)
+{
+	if (msg->UserLength)
+		freerds_message_pool_return_buffer(pool, msg->User);
+
+	if (msg->DomainLength)
+		freerds_message_pool_return_buffer(pool, msg->Domain);
+
+	if (msg->PasswordLength)
+	{
+		SecureZeroMemory(msg->Password, msg->PasswordLength);
+		freerds_message_pool_return_buffer(pool, msg->Password);
+	}
+}
+
 static RDS_MSG_DEFINITION RDS_MSG_LOGON_USER_DEFINITION =
 {
 	sizeof(RDS_MSG_LOGON_USER), "LogonUser",
 	(pRdsMessageRead) freerds_read_logon_user,
 	(pRdsMessageWrite) freerds_write_logon_user,
 	(pRdsMessageCopy) freerds_logon_user_copy,
-	(pRdsMessageFree) freerds_logon_user_free
+	(pRdsMessageFree) freerds_logon_user_free,
+	(pRdsMessagePoolCopy) freerds_logon_user_pool_copy,
+	(pRdsMessagePoolFree) freerds_logon_user_pool_free
 };
 
 /**
@@ -2425,3 +2548,206 @@ void freerds_server_message_free(RDS_MSG_COMMON* msg)
 			msgDef->Free(msg);
 	}
 }
+
+/**
+ * Message Pool
+ */
+
+rdsMessagePool* freerds_message_pool_new(void)
+{
+	rdsMessagePool* pool;
+
+	pool = (rdsMessagePool*) calloc(1, sizeof(rdsMessagePool));
+
+	if (!pool)
+		return NULL;
+
+	InitializeCriticalSectionAndSpinCount(&(pool->lock), 4000);
+
+	return pool;
+}
+
+void freerds_message_pool_free(rdsMessagePool* pool)
+{
+	int index;
+	void* object;
+	RDS_BUFFER_HEADER* header;
+
+	if (!pool)
+		return;
+
+	for (index = 0; index < RDS_MSG_POOL_TYPES; index++)
+	{
+		while (pool->objects[index])
+		{
+			object = pool->objects[index];
+			pool->objects[index] = *((void**) object);
+			free(object);
+		}
+	}
+
+	for (index = 0; index < RDS_BUFFER_POOL_CLASSES; index++)
+	{
+		while (pool->buffers[index])
+		{
+			header = pool->buffers[index];
+			pool->buffers[index] = (RDS_BUFFER_HEADER*) header->next;
+			free(header);
+		}
+	}
+
+	DeleteCriticalSection(&(pool->lock));
+
+	free(pool);
+}
+
+void* freerds_message_pool_take_buffer(rdsMessagePool* pool, UINT32 size)
+{
+	int sizeClass;
+	RDS_BUFFER_HEADER* header = NULL;
+
+	for (sizeClass = 0; sizeClass < RDS_BUFFER_POOL_CLASSES; sizeClass++)
+	{
+		if (size <= (UINT32) (1 << (sizeClass + RDS_BUFFER_POOL_MIN_SHIFT)))
+			break;
+	}
+
+	if (sizeClass < RDS_BUFFER_POOL_CLASSES)
+	{
+		EnterCriticalSection(&(pool->lock));
+
+		header = pool->buffers[sizeClass];
+
+		if (header)
+		{
+			pool->buffers[sizeClass] = (RDS_BUFFER_HEADER*) header->next;
+			pool->bufferCount[sizeClass]--;
+		}
+
+		LeaveCriticalSection(&(pool->lock));
+
+		if (!header)
+			header = (RDS_BUFFER_HEADER*) malloc(sizeof(RDS_BUFFER_HEADER) +
+					(1 << (sizeClass + RDS_BUFFER_POOL_MIN_SHIFT)));
+	}
+	else
+	{
+		sizeClass = -1;
+		header = (RDS_BUFFER_HEADER*) malloc(sizeof(RDS_BUFFER_HEADER) + size);
+	}
+
+	if (!header)
+		return NULL;
+
+	header->sizeClass = sizeClass;
+
+	return (void*) &header[1];
+}
+
+void freerds_message_pool_return_buffer(rdsMessagePool* pool, void* buffer)
+{
+	int sizeClass;
+	RDS_BUFFER_HEADER* header;
+
+	if (!buffer)
+		return;
+
+	header = &((RDS_BUFFER_HEADER*) buffer)[-1];
+	sizeClass = header->sizeClass;
+
+	if (sizeClass >= 0)
+	{
+		EnterCriticalSection(&(pool->lock));
+
+		if (pool->bufferCount[sizeClass] < RDS_BUFFER_POOL_MAX_BUFFERS)
+		{
+			header->next = (void*) pool->buffers[sizeClass];
+			pool->buffers[sizeClass] = header;
+			pool->bufferCount[sizeClass]++;
+			header = NULL;
+		}
+
+		LeaveCriticalSection(&(pool->lock));
+	}
+
+	if (header)
+		free(header);
+}
+
+void* freerds_server_message_pool_copy(rdsMessagePool* pool, RDS_MSG_COMMON* msg)
+{
+	int size;
+	void* dup = NULL;
+	RDS_MSG_DEFINITION* msgDef;
+
+	if (!pool)
+		return freerds_server_message_copy(msg);
+
+	if (msg->type >= RDS_MSG_POOL_TYPES)
+		return NULL;
+
+	msgDef = RDS_SERVER_MSG_DEFINITIONS[msg->type];
+
+	if (!msgDef)
+		return NULL;
+
+	size = msgDef->Size;
+
+	EnterCriticalSection(&(pool->lock));
+
+	dup = pool->objects[msg->type];
+
+	if (dup)
+	{
+		pool->objects[msg->type] = *((void**) dup);
+		pool->objectCount[msg->type]--;
+	}
+
+	LeaveCriticalSection(&(pool->lock));
+
+	if (!dup)
+		dup = malloc(size);
+
+	if (!dup)
+		return NULL;
+
+	CopyMemory(dup, msg, size);
+
+	if (msgDef->PoolCopy)
+		msgDef->PoolCopy(pool, (RDS_MSG_COMMON*) dup, msg);
+
+	return dup;
+}
+
+void freerds_server_message_pool_release(rdsMessagePool* pool, RDS_MSG_COMMON* msg)
+{
+	UINT32 type;
+	RDS_MSG_DEFINITION* msgDef;
+
+	if (!pool)
+	{
+		freerds_server_message_free(msg);
+		return;
+	}
+
+	type = msg->type;
+	msgDef = RDS_SERVER_MSG_DEFINITIONS[type];
+
+	if (msgDef->PoolFree)
+		msgDef->PoolFree(pool, msg);
+
+	EnterCriticalSection(&(pool->lock));
+
+	if (pool->objectCount[type] < RDS_MSG_POOL_MAX_OBJECTS)
+	{
+		*((void**) msg) = pool->objects[type];
+		pool->objects[type] = (void*) msg;
+		pool->objectCount[type]++;
+		msg = NULL;
+	}
+
+	LeaveCriticalSection(&(pool->lock));
+
+	if (msg)
+		free(msg);
+}
@@ -0,0 +1,686 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * Logon storm benchmark for the session manager
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Stands in for the freerds server on the FreeRDS_Manager pipe and
+ * drives LogonUser, DisconnectUserSession and LogOffUserSession calls
+ * from many concurrent virtual connections, then reports throughput
+ * and latency percentiles per call type, e.g.
+ *
+ *   freerds-logon-bench /clients:1000 /iterations:10 /user:bench
+ *
+ * The manager should run with the benchmark modules, e.g. in the
+ * [global] section of config.ini:
+ *
+ *   auth.module=Bench
+ *   module=bench
+ *   module.bench.modulename=Bench
+ *   session.timeout=1
+ *
+ * The modules are built with WITH_BENCHMARK but never installed, as the
+ * auth module accepts any password. Copy libfreerds-auth-bench.so into
+ * the manager's library directory on a test host only, the session
+ * module is also found through FREERDS_ADDITIONAL_MODULES.
+ *
+ * A non-zero session.timeout keeps disconnected sessions around so the
+ * second logon of each cycle takes the reconnect path. Stop freerds
+ * first, the manager only serves one ICP client.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pwd.h>
+#include <unistd.h>
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/pipe.h>
+#include <winpr/file.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/cmdline.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include <freerds/rpc.h>
+
+#define BENCH_CALL_LOGON		0
+#define BENCH_CALL_DISCONNECT		1
+#define BENCH_CALL_LOGOFF		2
+#define BENCH_CALL_COUNT		3
+
+/* every iteration is logon, disconnect, reconnecting logon, logoff */
+#define BENCH_STEP_LOGON		0
+#define BENCH_STEP_DISCONNECT		1
+#define BENCH_STEP_RECONNECT		2
+#define BENCH_STEP_LOGOFF		3
+#define BENCH_STEP_COUNT		4
+
+static const char* g_CallNames[BENCH_CALL_COUNT] =
+{
+	"LogonUser",
+	"DisconnectUserSession",
+	"LogOffUserSession"
+};
+
+struct bench_samples
+{
+	UINT64* values;
+	UINT32 count;
+	UINT32 size;
+	UINT32 errors;
+};
+typedef struct bench_samples benchSamples;
+
+struct bench_client
+{
+	UINT32 index;
+	UINT32 connectionId;
+	UINT32 iteration;
+	UINT32 step;
+	UINT64 start;
+};
+typedef struct bench_client benchClient;
+
+struct bench_item
+{
+	benchClient* client;
+	FDSAPI_MSG_HEADER header;
+	wStream* s;
+};
+typedef struct bench_item benchItem;
+
+struct bench_context
+{
+	HANDLE hPipe;
+	HANDLE hReaderThread;
+	HANDLE hDoneEvent;
+	wQueue* writeQueue;
+
+	char* user;
+	char* domain;
+	char* password;
+	UINT32 userCount;
+
+	UINT32 clientCount;
+	UINT32 iterations;
+	benchClient* clients;
+	LONG finished;
+	LONG nextConnectionId;
+
+	benchSamples samples[BENCH_CALL_COUNT];
+};
+typedef struct bench_context benchContext;
+
+COMMAND_LINE_ARGUMENT_A freerds_logon_bench_args[] =
+{
+	{ "clients", COMMAND_LINE_VALUE_REQUIRED, "<count>", "1000", NULL, -1, NULL, "concurrent connections" },
+	{ "iterations", COMMAND_LINE_VALUE_REQUIRED, "<count>", "10", NULL, -1, NULL, "logon cycles per connection" },
+	{ "user", COMMAND_LINE_VALUE_REQUIRED, "<name>", NULL, NULL, -1, NULL, "user name (default: current user)" },
+	{ "user-count", COMMAND_LINE_VALUE_REQUIRED, "<count>", "1", NULL, -1, NULL, "spread logons over <name>0..<name>N-1" },
+	{ "domain", COMMAND_LINE_VALUE_REQUIRED, "<name>", "", NULL, -1, NULL, "domain name" },
+	{ "password", COMMAND_LINE_VALUE_REQUIRED, "<password>", "bench", NULL, -1, NULL, "password" },
+	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
+};
+
+static UINT64 bench_time_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int bench_pipe_read(benchContext* bench, BYTE* data, UINT32 size)
+{
+	DWORD bytesRead;
+	UINT32 offset = 0;
+
+	while (offset < size)
+	{
+		if (!ReadFile(bench->hPipe, &data[offset], size - offset, &bytesRead, NULL) || !bytesRead)
+			return -1;
+
+		offset += bytesRead;
+	}
+
+	return 0;
+}
+
+static int bench_pipe_write(benchContext* bench, BYTE* data, UINT32 size)
+{
+	DWORD bytesWritten;
+	UINT32 offset = 0;
+
+	while (offset < size)
+	{
+		if (!WriteFile(bench->hPipe, &data[offset], size - offset, &bytesWritten, NULL) || !bytesWritten)
+			return -1;
+
+		offset += bytesWritten;
+	}
+
+	return 0;
+}
+
+static int bench_send(benchContext* bench, FDSAPI_MSG_HEADER* header, wStream* s)
+{
+	header->msgSize = s ? (UINT32) Stream_Length(s) : 0;
+
+	if (bench_pipe_write(bench, (BYTE*) header, FDSAPI_MSG_HEADER_SIZE) < 0)
+		return -1;
+
+	if (header->msgSize && (bench_pipe_write(bench, Stream_Buffer(s), header->msgSize) < 0))
+		return -1;
+
+	return 0;
+}
+
+static int bench_client_call_type(benchClient* client)
+{
+	switch (client->step)
+	{
+		case BENCH_STEP_DISCONNECT:
+			return BENCH_CALL_DISCONNECT;
+
+		case BENCH_STEP_LOGOFF:
+			return BENCH_CALL_LOGOFF;
+
+		default:
+			return BENCH_CALL_LOGON;
+	}
+}
+
+static int bench_client_send(benchContext* bench, benchClient* client)
+{
+	int status;
+	wStream* s = NULL;
+	char user[256];
+	FDSAPI_MSG_HEADER header;
+
+	ZeroMemory(&header, sizeof(header));
+	header.callId = client->index + 1;
+
+	switch (bench_client_call_type(client))
+	{
+		case BENCH_CALL_LOGON:
+		{
+			FDSAPI_LOGON_USER_REQUEST request;
+
+			if (bench->userCount > 1)
+				sprintf_s(user, sizeof(user), "%s%d", bench->user, (int) (client->index % bench->userCount));
+			else
+				sprintf_s(user, sizeof(user), "%s", bench->user);
+
+			client->connectionId = (UINT32) InterlockedIncrement(&bench->nextConnectionId);
+
+			ZeroMemory(&request, sizeof(request));
+			request.ConnectionId = client->connectionId;
+			request.User = user;
+			request.Domain = bench->domain;
+			request.Password = bench->password;
+			request.DesktopWidth = 1024;
+			request.DesktopHeight = 768;
+			request.ColorDepth = 32;
+			request.ClientName = "bench";
+			request.ClientAddress = "127.0.0.1";
+
+			header.msgType = FDSAPI_LOGON_USER_REQUEST_ID;
+			s = freerds_rpc_msg_pack(header.msgType, &request, NULL);
+			break;
+		}
+
+		case BENCH_CALL_DISCONNECT:
+		{
+			FDSAPI_DISCONNECT_USER_REQUEST request;
+
+			ZeroMemory(&request, sizeof(request));
+			request.ConnectionId = client->connectionId;
+
+			header.msgType = FDSAPI_DISCONNECT_USER_REQUEST_ID;
+			s = freerds_rpc_msg_pack(header.msgType, &request, NULL);
+			break;
+		}
+
+		case BENCH_CALL_LOGOFF:
+		{
+			FDSAPI_LOGOFF_USER_REQUEST request;
+
+			ZeroMemory(&request, sizeof(request));
+			request.ConnectionId = client->connectionId;
+
+			header.msgType = FDSAPI_LOGOFF_USER_REQUEST_ID;
+			s = freerds_rpc_msg_pack(header.msgType, &request, NULL);
+			break;
+		}
+	}
+
+	if (!s)
+		return -1;
+
+	client->start = bench_time_us();
+	status = bench_send(bench, &header, s);
+
+	Stream_Free(s, TRUE);
+
+	return status;
+}
+
+static void bench_record(benchContext* bench, int callType, UINT64 latency, UINT32 status)
+{
+	benchSamples* samples = &bench->samples[callType];
+
+	if (status != FDSAPI_STATUS_SUCCESS)
+	{
+		samples->errors++;
+		return;
+	}
+
+	if (samples->count < samples->size)
+		samples->values[samples->count++] = latency;
+}
+
+static void bench_queue_item(benchContext* bench, benchClient* client, FDSAPI_MSG_HEADER* header, wStream* s)
+{
+	benchItem* item = (benchItem*) calloc(1, sizeof(benchItem));
+
+	if (!item)
+		return;
+
+	item->client = client;
+
+	if (header)
+		CopyMemory(&item->header, header, sizeof(FDSAPI_MSG_HEADER));
+
+	item->s = s;
+
+	Queue_Enqueue(bench->writeQueue, item);
+}
+
+static void bench_process_response(benchContext* bench, FDSAPI_MSG_HEADER* header)
+{
+	benchClient* client;
+	UINT64 now = bench_time_us();
+
+	if ((header->callId == 0) || (header->callId > bench->clientCount))
+	{
+		fprintf(stderr, "unexpected response with call id %d\n", (int) header->callId);
+		return;
+	}
+
+	client = &bench->clients[header->callId - 1];
+
+	bench_record(bench, bench_client_call_type(client), now - client->start, header->status);
+
+	client->step++;
+
+	if (client->step == BENCH_STEP_COUNT)
+	{
+		client->step = BENCH_STEP_LOGON;
+		client->iteration++;
+	}
+
+	if (client->iteration < bench->iterations)
+	{
+		bench_queue_item(bench, client, NULL, NULL);
+		return;
+	}
+
+	if (InterlockedIncrement(&bench->finished) == (LONG) bench->clientCount)
+		SetEvent(bench->hDoneEvent);
+}
+
+static void bench_process_request(benchContext* bench, FDSAPI_MSG_HEADER* header, BYTE* buffer)
+{
+	wStream* s = NULL;
+	FDSAPI_MSG_HEADER response;
+
+	/* calls the manager makes to freerds, answer them like freerds would */
+
+	ZeroMemory(&response, sizeof(response));
+	response.msgType = FDSAPI_RESPONSE_ID(header->msgType);
+	response.callId = header->callId;
+	response.status = FDSAPI_STATUS_SUCCESS;
+
+	switch (header->msgType)
+	{
+		case FDSAPI_LOGOFF_USER_REQUEST_ID:
+		{
+			FDSAPI_LOGOFF_USER_REQUEST request;
+			FDSAPI_LOGOFF_USER_RESPONSE reply;
+
+			ZeroMemory(&request, sizeof(request));
+			ZeroMemory(&reply, sizeof(reply));
+
+			freerds_rpc_msg_unpack(header->msgType, &request, buffer, header->msgSize);
+			reply.ConnectionId = request.ConnectionId;
+
+			s = freerds_rpc_msg_pack(response.msgType, &reply, NULL);
+			break;
+		}
+
+		case FDSAPI_HEARTBEAT_REQUEST_ID:
+		{
+			FDSAPI_HEARTBEAT_REQUEST request;
+			FDSAPI_HEARTBEAT_RESPONSE reply;
+
+			ZeroMemory(&request, sizeof(request));
+			ZeroMemory(&reply, sizeof(reply));
+
+			freerds_rpc_msg_unpack(header->msgType, &request, buffer, header->msgSize);
+			reply.HeartbeatId = request.HeartbeatId;
+
+			s = freerds_rpc_msg_pack(response.msgType, &reply, NULL);
+			break;
+		}
+
+		case FDSAPI_SWITCH_SERVICE_ENDPOINT_REQUEST_ID:
+		{
+			FDSAPI_SWITCH_SERVICE_ENDPOINT_RESPONSE reply;
+
+			ZeroMemory(&reply, sizeof(reply));
+			s = freerds_rpc_msg_pack(response.msgType, &reply, NULL);
+			break;
+		}
+
+		default:
+			response.status = FDSAPI_STATUS_NOTFOUND;
+			break;
+	}
+
+	bench_queue_item(bench, NULL, &response, s);
+}
+
+static void* bench_reader_thread(benchContext* bench)
+{
+	BYTE* buffer = NULL;
+	UINT32 bufferSize = 0;
+	FDSAPI_MSG_HEADER header;
+
+	while (1)
+	{
+		if (bench_pipe_read(bench, (BYTE*) &header, FDSAPI_MSG_HEADER_SIZE) < 0)
+			break;
+
+		if (header.msgSize > bufferSize)
+		{
+			BYTE* newBuffer = (BYTE*) realloc(buffer, header.msgSize);
+
+			if (!newBuffer)
+				break;
+
+			buffer = newBuffer;
+			bufferSize = header.msgSize;
+		}
+
+		if (header.msgSize && (bench_pipe_read(bench, buffer, header.msgSize) < 0))
+			break;
+
+		if (FDSAPI_IS_RESPONSE_ID(header.msgType))
+			bench_process_response(bench, &header);
+		else
+			bench_process_request(bench, &header, buffer);
+	}
+
+	free(buffer);
+
+	if (WaitForSingleObject(bench->hDoneEvent, 0) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "connection to the manager was lost\n");
+		SetEvent(bench->hDoneEvent);
+	}
+
+	return NULL;
+}
+
+static int bench_compare_samples(const void* a, const void* b)
+{
+	UINT64 x = *((const UINT64*) a);
+	UINT64 y = *((const UINT64*) b);
+
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double bench_percentile(benchSamples* samples, double percentile)
+{
+	UINT32 index;
+
+	if (!samples->count)
+		return 0.0;
+
+	index = (UINT32) ((percentile / 100.0) * (samples->count - 1));
+
+	return samples->values[index] / 1000.0;
+}
+
+static void bench_report(benchContext* bench, UINT64 elapsed)
+{
+	int type;
+	double seconds = elapsed / 1000000.0;
+
+	printf("%u clients x %u iterations in %.3f s\n\n", bench->clientCount, bench->iterations, seconds);
+	printf("%-22s %9s %7s %10s %9s %9s %9s %9s %9s\n",
+			"call", "count", "errors", "calls/s", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+
+	for (type = 0; type < BENCH_CALL_COUNT; type++)
+	{
+		benchSamples* samples = &bench->samples[type];
+
+		qsort(samples->values, samples->count, sizeof(UINT64), bench_compare_samples);
+
+		printf("%-22s %9u %7u %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+				g_CallNames[type], samples->count, samples->errors,
+				seconds > 0 ? samples->count / seconds : 0.0,
+				bench_percentile(samples, 50.0), bench_percentile(samples, 90.0),
+				bench_percentile(samples, 99.0), bench_percentile(samples, 99.9),
+				bench_percentile(samples, 100.0));
+	}
+}
+
+static int bench_connect(benchContext* bench)
+{
+	char pipeName[] = "\\\\.\\pipe\\FreeRDS_Manager";
+
+	if (!WaitNamedPipeA(pipeName, 5000))
+	{
+		fprintf(stderr, "manager pipe %s is not available\n", pipeName);
+		return -1;
+	}
+
+	bench->hPipe = CreateFileA(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+	if (!bench->hPipe || (bench->hPipe == INVALID_HANDLE_VALUE))
+	{
+		fprintf(stderr, "failed to open manager pipe %s\n", pipeName);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_run(benchContext* bench)
+{
+	UINT32 index;
+	UINT64 start;
+	HANDLE events[2];
+	benchItem* item;
+	int status = 0;
+
+	if (bench_connect(bench) < 0)
+		return -1;
+
+	bench->hReaderThread = CreateThread(NULL, 0,
+			(LPTHREAD_START_ROUTINE) bench_reader_thread, bench, 0, NULL);
+
+	start = bench_time_us();
+
+	/* the storm: every connection logs on at once */
+	for (index = 0; index < bench->clientCount; index++)
+	{
+		if (bench_client_send(bench, &bench->clients[index]) < 0)
+		{
+			status = -1;
+			break;
+		}
+	}
+
+	events[0] = bench->hDoneEvent;
+	events[1] = Queue_Event(bench->writeQueue);
+
+	while (status == 0)
+	{
+		if (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0)
+			break;
+
+		while ((item = (benchItem*) Queue_Dequeue(bench->writeQueue)))
+		{
+			if (item->client)
+				status = bench_client_send(bench, item->client);
+			else
+				status = bench_send(bench, &item->header, item->s);
+
+			if (item->s)
+				Stream_Free(item->s, TRUE);
+
+			free(item);
+
+			if (status < 0)
+				break;
+		}
+	}
+
+	if (status == 0)
+		bench_report(bench, bench_time_us() - start);
+
+	/**
+	 * The reader thread stays blocked in ReadFile until the manager
+	 * goes away, so it is not joined: the context has to outlive it
+	 * and is left for process exit to reclaim.
+	 */
+
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	int type;
+	int status;
+	DWORD flags;
+	UINT32 index;
+	static benchContext bench;
+	COMMAND_LINE_ARGUMENT_A* arg;
+
+	ZeroMemory(&bench, sizeof(bench));
+
+	bench.clientCount = 1000;
+	bench.iterations = 10;
+	bench.userCount = 1;
+	bench.domain = "";
+	bench.password = "bench";
+	bench.nextConnectionId = 0x10000;
+
+	flags = 0;
+	flags |= COMMAND_LINE_SIGIL_SLASH;
+	flags |= COMMAND_LINE_SIGIL_DASH;
+	flags |= COMMAND_LINE_SIGIL_DOUBLE_DASH;
+	flags |= COMMAND_LINE_SEPARATOR_COLON;
+
+	status = CommandLineParseArgumentsA(argc, (const char**) argv,
+			freerds_logon_bench_args, flags, NULL, NULL, NULL);
+
+	if (status < 0)
+		return 1;
+
+	arg = freerds_logon_bench_args;
+
+	do
+	{
+		if (!(arg->Flags & COMMAND_LINE_VALUE_PRESENT))
+			continue;
+
+		CommandLineSwitchStart(arg)
+
+		CommandLineSwitchCase(arg, "clients")
+		{
+			bench.clientCount = (UINT32) atoi(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "iterations")
+		{
+			bench.iterations = (UINT32) atoi(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "user")
+		{
+			bench.user = arg->Value;
+		}
+		CommandLineSwitchCase(arg, "user-count")
+		{
+			bench.userCount = (UINT32) atoi(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "domain")
+		{
+			bench.domain = arg->Value;
+		}
+		CommandLineSwitchCase(arg, "password")
+		{
+			bench.password = arg->Value;
+		}
+		CommandLineSwitchEnd(arg)
+	}
+	while ((arg = CommandLineFindNextArgumentA(arg)) != NULL);
+
+#ifndef _WIN32
+	if (!bench.user)
+	{
+		struct passwd* pw = getpwuid(getuid());
+
+		if (pw)
+			bench.user = _strdup(pw->pw_name);
+	}
+#endif
+
+	if (!bench.user || !bench.clientCount || !bench.iterations)
+	{
+		fprintf(stderr, "usage: %s [/clients:<count>] [/iterations:<count>] [/user:<name>] [/user-count:<count>]\n", argv[0]);
+		return 1;
+	}
+
+	bench.clients = (benchClient*) calloc(bench.clientCount, sizeof(benchClient));
+
+	for (index = 0; index < bench.clientCount; index++)
+		bench.clients[index].index = index;
+
+	for (type = 0; type < BENCH_CALL_COUNT; type++)
+	{
+		bench.samples[type].size = bench.clientCount * bench.iterations * ((type == BENCH_CALL_LOGON) ? 2 : 1);
+		bench.samples[type].values = (UINT64*) calloc(bench.samples[type].size, sizeof(UINT64));
+	}
+
+	bench.hDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	bench.writeQueue = Queue_New(TRUE, -1, -1);
+
+	status = bench_run(&bench);
+
+	return (status < 0) ? 1 : 0;
+}
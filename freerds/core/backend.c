@@ -82,6 +82,9 @@ void freerds_connector_free(rdsBackendConnector* connector)
 	if (connector->ServerQueue)
 		MessageQueue_Free(connector->ServerQueue);
 
+	if (connector->ServerPool)
+		freerds_message_pool_free(connector->ServerPool);
+
 	if (connector->Endpoint)
 		free(connector->Endpoint);
 
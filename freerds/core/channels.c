@@ -28,6 +28,12 @@
 #include <winpr/platform.h>
 #include <winpr/wlog.h>
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#endif
+
 #include "channels.h"
 
 //#define WITH_FREERDS_CHANNELS	1
@@ -36,6 +42,10 @@
 
 #define TAG "freerds.server.channels"
 
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT	0
+#endif
+
 BOOL freerds_channels_is_channel_allowed(UINT32 SessionId, char* ChannelName)
 {
 	FDSAPI_CHANNEL_ALLOWED_REQUEST request;
@@ -53,43 +63,53 @@ BOOL freerds_channels_is_channel_allowed(UINT32 SessionId, char* ChannelName)
 
 int freerds_channels_post_connect(rdsConnection* session)
 {
-	BOOL allowed;
+	int index;
+	int count = 0;
+	char* channelNames[3] = { "cliprdr", "rdpdr", "rdpsnd" };
+	FDSAPI_CHANNEL_ALLOWED_REQUEST requests[3];
+	FDSAPI_CHANNEL_ALLOWED_RESPONSE responses[3];
 
-	if (WTSVirtualChannelManagerIsChannelJoined(session->vcm, "cliprdr"))
+	ZeroMemory(requests, sizeof(requests));
+	ZeroMemory(responses, sizeof(responses));
+
+	for (index = 0; index < 3; index++)
+	{
+		if (WTSVirtualChannelManagerIsChannelJoined(session->vcm, channelNames[index]))
+			requests[count++].ChannelName = channelNames[index];
+	}
+
+	/* one round trip for all joined channels */
+	if (count)
+		freerds_icp_IsChannelAllowedMultiple(requests, responses, count);
+
+	for (index = 0; index < count; index++)
 	{
-		allowed = freerds_channels_is_channel_allowed(session->id, "cliprdr");
-		WLog_INFO(TAG, "channel %s is %s", "cliprdr", allowed ? "allowed" : "not allowed");
+		WLog_INFO(TAG, "channel %s is %s", requests[index].ChannelName,
+				responses[index].ChannelAllowed ? "allowed" : "not allowed");
+	}
 
 #ifdef WITH_FREERDS_CHANNELS
+	if (WTSVirtualChannelManagerIsChannelJoined(session->vcm, "cliprdr"))
+	{
 		WLog_INFO(TAG, "Channel %s registered", "cliprdr");
 		session->cliprdr = cliprdr_server_context_new(session->vcm);
 		session->cliprdr->Start(session->cliprdr);
-#endif
 	}
 
 	if (WTSVirtualChannelManagerIsChannelJoined(session->vcm, "rdpdr"))
 	{
-		allowed = freerds_channels_is_channel_allowed(session->id, "rdpdr");
-		WLog_INFO(TAG, "channel %s is %s", "rdpdr", allowed ? "allowed" : "not allowed");
-
-#ifdef WITH_FREERDS_CHANNELS
 		WLog_INFO(TAG, "Channel %s registered", "rdpdr");
 		session->rdpdr = rdpdr_server_context_new(session->vcm);
 		session->rdpdr->Start(session->rdpdr);
-#endif
 	}
 
 	if (WTSVirtualChannelManagerIsChannelJoined(session->vcm, "rdpsnd"))
 	{
-		allowed = freerds_channels_is_channel_allowed(session->id, "rdpsnd");
-		WLog_INFO(TAG, "channel %s is %s", "rdpsnd", allowed ? "allowed" : "not allowed");
-
-#ifdef WITH_FREERDS_CHANNELS
 		WLog_INFO(TAG, "Channel %s registered", "rdpsnd");
 		session->rdpsnd = rdpsnd_server_context_new(session->vcm);
 		session->rdpsnd->Start(session->rdpsnd);
-#endif
 	}
+#endif
 
 	return 0;
 }
@@ -161,12 +181,88 @@ int freerds_bind_local_ephemeral_port(SOCKET* pSocket)
 	return port;
 }
 
+#ifndef _WIN32
+int freerds_bind_local_unix_socket(SOCKET* pSocket, const char* path)
+{
+	SOCKET s;
+	int status;
+	char* basePath;
+	struct sockaddr_un sockAddr;
+
+	*pSocket = 0;
+
+	if (strlen(path) >= sizeof(sockAddr.sun_path))
+		return -1;
+
+	basePath = GetNamedPipeUnixDomainSocketBaseFilePathA();
+
+	if (!basePath)
+		return -1;
+
+	if (!PathFileExistsA(basePath))
+		CreateDirectoryA(basePath, 0);
+
+	free(basePath);
+
+	s = _socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (s == INVALID_SOCKET)
+		return -1;
+
+	/* a previous instance may have left its socket file behind */
+	unlink(path);
+
+	ZeroMemory(&sockAddr, sizeof(sockAddr));
+	sockAddr.sun_family = AF_UNIX;
+	strcpy(sockAddr.sun_path, path);
+
+	status = _bind(s, (struct sockaddr*) &sockAddr, sizeof(sockAddr));
+
+	if (status != 0)
+	{
+		closesocket(s);
+		return -1;
+	}
+
+	/**
+	 * Session processes run as the logged on users, the channel
+	 * GUID handed out by the session manager authorizes them.
+	 */
+	chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+	*pSocket = s;
+
+	return 1;
+}
+#endif
+
 int freerds_channel_server_open(rdsChannelServer* channels)
 {
 	int status = 0;
 
+#ifndef _WIN32
+	channels->listenPath = GetNamedPipeUnixDomainSocketFilePathA(FREERDS_CHANNEL_PIPE_NAME);
+
+	if (!channels->listenPath)
+		return -1;
+
+	/* a port of 0 tells the clients to connect to the local socket */
+	channels->listenPort = 0;
+
+	if (freerds_bind_local_unix_socket(&(channels->listenerSocket), channels->listenPath) < 0)
+	{
+		WLog_ERR(TAG, "failed to bind %s", channels->listenPath);
+		free(channels->listenPath);
+		channels->listenPath = NULL;
+		return -1;
+	}
+#else
 	channels->listenPort = freerds_bind_local_ephemeral_port(&(channels->listenerSocket));
 
+	if (channels->listenPort < 0)
+		return -1;
+#endif
+
 	status = _listen(channels->listenerSocket, SOMAXCONN);
 
 	if (status == SOCKET_ERROR)
@@ -179,7 +275,10 @@ int freerds_channel_server_open(rdsChannelServer* channels)
 
 	channels->listenEvent = CreateFileDescriptorEvent(NULL, FALSE, FALSE, (int) channels->listenerSocket);
 
-	WLog_INFO(TAG, "Listening on %s:%d for channels...", channels->listenAddress, channels->listenPort);
+	if (channels->listenPath)
+		WLog_INFO(TAG, "Listening on %s for channels...", channels->listenPath);
+	else
+		WLog_INFO(TAG, "Listening on %s:%d for channels...", channels->listenAddress, channels->listenPort);
 
 	return 1;
 }
@@ -198,6 +297,15 @@ int freerds_channel_server_close(rdsChannelServer* channels)
 		channels->listenEvent = NULL;
 	}
 
+#ifndef _WIN32
+	if (channels->listenPath)
+	{
+		unlink(channels->listenPath);
+		free(channels->listenPath);
+		channels->listenPath = NULL;
+	}
+#endif
+
 	return 1;
 }
 
@@ -245,10 +353,13 @@ int freerds_channel_server_accept(rdsChannelServer* channels)
 		return -1;
 	}
 
-	optval = TRUE;
-	optlen = sizeof(optval);
+	if (!channels->listenPath)
+	{
+		optval = TRUE;
+		optlen = sizeof(optval);
 
-	_setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char*) &optval, optlen);
+		_setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char*) &optval, optlen);
+	}
 
 	channel->socket = socket;
 	channel->event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, (int) channel->socket);
@@ -294,6 +405,15 @@ rdsChannelServer* freerds_channel_server_new()
 		channels->table->keyCompare = HashTable_StringCompare;
 		channels->table->keyClone = HashTable_StringClone;
 		channels->table->keyFree = HashTable_StringFree;
+
+		channels->bufferPool = BufferPool_New(TRUE, 0, 0);
+
+		if (!channels->bufferPool)
+		{
+			HashTable_Free(channels->table);
+			free(channels);
+			return NULL;
+		}
 	}
 
 	return channels;
@@ -305,6 +425,7 @@ void freerds_channel_server_free(rdsChannelServer* channels)
 		return;
 
 	free(channels->listenAddress);
+	free(channels->listenPath);
 
 	if (channels->table)
 	{
@@ -312,6 +433,12 @@ void freerds_channel_server_free(rdsChannelServer* channels)
 		channels->table = NULL;
 	}
 
+	if (channels->bufferPool)
+	{
+		BufferPool_Free(channels->bufferPool);
+		channels->bufferPool = NULL;
+	}
+
 	free(channels);
 }
 
@@ -359,46 +486,155 @@ int freerdp_client_virtual_channel_read(freerdp_peer* client, HANDLE hChannel, B
 	return status;
 }
 
-int freerds_channel_check_socket(rdsConnection* connection, rdsChannel* channel)
+/**
+ * Only buffers of FREERDS_CHANNEL_BUFFER_SIZE are pooled. A larger one is
+ * allocated for a large frame and freed again afterwards, so a single
+ * large frame neither stays pinned in the pool nor is handed out later.
+ */
+static void freerds_channel_free_buffer(rdsChannel* channel, BYTE* buffer, UINT32 size)
 {
-	int status;
-	UINT32 length;
-	BYTE* buffer;
-	freerdp_peer* client;
+	if (size > FREERDS_CHANNEL_BUFFER_SIZE)
+		free(buffer);
+	else
+		BufferPool_Return(channel->channels->bufferPool, buffer);
+}
 
-	length = sizeof(buffer);
-	client = connection->client;
+static int freerds_channel_reserve(rdsChannel* channel, UINT32 size)
+{
+	BYTE* buffer;
 
-	status = _recv(channel->socket, (char*) &length, sizeof(length), 0);
+	if (channel->recvBuffer && (size <= channel->recvSize))
+		return 1;
 
-	if (status != sizeof(length))
+	if (size <= FREERDS_CHANNEL_BUFFER_SIZE)
 	{
-		WLog_ERR(TAG, "socket recv failed with status %d (lasterror=%d)", status, WSAGetLastError());
-		return -1;
+		size = FREERDS_CHANNEL_BUFFER_SIZE;
+		buffer = (BYTE*) BufferPool_Take(channel->channels->bufferPool, size);
+	}
+	else
+	{
+		buffer = (BYTE*) malloc(size);
 	}
-
-	buffer = (BYTE*) malloc(length);
 
 	if (!buffer)
-	{
-		WLog_ERR(TAG, "memory allocation error");
 		return -1;
+
+	if (channel->recvBuffer)
+	{
+		CopyMemory(buffer, channel->recvBuffer, channel->recvLength);
+		freerds_channel_free_buffer(channel, channel->recvBuffer, channel->recvSize);
 	}
 
-	status = _recv(channel->socket, (char*) buffer, length, 0);
+	channel->recvBuffer = buffer;
+	channel->recvSize = size;
 
-	if (status != length)
+	return 1;
+}
+
+static void freerds_channel_release(rdsChannel* channel)
+{
+	if (!channel->recvBuffer)
+		return;
+
+	freerds_channel_free_buffer(channel, channel->recvBuffer, channel->recvSize);
+
+	channel->recvBuffer = NULL;
+	channel->recvSize = 0;
+	channel->recvLength = 0;
+}
+
+int freerds_channel_check_socket(rdsConnection* connection, rdsChannel* channel)
+{
+	int status;
+	UINT32 space;
+	UINT32 length;
+	UINT32 offset;
+	freerdp_peer* client;
+
+	client = connection->client;
+
+	if (freerds_channel_reserve(channel, FREERDS_CHANNEL_BUFFER_SIZE) < 0)
 	{
-		WLog_ERR(TAG, "recv failed with status %d (lasterror=%d)", status, WSAGetLastError());
-		free(buffer);
+		WLog_ERR(TAG, "memory allocation error");
 		return -1;
 	}
 
-	client->VirtualChannelWrite(client, channel->rdpChannel, buffer, status);
+	while (1)
+	{
+		/* a frame larger than the buffer gets a larger one from the pool */
+		if (channel->recvLength >= sizeof(length))
+		{
+			CopyMemory(&length, channel->recvBuffer, sizeof(length));
+
+			if (length > FREERDS_CHANNEL_MAX_FRAME_SIZE)
+			{
+				WLog_ERR(TAG, "channel %s sent an oversized frame of %u bytes", channel->name, length);
+				return -1;
+			}
+
+			if (freerds_channel_reserve(channel, sizeof(length) + length) < 0)
+			{
+				WLog_ERR(TAG, "memory allocation error");
+				return -1;
+			}
+		}
 
-	free(buffer);
+		space = channel->recvSize - channel->recvLength;
 
-	return status;
+		status = _recv(channel->socket, (char*) &channel->recvBuffer[channel->recvLength], space, MSG_DONTWAIT);
+
+		if (status == 0)
+		{
+			WLog_DBG(TAG, "channel %s closed by the endpoint", channel->name);
+			return -1;
+		}
+
+		if (status < 0)
+		{
+			if (WSAGetLastError() == WSAEWOULDBLOCK)
+				break;
+
+			if (WSAGetLastError() == WSAEINTR)
+				continue;
+
+			WLog_ERR(TAG, "socket recv failed with status %d (lasterror=%d)", status, WSAGetLastError());
+			return -1;
+		}
+
+		channel->recvLength += status;
+
+		/* forward every complete frame straight out of the buffer */
+		offset = 0;
+
+		while ((channel->recvLength - offset) >= sizeof(length))
+		{
+			CopyMemory(&length, &channel->recvBuffer[offset], sizeof(length));
+
+			if ((channel->recvLength - offset - sizeof(length)) < length)
+				break;
+
+			client->VirtualChannelWrite(client, channel->rdpChannel,
+					&channel->recvBuffer[offset + sizeof(length)], length);
+
+			offset += sizeof(length) + length;
+		}
+
+		if (offset)
+		{
+			MoveMemory(channel->recvBuffer, &channel->recvBuffer[offset], channel->recvLength - offset);
+			channel->recvLength -= offset;
+		}
+
+		/* a short read drained the socket */
+		if ((UINT32) status < space)
+			break;
+	}
+
+	/* do not keep a buffer grown for a single large frame */
+	if (!channel->recvLength && (channel->recvSize > FREERDS_CHANNEL_BUFFER_SIZE))
+		freerds_channel_release(channel);
+
+	return 1;
 }
 
 int freerds_client_get_channel_event_handles(rdsConnection* connection, HANDLE* events, DWORD* nCount)
@@ -488,6 +724,8 @@ void freerds_channel_free(rdsChannel* channel)
 	if (!channel)
 		return;
 
+	freerds_channel_release(channel);
+
 	free(channel->name);
 	free(channel->guidString);
 
@@ -24,13 +24,19 @@
 #include <winpr/winsock.h>
 #include <winpr/collections.h>
 
+#include <freerds/fdsapi.h>
+
+#define FREERDS_CHANNEL_BUFFER_SIZE		0x10000
+
 struct rds_channel_server
 {
 	int listenPort;
 	char* listenAddress;
+	char* listenPath;
 	SOCKET listenerSocket;
 	HANDLE listenEvent;
 	wHashTable* table;
+	wBufferPool* bufferPool;
 };
 
 struct rds_channel
@@ -44,6 +50,9 @@ struct rds_channel
 	BOOL connected;
 	HANDLE readyEvent;
 	HANDLE rdpChannel;
+	BYTE* recvBuffer;
+	UINT32 recvSize;
+	UINT32 recvLength;
 	rdsServer* server;
 	rdsConnection* connection;
 	rdsChannelServer* channels;
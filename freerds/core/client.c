@@ -297,11 +297,19 @@ int freerds_client_inbound_shared_framebuffer(rdsBackend* backend, RDS_MSG_SHARE
 	if (attach)
 	{
 		void* addr;
+		BOOL remap = TRUE;
+		BOOL repaint;
 		rdpSettings* settings = connector->settings;
 		UINT32 DesktopWidth = msg->width;
 		UINT32 DesktopHeight = msg->height;
 
-		if (backend->framebuffer.fbAttached)
+		if (backend->framebuffer.fbAttached &&
+				(backend->framebuffer.fbSegmentId == msg->segmentId))
+		{
+			/* the backend resized in place, the mapping stays valid */
+			remap = FALSE;
+		}
+		else if (backend->framebuffer.fbAttached)
 		{
 			freerds_client_detach_framebuffer(&(backend->framebuffer));
 		}
@@ -313,24 +321,29 @@ int freerds_client_inbound_shared_framebuffer(rdsBackend* backend, RDS_MSG_SHARE
 		backend->framebuffer.fbBitsPerPixel = msg->bitsPerPixel;
 		backend->framebuffer.fbBytesPerPixel = msg->bytesPerPixel;
 
-#ifndef _WIN32
-		addr = shmat(backend->framebuffer.fbSegmentId, 0, SHM_RDONLY);
+		repaint = remap;
 
-		if (addr == ((void*) (size_t) (-1)))
+		if (remap)
 		{
-			WLog_ERR(TAG, "failed to attach to segment %d, errno: %d",
-					backend->framebuffer.fbSegmentId, errno);
-			return 1;
-		}
+#ifndef _WIN32
+			addr = shmat(backend->framebuffer.fbSegmentId, 0, SHM_RDONLY);
+
+			if (addr == ((void*) (size_t) (-1)))
+			{
+				WLog_ERR(TAG, "failed to attach to segment %d, errno: %d",
+						backend->framebuffer.fbSegmentId, errno);
+				return 1;
+			}
 #else
-		addr = NULL;
+			addr = NULL;
 #endif
 
-		backend->framebuffer.fbSharedMemory = (BYTE*) addr;
-		backend->framebuffer.fbAttached = 1;
+			backend->framebuffer.fbSharedMemory = (BYTE*) addr;
+			backend->framebuffer.fbAttached = 1;
 
-		WLog_INFO(TAG, "attached segment %d to %p",
-				backend->framebuffer.fbSegmentId, backend->framebuffer.fbSharedMemory);
+			WLog_INFO(TAG, "attached segment %d to %p",
+					backend->framebuffer.fbSegmentId, backend->framebuffer.fbSharedMemory);
+		}
 
 		if ((DesktopWidth != settings->DesktopWidth) || (DesktopHeight != settings->DesktopHeight))
 		{
@@ -340,9 +353,16 @@ int freerds_client_inbound_shared_framebuffer(rdsBackend* backend, RDS_MSG_SHARE
 			settings->DesktopHeight = DesktopHeight;
 
 			update->DesktopResize(context);
+
+			/* the client surface is recreated on reactivation */
+			repaint = TRUE;
 		}
 
-		if (1)
+		/*
+		 * A geometry update for the same segment and size leaves the client
+		 * surface intact, the backend sends its damaged areas on its own.
+		 */
+		if (repaint)
 		{
 			RDS_MSG_COMMON* msgCopy;
 			RDS_MSG_PAINT_RECT paintRect;
@@ -361,7 +381,7 @@ int freerds_client_inbound_shared_framebuffer(rdsBackend* backend, RDS_MSG_SHARE
 			paintRect.nWidth = msg->width;
 			paintRect.nHeight = msg->height;
 
-			msgCopy = freerds_server_message_copy((RDS_MSG_COMMON*) &paintRect);
+			msgCopy = freerds_server_message_pool_copy(connector->ServerPool, (RDS_MSG_COMMON*) &paintRect);
 
 			MessageQueue_Post(connector->ServerQueue, (void*) connector, msgCopy->type, (void*) msgCopy, NULL);
 		}
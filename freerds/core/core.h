@@ -68,6 +68,10 @@ struct rds_connection
 	UINT32 frameId;
 	wListDictionary* FrameList;
 
+	BOOL motionPending;
+	UINT16 motionX;
+	UINT16 motionY;
+
 	HANDLE vcm;
 	CliprdrServerContext* cliprdr;
 	RdpdrServerContext* rdpdr;
@@ -88,6 +92,7 @@ struct rds_backend_connector
 	int fps;
 	wLinkedList* ServerList;
 	wMessageQueue* ServerQueue;
+	rdsMessagePool* ServerPool;
 	rdsServerInterface* ServerProxy;
 	freerdp* instance;
 	rdpSettings* settings;
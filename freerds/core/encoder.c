@@ -61,6 +61,31 @@ int freerds_encoder_create_frame_id(rdsEncoder* encoder)
 	return (int) frame->frameId;
 }
 
+int freerds_encoder_uninit_grid(rdsEncoder* encoder);
+
+static UINT32 freerds_encoder_supported_codecs(rdpSettings* settings)
+{
+	UINT32 codecs = FREERDP_CODEC_PLANAR | FREERDP_CODEC_INTERLEAVED;
+
+	if (settings->RemoteFxCodec)
+		codecs |= FREERDP_CODEC_REMOTEFX;
+
+	if (settings->NSCodec)
+		codecs |= FREERDP_CODEC_NSCODEC;
+
+	return codecs;
+}
+
+static DWORD freerds_encoder_planar_flags(rdpSettings* settings)
+{
+	DWORD planarFlags = PLANAR_FORMAT_HEADER_RLE;
+
+	if (settings->DrawAllowSkipAlpha)
+		planarFlags |= PLANAR_FORMAT_HEADER_NA;
+
+	return planarFlags;
+}
+
 int freerds_encoder_init_grid(rdsEncoder* encoder)
 {
 	int i, j, k;
@@ -73,6 +98,15 @@ int freerds_encoder_init_grid(rdsEncoder* encoder)
 	tileSize = encoder->maxTileWidth * encoder->maxTileHeight * 4;
 	tileCount = encoder->gridWidth * encoder->gridHeight;
 
+	/* tiles are addressed linearly, so a smaller grid fits into the existing buffers */
+	if (encoder->gridBuffer && (tileCount <= encoder->gridSize))
+		return 0;
+
+	freerds_encoder_uninit_grid(encoder);
+
+	encoder->gridWidth = ((encoder->width + (encoder->maxTileWidth - 1)) / encoder->maxTileWidth);
+	encoder->gridHeight = ((encoder->height + (encoder->maxTileHeight - 1)) / encoder->maxTileHeight);
+
 	encoder->gridBuffer = (BYTE*) malloc(tileSize * tileCount);
 
 	if (!encoder->gridBuffer)
@@ -92,6 +126,8 @@ int freerds_encoder_init_grid(rdsEncoder* encoder)
 		}
 	}
 
+	encoder->gridSize = tileCount;
+
 	return 0;
 }
 
@@ -111,6 +147,7 @@ int freerds_encoder_uninit_grid(rdsEncoder* encoder)
 
 	encoder->gridWidth = 0;
 	encoder->gridHeight = 0;
+	encoder->gridSize = 0;
 
 	return 0;
 }
@@ -145,6 +182,13 @@ int freerds_encoder_init_rfx(rdsEncoder* encoder)
 	return 1;
 }
 
+static void freerds_encoder_update_nsc(rdsEncoder* encoder, rdpSettings* settings)
+{
+	encoder->nsc->ColorLossLevel = settings->NSCodecColorLossLevel;
+	encoder->nsc->ChromaSubsamplingLevel = settings->NSCodecAllowSubsampling ? 1 : 0;
+	encoder->nsc->DynamicColorFidelity = settings->NSCodecAllowDynamicColorFidelity;
+}
+
 int freerds_encoder_init_nsc(rdsEncoder* encoder)
 {
 	rdpSettings* settings = encoder->connection->settings;
@@ -166,9 +210,7 @@ int freerds_encoder_init_nsc(rdsEncoder* encoder)
 		encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
 	}
 
-	encoder->nsc->ColorLossLevel = settings->NSCodecColorLossLevel;
-	encoder->nsc->ChromaSubsamplingLevel = settings->NSCodecAllowSubsampling ? 1 : 0;
-	encoder->nsc->DynamicColorFidelity = settings->NSCodecAllowDynamicColorFidelity;
+	freerds_encoder_update_nsc(encoder, settings);
 
 	encoder->codecs |= FREERDP_CODEC_NSCODEC;
 
@@ -177,17 +219,13 @@ int freerds_encoder_init_nsc(rdsEncoder* encoder)
 
 int freerds_encoder_init_planar(rdsEncoder* encoder)
 {
-	DWORD planarFlags = 0;
 	rdpSettings* settings = encoder->connection->settings;
 
-	if (settings->DrawAllowSkipAlpha)
-		planarFlags |= PLANAR_FORMAT_HEADER_NA;
-
-	planarFlags |= PLANAR_FORMAT_HEADER_RLE;
-
 	if (!encoder->planar)
 	{
-		encoder->planar = freerdp_bitmap_planar_context_new(planarFlags,
+		encoder->planarFlags = freerds_encoder_planar_flags(settings);
+
+		encoder->planar = freerdp_bitmap_planar_context_new(encoder->planarFlags,
 				encoder->maxTileWidth, encoder->maxTileHeight);
 	}
 
@@ -294,16 +332,8 @@ int freerds_encoder_uninit_interleaved(rdsEncoder* encoder)
 	return 1;
 }
 
-int freerds_encoder_uninit(rdsEncoder* encoder)
+int freerds_encoder_uninit_codecs(rdsEncoder* encoder)
 {
-	freerds_encoder_uninit_grid(encoder);
-
-	if (encoder->bs)
-	{
-		Stream_Free(encoder->bs, TRUE);
-		encoder->bs = NULL;
-	}
-
 	if (encoder->codecs & FREERDP_CODEC_REMOTEFX)
 	{
 		freerds_encoder_uninit_rfx(encoder);
@@ -327,26 +357,72 @@ int freerds_encoder_uninit(rdsEncoder* encoder)
 	return 1;
 }
 
-int freerds_encoder_reset(rdsEncoder* encoder)
+int freerds_encoder_uninit(rdsEncoder* encoder)
 {
-	int status;
-	UINT32 codecs = encoder->codecs;
+	freerds_encoder_uninit_grid(encoder);
 
-	status = freerds_encoder_uninit(encoder);
+	if (encoder->bs)
+	{
+		Stream_Free(encoder->bs, TRUE);
+		encoder->bs = NULL;
+	}
 
-	if (status < 0)
-		return -1;
+	freerds_encoder_uninit_codecs(encoder);
 
-	status = freerds_encoder_init(encoder);
+	return 1;
+}
 
-	if (status < 0)
-		return -1;
+/**
+ * Adapts the encoder to the settings of a reactivation. Codec contexts
+ * are kept while the color depth and the codecs the client supports stay
+ * the same, otherwise they are dropped and freerds_encoder_prepare builds
+ * them again from the new settings.
+ */
+int freerds_encoder_reset(rdsEncoder* encoder, rdpSettings* settings)
+{
+	UINT32 supportedCodecs;
 
-	status = freerds_encoder_prepare(encoder, codecs);
+	supportedCodecs = freerds_encoder_supported_codecs(settings);
 
-	if (status < 0)
+	if ((encoder->bpp != (int) settings->ColorDepth) || (encoder->supportedCodecs != supportedCodecs))
+	{
+		freerds_encoder_uninit_codecs(encoder);
+	}
+	else
+	{
+		if (encoder->planar && (encoder->planarFlags != freerds_encoder_planar_flags(settings)))
+			freerds_encoder_uninit_planar(encoder);
+
+		if (encoder->nsc)
+			freerds_encoder_update_nsc(encoder, settings);
+
+		if (encoder->frameList)
+			encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
+	}
+
+	encoder->width = settings->DesktopWidth;
+	encoder->height = settings->DesktopHeight;
+	encoder->bpp = settings->ColorDepth;
+	encoder->supportedCodecs = supportedCodecs;
+
+	if (freerds_encoder_init_grid(encoder) < 0)
 		return -1;
 
+	if (encoder->rfx)
+	{
+		encoder->rfx->width = encoder->width;
+		encoder->rfx->height = encoder->height;
+
+		/* the client expects the RemoteFX headers again after a reactivation */
+		rfx_context_reset(encoder->rfx);
+	}
+
+	if (encoder->frameList)
+	{
+		ListDictionary_Clear(encoder->frameList);
+		encoder->fps = 16;
+	}
+
 	return 1;
 }
 
@@ -405,6 +481,8 @@ rdsEncoder* freerds_encoder_new(rdsConnection* connection, int width, int height
 
 	encoder->width = width;
 	encoder->height = height;
+	encoder->bpp = bpp;
+	encoder->supportedCodecs = freerds_encoder_supported_codecs(connection->settings);
 
 	if (freerds_encoder_init(encoder) < 0)
 	{
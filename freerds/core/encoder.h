@@ -32,11 +32,15 @@ struct rds_encoder
 
 	int width;
 	int height;
+	int bpp;
 	UINT32 codecs;
+	UINT32 supportedCodecs;
+	DWORD planarFlags;
 
 	BYTE** grid;
 	int gridWidth;
 	int gridHeight;
+	int gridSize;
 	BYTE* gridBuffer;
 	int maxTileWidth;
 	int maxTileHeight;
@@ -56,7 +60,7 @@ struct rds_encoder
 };
 typedef struct rds_encoder rdsEncoder;
 
-int freerds_encoder_reset(rdsEncoder* encoder);
+int freerds_encoder_reset(rdsEncoder* encoder, rdpSettings* settings);
 int freerds_encoder_prepare(rdsEncoder* encoder, UINT32 codecs);
 int freerds_encoder_create_frame_id(rdsEncoder* encoder);
 
@@ -34,7 +34,7 @@ int freerds_server_message_enqueue(rdsBackend* backend, RDS_MSG_COMMON* msg)
 	void* copy = NULL;
 	rdsBackendConnector* connector = (rdsBackendConnector*) backend;
 
-	copy = freerds_server_message_copy(msg);
+	copy = freerds_server_message_pool_copy(connector->ServerPool, msg);
 
 	LinkedList_AddLast(connector->ServerList, (void*) copy);
 
@@ -293,7 +293,7 @@ int freerds_message_server_queue_process_message(rdsBackendConnector* connector,
 			break;
 	}
 
-	freerds_server_message_free((RDS_MSG_COMMON*) message->wParam);
+	freerds_server_message_pool_release(connector->ServerPool, (RDS_MSG_COMMON*) message->wParam);
 
 	if (status < 0)
 	{
@@ -414,7 +414,7 @@ int freerds_message_server_queue_pack(rdsBackendConnector* connector)
 			paintRect.nWidth = rect.width;
 			paintRect.nHeight = rect.height;
 
-			msg = freerds_server_message_copy((RDS_MSG_COMMON*) &paintRect);
+			msg = freerds_server_message_pool_copy(connector->ServerPool, (RDS_MSG_COMMON*) &paintRect);
 
 			MessageQueue_Post(connector->ServerQueue, (void*) connector, msg->type, (void*) msg, NULL);
 		}
@@ -485,6 +485,7 @@ int freerds_message_server_connector_init(rdsBackendConnector* backend)
 
 	connector->ServerList = LinkedList_New();
 	connector->ServerQueue = MessageQueue_New(NULL);
+	connector->ServerPool = freerds_message_pool_new();
 
 	return 0;
 }
@@ -192,21 +192,54 @@ BOOL freerds_peer_activate(freerdp_peer* client)
 
 	if (connection->encoder)
 	{
-		freerds_encoder_free(connection->encoder);
-		connection->encoder = NULL;
+		/* reactivation, the codec contexts are kept unless the settings changed them */
+		if (freerds_encoder_reset(connection->encoder, settings) < 0)
+		{
+			freerds_encoder_free(connection->encoder);
+			connection->encoder = NULL;
+		}
 	}
 
-	connection->encoder = freerds_encoder_new(connection,
-		settings->DesktopWidth, settings->DesktopHeight, settings->ColorDepth);
+	if (!connection->encoder)
+	{
+		connection->encoder = freerds_encoder_new(connection,
+			settings->DesktopWidth, settings->DesktopHeight, settings->ColorDepth);
+	}
 
 	return TRUE;
 }
 
+/**
+ * Plain pointer moves are held back until the input received from the
+ * client has been processed, so a burst of them reaches the backend as
+ * a single move. Any other input event flushes the pending move first.
+ */
+static void freerds_input_flush_motion(rdsConnection* connection)
+{
+	rdsBackend* backend = (rdsBackend *)connection->connector;
+
+	if (!connection->motionPending)
+		return;
+
+	connection->motionPending = FALSE;
+
+	if (backend)
+	{
+		if (backend->client->MouseEvent)
+		{
+			backend->client->MouseEvent(backend, PTR_FLAGS_MOVE,
+					connection->motionX, connection->motionY);
+		}
+	}
+}
+
 void freerds_input_synchronize_event(rdpInput* input, UINT32 flags)
 {
 	rdsConnection* connection = (rdsConnection*) input->context;
 	rdsBackend* backend = (rdsBackend *)connection->connector;
 
+	freerds_input_flush_motion(connection);
+
 	if (backend)
 	{
 		if (backend->client->SynchronizeKeyboardEvent)
@@ -221,6 +254,8 @@ void freerds_input_keyboard_event(rdpInput* input, UINT16 flags, UINT16 code)
 	rdsConnection* connection = (rdsConnection*) input->context;
 	rdsBackend* backend = (rdsBackend *)connection->connector;
 
+	freerds_input_flush_motion(connection);
+
 	if (backend)
 	{
 		if (backend->client->ScancodeKeyboardEvent)
@@ -235,6 +270,8 @@ void freerds_input_unicode_keyboard_event(rdpInput* input, UINT16 flags, UINT16
 	rdsConnection* connection = (rdsConnection*) input->context;
 	rdsBackend* backend = (rdsBackend *)connection->connector;
 
+	freerds_input_flush_motion(connection);
+
 	if (backend)
 	{
 		if (backend->client->UnicodeKeyboardEvent)
@@ -249,6 +286,16 @@ void freerds_input_mouse_event(rdpInput* input, UINT16 flags, UINT16 x, UINT16 y
 	rdsConnection* connection = (rdsConnection*) input->context;
 	rdsBackend* backend = (rdsBackend *)connection->connector;
 
+	if (flags == PTR_FLAGS_MOVE)
+	{
+		connection->motionPending = TRUE;
+		connection->motionX = x;
+		connection->motionY = y;
+		return;
+	}
+
+	freerds_input_flush_motion(connection);
+
 	if (backend)
 	{
 		if (backend->client->MouseEvent)
@@ -263,6 +310,8 @@ void freerds_input_extended_mouse_event(rdpInput* input, UINT16 flags, UINT16 x,
 	rdsConnection* connection = (rdsConnection*) input->context;
 	rdsBackend* backend = (rdsBackend *)connection->connector;
 
+	freerds_input_flush_motion(connection);
+
 	if (backend)
 	{
 		if (backend->client->ExtendedMouseEvent)
@@ -541,6 +590,8 @@ void* freerds_connection_main_thread(void* arg)
 				WLog_ERR(TAG, "Failed to check freerdp file descriptor");
 				break;
 			}
+
+			freerds_input_flush_motion(connection);
 		}
 
 		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
@@ -96,35 +96,28 @@ int tp_npipe_read(pbRPCContext* context, BYTE* data, UINT32 size)
 	return bytesRead;
 }
 
-struct pbrpc_transaction
+FDSAPI_MSG_PACKET* pbrpc_message_new(pbRPCContext* context)
 {
-	void* callbackArg;
-	BOOL freeAfterResponse;
-	pbRpcResponseCallback responseCallback;
-};
-typedef struct pbrpc_transaction pbRPCTransaction;
+	FDSAPI_MSG_PACKET* msg = (FDSAPI_MSG_PACKET*) ObjectPool_Take(context->messagePool);
 
-DWORD pbrpc_getTag(pbRPCContext *context)
-{
-	return InterlockedIncrement(&(context->tag));
-}
-
-FDSAPI_MSG_PACKET* pbrpc_message_new()
-{
-	FDSAPI_MSG_PACKET* msg = calloc(1, sizeof(FDSAPI_MSG_PACKET));
+	if (!msg)
+		msg = (FDSAPI_MSG_PACKET*) malloc(sizeof(FDSAPI_MSG_PACKET));
 
 	if (!msg)
 		return msg;
 
+	ZeroMemory(msg, sizeof(FDSAPI_MSG_PACKET));
+
 	return msg;
 }
 
-void pbrpc_message_free(FDSAPI_MSG_PACKET* msg, BOOL freePayload)
+/* Received payloads come from the buffer pool, sent ones belong to the caller. */
+void pbrpc_message_free(pbRPCContext* context, FDSAPI_MSG_PACKET* msg, BOOL freePayload)
 {
-	if (freePayload)
-		free(msg->buffer);
+	if (freePayload && msg->buffer)
+		BufferPool_Return(context->bufferPool, msg->buffer);
 
-	free(msg);
+	ObjectPool_Return(context->messagePool, msg);
 }
 
 pbRPCPayload* pbrpc_payload_new()
@@ -135,33 +128,164 @@ pbRPCPayload* pbrpc_payload_new()
 
 void pbrpc_free_payload(pbRPCPayload* response)
 {
-	if (!response)
+	if (!response || !response->buffer)
 		return;
 
-	free(response->buffer);
-	free(response);
+	BufferPool_Return(g_Server->rpc->bufferPool, response->buffer);
+	response->buffer = NULL;
+}
+
+static void pbrpc_clear_write_queue(pbRPCContext* context)
+{
+	FDSAPI_MSG_PACKET* msg;
+
+	while ((msg = (FDSAPI_MSG_PACKET*) Queue_Dequeue(context->writeQueue)))
+		pbrpc_message_free(context, msg, FALSE);
+}
+
+/* Transactions are indexed by tag, a busy slot makes the next tag be tried. */
+static UINT32 pbrpc_transaction_new(pbRPCContext* context, pbRPCCall* call,
+		pbRpcResponseCallback callback, void* callbackArg)
+{
+	int index;
+	UINT32 tag;
+	pbRPCTransaction* ta;
+
+	EnterCriticalSection(&context->transactionLock);
+
+	for (index = 0; index < PBRPC_TRANSACTION_SLOTS; index++)
+	{
+		tag = (UINT32) InterlockedIncrement(&(context->tag));
+
+		if (!tag)
+			continue;
+
+		ta = &context->transactions[tag % PBRPC_TRANSACTION_SLOTS];
+
+		if (!ta->tag)
+		{
+			ta->tag = tag;
+			ta->call = call;
+			ta->responseCallback = callback;
+			ta->callbackArg = callbackArg;
+			LeaveCriticalSection(&context->transactionLock);
+			return tag;
+		}
+	}
+
+	LeaveCriticalSection(&context->transactionLock);
+
+	WLog_ERR(TAG, "all %d transaction slots are in use", PBRPC_TRANSACTION_SLOTS);
+
+	return 0;
+}
+
+/* must be called with the transaction lock held */
+static pbRPCTransaction* pbrpc_transaction_find(pbRPCContext* context, UINT32 tag)
+{
+	pbRPCTransaction* ta = &context->transactions[tag % PBRPC_TRANSACTION_SLOTS];
+
+	if (!tag || (ta->tag != tag))
+		return NULL;
+
+	return ta;
+}
+
+static pbRPCWaiter* pbrpc_waiter_new(pbRPCContext* context)
+{
+	pbRPCWaiter* waiter = (pbRPCWaiter*) ObjectPool_Take(context->waiterPool);
+
+	if (waiter)
+		return waiter;
+
+	waiter = (pbRPCWaiter*) calloc(1, sizeof(pbRPCWaiter));
+
+	if (!waiter)
+		return NULL;
+
+	waiter->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	if (!waiter->event)
+	{
+		free(waiter);
+		return NULL;
+	}
+
+	return waiter;
+}
+
+static void pbrpc_waiter_free(void* obj)
+{
+	pbRPCWaiter* waiter = (pbRPCWaiter*) obj;
+
+	CloseHandle(waiter->event);
+	free(waiter);
 }
 
-static void queue_item_free(void* obj)
+/**
+ * Completes a synchronous call, with the transaction lock held so that
+ * a timed out caller never races a late response for the same call.
+ */
+static void pbrpc_call_complete(pbRPCContext* context, pbRPCCall* call, UINT32 status, FDSAPI_MSG_PACKET* response)
 {
-	pbrpc_message_free((FDSAPI_MSG_PACKET*) obj, FALSE);
+	pbRPCWaiter* waiter = call->waiter;
+
+	call->status = status;
+
+	if (response)
+	{
+		/* the payload keeps the pooled receive buffer */
+		call->status = response->status;
+		call->response.buffer = response->buffer;
+		call->response.length = response->length;
+		pbrpc_message_free(context, response, FALSE);
+	}
+
+	if (InterlockedDecrement(&waiter->pending) == 0)
+		SetEvent(waiter->event);
 }
 
-static void list_dictionary_item_free(void* item)
+static DWORD pbrpc_call_timeout(pbRPCContext* context, UINT32 type)
 {
-	wListDictionaryItem* di = (wListDictionaryItem*) item;
-	free((pbRPCTransaction*)(di->value));
+	UINT32 index = FDSAPI_REQUEST_ID(type) - PBRPC_CALL_TYPE_BASE;
+
+	if (index >= PBRPC_CALL_TYPES)
+		return PBRPC_DEFAULT_CALL_TIMEOUT;
+
+	return context->callTimeouts[index];
+}
+
+void pbrpc_set_call_timeout(pbRPCContext* context, UINT32 type, DWORD timeout)
+{
+	UINT32 index = FDSAPI_REQUEST_ID(type) - PBRPC_CALL_TYPE_BASE;
+
+	if (index < PBRPC_CALL_TYPES)
+		context->callTimeouts[index] = timeout;
 }
 
 pbRPCContext* pbrpc_server_new()
 {
+	int index;
 	pbRPCContext* context = calloc(1, sizeof(pbRPCContext));
 
 	context->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-	context->transactions = ListDictionary_New(TRUE);
-	ListDictionary_ValueObject(context->transactions)->fnObjectFree = list_dictionary_item_free;
+	InitializeCriticalSectionAndSpinCount(&context->transactionLock, 4000);
 	context->writeQueue = Queue_New(TRUE, -1, -1);
-	context->writeQueue->object.fnObjectFree = queue_item_free;
+
+	for (index = 0; index < PBRPC_CALL_TYPES; index++)
+		context->callTimeouts[index] = PBRPC_DEFAULT_CALL_TIMEOUT;
+
+	/* authentication and session startup happen while a logon is pending */
+	pbrpc_set_call_timeout(context, FDSAPI_LOGON_USER_REQUEST_ID, 30000);
+	pbrpc_set_call_timeout(context, FDSAPI_CHANNEL_ALLOWED_REQUEST_ID, 5000);
+
+	context->waiterPool = ObjectPool_New(TRUE);
+	context->waiterPool->object.fnObjectFree = pbrpc_waiter_free;
+
+	context->messagePool = ObjectPool_New(TRUE);
+	context->messagePool->object.fnObjectFree = free;
+	context->bufferPool = BufferPool_New(TRUE, 0, 0);
+	context->decoder = freerds_rpc_decoder_new();
 
 	return context;
 }
@@ -173,8 +297,13 @@ void pbrpc_server_free(pbRPCContext* context)
 
 	CloseHandle(context->stopEvent);
 	CloseHandle(context->thread);
-	ListDictionary_Free(context->transactions);
+	DeleteCriticalSection(&context->transactionLock);
+	pbrpc_clear_write_queue(context);
 	Queue_Free(context->writeQueue);
+	ObjectPool_Free(context->waiterPool);
+	ObjectPool_Free(context->messagePool);
+	BufferPool_Free(context->bufferPool);
+	freerds_rpc_decoder_free(context->decoder);
 
 	free(context);
 }
@@ -189,7 +318,7 @@ int pbrpc_receive_message(rdsServer* server, FDSAPI_MSG_HEADER* header, BYTE** b
 	if (status < 0)
 		return status;
 
-	*buffer = malloc(header->msgSize);
+	*buffer = (BYTE*) BufferPool_Take(context->bufferPool, header->msgSize ? header->msgSize : 1);
 
 	if (!(*buffer))
 		return -1;
@@ -198,7 +327,7 @@ int pbrpc_receive_message(rdsServer* server, FDSAPI_MSG_HEADER* header, BYTE** b
 
 	if (status < 0)
 	{
-		free(*buffer);
+		BufferPool_Return(context->bufferPool, *buffer);
 		return status;
 	}
 
@@ -225,22 +354,39 @@ int pbrpc_send_message(rdsServer* server, FDSAPI_MSG_HEADER* header, BYTE* buffe
 
 static int pbrpc_process_response(rdsServer* server, FDSAPI_MSG_PACKET* msg)
 {
+	pbRPCTransaction ta;
+	pbRPCTransaction* slot;
 	pbRPCContext* context = server->rpc;
-	pbRPCTransaction* ta = ListDictionary_GetItemValue(context->transactions, (void*)((UINT_PTR)msg->callId));
 
-	if (!ta)
+	EnterCriticalSection(&context->transactionLock);
+
+	slot = pbrpc_transaction_find(context, msg->callId);
+
+	if (!slot)
 	{
+		LeaveCriticalSection(&context->transactionLock);
 		WLog_ERR(TAG, "unsoliciated response - ignoring (tag %d)", msg->callId);
+		pbrpc_message_free(context, msg, TRUE);
 		return 1;
 	}
 
-	ListDictionary_Remove(context->transactions, (void*)((UINT_PTR)msg->callId));
+	CopyMemory(&ta, slot, sizeof(pbRPCTransaction));
+	slot->tag = 0;
 
-	if (ta->responseCallback)
-		ta->responseCallback(msg->status, msg, ta->callbackArg);
+	if (ta.call)
+	{
+		pbrpc_call_complete(context, ta.call, msg->status, msg);
+		LeaveCriticalSection(&context->transactionLock);
+		return 0;
+	}
 
-	if (ta->freeAfterResponse)
-		free(ta);
+	LeaveCriticalSection(&context->transactionLock);
+
+	/* the callback takes over the message */
+	if (ta.responseCallback)
+		ta.responseCallback(msg->status, msg, ta.callbackArg);
+	else
+		pbrpc_message_free(context, msg, TRUE);
 
 	return 0;
 }
@@ -260,46 +406,38 @@ static int pbrpc_process_message_out(rdsServer* server, FDSAPI_MSG_PACKET* msg)
 	return status;
 }
 
-static pbRPCPayload* pbrpc_fill_payload(FDSAPI_MSG_PACKET* msg)
-{
-	pbRPCPayload* pl = (pbRPCPayload*) calloc(1, sizeof(pbRPCPayload));
-
-	pl->buffer = msg->buffer;
-	pl->length = msg->length;
-
-	return pl;
-}
-
 int pbrpc_send_response(rdsServer* server, pbRPCPayload* response, UINT32 status, UINT32 type, UINT32 tag)
 {
 	int ret;
-	FDSAPI_MSG_PACKET* msg;
+	FDSAPI_MSG_PACKET msg;
 
-	msg = pbrpc_message_new();
+	ZeroMemory(&msg, sizeof(msg));
 
-	msg->callId = tag;
-	msg->msgType = FDSAPI_RESPONSE_ID(type);
-	msg->status = status;
+	msg.callId = tag;
+	msg.msgType = FDSAPI_RESPONSE_ID(type);
+	msg.status = status;
 
 	if (response)
 	{
 		if (status == 0)
 		{
-			msg->buffer = response->buffer;
-			msg->length = response->length;
+			msg.buffer = response->buffer;
+			msg.length = response->length;
 		}
 	}
 
-	ret = pbrpc_process_message_out(server, msg);
+	ret = pbrpc_process_message_out(server, &msg);
 
 	if (response)
 	{
-		free(response->buffer);
+		if (response->s)
+			Stream_Free(response->s, TRUE);
+		else
+			free(response->buffer);
+
 		free(response);
 	}
 
-	pbrpc_message_free(msg, FALSE);
-
 	return ret;
 }
 
@@ -307,7 +445,7 @@ static int pbrpc_process_request(rdsServer* server, FDSAPI_MSG_PACKET* msg)
 {
 	int status = 0;
 	UINT32 msgType;
-	pbRPCCallback cb;
+	pbRPCCallback cb = NULL;
 	pbRPCPayload* response = NULL;
 
 	msgType = msg->msgType;
@@ -359,7 +497,13 @@ int pbrpc_process_message_in(rdsServer* server)
 	if (pbrpc_receive_message(server, &header, &buffer) < 0)
 		return -1;
 
-	msg = (FDSAPI_MSG_PACKET*) calloc(1, sizeof(FDSAPI_MSG_PACKET));
+	msg = pbrpc_message_new(server->rpc);
+
+	if (!msg)
+	{
+		BufferPool_Return(server->rpc->bufferPool, buffer);
+		return -1;
+	}
 
 	CopyMemory(msg, &header, sizeof(FDSAPI_MSG_HEADER));
 
@@ -367,9 +511,15 @@ int pbrpc_process_message_in(rdsServer* server)
 	msg->length = header.msgSize;
 
 	if (FDSAPI_IS_RESPONSE_ID(msg->msgType))
+	{
 		status = pbrpc_process_response(server, msg);
+	}
 	else
+	{
+		/* requests are decoded (or copied) before their handler returns */
 		status = pbrpc_process_request(server, msg);
+		pbrpc_message_free(server->rpc, msg, TRUE);
+	}
 
 	return status;
 }
@@ -406,18 +556,30 @@ static void pbrpc_connect(pbRPCContext* context)
 
 static void pbrpc_reconnect(pbRPCContext* context)
 {
-	pbRPCTransaction* ta = NULL;
+	int index;
+	pbRPCTransaction ta;
+	pbRPCTransaction* slot;
+
 	context->isConnected = FALSE;
 
 	tp_npipe_close(context);
-	Queue_Clear(context->writeQueue);
+	pbrpc_clear_write_queue(context);
 
-	while ((ta = ListDictionary_Remove_Head(context->transactions)))
+	for (index = 0; index < PBRPC_TRANSACTION_SLOTS; index++)
 	{
-		ta->responseCallback(PBRCP_TRANSPORT_ERROR, 0, ta->callbackArg);
+		EnterCriticalSection(&context->transactionLock);
+
+		slot = &context->transactions[index];
+		CopyMemory(&ta, slot, sizeof(pbRPCTransaction));
+		slot->tag = 0;
+
+		if (ta.tag && ta.call)
+			pbrpc_call_complete(context, ta.call, PBRCP_TRANSPORT_ERROR, NULL);
+
+		LeaveCriticalSection(&context->transactionLock);
 
-		if (ta->freeAfterResponse)
-			free(ta);
+		if (ta.tag && !ta.call && ta.responseCallback)
+			ta.responseCallback(PBRCP_TRANSPORT_ERROR, 0, ta.callbackArg);
 	}
 
 	pbrpc_connect(context);
@@ -470,7 +632,7 @@ static void pbrpc_main_loop(pbRPCContext* context)
 			while ((msg = Queue_Dequeue(context->writeQueue)))
 			{
 				status = pbrpc_process_message_out(server, msg);
-				pbrpc_message_free(msg, FALSE);
+				pbrpc_message_free(context, msg, FALSE);
 			}
 
 			if (status < 0)
@@ -499,95 +661,124 @@ int pbrpc_server_stop(pbRPCContext* context)
 	return 0;
 }
 
-/** @brief contextual data to handle a local call */
-struct pbrpc_local_call_context {
-	HANDLE event;
-	FDSAPI_MSG_PACKET *response;
-	PBRPCSTATUS status;
-};
-
-static void pbrpc_response_local_cb(PBRPCSTATUS reason, FDSAPI_MSG_PACKET* response, void *args)
+int pbrpc_call_methods(rdsServer* server, pbRPCCall* calls, int count)
 {
-	struct pbrpc_local_call_context *context = (struct pbrpc_local_call_context*) args;
-	context->response = response;
-	context->status = reason;
-	SetEvent(context->event);
-}
-
-int pbrpc_call_method(rdsServer* server, UINT32 type, pbRPCPayload* request, pbRPCPayload** response)
-{
-	UINT32 tag;
-	DWORD wait_ret;
-	pbRPCTransaction ta;
-	UINT32 ret = PBRPC_FAILED;
+	int index;
+	BOOL done = FALSE;
+	DWORD timeout = 0;
+	pbRPCCall* call;
+	pbRPCTransaction* ta;
+	pbRPCWaiter* waiter;
 	FDSAPI_MSG_PACKET* msg;
 	pbRPCContext* context = server->rpc;
-	struct pbrpc_local_call_context local_context;
+
+	for (index = 0; index < count; index++)
+	{
+		call = &calls[index];
+		call->tag = 0;
+		call->status = PBRCP_TRANSPORT_ERROR;
+		call->waiter = NULL;
+		ZeroMemory(&call->response, sizeof(pbRPCPayload));
+	}
 
 	if (!context->isConnected)
 		return PBRCP_TRANSPORT_ERROR;
 
-	tag = pbrpc_getTag(context);
+	waiter = pbrpc_waiter_new(context);
 
-	msg = pbrpc_message_new();
+	if (!waiter)
+		return PBRPC_FAILED;
 
-	msg->callId = tag;
-	msg->status = FDSAPI_STATUS_SUCCESS;
-	msg->buffer = request->buffer;
-	msg->length = request->length;
-	msg->msgType = FDSAPI_REQUEST_ID(type);
+	waiter->pending = count;
 
-	ZeroMemory(&local_context, sizeof(local_context));
-	local_context.event = CreateEvent(NULL, TRUE, FALSE, NULL);
-	local_context.status = PBRCP_CALL_TIMEOUT;
+	for (index = 0; index < count; index++)
+	{
+		call = &calls[index];
+		call->waiter = waiter;
 
-	ta.responseCallback = pbrpc_response_local_cb;
-	ta.callbackArg = &local_context;
-	ta.freeAfterResponse = FALSE;
+		if (!(msg = pbrpc_message_new(context)) || !(call->tag = pbrpc_transaction_new(context, call, NULL, NULL)))
+		{
+			if (msg)
+				pbrpc_message_free(context, msg, FALSE);
 
-	ListDictionary_Add(context->transactions, (void*)((UINT_PTR)(msg->callId)), &ta);
-	Queue_Enqueue(context->writeQueue, msg);
+			/* responses of the calls issued so far may already be in */
+			call->status = PBRPC_FAILED;
 
-	wait_ret = WaitForSingleObject(local_context.event, 10000);
+			if (InterlockedDecrement(&waiter->pending) == 0)
+				done = TRUE;
 
-	if (wait_ret != WAIT_OBJECT_0)
-	{
-		if (!ListDictionary_Remove(context->transactions, (void*)((UINT_PTR)(tag))))
-		{
-			// special case - timeout occurred but request is already processing, see comment above
-			WaitForSingleObject(local_context.event, INFINITE);
+			continue;
 		}
-		else
-		{
-			ret = PBRCP_CALL_TIMEOUT;
-		}
-	}
 
-	CloseHandle(local_context.event);
-	msg = local_context.response;
+		msg->callId = call->tag;
+		msg->status = FDSAPI_STATUS_SUCCESS;
+		msg->buffer = call->request->buffer;
+		msg->length = call->request->length;
+		msg->msgType = FDSAPI_REQUEST_ID(call->type);
 
-	if (!msg)
-	{
-		if (local_context.status)
-			ret = local_context.status;
-		else
-			ret = PBRPC_FAILED;
+		if (pbrpc_call_timeout(context, call->type) > timeout)
+			timeout = pbrpc_call_timeout(context, call->type);
+
+		Queue_Enqueue(context->writeQueue, msg);
 	}
-	else
+
+	if (!done && (WaitForSingleObject(waiter->event, timeout) != WAIT_OBJECT_0))
 	{
-		*response = pbrpc_fill_payload(msg);
-		ret = msg->status;
-		pbrpc_message_free(msg, FALSE);
+		int timedOut = 0;
+
+		EnterCriticalSection(&context->transactionLock);
+
+		for (index = 0; index < count; index++)
+		{
+			call = &calls[index];
+			ta = pbrpc_transaction_find(context, call->tag);
+
+			if (ta && (ta->call == call))
+			{
+				ta->tag = 0;
+				call->status = PBRCP_CALL_TIMEOUT;
+				InterlockedDecrement(&waiter->pending);
+				timedOut++;
+			}
+		}
+
+		/* the last call completed after the wait gave up, swallow its signal */
+		if (!timedOut)
+			WaitForSingleObject(waiter->event, 0);
+
+		LeaveCriticalSection(&context->transactionLock);
+
+		if (timedOut)
+			WLog_ERR(TAG, "%d of %d calls timed out after %d ms", timedOut, count, (int) timeout);
 	}
 
-	return ret;
+	ObjectPool_Return(context->waiterPool, waiter);
+
+	return PBRPC_SUCCESS;
+}
+
+int pbrpc_call_method(rdsServer* server, UINT32 type, pbRPCPayload* request, pbRPCPayload* response)
+{
+	int status;
+	pbRPCCall call;
+
+	call.type = type;
+	call.request = request;
+
+	status = pbrpc_call_methods(server, &call, 1);
+
+	CopyMemory(response, &call.response, sizeof(pbRPCPayload));
+
+	if (status != PBRPC_SUCCESS)
+		return status;
+
+	return call.status;
 }
 
 void pbrcp_call_method_async(pbRPCContext* context, UINT32 type, pbRPCPayload* request,
 		pbRpcResponseCallback callback, void *callback_args)
 {
 	UINT32 tag;
-	pbRPCTransaction* ta;
 	FDSAPI_MSG_PACKET* msg;
 
 	if (!context->isConnected)
@@ -596,14 +787,18 @@ void pbrcp_call_method_async(pbRPCContext* context, UINT32 type, pbRPCPayload* r
 		return;
 	}
 
-	ta = (pbRPCTransaction*) calloc(1, sizeof(pbRPCTransaction));
-	ta->freeAfterResponse = TRUE;
-	ta->responseCallback = callback;
-	ta->callbackArg = callback_args;
-
-	tag = pbrpc_getTag(context);
+	if (!(msg = pbrpc_message_new(context)))
+	{
+		callback(PBRPC_FAILED, 0, callback_args);
+		return;
+	}
 
-	msg = pbrpc_message_new();
+	if (!(tag = pbrpc_transaction_new(context, NULL, callback, callback_args)))
+	{
+		pbrpc_message_free(context, msg, FALSE);
+		callback(PBRPC_FAILED, 0, callback_args);
+		return;
+	}
 
 	msg->callId = tag;
 	msg->status = FDSAPI_STATUS_SUCCESS;
@@ -611,7 +806,6 @@ void pbrcp_call_method_async(pbRPCContext* context, UINT32 type, pbRPCPayload* r
 	msg->length = request->length;
 	msg->msgType = FDSAPI_REQUEST_ID(type);
 
-	ListDictionary_Add(context->transactions, (void*)((UINT_PTR)(msg->callId)), ta);
 	Queue_Enqueue(context->writeQueue, msg);
 }
 
@@ -619,34 +813,69 @@ void pbrcp_call_method_async(pbRPCContext* context, UINT32 type, pbRPCPayload* r
 
 int freerds_icp_IsChannelAllowed(FDSAPI_CHANNEL_ALLOWED_REQUEST* pRequest, FDSAPI_CHANNEL_ALLOWED_RESPONSE* pResponse)
 {
-	int status;
-	pbRPCPayload pbrequest;
-	pbRPCPayload* pbresponse = NULL;
+	return freerds_icp_IsChannelAllowedMultiple(pRequest, pResponse, 1);
+}
+
+/* Issues the requests together and waits for all of them, failed ones leave their response untouched. */
+int freerds_icp_IsChannelAllowedMultiple(FDSAPI_CHANNEL_ALLOWED_REQUEST* pRequests,
+		FDSAPI_CHANNEL_ALLOWED_RESPONSE* pResponses, int count)
+{
+	int index;
+	int first;
+	int callCount;
+	int status = PBRPC_SUCCESS;
+	int callStatus;
+	pbRPCCall calls[8];
+	pbRPCPayload pbrequests[8];
 	UINT32 type = FDSAPI_CHANNEL_ALLOWED_REQUEST_ID;
 
-	pbrequest.s = freerds_rpc_msg_pack(type, pRequest, NULL);
-	pbrequest.buffer = Stream_Buffer(pbrequest.s);
-	pbrequest.length = Stream_Length(pbrequest.s);
+	for (first = 0; first < count; first += callCount)
+	{
+		callCount = count - first;
 
-	status = pbrpc_call_method(g_Server, FDSAPI_REQUEST_ID(type), &pbrequest, &pbresponse);
+		if (callCount > 8)
+			callCount = 8;
 
-	Stream_Free(pbrequest.s, TRUE);
+		for (index = 0; index < callCount; index++)
+		{
+			pbrequests[index].s = freerds_rpc_msg_pack(type, &pRequests[first + index], NULL);
+			pbrequests[index].buffer = Stream_Buffer(pbrequests[index].s);
+			pbrequests[index].length = Stream_Length(pbrequests[index].s);
 
-	if (status != 0)
-		return status;
+			calls[index].type = FDSAPI_REQUEST_ID(type);
+			calls[index].request = &pbrequests[index];
+		}
 
-	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse->buffer, pbresponse->length);
+		callStatus = pbrpc_call_methods(g_Server, calls, callCount);
 
-	pbrpc_free_payload(pbresponse);
+		for (index = 0; index < callCount; index++)
+		{
+			Stream_Free(pbrequests[index].s, TRUE);
 
-	return PBRPC_SUCCESS;
+			if (!callStatus)
+				callStatus = calls[index].status;
+
+			if (!calls[index].status)
+			{
+				freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), &pResponses[first + index],
+						calls[index].response.buffer, calls[index].response.length);
+			}
+
+			pbrpc_free_payload(&calls[index].response);
+		}
+
+		if (!status)
+			status = callStatus;
+	}
+
+	return status;
 }
 
 int freerds_icp_DisconnectUserSession(FDSAPI_DISCONNECT_USER_REQUEST* pRequest, FDSAPI_DISCONNECT_USER_RESPONSE* pResponse)
 {
 	int status;
 	pbRPCPayload pbrequest;
-	pbRPCPayload* pbresponse = NULL;
+	pbRPCPayload pbresponse;
 	UINT32 type = FDSAPI_DISCONNECT_USER_REQUEST_ID;
 
 	pbrequest.s = freerds_rpc_msg_pack(type, pRequest, NULL);
@@ -658,11 +887,14 @@ int freerds_icp_DisconnectUserSession(FDSAPI_DISCONNECT_USER_REQUEST* pRequest,
 	Stream_Free(pbrequest.s, TRUE);
 
 	if (status != 0)
+	{
+		pbrpc_free_payload(&pbresponse);
 		return status;
+	}
 
-	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse->buffer, pbresponse->length);
+	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse.buffer, pbresponse.length);
 
-	pbrpc_free_payload(pbresponse);
+	pbrpc_free_payload(&pbresponse);
 
 	return PBRPC_SUCCESS;
 }
@@ -671,7 +903,7 @@ int freerds_icp_LogOffUserSession(FDSAPI_LOGOFF_USER_REQUEST* pRequest, FDSAPI_L
 {
 	int status;
 	pbRPCPayload pbrequest;
-	pbRPCPayload* pbresponse = NULL;
+	pbRPCPayload pbresponse;
 	UINT32 type = FDSAPI_LOGOFF_USER_REQUEST_ID;
 
 	pbrequest.s = freerds_rpc_msg_pack(type, pRequest, NULL);
@@ -683,11 +915,14 @@ int freerds_icp_LogOffUserSession(FDSAPI_LOGOFF_USER_REQUEST* pRequest, FDSAPI_L
 	Stream_Free(pbrequest.s, TRUE);
 
 	if (status != 0)
+	{
+		pbrpc_free_payload(&pbresponse);
 		return status;
+	}
 
-	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse->buffer, pbresponse->length);
+	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse.buffer, pbresponse.length);
 
-	pbrpc_free_payload(pbresponse);
+	pbrpc_free_payload(&pbresponse);
 
 	return PBRPC_SUCCESS;
 }
@@ -696,7 +931,7 @@ int freerds_icp_LogonUser(FDSAPI_LOGON_USER_REQUEST* pRequest, FDSAPI_LOGON_USER
 {
 	int status;
 	pbRPCPayload pbrequest;
-	pbRPCPayload* pbresponse = NULL;
+	pbRPCPayload pbresponse;
 	UINT32 type = FDSAPI_LOGON_USER_REQUEST_ID;
 
 	pbrequest.s = freerds_rpc_msg_pack(type, pRequest, NULL);
@@ -708,11 +943,14 @@ int freerds_icp_LogonUser(FDSAPI_LOGON_USER_REQUEST* pRequest, FDSAPI_LOGON_USER
 	Stream_Free(pbrequest.s, TRUE);
 
 	if (status != 0)
+	{
+		pbrpc_free_payload(&pbresponse);
 		return status;
+	}
 
-	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse->buffer, pbresponse->length);
+	freerds_rpc_msg_unpack(FDSAPI_RESPONSE_ID(type), pResponse, pbresponse.buffer, pbresponse.length);
 
-	pbrpc_free_payload(pbresponse);
+	pbrpc_free_payload(&pbresponse);
 
 	return PBRPC_SUCCESS;
 }
@@ -726,7 +964,7 @@ int freerds_icp_Heartbeat(FDSAPI_MSG_PACKET* msg, pbRPCPayload** pbresponse)
 	FDSAPI_HEARTBEAT_RESPONSE response;
 	UINT32 type = FDSAPI_HEARTBEAT_REQUEST_ID;
 
-	freerds_rpc_msg_unpack(FDSAPI_REQUEST_ID(type), &request, msg->buffer, msg->length);
+	freerds_rpc_msg_unpack_borrowed(g_Server->rpc->decoder, FDSAPI_REQUEST_ID(type), &request, msg->buffer, msg->length);
 	CopyMemory(&request, msg, sizeof(FDSAPI_MSG_HEADER));
 
 	response.msgType = FDSAPI_RESPONSE_ID(type);
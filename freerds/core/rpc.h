@@ -28,17 +28,6 @@
 
 #include "freerds.h"
 
-struct pbrpc_context
-{
-	LONG tag;
-	HANDLE hPipe;
-	HANDLE stopEvent;
-	HANDLE thread;
-	BOOL isConnected;
-	wQueue* writeQueue;
-	wListDictionary* transactions;
-};
-
 struct pbrpc_payload
 {
 	wStream* s;
@@ -62,15 +51,75 @@ typedef enum pbrpc_status
 
 typedef void (*pbRpcResponseCallback)(UINT32 reason, FDSAPI_MSG_PACKET* response, void *args);
 
+#define PBRPC_TRANSACTION_SLOTS		256
+#define PBRPC_CALL_TYPE_BASE		1000
+#define PBRPC_CALL_TYPES		16
+#define PBRPC_DEFAULT_CALL_TIMEOUT	10000
+
+/* waits for a group of synchronous calls, taken from a pool and reused */
+struct pbrpc_waiter
+{
+	HANDLE event;
+	LONG pending;
+};
+typedef struct pbrpc_waiter pbRPCWaiter;
+
+/* a synchronous call, owned by the calling thread */
+struct pbrpc_call
+{
+	UINT32 type;
+	UINT32 tag;
+	UINT32 status;
+	pbRPCPayload* request;
+	pbRPCPayload response;
+	pbRPCWaiter* waiter;
+};
+typedef struct pbrpc_call pbRPCCall;
+
+/* a slot is free while its tag is 0 */
+struct pbrpc_transaction
+{
+	UINT32 tag;
+	pbRPCCall* call;
+	void* callbackArg;
+	pbRpcResponseCallback responseCallback;
+};
+typedef struct pbrpc_transaction pbRPCTransaction;
+
+struct pbrpc_context
+{
+	LONG tag;
+	HANDLE hPipe;
+	HANDLE stopEvent;
+	HANDLE thread;
+	BOOL isConnected;
+	wQueue* writeQueue;
+	CRITICAL_SECTION transactionLock;
+	pbRPCTransaction transactions[PBRPC_TRANSACTION_SLOTS];
+	DWORD callTimeouts[PBRPC_CALL_TYPES];
+	wObjectPool* waiterPool;
+	wObjectPool* messagePool;
+	wBufferPool* bufferPool;
+	rdsRpcDecoder* decoder;
+};
+
 int pbrpc_server_start(pbRPCContext* context);
 int pbrpc_server_stop(pbRPCContext* context);
 
 pbRPCContext* pbrpc_server_new();
 void pbrpc_server_free(pbRPCContext* context);
 
+void pbrpc_set_call_timeout(pbRPCContext* context, UINT32 type, DWORD timeout);
+
+int pbrpc_call_method(rdsServer* server, UINT32 type, pbRPCPayload* request, pbRPCPayload* response);
+int pbrpc_call_methods(rdsServer* server, pbRPCCall* calls, int count);
+void pbrpc_free_payload(pbRPCPayload* response);
+
 /* icp */
 
 int freerds_icp_IsChannelAllowed(FDSAPI_CHANNEL_ALLOWED_REQUEST* pRequest, FDSAPI_CHANNEL_ALLOWED_RESPONSE* pResponse);
+int freerds_icp_IsChannelAllowedMultiple(FDSAPI_CHANNEL_ALLOWED_REQUEST* pRequests,
+		FDSAPI_CHANNEL_ALLOWED_RESPONSE* pResponses, int count);
 int freerds_icp_DisconnectUserSession(FDSAPI_DISCONNECT_USER_REQUEST* pRequest, FDSAPI_DISCONNECT_USER_RESPONSE* pResponse);
 int freerds_icp_LogOffUserSession(FDSAPI_LOGOFF_USER_REQUEST* pRequest, FDSAPI_LOGOFF_USER_RESPONSE* pResponse);
 int freerds_icp_LogonUser(FDSAPI_LOGON_USER_REQUEST* pRequest, FDSAPI_LOGON_USER_RESPONSE* pResponse);
@@ -42,29 +42,19 @@ static wStream* freerds_pack_channel_allowed_request(FDSAPI_CHANNEL_ALLOWED_REQU
 	return s;
 }
 
-static BOOL freerds_unpack_channel_allowed_request(FDSAPI_CHANNEL_ALLOWED_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_channel_allowed_request(FDSAPI_CHANNEL_ALLOWED_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
+	if (!msgpack_unpack_cstr(obj++, &(request->ChannelName), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->ChannelName)))
-		return FALSE;
-
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -101,32 +91,22 @@ static wStream* freerds_pack_channel_allowed_response(FDSAPI_CHANNEL_ALLOWED_RES
 	return s;
 }
 
-static BOOL freerds_unpack_channel_allowed_response(FDSAPI_CHANNEL_ALLOWED_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_channel_allowed_response(FDSAPI_CHANNEL_ALLOWED_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_bool(obj++, &(response->ChannelAllowed)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -162,29 +142,19 @@ static wStream* freerds_pack_heartbeat_request(FDSAPI_HEARTBEAT_REQUEST* request
 	return s;
 }
 
-static BOOL freerds_unpack_heartbeat_request(FDSAPI_HEARTBEAT_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_heartbeat_request(FDSAPI_HEARTBEAT_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->HeartbeatId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -221,32 +191,22 @@ static wStream* freerds_pack_heartbeat_response(FDSAPI_HEARTBEAT_RESPONSE* respo
 	return s;
 }
 
-static BOOL freerds_unpack_heartbeat_response(FDSAPI_HEARTBEAT_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_heartbeat_response(FDSAPI_HEARTBEAT_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(response->HeartbeatId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -294,34 +254,26 @@ static wStream* freerds_pack_logon_user_request(FDSAPI_LOGON_USER_REQUEST* reque
 	return s;
 }
 
-static BOOL freerds_unpack_logon_user_request(FDSAPI_LOGON_USER_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_logon_user_request(FDSAPI_LOGON_USER_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 13))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 13))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->ConnectionId)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->User)))
+	if (!msgpack_unpack_cstr(obj++, &(request->User), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->Domain)))
+	if (!msgpack_unpack_cstr(obj++, &(request->Domain), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->Password)))
+	if (!msgpack_unpack_cstr(obj++, &(request->Password), context))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(request->DesktopWidth)))
@@ -333,10 +285,10 @@ static BOOL freerds_unpack_logon_user_request(FDSAPI_LOGON_USER_REQUEST* request
 	if (!msgpack_unpack_uint32(obj++, &(request->ColorDepth)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->ClientName)))
+	if (!msgpack_unpack_cstr(obj++, &(request->ClientName), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->ClientAddress)))
+	if (!msgpack_unpack_cstr(obj++, &(request->ClientAddress), context))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(request->ClientBuild)))
@@ -351,8 +303,6 @@ static BOOL freerds_unpack_logon_user_request(FDSAPI_LOGON_USER_REQUEST* request
 	if (!msgpack_unpack_uint32(obj++, &(request->ClientProtocolType)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -393,32 +343,22 @@ static wStream* freerds_pack_logon_user_response(FDSAPI_LOGON_USER_RESPONSE* res
 	return s;
 }
 
-static BOOL freerds_unpack_logon_user_response(FDSAPI_LOGON_USER_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_logon_user_response(FDSAPI_LOGON_USER_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(response->ServiceEndpoint)))
+	if (!msgpack_unpack_cstr(obj++, &(response->ServiceEndpoint), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -454,29 +394,19 @@ static wStream* freerds_pack_logoff_user_request(FDSAPI_LOGOFF_USER_REQUEST* req
 	return s;
 }
 
-static BOOL freerds_unpack_logoff_user_request(FDSAPI_LOGOFF_USER_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_logoff_user_request(FDSAPI_LOGOFF_USER_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->ConnectionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -513,32 +443,22 @@ static wStream* freerds_pack_logoff_user_response(FDSAPI_LOGOFF_USER_RESPONSE* r
 	return s;
 }
 
-static BOOL freerds_unpack_logoff_user_response(FDSAPI_LOGOFF_USER_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_logoff_user_response(FDSAPI_LOGOFF_USER_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(response->ConnectionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -574,29 +494,19 @@ static wStream* freerds_pack_disconnect_user_request(FDSAPI_DISCONNECT_USER_REQU
 	return s;
 }
 
-static BOOL freerds_unpack_disconnect_user_request(FDSAPI_DISCONNECT_USER_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_disconnect_user_request(FDSAPI_DISCONNECT_USER_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->ConnectionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -633,32 +543,22 @@ static wStream* freerds_pack_disconnect_user_response(FDSAPI_DISCONNECT_USER_RES
 	return s;
 }
 
-static BOOL freerds_unpack_disconnect_user_response(FDSAPI_DISCONNECT_USER_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_disconnect_user_response(FDSAPI_DISCONNECT_USER_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(response->ConnectionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -695,32 +595,22 @@ static wStream* freerds_pack_switch_service_endpoint_request(FDSAPI_SWITCH_SERVI
 	return s;
 }
 
-static BOOL freerds_unpack_switch_service_endpoint_request(FDSAPI_SWITCH_SERVICE_ENDPOINT_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_switch_service_endpoint_request(FDSAPI_SWITCH_SERVICE_ENDPOINT_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->ConnectionId)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->ServiceEndpoint)))
+	if (!msgpack_unpack_cstr(obj++, &(request->ServiceEndpoint), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -756,29 +646,19 @@ static wStream* freerds_pack_switch_service_endpoint_response(FDSAPI_SWITCH_SERV
 	return s;
 }
 
-static BOOL freerds_unpack_switch_service_endpoint_response(FDSAPI_SWITCH_SERVICE_ENDPOINT_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_switch_service_endpoint_response(FDSAPI_SWITCH_SERVICE_ENDPOINT_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -817,38 +697,28 @@ static wStream* freerds_pack_start_session_request(FDSAPI_START_SESSION_REQUEST*
 	return s;
 }
 
-static BOOL freerds_unpack_start_session_request(FDSAPI_START_SESSION_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_start_session_request(FDSAPI_START_SESSION_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 4))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 4))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->SessionId)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->User)))
+	if (!msgpack_unpack_cstr(obj++, &(request->User), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->Domain)))
+	if (!msgpack_unpack_cstr(obj++, &(request->Domain), context))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->Password)))
+	if (!msgpack_unpack_cstr(obj++, &(request->Password), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -887,32 +757,22 @@ static wStream* freerds_pack_start_session_response(FDSAPI_START_SESSION_RESPONS
 	return s;
 }
 
-static BOOL freerds_unpack_start_session_response(FDSAPI_START_SESSION_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_start_session_response(FDSAPI_START_SESSION_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(response->ServiceEndpoint)))
+	if (!msgpack_unpack_cstr(obj++, &(response->ServiceEndpoint), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -948,29 +808,19 @@ static wStream* freerds_pack_end_session_request(FDSAPI_END_SESSION_REQUEST* req
 	return s;
 }
 
-static BOOL freerds_unpack_end_session_request(FDSAPI_END_SESSION_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_end_session_request(FDSAPI_END_SESSION_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 1))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 1))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->SessionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -1007,32 +857,22 @@ static wStream* freerds_pack_end_session_response(FDSAPI_END_SESSION_RESPONSE* r
 	return s;
 }
 
-static BOOL freerds_unpack_end_session_response(FDSAPI_END_SESSION_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_end_session_response(FDSAPI_END_SESSION_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(response->SessionId)))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -1069,32 +909,22 @@ static wStream* freerds_pack_channel_endpoint_open_request(FDSAPI_CHANNEL_ENDPOI
 	return s;
 }
 
-static BOOL freerds_unpack_channel_endpoint_open_request(FDSAPI_CHANNEL_ENDPOINT_OPEN_REQUEST* request, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_channel_endpoint_open_request(FDSAPI_CHANNEL_ENDPOINT_OPEN_REQUEST* request, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
-
-	msgpack_unpacked_init(&pk);
 
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(request->ConnectionId)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(request->ChannelName)))
+	if (!msgpack_unpack_cstr(obj++, &(request->ChannelName), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -1132,35 +962,25 @@ static wStream* freerds_pack_channel_endpoint_open_response(FDSAPI_CHANNEL_ENDPO
 	return s;
 }
 
-static BOOL freerds_unpack_channel_endpoint_open_response(FDSAPI_CHANNEL_ENDPOINT_OPEN_RESPONSE* response, const BYTE* buffer, UINT32 size)
+static BOOL freerds_unpack_channel_endpoint_open_response(FDSAPI_CHANNEL_ENDPOINT_OPEN_RESPONSE* response, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t count;
-	msgpack_unpacked pk;
 	msgpack_object* obj;
-	msgpack_object* root;
 
-	msgpack_unpacked_init(&pk);
-
-	if (!msgpack_unpack_next(&pk, (const char*) buffer, size, NULL))
+	if (!msgpack_unpack_array_min(root, &count, 2))
 		return FALSE;
 
-	root = &(pk.data);
 	obj = root->via.array.ptr;
 
-	if (!msgpack_unpack_array_min(root, &count, 2))
-		return FALSE;
-
 	if (!msgpack_unpack_uint32(obj++, &(response->status)))
 		return FALSE;
 
 	if (!msgpack_unpack_uint32(obj++, &(response->ChannelPort)))
 		return FALSE;
 
-	if (!msgpack_unpack_cstr(obj++, &(response->ChannelGuid)))
+	if (!msgpack_unpack_cstr(obj++, &(response->ChannelGuid), context))
 		return FALSE;
 
-	msgpack_unpacked_destroy(&pk);
-
 	return TRUE;
 }
 
@@ -98,9 +98,10 @@ int msgpack_pack_cstr(msgpack_packer* pk, const char* cstr)
 	return 0;
 }
 
-BOOL msgpack_unpack_cstr(msgpack_object* obj, char** cstr)
+BOOL msgpack_unpack_cstr(msgpack_object* obj, char** cstr, RDS_RPC_UNPACK_CONTEXT* context)
 {
 	size_t length;
+	BYTE* ptr;
 
 	if (obj->type != MSGPACK_OBJECT_RAW)
 		return FALSE;
@@ -113,7 +114,28 @@ BOOL msgpack_unpack_cstr(msgpack_object* obj, char** cstr)
 		return TRUE;
 	}
 
-	*cstr = (char*) malloc(length + 1);
+	if (context->end)
+	{
+		ptr = (BYTE*) obj->via.raw.ptr;
+
+		/**
+		 * The byte behind a string is the header of the next object,
+		 * which has been parsed already, so it can become the string
+		 * terminator. Only a string ending the buffer needs a copy.
+		 */
+		if ((ptr + length) < context->end)
+		{
+			ptr[length] = '\0';
+			*cstr = (char*) ptr;
+			return TRUE;
+		}
+
+		*cstr = (char*) msgpack_zone_malloc_no_align(context->zone, length + 1);
+	}
+	else
+	{
+		*cstr = (char*) malloc(length + 1);
+	}
 
 	if (!(*cstr))
 		return FALSE;
@@ -197,9 +219,29 @@ wStream* freerds_rpc_msg_pack(UINT32 type, void* data, wStream* s)
 	return func->Pack(data, s);
 }
 
+static BOOL freerds_rpc_msg_decode(RDS_RPC_PACK_FUNC* func, void* data, const BYTE* buffer, UINT32 size,
+		RDS_RPC_UNPACK_CONTEXT* context)
+{
+	msgpack_object root;
+	msgpack_unpack_return status;
+
+	/* leave the header alone, callers copy it in before or after */
+	ZeroMemory(((BYTE*) data) + FDSAPI_MSG_HEADER_SIZE, func->msgSize - FDSAPI_MSG_HEADER_SIZE);
+
+	status = msgpack_unpack((const char*) buffer, size, NULL, context->zone, &root);
+
+	if ((status != MSGPACK_UNPACK_SUCCESS) && (status != MSGPACK_UNPACK_EXTRA_BYTES))
+		return FALSE;
+
+	return func->Unpack(data, &root, context);
+}
+
 BOOL freerds_rpc_msg_unpack(UINT32 type, void* data, const BYTE* buffer, UINT32 size)
 {
+	BOOL status;
+	msgpack_zone zone;
 	RDS_RPC_PACK_FUNC* func;
+	RDS_RPC_UNPACK_CONTEXT context;
 
 	if (!data)
 		return FALSE;
@@ -209,7 +251,77 @@ BOOL freerds_rpc_msg_unpack(UINT32 type, void* data, const BYTE* buffer, UINT32
 	if (!func)
 		return FALSE;
 
-	return func->Unpack(data, buffer, size);
+	if (!msgpack_zone_init(&zone, RDS_RPC_ZONE_CHUNK_SIZE))
+		return FALSE;
+
+	context.zone = &zone;
+	context.end = NULL;
+
+	status = freerds_rpc_msg_decode(func, data, buffer, size, &context);
+
+	/**
+	 * Strings decoded before the failure are owned as well. They are
+	 * freed here and cleared, callers may still run freerds_rpc_msg_free.
+	 */
+	if (!status)
+	{
+		func->Free(data);
+		ZeroMemory(((BYTE*) data) + FDSAPI_MSG_HEADER_SIZE, func->msgSize - FDSAPI_MSG_HEADER_SIZE);
+	}
+
+	msgpack_zone_destroy(&zone);
+
+	return status;
+}
+
+BOOL freerds_rpc_msg_unpack_borrowed(rdsRpcDecoder* decoder, UINT32 type, void* data, BYTE* buffer, UINT32 size)
+{
+	RDS_RPC_PACK_FUNC* func;
+	RDS_RPC_UNPACK_CONTEXT context;
+
+	if (!decoder || !data)
+		return FALSE;
+
+	func = freerds_rpc_msg_find_func(type);
+
+	if (!func)
+		return FALSE;
+
+	/* whatever the previous message borrowed from the zone is gone now */
+	msgpack_zone_clear(&decoder->zone);
+
+	context.zone = &decoder->zone;
+	context.end = buffer + size;
+
+	return freerds_rpc_msg_decode(func, data, buffer, size, &context);
+}
+
+rdsRpcDecoder* freerds_rpc_decoder_new()
+{
+	rdsRpcDecoder* decoder;
+
+	decoder = (rdsRpcDecoder*) calloc(1, sizeof(rdsRpcDecoder));
+
+	if (!decoder)
+		return NULL;
+
+	if (!msgpack_zone_init(&decoder->zone, RDS_RPC_ZONE_CHUNK_SIZE))
+	{
+		free(decoder);
+		return NULL;
+	}
+
+	return decoder;
+}
+
+void freerds_rpc_decoder_free(rdsRpcDecoder* decoder)
+{
+	if (!decoder)
+		return;
+
+	msgpack_zone_destroy(&decoder->zone);
+
+	free(decoder);
 }
 
 void freerds_rpc_msg_free(UINT32 type, void* data)
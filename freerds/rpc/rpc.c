@@ -31,6 +31,16 @@
 #include <winpr/thread.h>
 #include <winpr/wlog.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#endif
+
 #define RDS_RPC_HEADER_LENGTH		4
 #define RDS_RPC_PIPE_BUFFER_SIZE	0xFFFF
 
@@ -38,6 +48,16 @@
 #define RDS_RPC_CONNECT_RETRIES		10
 #define RDS_RPC_RECONNECT_INTERVAL	15000
 
+#define RDS_RPC_MAX_MESSAGE_SIZE	0x1000000
+#define RDS_RPC_MAX_OUTBOUND_SIZE	0x400000
+
+#define RDS_RPC_MAX_REACTORS		4
+#define RDS_RPC_REACTOR_CLIENTS		256
+#define RDS_RPC_REACTOR_MAX_EVENTS	64
+
+#define RDS_RPC_DISPATCH_WORKERS	4
+#define RDS_RPC_MAX_DISPATCH_SIZE	(2 * RDS_RPC_MAX_MESSAGE_SIZE)
+
 static wLog* g_logger;
 
 /**
@@ -311,6 +331,10 @@ rdsRpcClient* freerds_rpc_client_new(const char* Endpoint)
 		rpcClient->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 		rpcClient->InboundStream = Stream_New(NULL, 8192);
+
+		rpcClient->fd = -1;
+		InitializeCriticalSection(&rpcClient->OutboundLock);
+		InitializeCriticalSection(&rpcClient->DispatchLock);
 	}
 
 	return rpcClient;
@@ -337,6 +361,24 @@ void freerds_rpc_client_free(rdsRpcClient* rpcClient)
 		Stream_Free(rpcClient->InboundStream, TRUE);
 	}
 
+	if (rpcClient->OutboundStream)
+	{
+		Stream_Free(rpcClient->OutboundStream, TRUE);
+	}
+
+	if (rpcClient->DispatchStream)
+	{
+		Stream_Free(rpcClient->DispatchStream, TRUE);
+	}
+
+	if (rpcClient->DispatchSpare)
+	{
+		Stream_Free(rpcClient->DispatchSpare, TRUE);
+	}
+
+	DeleteCriticalSection(&rpcClient->OutboundLock);
+	DeleteCriticalSection(&rpcClient->DispatchLock);
+
 	free(rpcClient);
 }
 
@@ -421,6 +463,12 @@ void* freerds_rpc_client_thread(void* arg)
 		{
 			CloseHandle(rpcClient->hClientPipe);
 			rpcClient->hClientPipe = NULL;
+
+			/* stopped by the server, the owner still has to hear about it */
+			if (rpcClient->ConnectionClosed)
+			{
+				rpcClient->ConnectionClosed(rpcClient);
+			}
 		}
 
 		CloseHandle(rpcClient->hClientThread);
@@ -478,11 +526,16 @@ int freerds_rpc_client_stop(rdsRpcClient* rpcClient)
 	return 0;
 }
 
+static int freerds_rpc_reactor_send_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length);
+
 int freerds_rpc_client_send_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length)
 {
 	int totalLength;
 	int status;
 
+	if (rpcClient->Reactor)
+		return freerds_rpc_reactor_send_message(rpcClient, buffer, length);
+
 	totalLength = length + sizeof(UINT32);
 
 	status = freerds_rpc_named_pipe_write(rpcClient->hClientPipe, (BYTE*) &totalLength, sizeof(UINT32));
@@ -497,6 +550,747 @@ int freerds_rpc_client_send_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT3
 
 
 
+/**
+ *
+ * RPC server reactor
+ *
+ * Accepted connections are spread over a few epoll reactor threads
+ * instead of getting a thread each. A reactor reads whatever is
+ * available, hands every complete message to the dispatch workers and
+ * goes back to waiting. Sends never block: what the pipe does not take
+ * right away is queued on the client and flushed once the pipe is
+ * writable again. Reactors are started on demand, a server with a
+ * handful of clients runs a single one.
+ *
+ * MessageReceived handlers may block, so they never run on a reactor.
+ * A client with pending messages is queued to the dispatch workers
+ * once, and one worker at a time delivers its messages in order. The
+ * reactor and a queued dispatch each hold a reference on the client,
+ * ConnectionClosed is called when the last one is dropped. Messages
+ * received before the peer closed are delivered before that.
+ *
+ */
+
+#ifdef __linux__
+
+struct rds_rpc_reactor
+{
+	int epollfd;
+	int wakefd;
+	HANDLE hThread;
+	BOOL stop;
+	LONG clientCount;
+	rdsRpcServer* rpcServer;
+};
+
+struct rds_rpc_dispatcher
+{
+	wQueue* queue;
+	HANDLE hStopEvent;
+	int threadCount;
+	HANDLE threads[RDS_RPC_DISPATCH_WORKERS];
+};
+
+static void freerds_rpc_reactor_release(rdsRpcClient* rpcClient)
+{
+	if (InterlockedDecrement(&rpcClient->RefCount) > 0)
+		return;
+
+	/* no handler runs for this client anymore */
+	if (rpcClient->ConnectionClosed)
+		rpcClient->ConnectionClosed(rpcClient);
+
+	freerds_rpc_client_free(rpcClient);
+}
+
+static void freerds_rpc_dispatch_client(rdsRpcClient* rpcClient)
+{
+	size_t offset;
+	size_t position;
+	UINT32 length;
+	wStream* s;
+
+	while (1)
+	{
+		EnterCriticalSection(&rpcClient->DispatchLock);
+
+		s = rpcClient->DispatchStream;
+
+		/* messages that came in before the peer closed are still delivered */
+		if (Stream_GetPosition(s) == 0)
+		{
+			Stream_SetPosition(s, 0);
+			rpcClient->DispatchQueued = FALSE;
+			LeaveCriticalSection(&rpcClient->DispatchLock);
+			break;
+		}
+
+		/* the reactor keeps appending to the other stream meanwhile */
+		rpcClient->DispatchStream = rpcClient->DispatchSpare;
+		rpcClient->DispatchSpare = s;
+
+		LeaveCriticalSection(&rpcClient->DispatchLock);
+
+		offset = 0;
+		position = Stream_GetPosition(s);
+
+		while (offset < position)
+		{
+			length = *((UINT32*) &Stream_Buffer(s)[offset]);
+
+			rpcClient->MessageReceived(rpcClient, &Stream_Buffer(s)[offset + RDS_RPC_HEADER_LENGTH],
+					length - RDS_RPC_HEADER_LENGTH);
+
+			offset += length;
+		}
+
+		Stream_SetPosition(s, 0);
+	}
+
+	freerds_rpc_reactor_release(rpcClient);
+}
+
+static void* freerds_rpc_dispatcher_thread(void* arg)
+{
+	HANDLE events[2];
+	rdsRpcClient* rpcClient;
+	rdsRpcDispatcher* dispatcher = (rdsRpcDispatcher*) arg;
+
+	events[0] = dispatcher->hStopEvent;
+	events[1] = Queue_Event(dispatcher->queue);
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == (WAIT_OBJECT_0 + 1))
+	{
+		rpcClient = (rdsRpcClient*) Queue_Dequeue(dispatcher->queue);
+
+		if (rpcClient)
+			freerds_rpc_dispatch_client(rpcClient);
+	}
+
+	return NULL;
+}
+
+static rdsRpcDispatcher* freerds_rpc_dispatcher_new()
+{
+	rdsRpcDispatcher* dispatcher;
+
+	dispatcher = (rdsRpcDispatcher*) calloc(1, sizeof(rdsRpcDispatcher));
+
+	if (!dispatcher)
+		return NULL;
+
+	dispatcher->queue = Queue_New(TRUE, -1, -1);
+	dispatcher->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!dispatcher->queue || !dispatcher->hStopEvent)
+		goto fail;
+
+	while (dispatcher->threadCount < RDS_RPC_DISPATCH_WORKERS)
+	{
+		HANDLE hThread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) freerds_rpc_dispatcher_thread,
+				(void*) dispatcher, 0, NULL);
+
+		if (!hThread)
+			break;
+
+		dispatcher->threads[dispatcher->threadCount++] = hThread;
+	}
+
+	if (!dispatcher->threadCount)
+		goto fail;
+
+	return dispatcher;
+
+fail:
+	WLog_Print(g_logger, WLOG_ERROR, "failed to create rpc dispatcher");
+
+	if (dispatcher->queue)
+		Queue_Free(dispatcher->queue);
+
+	if (dispatcher->hStopEvent)
+		CloseHandle(dispatcher->hStopEvent);
+
+	free(dispatcher);
+
+	return NULL;
+}
+
+/**
+ * Called once the reactors are gone, so nothing is queued anymore.
+ * Waits for handlers that are still running.
+ */
+static void freerds_rpc_dispatcher_free(rdsRpcDispatcher* dispatcher)
+{
+	int index;
+	rdsRpcClient* rpcClient;
+
+	SetEvent(dispatcher->hStopEvent);
+
+	for (index = 0; index < dispatcher->threadCount; index++)
+	{
+		WaitForSingleObject(dispatcher->threads[index], INFINITE);
+		CloseHandle(dispatcher->threads[index]);
+	}
+
+	while ((rpcClient = (rdsRpcClient*) Queue_Dequeue(dispatcher->queue)))
+		freerds_rpc_reactor_release(rpcClient);
+
+	Queue_Free(dispatcher->queue);
+	CloseHandle(dispatcher->hStopEvent);
+
+	free(dispatcher);
+}
+
+static int freerds_rpc_dispatch_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length)
+{
+	wStream* s;
+
+	EnterCriticalSection(&rpcClient->DispatchLock);
+
+	s = rpcClient->DispatchStream;
+
+	/* a handler that never returns must not make us buffer forever */
+	if (Stream_GetPosition(s) + length > RDS_RPC_MAX_DISPATCH_SIZE)
+	{
+		LeaveCriticalSection(&rpcClient->DispatchLock);
+		WLog_Print(g_logger, WLOG_ERROR, "%s is not taking messages, dropping the connection", rpcClient->Endpoint);
+		return -1;
+	}
+
+	Stream_EnsureRemainingCapacity(s, length);
+	Stream_Write(s, buffer, length);
+
+	if (!rpcClient->DispatchQueued)
+	{
+		rpcClient->DispatchQueued = TRUE;
+		InterlockedIncrement(&rpcClient->RefCount);
+		Queue_Enqueue(rpcClient->RpcServer->Dispatcher->queue, rpcClient);
+	}
+
+	LeaveCriticalSection(&rpcClient->DispatchLock);
+
+	return 0;
+}
+
+static void freerds_rpc_reactor_update_events(rdsRpcClient* rpcClient, BOOL writable)
+{
+	struct epoll_event event;
+
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+	event.data.ptr = rpcClient;
+
+	/* fails until the connection is watched, which then picks up the flag */
+	epoll_ctl(rpcClient->Reactor->epollfd, EPOLL_CTL_MOD, rpcClient->fd, &event);
+	rpcClient->WriteArmed = writable;
+}
+
+static int freerds_rpc_reactor_send_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length)
+{
+	ssize_t status = 0;
+	size_t offset;
+	UINT32 totalLength;
+	struct iovec iov[2];
+	struct msghdr msg;
+	wStream* s;
+
+	totalLength = length + RDS_RPC_HEADER_LENGTH;
+
+	EnterCriticalSection(&rpcClient->OutboundLock);
+
+	if (rpcClient->Closed)
+	{
+		LeaveCriticalSection(&rpcClient->OutboundLock);
+		return -1;
+	}
+
+	s = rpcClient->OutboundStream;
+
+	/* only write directly if nothing is queued, or messages would interleave */
+	if (Stream_GetPosition(s) == 0)
+	{
+		iov[0].iov_base = &totalLength;
+		iov[0].iov_len = RDS_RPC_HEADER_LENGTH;
+		iov[1].iov_base = buffer;
+		iov[1].iov_len = length;
+
+		ZeroMemory(&msg, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+
+		do
+		{
+			status = sendmsg(rpcClient->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+		while ((status < 0) && (errno == EINTR));
+
+		if (status < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			{
+				/* the reactor sees the hangup and closes the connection */
+				LeaveCriticalSection(&rpcClient->OutboundLock);
+				return -1;
+			}
+
+			status = 0;
+		}
+	}
+
+	if (status < totalLength)
+	{
+		if (Stream_GetPosition(s) + (totalLength - status) > RDS_RPC_MAX_OUTBOUND_SIZE)
+		{
+			WLog_Print(g_logger, WLOG_ERROR, "outbound queue of %s full, dropping message", rpcClient->Endpoint);
+			LeaveCriticalSection(&rpcClient->OutboundLock);
+			return -1;
+		}
+
+		Stream_EnsureRemainingCapacity(s, totalLength - status);
+
+		for (offset = status; offset < RDS_RPC_HEADER_LENGTH; offset++)
+			Stream_Write_UINT8(s, ((BYTE*) &totalLength)[offset]);
+
+		offset = (status > RDS_RPC_HEADER_LENGTH) ? (status - RDS_RPC_HEADER_LENGTH) : 0;
+		Stream_Write(s, &buffer[offset], length - offset);
+
+		if (!rpcClient->WriteArmed)
+			freerds_rpc_reactor_update_events(rpcClient, TRUE);
+	}
+
+	LeaveCriticalSection(&rpcClient->OutboundLock);
+
+	return length;
+}
+
+static int freerds_rpc_reactor_flush(rdsRpcClient* rpcClient)
+{
+	ssize_t status;
+	size_t pending;
+	wStream* s;
+
+	EnterCriticalSection(&rpcClient->OutboundLock);
+
+	s = rpcClient->OutboundStream;
+	pending = Stream_GetPosition(s);
+
+	while (pending > 0)
+	{
+		status = send(rpcClient->fd, Stream_Buffer(s), pending, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			LeaveCriticalSection(&rpcClient->OutboundLock);
+			return -1;
+		}
+
+		MoveMemory(Stream_Buffer(s), Stream_Buffer(s) + status, pending - status);
+		pending -= status;
+		Stream_SetPosition(s, pending);
+	}
+
+	if ((pending == 0) && rpcClient->WriteArmed)
+		freerds_rpc_reactor_update_events(rpcClient, FALSE);
+
+	LeaveCriticalSection(&rpcClient->OutboundLock);
+
+	return 0;
+}
+
+static int freerds_rpc_reactor_receive(rdsRpcClient* rpcClient)
+{
+	ssize_t status;
+	size_t offset;
+	size_t position;
+	UINT32 length;
+	BYTE* buffer;
+	wStream* s = rpcClient->InboundStream;
+
+	while (1)
+	{
+		Stream_EnsureRemainingCapacity(s, 4096);
+
+		status = read(rpcClient->fd, Stream_Pointer(s), Stream_Capacity(s) - Stream_GetPosition(s));
+
+		if (status == 0)
+			return -1;
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0;
+
+			return -1;
+		}
+
+		Stream_Seek(s, status);
+
+		/* dispatch every complete message in the buffer */
+		offset = 0;
+		position = Stream_GetPosition(s);
+		buffer = Stream_Buffer(s);
+
+		while ((position - offset) >= RDS_RPC_HEADER_LENGTH)
+		{
+			length = *((UINT32*) &buffer[offset]);
+
+			if ((length < RDS_RPC_HEADER_LENGTH) || (length > RDS_RPC_MAX_MESSAGE_SIZE))
+			{
+				WLog_Print(g_logger, WLOG_ERROR, "invalid message length %lu", (unsigned long) length);
+				return -1;
+			}
+
+			if ((position - offset) < length)
+				break;
+
+			if (rpcClient->MessageReceived &&
+					(freerds_rpc_dispatch_message(rpcClient, &buffer[offset], length) < 0))
+				return -1;
+
+			offset += length;
+		}
+
+		if (offset > 0)
+		{
+			MoveMemory(buffer, &buffer[offset], position - offset);
+			Stream_SetPosition(s, position - offset);
+		}
+
+		/* make room for the rest of a large message in one go */
+		if (Stream_GetPosition(s) >= RDS_RPC_HEADER_LENGTH)
+		{
+			length = *((UINT32*) Stream_Buffer(s));
+
+			if (length <= RDS_RPC_MAX_MESSAGE_SIZE)
+				Stream_EnsureCapacity(s, length);
+		}
+	}
+
+	return 0;
+}
+
+static void freerds_rpc_reactor_close(rdsRpcClient* rpcClient)
+{
+	rdsRpcReactor* reactor = rpcClient->Reactor;
+
+	epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, rpcClient->fd, NULL);
+
+	/* broadcasts hold the list lock, so nobody else is sending once we are out */
+	ArrayList_Remove(reactor->rpcServer->ClientList, rpcClient);
+
+	EnterCriticalSection(&rpcClient->OutboundLock);
+	rpcClient->Closed = TRUE;
+	CloseHandle(rpcClient->hClientPipe);
+	rpcClient->hClientPipe = NULL;
+	LeaveCriticalSection(&rpcClient->OutboundLock);
+
+	InterlockedDecrement(&reactor->clientCount);
+
+	/* also on shutdown, owners may keep the client in lists of their own */
+	freerds_rpc_reactor_release(rpcClient);
+}
+
+static void* freerds_rpc_reactor_thread(void* arg)
+{
+	int i;
+	int index;
+	int count;
+	UINT64 value;
+	rdsRpcClient* rpcClient;
+	rdsRpcReactor* reactor = (rdsRpcReactor*) arg;
+	struct epoll_event events[RDS_RPC_REACTOR_MAX_EVENTS];
+
+	while (!reactor->stop)
+	{
+		count = epoll_wait(reactor->epollfd, events, RDS_RPC_REACTOR_MAX_EVENTS, -1);
+
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_Print(g_logger, WLOG_ERROR, "epoll_wait failed: %d", errno);
+			break;
+		}
+
+		for (index = 0; index < count; index++)
+		{
+			rpcClient = (rdsRpcClient*) events[index].data.ptr;
+
+			if (!rpcClient)
+			{
+				if (read(reactor->wakefd, &value, sizeof(value)) < 0)
+					value = 0;
+
+				continue;
+			}
+
+			/* read first, what the peer sent before going away is delivered */
+			if ((events[index].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+					(freerds_rpc_reactor_receive(rpcClient) < 0))
+			{
+				WLog_Print(g_logger, WLOG_TRACE, "connection closed");
+				freerds_rpc_reactor_close(rpcClient);
+				continue;
+			}
+
+			if ((events[index].events & EPOLLOUT) && (freerds_rpc_reactor_flush(rpcClient) < 0))
+			{
+				WLog_Print(g_logger, WLOG_TRACE, "connection closed");
+				freerds_rpc_reactor_close(rpcClient);
+			}
+		}
+	}
+
+	/* the server is stopping, drop the remaining clients of this reactor */
+	ArrayList_Lock(reactor->rpcServer->ClientList);
+
+	for (i = ArrayList_Count(reactor->rpcServer->ClientList) - 1; i >= 0; i--)
+	{
+		rpcClient = (rdsRpcClient*) ArrayList_GetItem(reactor->rpcServer->ClientList, i);
+
+		if (rpcClient->Reactor == reactor)
+			freerds_rpc_reactor_close(rpcClient);
+	}
+
+	ArrayList_Unlock(reactor->rpcServer->ClientList);
+
+	return NULL;
+}
+
+static rdsRpcReactor* freerds_rpc_reactor_new(rdsRpcServer* rpcServer)
+{
+	struct epoll_event event;
+	rdsRpcReactor* reactor;
+
+	reactor = (rdsRpcReactor*) calloc(1, sizeof(rdsRpcReactor));
+
+	if (!reactor)
+		return NULL;
+
+	reactor->rpcServer = rpcServer;
+	reactor->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	reactor->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if ((reactor->epollfd < 0) || (reactor->wakefd < 0))
+		goto fail;
+
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->wakefd, &event) < 0)
+		goto fail;
+
+	reactor->hThread = CreateThread(NULL, 0,
+			(LPTHREAD_START_ROUTINE) freerds_rpc_reactor_thread,
+			(void*) reactor, 0, NULL);
+
+	if (!reactor->hThread)
+		goto fail;
+
+	return reactor;
+
+fail:
+	WLog_Print(g_logger, WLOG_ERROR, "failed to create rpc reactor: %d", errno);
+
+	if (reactor->epollfd >= 0)
+		close(reactor->epollfd);
+
+	if (reactor->wakefd >= 0)
+		close(reactor->wakefd);
+
+	free(reactor);
+
+	return NULL;
+}
+
+static void freerds_rpc_reactor_free(rdsRpcReactor* reactor)
+{
+	UINT64 value = 1;
+
+	reactor->stop = TRUE;
+
+	if (write(reactor->wakefd, &value, sizeof(value)) < 0)
+		WLog_Print(g_logger, WLOG_ERROR, "failed to wake rpc reactor: %d", errno);
+
+	WaitForSingleObject(reactor->hThread, INFINITE);
+	CloseHandle(reactor->hThread);
+
+	close(reactor->epollfd);
+	close(reactor->wakefd);
+
+	free(reactor);
+}
+
+/**
+ * Called from the accept thread before ConnectionAccepted, so that
+ * anything sent from within the callback is already queued on the
+ * reactor. The connection is only polled once it is watched.
+ */
+static BOOL freerds_rpc_reactor_attach(rdsRpcServer* rpcServer, rdsRpcClient* rpcClient)
+{
+	int index;
+	int fd;
+	int flags;
+	rdsRpcReactor* reactor = NULL;
+
+	fd = GetNamePipeFileDescriptor(rpcClient->hClientPipe);
+
+	if (fd < 0)
+		return FALSE;
+
+	if (!rpcServer->Dispatcher)
+		rpcServer->Dispatcher = freerds_rpc_dispatcher_new();
+
+	if (!rpcServer->Dispatcher)
+		return FALSE;
+
+	/* use the least loaded reactor, start another one once they fill up */
+	for (index = 0; index < rpcServer->ReactorCount; index++)
+	{
+		if (!reactor || (rpcServer->Reactors[index]->clientCount < reactor->clientCount))
+			reactor = rpcServer->Reactors[index];
+	}
+
+	if ((!reactor || (reactor->clientCount >= RDS_RPC_REACTOR_CLIENTS)) &&
+			(rpcServer->ReactorCount < RDS_RPC_MAX_REACTORS))
+	{
+		rdsRpcReactor* added = freerds_rpc_reactor_new(rpcServer);
+
+		if (added)
+		{
+			rpcServer->Reactors[rpcServer->ReactorCount++] = added;
+			reactor = added;
+		}
+	}
+
+	if (!reactor)
+		return FALSE;
+
+	if (!rpcClient->OutboundStream)
+		rpcClient->OutboundStream = Stream_New(NULL, 8192);
+
+	if (!rpcClient->DispatchStream)
+		rpcClient->DispatchStream = Stream_New(NULL, 8192);
+
+	if (!rpcClient->DispatchSpare)
+		rpcClient->DispatchSpare = Stream_New(NULL, 8192);
+
+	if (!rpcClient->OutboundStream || !rpcClient->DispatchStream || !rpcClient->DispatchSpare)
+		return FALSE;
+
+	/* the last step, a connection that is not attached stays blocking */
+	flags = fcntl(fd, F_GETFL);
+
+	if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+		return FALSE;
+
+	rpcClient->fd = fd;
+	rpcClient->fdFlags = flags;
+	rpcClient->Reactor = reactor;
+	rpcClient->RefCount = 1;
+
+	InterlockedIncrement(&reactor->clientCount);
+
+	return TRUE;
+}
+
+/**
+ * Undoes an attach for a connection that could not be watched, so that
+ * a thread of its own can serve it with the pipe mode it expects.
+ */
+static void freerds_rpc_reactor_detach(rdsRpcClient* rpcClient)
+{
+	wStream* s;
+
+	EnterCriticalSection(&rpcClient->OutboundLock);
+
+	/* back to the mode the pipe was accepted with */
+	fcntl(rpcClient->fd, F_SETFL, rpcClient->fdFlags);
+
+	/* whatever ConnectionAccepted queued goes out before the thread starts */
+	s = rpcClient->OutboundStream;
+
+	if (Stream_GetPosition(s) > 0)
+	{
+		freerds_rpc_named_pipe_write(rpcClient->hClientPipe, Stream_Buffer(s), Stream_GetPosition(s));
+		Stream_SetPosition(s, 0);
+	}
+
+	InterlockedDecrement(&rpcClient->Reactor->clientCount);
+
+	rpcClient->Reactor = NULL;
+	rpcClient->WriteArmed = FALSE;
+	rpcClient->fd = -1;
+
+	LeaveCriticalSection(&rpcClient->OutboundLock);
+}
+
+static BOOL freerds_rpc_reactor_watch(rdsRpcClient* rpcClient)
+{
+	struct epoll_event event;
+
+	EnterCriticalSection(&rpcClient->OutboundLock);
+
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN | (rpcClient->WriteArmed ? EPOLLOUT : 0);
+	event.data.ptr = rpcClient;
+
+	if (epoll_ctl(rpcClient->Reactor->epollfd, EPOLL_CTL_ADD, rpcClient->fd, &event) < 0)
+	{
+		LeaveCriticalSection(&rpcClient->OutboundLock);
+		WLog_Print(g_logger, WLOG_ERROR, "failed to watch connection: %d", errno);
+		freerds_rpc_reactor_detach(rpcClient);
+		return FALSE;
+	}
+
+	LeaveCriticalSection(&rpcClient->OutboundLock);
+
+	return TRUE;
+}
+
+static void freerds_rpc_reactor_stop_all(rdsRpcServer* rpcServer)
+{
+	int index;
+
+	for (index = 0; index < rpcServer->ReactorCount; index++)
+	{
+		freerds_rpc_reactor_free(rpcServer->Reactors[index]);
+		rpcServer->Reactors[index] = NULL;
+	}
+
+	rpcServer->ReactorCount = 0;
+
+	/* after the reactors, the handlers still running hold the last references */
+	if (rpcServer->Dispatcher)
+	{
+		freerds_rpc_dispatcher_free(rpcServer->Dispatcher);
+		rpcServer->Dispatcher = NULL;
+	}
+}
+
+#else
+
+static int freerds_rpc_reactor_send_message(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length) { return -1; }
+static BOOL freerds_rpc_reactor_attach(rdsRpcServer* rpcServer, rdsRpcClient* rpcClient) { return FALSE; }
+static BOOL freerds_rpc_reactor_watch(rdsRpcClient* rpcClient) { return FALSE; }
+static void freerds_rpc_reactor_stop_all(rdsRpcServer* rpcServer) { }
+
+#endif
+
+
+
 /**
  *
  * RPC server implementation
@@ -526,6 +1320,8 @@ rdsRpcServer* freerds_rpc_server_new(const char* Endpoint)
 
 		rpcServer->ClientList = ArrayList_New(TRUE);
 
+		rpcServer->Reactors = (rdsRpcReactor**) calloc(RDS_RPC_MAX_REACTORS, sizeof(rdsRpcReactor*));
+
 		rpcServer->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 	}
 
@@ -540,6 +1336,8 @@ void freerds_rpc_server_free(rdsRpcServer* rpcServer)
 
 	ArrayList_Free(rpcServer->ClientList);
 
+	free(rpcServer->Reactors);
+
 	if (rpcServer->Endpoint)
 	{
 		free(rpcServer->Endpoint);
@@ -557,6 +1355,7 @@ void* freerds_rpc_server_thread(void* arg)
 {
 	int i;
 	int count;
+	BOOL bReactor;
 	HANDLE hClientPipe;
 	rdsRpcClient* rpcClient;
 	rdsRpcServer* rpcServer = (rdsRpcServer*) arg;
@@ -599,18 +1398,32 @@ void* freerds_rpc_server_thread(void* arg)
 
 		ArrayList_Add(rpcServer->ClientList, rpcClient);
 
-		/* Create the client thread. */
-		rpcClient->hClientThread = CreateThread(NULL, 0,
-			(LPTHREAD_START_ROUTINE) freerds_rpc_client_thread,
-			(void*) rpcClient, 0, NULL);
+		/* Hand the client to a reactor if one can take it. */
+		bReactor = freerds_rpc_reactor_attach(rpcServer, rpcClient);
 
 		/* Invoke the ConnectionAccepted callback function. */
 		if (rpcServer->ConnectionAccepted)
 		{
 			rpcServer->ConnectionAccepted(rpcClient);
 		}
+
+		/* Start serving the client, from the reactor or a thread of its own. */
+		if (bReactor)
+		{
+			bReactor = freerds_rpc_reactor_watch(rpcClient);
+		}
+
+		if (!bReactor)
+		{
+			rpcClient->hClientThread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) freerds_rpc_client_thread,
+				(void*) rpcClient, 0, NULL);
+		}
 	}
 
+	/* Reactors close their clients themselves. */
+	freerds_rpc_reactor_stop_all(rpcServer);
+
 	ArrayList_Lock(rpcServer->ClientList);
 
 	/* Signal all client threads to stop. */
@@ -26,8 +26,27 @@
 
 #include <freerds/rpc.h>
 
+#define RDS_RPC_ZONE_CHUNK_SIZE		1024
+
+/**
+ * Without an end pointer strings are copied to the heap and released
+ * by the message free function, otherwise they are borrowed from the
+ * receive buffer (or the zone) until the next decode.
+ */
+struct _RDS_RPC_UNPACK_CONTEXT
+{
+	msgpack_zone* zone;
+	BYTE* end;
+};
+typedef struct _RDS_RPC_UNPACK_CONTEXT RDS_RPC_UNPACK_CONTEXT;
+
+struct rds_rpc_decoder
+{
+	msgpack_zone zone;
+};
+
 typedef wStream* (*pRdsRpcPack)(void* data, wStream* s);
-typedef BOOL (*pRdsRpcUnpack)(void* data, const BYTE* buffer, UINT32 size);
+typedef BOOL (*pRdsRpcUnpack)(void* data, msgpack_object* root, RDS_RPC_UNPACK_CONTEXT* context);
 typedef void (*pRdsRpcFree)(void* data);
 
 struct _RDS_RPC_PACK_FUNC
@@ -57,7 +76,7 @@ BOOL msgpack_unpack_uint32(msgpack_object* obj, UINT32* d);
 BOOL msgpack_unpack_uint64(msgpack_object* obj, UINT64* d);
 
 int msgpack_pack_cstr(msgpack_packer* pk, const char* cstr);
-BOOL msgpack_unpack_cstr(msgpack_object* obj, char** cstr);
+BOOL msgpack_unpack_cstr(msgpack_object* obj, char** cstr, RDS_RPC_UNPACK_CONTEXT* context);
 
 int msgpack_pack_bool(msgpack_packer* pk, BOOL b);
 BOOL msgpack_unpack_bool(msgpack_object* obj, BOOL* b);
@@ -8,6 +8,7 @@
 
 /* Forward declare test functions. */
 int TestFreeRdsRpcMsg(int, char*[]);
+int TestFreeRdsRpcBench(int, char*[]);
 
 
 /* Create map.  */
@@ -24,6 +25,10 @@ functionMapEntry cmakeGeneratedFunctionMapEntries[] = {
     "TestFreeRdsRpcMsg",
     TestFreeRdsRpcMsg
   },
+  {
+    "TestFreeRdsRpcBench",
+    TestFreeRdsRpcBench
+  },
 
   {0,0}
 };
@@ -0,0 +1,776 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * RPC throughput and latency benchmark
+ *
+ * Starts an rdsRpcServer and a set of rdsRpcClients on a private local
+ * pipe, then for every client count and payload size measures
+ *
+ *   roundtrip: each client sends a request and waits for the reply
+ *   broadcast: the server broadcasts, latency is until the last client has it
+ *
+ * Requests are FDSAPI_LOGON_USER_REQUEST messages whose user name is
+ * padded to the payload size, so both ends go through the msgpack
+ * codecs. The defaults are small enough for a CI run, larger runs are
+ * selected on the command line, e.g.
+ *
+ *   TestFreeRdsRpc TestFreeRdsRpcBench /clients:1,16,128 /sizes:64,4096,65536 /messages:5000
+ *
+ * Allocations are reported per message, for both ends together, when
+ * the counting shim built next to the test is preloaded. ctest does that
+ * except in sanitizer builds, a manual run needs
+ *
+ *   LD_PRELOAD=libfreerds-rpc-bench-alloc.so TestFreeRdsRpc TestFreeRdsRpcBench
+ *
+ * Otherwise the column reads n/a. The test fails if a message is lost
+ * or late.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/cmdline.h>
+#include <winpr/interlocked.h>
+
+#include <freerds/rpc.h>
+
+#define BENCH_MAX_VALUES		16
+#define BENCH_REPLY_TIMEOUT		10000
+#define BENCH_CONNECT_TIMEOUT		10000
+
+/* exported by the preloaded counting shim, if any */
+typedef long (*pBenchAllocations)(void);
+static pBenchAllocations g_Allocations = NULL;
+
+struct bench_samples
+{
+	UINT64* values;
+	UINT32 count;
+	UINT32 size;
+};
+typedef struct bench_samples benchSamples;
+
+typedef struct bench_context benchContext;
+
+struct bench_client
+{
+	UINT32 index;
+	benchContext* bench;
+	rdsRpcClient* rpcClient;
+	rdsRpcDecoder* decoder;
+	wStream* s;
+
+	HANDLE hThread;
+	HANDLE hReplyEvent;
+	UINT32 expectedCallId;
+	BOOL failed;
+
+	benchSamples samples;
+};
+typedef struct bench_client benchClient;
+
+/* state of a server side connection */
+struct bench_connection
+{
+	rdsRpcDecoder* decoder;
+	wStream* s;
+};
+typedef struct bench_connection benchConnection;
+
+struct bench_context
+{
+	char endpoint[64];
+	rdsRpcServer* rpcServer;
+
+	UINT32 clientCounts[BENCH_MAX_VALUES];
+	UINT32 clientCountCount;
+	UINT32 sizes[BENCH_MAX_VALUES];
+	UINT32 sizeCount;
+	UINT32 messages;
+	UINT32 broadcasts;
+
+	char* payload;
+	UINT32 payloadSize;
+
+	UINT32 clientCount;
+	benchClient* clients;
+	LONG accepted;
+	LONG closed;
+
+	LONG broadcastPending;
+	UINT32 broadcastId;
+	HANDLE hBroadcastEvent;
+	LONG errors;
+};
+
+COMMAND_LINE_ARGUMENT_A freerds_rpc_bench_args[] =
+{
+	{ "clients", COMMAND_LINE_VALUE_REQUIRED, "<n,...>", "1,4", NULL, -1, NULL, "client counts" },
+	{ "sizes", COMMAND_LINE_VALUE_REQUIRED, "<bytes,...>", "64,4096", NULL, -1, NULL, "payload sizes" },
+	{ "messages", COMMAND_LINE_VALUE_REQUIRED, "<count>", "200", NULL, -1, NULL, "round trips per client" },
+	{ "broadcasts", COMMAND_LINE_VALUE_REQUIRED, "<count>", "100", NULL, -1, NULL, "broadcasts per run" },
+	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
+};
+
+static UINT64 bench_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static LONG bench_allocations()
+{
+	return g_Allocations ? (LONG) g_Allocations() : 0;
+}
+
+static UINT32 bench_parse_list(const char* value, UINT32* list)
+{
+	char* end;
+	UINT32 count = 0;
+
+	while (*value && (count < BENCH_MAX_VALUES))
+	{
+		list[count] = (UINT32) strtoul(value, &end, 10);
+
+		if ((end == value) || !list[count])
+			return 0;
+
+		count++;
+		value = (*end == ',') ? end + 1 : end;
+	}
+
+	return count;
+}
+
+/* packs a message behind room for its header, the stream is reused */
+static int bench_pack(wStream* s, UINT32 msgType, UINT32 callId, void* data)
+{
+	FDSAPI_MSG_HEADER header;
+
+	Stream_SetPosition(s, FDSAPI_MSG_HEADER_SIZE);
+
+	if (!freerds_rpc_msg_pack(msgType, data, s))
+		return -1;
+
+	ZeroMemory(&header, sizeof(header));
+	header.msgType = msgType;
+	header.msgSize = (UINT32) Stream_Length(s) - FDSAPI_MSG_HEADER_SIZE;
+	header.callId = callId;
+	header.status = FDSAPI_STATUS_SUCCESS;
+
+	CopyMemory(Stream_Buffer(s), &header, FDSAPI_MSG_HEADER_SIZE);
+
+	return 0;
+}
+
+static BOOL bench_unpack(rdsRpcDecoder* decoder, BYTE* buffer, UINT32 length, FDSAPI_MSG_HEADER* header, void* data)
+{
+	if (length < FDSAPI_MSG_HEADER_SIZE)
+		return FALSE;
+
+	CopyMemory(header, buffer, FDSAPI_MSG_HEADER_SIZE);
+
+	if (header->msgSize != length - FDSAPI_MSG_HEADER_SIZE)
+		return FALSE;
+
+	return freerds_rpc_msg_unpack_borrowed(decoder, header->msgType, data,
+			&buffer[FDSAPI_MSG_HEADER_SIZE], header->msgSize);
+}
+
+static void bench_fill_request(benchContext* bench, FDSAPI_LOGON_USER_REQUEST* request, UINT32 connectionId)
+{
+	ZeroMemory(request, sizeof(FDSAPI_LOGON_USER_REQUEST));
+
+	request->ConnectionId = connectionId;
+	request->User = bench->payload;
+	request->Domain = "bench";
+	request->Password = "bench";
+	request->DesktopWidth = 1024;
+	request->DesktopHeight = 768;
+	request->ColorDepth = 32;
+	request->ClientName = "bench";
+	request->ClientAddress = "127.0.0.1";
+}
+
+/* server side */
+
+static int bench_server_connection_accepted(rdsRpcClient* rpcClient)
+{
+	benchContext* bench = (benchContext*) rpcClient->RpcServer->custom;
+	benchConnection* connection = (benchConnection*) calloc(1, sizeof(benchConnection));
+
+	if (!connection)
+		return -1;
+
+	connection->decoder = freerds_rpc_decoder_new();
+	connection->s = Stream_New(NULL, 1024);
+	rpcClient->custom = connection;
+
+	InterlockedIncrement(&bench->accepted);
+
+	return 0;
+}
+
+static int bench_server_connection_closed(rdsRpcClient* rpcClient)
+{
+	benchContext* bench = (benchContext*) rpcClient->RpcServer->custom;
+	benchConnection* connection = (benchConnection*) rpcClient->custom;
+
+	if (connection)
+	{
+		freerds_rpc_decoder_free(connection->decoder);
+		Stream_Free(connection->s, TRUE);
+		free(connection);
+		rpcClient->custom = NULL;
+	}
+
+	InterlockedIncrement(&bench->closed);
+
+	return 0;
+}
+
+static int bench_server_message_received(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length)
+{
+	FDSAPI_MSG_HEADER header;
+	FDSAPI_LOGON_USER_REQUEST request;
+	FDSAPI_LOGON_USER_RESPONSE response;
+	benchContext* bench = (benchContext*) rpcClient->RpcServer->custom;
+	benchConnection* connection = (benchConnection*) rpcClient->custom;
+
+	if (!bench_unpack(connection->decoder, buffer, length, &header, &request) ||
+			(header.msgType != FDSAPI_LOGON_USER_REQUEST_ID) || (request.ConnectionId != header.callId))
+	{
+		InterlockedIncrement(&bench->errors);
+		return -1;
+	}
+
+	ZeroMemory(&response, sizeof(response));
+	response.ServiceEndpoint = "bench";
+
+	if (bench_pack(connection->s, FDSAPI_LOGON_USER_RESPONSE_ID, header.callId, &response) < 0)
+		return -1;
+
+	return freerds_rpc_client_send_message(rpcClient, Stream_Buffer(connection->s),
+			(UINT32) Stream_Length(connection->s));
+}
+
+/* client side */
+
+static int bench_client_message_received(rdsRpcClient* rpcClient, BYTE* buffer, UINT32 length)
+{
+	FDSAPI_MSG_HEADER header;
+	benchClient* client = (benchClient*) rpcClient->custom;
+	benchContext* bench = client->bench;
+
+	/* the largest of both message types */
+	union
+	{
+		FDSAPI_LOGON_USER_REQUEST request;
+		FDSAPI_LOGON_USER_RESPONSE response;
+	} msg;
+
+	if (!bench_unpack(client->decoder, buffer, length, &header, &msg))
+	{
+		InterlockedIncrement(&bench->errors);
+		return -1;
+	}
+
+	if (header.msgType == FDSAPI_LOGON_USER_RESPONSE_ID)
+	{
+		if (header.callId != client->expectedCallId)
+			InterlockedIncrement(&bench->errors);
+
+		SetEvent(client->hReplyEvent);
+	}
+	else if (header.msgType == FDSAPI_LOGON_USER_REQUEST_ID)
+	{
+		if (header.callId != bench->broadcastId)
+			InterlockedIncrement(&bench->errors);
+		else if (InterlockedDecrement(&bench->broadcastPending) == 0)
+			SetEvent(bench->hBroadcastEvent);
+	}
+
+	return 0;
+}
+
+static void* bench_client_thread(benchClient* client)
+{
+	UINT32 index;
+	UINT64 start;
+	benchContext* bench = client->bench;
+	FDSAPI_LOGON_USER_REQUEST request;
+
+	for (index = 0; index < bench->messages; index++)
+	{
+		client->expectedCallId = (client->index << 20) | (index + 1);
+
+		bench_fill_request(bench, &request, client->expectedCallId);
+
+		if (bench_pack(client->s, FDSAPI_LOGON_USER_REQUEST_ID, client->expectedCallId, &request) < 0)
+			break;
+
+		start = bench_time_ns();
+
+		if (freerds_rpc_client_send_message(client->rpcClient, Stream_Buffer(client->s),
+				(UINT32) Stream_Length(client->s)) < 0)
+			break;
+
+		if (WaitForSingleObject(client->hReplyEvent, BENCH_REPLY_TIMEOUT) != WAIT_OBJECT_0)
+			break;
+
+		client->samples.values[client->samples.count++] = bench_time_ns() - start;
+	}
+
+	if (index < bench->messages)
+		client->failed = TRUE;
+
+	return NULL;
+}
+
+/* reporting */
+
+static int bench_compare_samples(const void* a, const void* b)
+{
+	UINT64 x = *((const UINT64*) a);
+	UINT64 y = *((const UINT64*) b);
+
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double bench_percentile(benchSamples* samples, double percentile)
+{
+	UINT32 index;
+
+	if (!samples->count)
+		return 0.0;
+
+	index = (UINT32) ((percentile / 100.0) * (samples->count - 1));
+
+	return samples->values[index] / 1000.0;
+}
+
+static void bench_report(const char* mode, UINT32 clientCount, UINT32 bytes, UINT32 messages,
+		benchSamples* samples, UINT64 elapsed, LONG allocations)
+{
+	double seconds = elapsed / 1000000000.0;
+
+	qsort(samples->values, samples->count, sizeof(UINT64), bench_compare_samples);
+
+	printf("%-10s %7u %8u %9u %11.0f %9.1f %9.1f %9.1f %9.1f",
+			mode, clientCount, bytes, messages,
+			(seconds > 0) ? messages / seconds : 0.0,
+			bench_percentile(samples, 50.0), bench_percentile(samples, 90.0),
+			bench_percentile(samples, 99.0), bench_percentile(samples, 100.0));
+
+	if (g_Allocations)
+		printf(" %11.2f\n", messages ? (double) allocations / messages : 0.0);
+	else
+		printf(" %11s\n", "n/a");
+}
+
+static UINT32 bench_message_size(benchContext* bench)
+{
+	UINT32 size;
+	wStream* s = Stream_New(NULL, 1024);
+	FDSAPI_LOGON_USER_REQUEST request;
+
+	bench_fill_request(bench, &request, 1);
+	bench_pack(s, FDSAPI_LOGON_USER_REQUEST_ID, 1, &request);
+	size = (UINT32) Stream_Length(s);
+
+	Stream_Free(s, TRUE);
+
+	return size;
+}
+
+static int bench_run_roundtrip(benchContext* bench)
+{
+	UINT32 index;
+	UINT64 start;
+	UINT64 elapsed;
+	LONG allocations;
+	benchSamples samples;
+	benchClient* client;
+	int status = 0;
+
+	ZeroMemory(&samples, sizeof(samples));
+	samples.size = bench->clientCount * bench->messages;
+	samples.values = (UINT64*) calloc(samples.size, sizeof(UINT64));
+
+	if (!samples.values)
+		return -1;
+
+	allocations = bench_allocations();
+	start = bench_time_ns();
+
+	for (index = 0; index < bench->clientCount; index++)
+	{
+		client = &bench->clients[index];
+		client->samples.count = 0;
+		client->failed = FALSE;
+		client->hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) bench_client_thread, client, 0, NULL);
+	}
+
+	for (index = 0; index < bench->clientCount; index++)
+	{
+		client = &bench->clients[index];
+		WaitForSingleObject(client->hThread, INFINITE);
+		CloseHandle(client->hThread);
+		client->hThread = NULL;
+	}
+
+	elapsed = bench_time_ns() - start;
+	allocations = bench_allocations() - allocations;
+
+	for (index = 0; index < bench->clientCount; index++)
+	{
+		client = &bench->clients[index];
+
+		if (client->failed)
+			status = -1;
+
+		CopyMemory(&samples.values[samples.count], client->samples.values, client->samples.count * sizeof(UINT64));
+		samples.count += client->samples.count;
+	}
+
+	bench_report("roundtrip", bench->clientCount, bench_message_size(bench), samples.count,
+			&samples, elapsed, allocations);
+
+	free(samples.values);
+
+	if (status < 0)
+		fprintf(stderr, "roundtrip: replies missing after %d ms\n", BENCH_REPLY_TIMEOUT);
+
+	return status;
+}
+
+static int bench_run_broadcast(benchContext* bench)
+{
+	UINT32 index;
+	UINT64 start;
+	UINT64 elapsed;
+	UINT64 sent;
+	LONG allocations;
+	benchSamples samples;
+	wStream* s;
+	FDSAPI_LOGON_USER_REQUEST request;
+	int status = 0;
+
+	ZeroMemory(&samples, sizeof(samples));
+	samples.size = bench->broadcasts;
+	samples.values = (UINT64*) calloc(samples.size, sizeof(UINT64));
+	s = Stream_New(NULL, 1024);
+
+	if (!samples.values || !s)
+	{
+		free(samples.values);
+
+		if (s)
+			Stream_Free(s, TRUE);
+
+		return -1;
+	}
+
+	allocations = bench_allocations();
+	start = bench_time_ns();
+
+	for (index = 0; index < bench->broadcasts; index++)
+	{
+		bench->broadcastId = index + 1;
+		bench->broadcastPending = (LONG) bench->clientCount;
+
+		bench_fill_request(bench, &request, bench->broadcastId);
+
+		if (bench_pack(s, FDSAPI_LOGON_USER_REQUEST_ID, bench->broadcastId, &request) < 0)
+		{
+			status = -1;
+			break;
+		}
+
+		sent = bench_time_ns();
+
+		freerds_rpc_server_broadcast_message(bench->rpcServer, Stream_Buffer(s), (UINT32) Stream_Length(s));
+
+		if (WaitForSingleObject(bench->hBroadcastEvent, BENCH_REPLY_TIMEOUT) != WAIT_OBJECT_0)
+		{
+			fprintf(stderr, "broadcast: %d of %u clients missing after %d ms\n",
+					(int) bench->broadcastPending, bench->clientCount, BENCH_REPLY_TIMEOUT);
+			status = -1;
+			break;
+		}
+
+		samples.values[samples.count++] = bench_time_ns() - sent;
+	}
+
+	elapsed = bench_time_ns() - start;
+	allocations = bench_allocations() - allocations;
+
+	/* deliveries are what scales with the fan-out */
+	bench_report("broadcast", bench->clientCount, (UINT32) Stream_Length(s), samples.count * bench->clientCount,
+			&samples, elapsed, allocations);
+
+	Stream_Free(s, TRUE);
+	free(samples.values);
+
+	return status;
+}
+
+static BOOL bench_wait_for(LONG* counter, LONG value)
+{
+	UINT64 deadline = bench_time_ns() + ((UINT64) BENCH_CONNECT_TIMEOUT * 1000000);
+
+	while (InterlockedCompareExchange(counter, 0, 0) < value)
+	{
+		if (bench_time_ns() > deadline)
+			return FALSE;
+
+		Sleep(1);
+	}
+
+	return TRUE;
+}
+
+static void bench_disconnect_clients(benchContext* bench)
+{
+	UINT32 index;
+	benchClient* client;
+
+	for (index = 0; index < bench->clientCount; index++)
+	{
+		client = &bench->clients[index];
+
+		if (client->rpcClient)
+			freerds_rpc_client_free(client->rpcClient);
+
+		if (client->decoder)
+			freerds_rpc_decoder_free(client->decoder);
+
+		if (client->s)
+			Stream_Free(client->s, TRUE);
+
+		if (client->hReplyEvent)
+			CloseHandle(client->hReplyEvent);
+
+		free(client->samples.values);
+	}
+
+	free(bench->clients);
+	bench->clients = NULL;
+}
+
+static int bench_connect_clients(benchContext* bench, UINT32 clientCount)
+{
+	UINT32 index;
+	benchClient* client;
+
+	bench->clientCount = clientCount;
+	bench->clients = (benchClient*) calloc(clientCount, sizeof(benchClient));
+
+	if (!bench->clients)
+		return -1;
+
+	bench->accepted = 0;
+	bench->closed = 0;
+
+	for (index = 0; index < clientCount; index++)
+	{
+		client = &bench->clients[index];
+		client->index = index;
+		client->bench = bench;
+		client->decoder = freerds_rpc_decoder_new();
+		client->s = Stream_New(NULL, 1024);
+		client->hReplyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		client->samples.size = bench->messages;
+		client->samples.values = (UINT64*) calloc(bench->messages, sizeof(UINT64));
+		client->rpcClient = freerds_rpc_client_new(bench->endpoint);
+
+		if (!client->decoder || !client->s || !client->hReplyEvent || !client->samples.values || !client->rpcClient)
+			return -1;
+
+		client->rpcClient->custom = client;
+		client->rpcClient->MessageReceived = bench_client_message_received;
+
+		if (freerds_rpc_client_start(client->rpcClient) < 0)
+			return -1;
+	}
+
+	if (!bench_wait_for(&bench->accepted, (LONG) clientCount))
+	{
+		fprintf(stderr, "only %d of %u clients were accepted\n", (int) bench->accepted, clientCount);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_run(benchContext* bench)
+{
+	UINT32 count;
+	UINT32 size;
+	int status = 0;
+
+	printf("%-10s %7s %8s %9s %11s %9s %9s %9s %9s %11s\n",
+			"mode", "clients", "bytes", "messages", "msgs/s",
+			"p50 us", "p90 us", "p99 us", "max us", "allocs/msg");
+
+	for (count = 0; (count < bench->clientCountCount) && (status == 0); count++)
+	{
+		if (bench_connect_clients(bench, bench->clientCounts[count]) < 0)
+		{
+			fprintf(stderr, "failed to connect %u clients to %s\n", bench->clientCounts[count], bench->endpoint);
+			bench_disconnect_clients(bench);
+			return -1;
+		}
+
+		for (size = 0; (size < bench->sizeCount) && (status == 0); size++)
+		{
+			/* leave room for the header and the other fields */
+			bench->payloadSize = (bench->sizes[size] > 128) ? bench->sizes[size] - 128 : 1;
+			memset(bench->payload, 'x', bench->payloadSize);
+			bench->payload[bench->payloadSize] = '\0';
+
+			if ((bench_run_roundtrip(bench) < 0) || (bench_run_broadcast(bench) < 0))
+				status = -1;
+		}
+
+		bench_disconnect_clients(bench);
+
+		if (!bench_wait_for(&bench->closed, (LONG) bench->clientCounts[count]))
+			fprintf(stderr, "server still holds %d connections\n", (int) (bench->accepted - bench->closed));
+	}
+
+	if (bench->errors)
+	{
+		fprintf(stderr, "%d messages did not decode or arrived out of order\n", (int) bench->errors);
+		status = -1;
+	}
+
+	return status;
+}
+
+int TestFreeRdsRpcBench(int argc, char* argv[])
+{
+	int status;
+	DWORD flags;
+	UINT32 index;
+	UINT32 maxSize = 0;
+	benchContext bench;
+	COMMAND_LINE_ARGUMENT_A* arg;
+
+	ZeroMemory(&bench, sizeof(bench));
+
+	bench.clientCountCount = bench_parse_list("1,4", bench.clientCounts);
+	bench.sizeCount = bench_parse_list("64,4096", bench.sizes);
+	bench.messages = 200;
+	bench.broadcasts = 100;
+
+	flags = COMMAND_LINE_SIGIL_SLASH | COMMAND_LINE_SIGIL_DASH | COMMAND_LINE_SEPARATOR_COLON;
+
+	status = CommandLineParseArgumentsA(argc, (const char**) argv, freerds_rpc_bench_args, flags, NULL, NULL, NULL);
+
+	if (status < 0)
+		return -1;
+
+	arg = freerds_rpc_bench_args;
+
+	do
+	{
+		if (!(arg->Flags & COMMAND_LINE_VALUE_PRESENT))
+			continue;
+
+		CommandLineSwitchStart(arg)
+
+		CommandLineSwitchCase(arg, "clients")
+		{
+			bench.clientCountCount = bench_parse_list(arg->Value, bench.clientCounts);
+		}
+		CommandLineSwitchCase(arg, "sizes")
+		{
+			bench.sizeCount = bench_parse_list(arg->Value, bench.sizes);
+		}
+		CommandLineSwitchCase(arg, "messages")
+		{
+			bench.messages = (UINT32) atoi(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "broadcasts")
+		{
+			bench.broadcasts = (UINT32) atoi(arg->Value);
+		}
+		CommandLineSwitchEnd(arg)
+	}
+	while ((arg = CommandLineFindNextArgumentA(arg)) != NULL);
+
+	if (!bench.clientCountCount || !bench.sizeCount || !bench.messages || !bench.broadcasts)
+	{
+		fprintf(stderr, "usage: %s [/clients:<n,...>] [/sizes:<bytes,...>] [/messages:<count>] [/broadcasts:<count>]\n", argv[0]);
+		return -1;
+	}
+
+	for (index = 0; index < bench.sizeCount; index++)
+	{
+		if (bench.sizes[index] > maxSize)
+			maxSize = bench.sizes[index];
+	}
+
+#ifndef _WIN32
+	{
+		void* self = dlopen(NULL, RTLD_LAZY);
+
+		if (self)
+			g_Allocations = (pBenchAllocations) dlsym(self, "freerds_rpc_bench_allocations");
+	}
+#endif
+
+	/* a private endpoint, so parallel runs do not meet */
+	sprintf_s(bench.endpoint, sizeof(bench.endpoint), "RpcBench%u", (unsigned int) GetCurrentProcessId());
+
+	bench.payload = (char*) malloc(maxSize + 1);
+	bench.hBroadcastEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	bench.rpcServer = freerds_rpc_server_new(bench.endpoint);
+
+	if (!bench.payload || !bench.hBroadcastEvent || !bench.rpcServer)
+		return -1;
+
+	bench.rpcServer->custom = &bench;
+	bench.rpcServer->ConnectionAccepted = bench_server_connection_accepted;
+	bench.rpcServer->ConnectionClosed = bench_server_connection_closed;
+	bench.rpcServer->MessageReceived = bench_server_message_received;
+
+	if (freerds_rpc_server_start(bench.rpcServer) < 0)
+	{
+		fprintf(stderr, "failed to start the rpc server on %s\n", bench.endpoint);
+		return -1;
+	}
+
+	status = bench_run(&bench);
+
+	freerds_rpc_server_stop(bench.rpcServer);
+	freerds_rpc_server_free(bench.rpcServer);
+
+	CloseHandle(bench.hBroadcastEvent);
+	free(bench.payload);
+
+	return status;
+}
@@ -0,0 +1,51 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * Allocation counter for the RPC benchmark
+ *
+ * Preloaded into TestFreeRdsRpc to count malloc, calloc and realloc
+ * calls, never linked into it, so sanitizer builds keep their own
+ * allocator. The benchmark finds the counter at runtime.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static long g_Allocations = 0;
+
+long freerds_rpc_bench_allocations(void)
+{
+	return __sync_fetch_and_add(&g_Allocations, 0);
+}
+
+void* malloc(size_t size)
+{
+	__sync_fetch_and_add(&g_Allocations, 1);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	__sync_fetch_and_add(&g_Allocations, 1);
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	__sync_fetch_and_add(&g_Allocations, 1);
+	return __libc_realloc(ptr, size);
+}
@@ -86,11 +86,151 @@ int test_rpc_msg2()
 	return 0;
 }
 
+int test_rpc_msg3()
+{
+	int pass;
+	wStream* s;
+	UINT32 msgType;
+	rdsRpcDecoder* decoder;
+	FDSAPI_LOGON_USER_REQUEST request;
+
+	msgType = FDSAPI_LOGON_USER_REQUEST_ID;
+
+	decoder = freerds_rpc_decoder_new();
+
+	if (!decoder)
+		return 1;
+
+	/* the decoder is reused, strings are borrowed from the buffer */
+	for (pass = 0; pass < 2; pass++)
+	{
+		ZeroMemory(&request, sizeof(request));
+
+		request.ConnectionId = 321;
+		request.User = "User";
+		request.Domain = "Domain";
+		request.Password = "Password";
+		request.ClientName = "ClientName";
+		request.ClientAddress = "ClientAddress";
+		request.ClientProtocolType = 1;
+
+		s = freerds_rpc_msg_pack(msgType, &request, NULL);
+
+		if (!s)
+			return 1;
+
+		ZeroMemory(&request, sizeof(request));
+
+		if (!freerds_rpc_msg_unpack_borrowed(decoder, msgType, &request, Stream_Buffer(s), Stream_Length(s)))
+			return 1;
+
+		if ((request.ConnectionId != 321) || (request.ClientProtocolType != 1))
+			return 1;
+
+		if (strcmp(request.User, "User") || strcmp(request.Domain, "Domain") ||
+				strcmp(request.Password, "Password") || strcmp(request.ClientName, "ClientName") ||
+				strcmp(request.ClientAddress, "ClientAddress"))
+			return 1;
+
+		if (((BYTE*) request.User < Stream_Buffer(s)) ||
+				((BYTE*) request.User >= Stream_Buffer(s) + Stream_Length(s)))
+			return 1;
+
+		Stream_Free(s, TRUE);
+	}
+
+	freerds_rpc_decoder_free(decoder);
+
+	return 0;
+}
+
+int test_rpc_msg4()
+{
+	int pass;
+	UINT32 index;
+	wStream* s;
+	UINT32 msgType;
+	FDSAPI_LOGON_USER_REQUEST request;
+
+	msgType = FDSAPI_LOGON_USER_REQUEST_ID;
+
+	/* a truncated message, then one whose DesktopWidth is a string */
+	for (pass = 0; pass < 2; pass++)
+	{
+		ZeroMemory(&request, sizeof(request));
+
+		request.ConnectionId = 321;
+		request.User = "User";
+		request.Domain = "Domain";
+		request.Password = "Password";
+		request.DesktopWidth = 1024;
+		request.DesktopHeight = 768;
+		request.ClientName = "ClientName";
+		request.ClientAddress = "ClientAddress";
+
+		s = freerds_rpc_msg_pack(msgType, &request, NULL);
+
+		if (!s)
+			return 1;
+
+		if (pass == 0)
+		{
+			Stream_SetLength(s, Stream_Length(s) - 8);
+		}
+		else
+		{
+			/* uint16 1024 followed by uint16 768, retyped as a 2 byte string */
+			for (index = 0; index + 6 <= Stream_Length(s); index++)
+			{
+				BYTE* p = &Stream_Buffer(s)[index];
+
+				if ((p[0] == 0xCD) && (p[1] == 0x04) && (p[2] == 0x00) &&
+						(p[3] == 0xCD) && (p[4] == 0x03) && (p[5] == 0x00))
+				{
+					p[0] = 0xA2;
+					break;
+				}
+			}
+
+			if (index + 6 > Stream_Length(s))
+				return 1;
+		}
+
+		ZeroMemory(&request, sizeof(request));
+
+		if (freerds_rpc_msg_unpack(msgType, &request, Stream_Buffer(s), Stream_Length(s)))
+			return 1;
+
+		if (request.User || request.Domain || request.Password ||
+				request.ClientName || request.ClientAddress)
+			return 1;
+
+		/* what callers do regardless of the result */
+		freerds_rpc_msg_free(msgType, &request);
+
+		Stream_Free(s, TRUE);
+	}
+
+	return 0;
+}
+
 int TestFreeRdsRpcMsg(int argc, char* argv[])
 {
 	test_rpc_msg1();
 	test_rpc_msg2();
 
+	if (test_rpc_msg3() != 0)
+	{
+		fprintf(stderr, "borrowed decoding failed\n");
+		return -1;
+	}
+
+	if (test_rpc_msg4() != 0)
+	{
+		fprintf(stderr, "decoding a broken message left freed strings behind\n");
+		return -1;
+	}
+
 	return 0;
 }
 
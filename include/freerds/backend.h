@@ -36,6 +36,8 @@ typedef struct rds_backend_service rdsBackendService;
 
 typedef struct rds_connection rdsConnection;
 
+typedef struct rds_message_pool rdsMessagePool;
+
 /* Common Data Types */
 
 #define RDS_MSG_FLAG_RECT		0x00000001
@@ -784,6 +786,15 @@ FREERDS_EXPORT int freerds_server_message_write(wStream* s, RDS_MSG_COMMON* msg)
 FREERDS_EXPORT void* freerds_server_message_copy(RDS_MSG_COMMON* msg);
 FREERDS_EXPORT void freerds_server_message_free(RDS_MSG_COMMON* msg);
 
+FREERDS_EXPORT rdsMessagePool* freerds_message_pool_new(void);
+FREERDS_EXPORT void freerds_message_pool_free(rdsMessagePool* pool);
+
+FREERDS_EXPORT void* freerds_message_pool_take_buffer(rdsMessagePool* pool, UINT32 size);
+FREERDS_EXPORT void freerds_message_pool_return_buffer(rdsMessagePool* pool, void* buffer);
+
+FREERDS_EXPORT void* freerds_server_message_pool_copy(rdsMessagePool* pool, RDS_MSG_COMMON* msg);
+FREERDS_EXPORT void freerds_server_message_pool_release(rdsMessagePool* pool, RDS_MSG_COMMON* msg);
+
 FREERDS_EXPORT rdsClientInterface* freerds_client_outbound_interface_new(void);
 FREERDS_EXPORT rdsServerInterface* freerds_server_outbound_interface_new(void);
 
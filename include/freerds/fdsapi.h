@@ -35,6 +35,63 @@ extern "C" {
 FREERDS_EXPORT int WINAPI FreeRDS_AuthenticateUser(UINT32 SessionId,
 	LPCSTR Username, LPCSTR Password, LPCSTR Domain);
 
+/**
+ * Only deliver the events of one session (or WTS_CURRENT_SESSION) to
+ * WTSWaitSystemEvent and WTSRegisterSessionNotification in this process.
+ */
+FREERDS_EXPORT BOOL WINAPI FreeRDS_WTSFilterSessionEvents(DWORD SessionId);
+
+/**
+ * Asynchronous WTSQuerySessionInformation. The completion runs on an
+ * internal FDSAPI thread, must not block, and owns pBuffer (release
+ * it with WTSFreeMemory). dwError is ERROR_TIMEOUT if no answer came
+ * within dwTimeout milliseconds (0 picks the default) and
+ * RPC_S_SERVER_UNAVAILABLE if the connection to the server dropped.
+ */
+typedef VOID (WINAPI *PFREERDS_WTS_QUERY_COMPLETION)(PVOID Context, DWORD SessionId,
+	WTS_INFO_CLASS WTSInfoClass, DWORD dwError, LPSTR pBuffer, DWORD BytesReturned);
+
+FREERDS_EXPORT BOOL WINAPI FreeRDS_WTSQuerySessionInformationAsyncA(DWORD SessionId,
+	WTS_INFO_CLASS WTSInfoClass, DWORD dwTimeout, PFREERDS_WTS_QUERY_COMPLETION Completion, PVOID Context);
+
+/**
+ * The largest message a virtual channel carries. Writes above it fail
+ * with ERROR_INVALID_PARAMETER.
+ */
+#define FREERDS_CHANNEL_MAX_FRAME_SIZE		0x1000000
+
+/**
+ * Vectored WTSVirtualChannelWrite, the buffers are sent as one message.
+ */
+typedef struct _FREERDS_WTS_BUFFER
+{
+	PCHAR Buffer;
+	ULONG Length;
+} FREERDS_WTS_BUFFER, *PFREERDS_WTS_BUFFER;
+
+FREERDS_EXPORT BOOL WINAPI FreeRDS_WTSVirtualChannelWriteV(HANDLE hChannelHandle,
+	const FREERDS_WTS_BUFFER* pBuffers, ULONG BufferCount, PULONG pBytesWritten);
+
+/**
+ * Combine subsequent writes to a channel until MaxBytes are pending or
+ * the oldest pending byte is MaxDelay milliseconds old (0 picks the
+ * default). Combined writes reach the client as a single message, so
+ * only enable this for protocols which delimit their own messages.
+ * MaxBytes 0 turns combining off again. FreeRDS_WTSVirtualChannelFlush
+ * sends whatever is pending right away.
+ *
+ * While combining, *pBytesWritten counts bytes that may only have been
+ * buffered. A flush that fails later, including one done in the
+ * background, is not reported by the write that queued the bytes: the
+ * next write or FreeRDS_WTSVirtualChannelFlush on the channel fails with
+ * ERROR_BROKEN_PIPE instead, and the pending bytes are lost. Call
+ * FreeRDS_WTSVirtualChannelFlush where delivery has to be confirmed.
+ */
+FREERDS_EXPORT BOOL WINAPI FreeRDS_WTSVirtualChannelSetWriteCombining(HANDLE hChannelHandle,
+	ULONG MaxBytes, ULONG MaxDelay);
+
+FREERDS_EXPORT BOOL WINAPI FreeRDS_WTSVirtualChannelFlush(HANDLE hChannelHandle);
+
 #ifdef __cplusplus
 }
 #endif
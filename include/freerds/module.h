@@ -28,6 +28,8 @@
 typedef struct rds_module_entry_points_v1 RDS_MODULE_ENTRY_POINTS_V1;
 typedef RDS_MODULE_ENTRY_POINTS_V1 RDS_MODULE_ENTRY_POINTS;
 
+#define RDS_MODULE_MAX_PROCESSES	4
+
 struct _RDS_MODULE_COMMON
 {
 	WORD sessionId;
@@ -41,6 +43,23 @@ struct _RDS_MODULE_COMMON
 };
 typedef struct _RDS_MODULE_COMMON RDS_MODULE_COMMON;
 
+/**
+ * What a module needs to find a running session again after
+ * the session manager has been restarted. The instance is module
+ * specific, the X11 module stores the display number in it.
+ * Start times tell a process apart from a later one that reuses
+ * its pid, on Linux they are the starttime field of /proc/<pid>/stat.
+ */
+
+struct _RDS_MODULE_STATE
+{
+	UINT32 instance;
+	UINT32 processCount;
+	DWORD processIds[RDS_MODULE_MAX_PROCESSES];
+	UINT64 processStartTimes[RDS_MODULE_MAX_PROCESSES];
+};
+typedef struct _RDS_MODULE_STATE RDS_MODULE_STATE;
+
 struct _RDS_MODULE_CONFIG_CALLBACKS
 {
 	pgetPropertyBool getPropertyBool;
@@ -67,6 +86,11 @@ typedef void (*pRdsModuleFree)(RDS_MODULE_COMMON* module);
 typedef char* (*pRdsModuleStart)(RDS_MODULE_COMMON* module);
 typedef int (*pRdsModuleStop)(RDS_MODULE_COMMON* module);
 
+typedef int (*pRdsModuleGetState)(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state);
+typedef char* (*pRdsModuleAdopt)(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state);
+
+typedef void (*pRdsModuleExit)();
+
 struct rds_module_entry_points_v1
 {
 	DWORD Version;
@@ -80,6 +104,13 @@ struct rds_module_entry_points_v1
 
 	RDS_MODULE_CONFIG_CALLBACKS config;
 	RDS_MODULE_STATUS_CALLBACKS status;
+
+	/* optional, modules without them lose their sessions on a manager restart */
+	pRdsModuleGetState GetState;
+	pRdsModuleAdopt Adopt;
+
+	/* optional, called once before the manager exits */
+	pRdsModuleExit Exit;
 };
 
 #define RDS_MODULE_INTERFACE_VERSION	1
@@ -51,6 +51,13 @@ struct _FDSAPI_MSG_PACKET
 };
 typedef struct _FDSAPI_MSG_PACKET FDSAPI_MSG_PACKET;
 
+/**
+ * Virtual channel endpoints are announced with ChannelPort 0 when
+ * they listen on this local socket instead of a loopback TCP port
+ */
+
+#define FREERDS_CHANNEL_PIPE_NAME	"\\\\.\\pipe\\FreeRDS_Channels"
+
 /* RPC Status Code Definitions */
 
 #define FDSAPI_STATUS_SUCCESS		0
@@ -233,6 +240,9 @@ extern "C" {
 
 typedef struct rds_rpc_server rdsRpcServer;
 typedef struct rds_rpc_client rdsRpcClient;
+typedef struct rds_rpc_decoder rdsRpcDecoder;
+typedef struct rds_rpc_reactor rdsRpcReactor;
+typedef struct rds_rpc_dispatcher rdsRpcDispatcher;
 
 typedef int (*pRdsRpcConnectionAccepted)(rdsRpcClient* rpcClient);
 typedef int (*pRdsRpcConnectionClosed)(rdsRpcClient* rpcClient);
@@ -251,6 +261,10 @@ struct rds_rpc_server
 	pRdsRpcConnectionAccepted ConnectionAccepted;
 	pRdsRpcConnectionClosed ConnectionClosed;
 	pRdsRpcMessageReceived MessageReceived;
+
+	int ReactorCount;
+	rdsRpcReactor** Reactors;
+	rdsRpcDispatcher* Dispatcher;
 };
 
 struct rds_rpc_client
@@ -268,6 +282,22 @@ struct rds_rpc_client
 
 	pRdsRpcConnectionClosed ConnectionClosed;
 	pRdsRpcMessageReceived MessageReceived;
+
+	/* set for server side clients served by a reactor */
+	rdsRpcReactor* Reactor;
+	int fd;
+	int fdFlags;
+	BOOL WriteArmed;
+	BOOL Closed;
+	wStream* OutboundStream;
+	CRITICAL_SECTION OutboundLock;
+
+	/* complete messages waiting for a dispatch worker */
+	LONG RefCount;
+	BOOL DispatchQueued;
+	wStream* DispatchStream;
+	wStream* DispatchSpare;
+	CRITICAL_SECTION DispatchLock;
 };
 
 FREERDS_EXPORT rdsRpcServer* freerds_rpc_server_new(const char* Endpoint);
@@ -291,6 +321,19 @@ FREERDS_EXPORT wStream* freerds_rpc_msg_pack(UINT32 type, void* data, wStream* s
 FREERDS_EXPORT BOOL freerds_rpc_msg_unpack(UINT32 type, void* data, const BYTE* buffer, UINT32 size);
 FREERDS_EXPORT void freerds_rpc_msg_free(UINT32 type, void* data);
 
+/**
+ * Decodes without copying strings to the heap. They point into buffer,
+ * which is modified in place and cannot be decoded a second time, or
+ * into the decoder. They stay valid until the buffer is released or the
+ * decoder decodes the next message. Do not call freerds_rpc_msg_free on
+ * such a message.
+ */
+FREERDS_EXPORT rdsRpcDecoder* freerds_rpc_decoder_new(void);
+FREERDS_EXPORT void freerds_rpc_decoder_free(rdsRpcDecoder* decoder);
+
+FREERDS_EXPORT BOOL freerds_rpc_msg_unpack_borrowed(rdsRpcDecoder* decoder, UINT32 type, void* data,
+		BYTE* buffer, UINT32 size);
+
 #ifdef __cplusplus
 }
 #endif
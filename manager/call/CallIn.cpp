@@ -28,6 +28,7 @@
 namespace freerds
 {
 	CallIn::CallIn()
+	: mDecoder(0), mRequestBuffer(0), mRequestLength(0)
 	{
 
 	};
@@ -37,9 +38,16 @@ namespace freerds
 
 	};
 
-	void CallIn::setEncodedRequest(std::string encodedRequest)
+	void CallIn::setRequestBuffer(rdsRpcDecoder* decoder, BYTE* buffer, UINT32 length)
 	{
-		mEncodedRequest = encodedRequest;
+		mDecoder = decoder;
+		mRequestBuffer = buffer;
+		mRequestLength = length;
+	}
+
+	BOOL CallIn::unpackRequest(UINT32 type, void* data)
+	{
+		return freerds_rpc_msg_unpack_borrowed(mDecoder, type, data, mRequestBuffer, mRequestLength);
 	}
 
 	std::string CallIn::getEncodedResponse()
@@ -51,4 +59,14 @@ namespace freerds
 	{
 		return 1;
 	}
+
+	bool CallIn::isBlocking()
+	{
+		return true;
+	}
+
+	bool CallIn::getOrderingKey(UINT32* key)
+	{
+		return false;
+	}
 }
@@ -22,6 +22,8 @@
 
 #include <call/Call.h>
 
+#include <freerds/rpc.h>
+
 namespace freerds
 {
 	class CallIn: public Call
@@ -31,13 +33,29 @@ namespace freerds
 		virtual ~CallIn();
 		virtual unsigned long getDerivedType();
 
-		void setEncodedRequest(std::string encodedRequest);
+		void setRequestBuffer(rdsRpcDecoder* decoder, BYTE* buffer, UINT32 length);
 		virtual int decodeRequest() = 0;
 
 		virtual int encodeResponse() = 0;
 		std::string getEncodedResponse();
 
 		virtual int doStuff() = 0;
+
+		virtual bool isBlocking();
+		virtual bool getOrderingKey(UINT32* key);
+
+	protected:
+		/**
+		 * decodeRequest runs on the engine thread, strings of the unpacked
+		 * message point into the engine's receive buffer and are only valid
+		 * until decodeRequest returns.
+		 */
+		BOOL unpackRequest(UINT32 type, void* data);
+
+	private:
+		rdsRpcDecoder* mDecoder;
+		BYTE* mRequestBuffer;
+		UINT32 mRequestLength;
 	};
 }
 
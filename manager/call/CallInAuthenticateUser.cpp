@@ -49,21 +49,13 @@ namespace freerds
 
 	int CallInAuthenticateUser::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mSessionId = m_Request.SessionId;
 		mUserName = m_Request.User ? m_Request.User : "";
 		mDomainName = m_Request.Domain ? m_Request.Domain : "";
 		mPassword = m_Request.Password ? m_Request.Password : "";
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInAuthenticateUser, WLOG_DEBUG,
 			"request: sessionId=%lu, userName=%s, domainName=%s",
 			mSessionId, mUserName.c_str(), mDomainName.c_str());
@@ -115,8 +107,9 @@ namespace freerds
 	{
 		SessionPtr currentSession;
 		bool reconnectAllowed;
+		PropertySetPtr properties = APP_CONTEXT.getPropertyManager()->resolveProperties(mUserName);
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyBool("session.reconnect", reconnectAllowed)) {
+		if (!properties->getPropertyBool(PROPERTY_KEY_SESSION_RECONNECT, reconnectAllowed)) {
 			reconnectAllowed = true;
 		}
 
@@ -142,6 +135,7 @@ namespace freerds
 
 			currentSession->setUserName(mUserName);
 			currentSession->setDomain(mDomainName);
+			currentSession->setProperties(properties);
 
 			if (!currentSession->generateUserToken())
 			{
@@ -162,7 +156,7 @@ namespace freerds
 			}
 			std::string moduleConfigName;
 
-			if (!APP_CONTEXT.getPropertyManager()->getPropertyString("module", moduleConfigName)) {
+			if (!properties->getPropertyString(PROPERTY_KEY_MODULE, moduleConfigName)) {
 				moduleConfigName = "X11";
 			}
 			currentSession->setModuleConfigName(moduleConfigName);
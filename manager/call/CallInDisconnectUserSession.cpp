@@ -49,18 +49,10 @@ namespace freerds
 
 	int CallInDisconnectUserSession::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mConnectionId = m_Request.ConnectionId;
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInDisconnectUserSession, WLOG_DEBUG,
 			"request: connectionId=%lu", mConnectionId);
 
@@ -117,7 +109,7 @@ namespace freerds
 
 		long timeout;
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("session.timeout", &timeout)) {
+		if (!currentSession->getProperties()->getPropertyNumber(PROPERTY_KEY_SESSION_TIMEOUT, &timeout)) {
 			timeout = 0;
 		}
 
@@ -135,4 +127,10 @@ namespace freerds
 
 		return 0;
 	}
+
+	bool CallInDisconnectUserSession::getOrderingKey(UINT32* key)
+	{
+		*key = (UINT32) mConnectionId;
+		return true;
+	}
 }
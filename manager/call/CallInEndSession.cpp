@@ -49,18 +49,10 @@ namespace freerds
 
 	int CallInEndSession::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mSessionId = m_Request.SessionId;
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInEndSession, WLOG_DEBUG,
 			"request: sessionId=%lu", mSessionId);
 
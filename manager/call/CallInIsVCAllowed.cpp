@@ -48,18 +48,10 @@ namespace freerds
 
 	int CallInIsVCAllowed::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mVirtualChannelName = m_Request.ChannelName ? m_Request.ChannelName : "";
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInIsVCAllowed, WLOG_DEBUG,
 			"request: virtualChannelName=%s",
 			mVirtualChannelName.c_str());
@@ -92,5 +84,9 @@ namespace freerds
 
 		return 0;
 	}
-}
 
+	bool CallInIsVCAllowed::isBlocking()
+	{
+		return false;
+	}
+}
@@ -48,18 +48,10 @@ namespace freerds
 
 	int CallInLogOffUserSession::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mConnectionId = m_Request.ConnectionId;
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInLogOffUserSession, WLOG_DEBUG,
 			"request: connectionId=%lu", mConnectionId);
 
@@ -119,4 +111,10 @@ namespace freerds
 
 		return 0;
 	}
+
+	bool CallInLogOffUserSession::getOrderingKey(UINT32* key)
+	{
+		*key = (UINT32) mConnectionId;
+		return true;
+	}
 }
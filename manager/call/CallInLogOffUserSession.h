@@ -37,6 +37,7 @@ namespace freerds
 		virtual int decodeRequest();
 		virtual int encodeResponse();
 		virtual int doStuff();
+		virtual bool getOrderingKey(UINT32* key);
 
 	private:
 		long mConnectionId;
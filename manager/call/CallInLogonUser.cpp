@@ -50,13 +50,7 @@ namespace freerds
 
 	int CallInLogonUser::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
+		unpackRequest(m_RequestId, &m_Request);
 
 		mConnectionId = m_Request.ConnectionId;
 		mUserName = m_Request.User ? m_Request.User : "";
@@ -72,8 +66,6 @@ namespace freerds
 		mClientHardwareId = m_Request.ClientHardwareId;
 		mClientProtocolType = m_Request.ClientProtocolType;
 
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
-
 		WLog_Print(logger_CallInLogonUser, WLOG_DEBUG,
 			"request: connectionId=%lu, userName=%s, domainName=%s, width=%ld, height=%ld, colorDepth=%ld, "
 			"clientName=%s, clientAddress=%s, clientBuildNumber=%ld, clientProductId=%ld, clientHardwareId=%ld, "
@@ -128,14 +120,15 @@ namespace freerds
 		bool reconnectAllowed;
 		SessionPtr currentSession;
 		ConnectionPtr currentConnection = APP_CONTEXT.getConnectionStore()->getOrCreateConnection(mConnectionId);
+		PropertySetPtr properties = APP_CONTEXT.getPropertyManager()->resolveProperties(mUserName);
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyBool("session.reconnect", reconnectAllowed)) {
+		if (!properties->getPropertyBool(PROPERTY_KEY_SESSION_RECONNECT, reconnectAllowed)) {
 			reconnectAllowed = true;
 		}
 
 		if (reconnectAllowed)
 		{
-			currentSession = APP_CONTEXT.getSessionStore()->getFirstDisconnectedSessionUserName(mUserName, mDomainName);
+			currentSession = APP_CONTEXT.getSessionStore()->claimDisconnectedSessionUserName(mUserName, mDomainName);
 			if (currentSession)
 			{
 				WLog_Print(logger_CallInLogonUser, WLOG_DEBUG,
@@ -144,7 +137,7 @@ namespace freerds
 			}
 		}
 
-		if (currentSession && (currentSession->getConnectState() == WTSDisconnected))
+		if (currentSession)
 		{
 			// reconnect to a disconnected session
 			WLog_Print(logger_CallInLogonUser, WLOG_DEBUG,
@@ -172,6 +165,7 @@ namespace freerds
 
 			currentSession->setUserName(mUserName);
 			currentSession->setDomain(mDomainName);
+			currentSession->setProperties(properties);
 			currentSession->setClientDisplayWidth(mWidth);
 			currentSession->setClientDisplayHeight(mHeight);
 			currentSession->setClientDisplayColorDepth(mColorDepth);
@@ -205,7 +199,7 @@ namespace freerds
 			}
 			std::string moduleConfigName;
 
-			if (!APP_CONTEXT.getPropertyManager()->getPropertyString("module", moduleConfigName)) {
+			if (!properties->getPropertyString(PROPERTY_KEY_MODULE, moduleConfigName)) {
 				moduleConfigName = "X11";
 			}
 			currentSession->setModuleConfigName(moduleConfigName);
@@ -242,13 +236,27 @@ namespace freerds
 	{
 		// authentication failed, start up greeter module
 		ConnectionPtr currentConnection = APP_CONTEXT.getConnectionStore()->getOrCreateConnection(mConnectionId);
-		SessionPtr currentSession = APP_CONTEXT.getSessionStore()->createSession();
 
 		std::string greeter;
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyString("auth.greeter", greeter)) {
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyString(PROPERTY_KEY_AUTH_GREETER, greeter)) {
 			greeter = "Qt";
 		}
+
+		SessionPtr currentSession = APP_CONTEXT.claimPrelaunchedGreeter(greeter);
+		bool prelaunched = (currentSession.get() != NULL);
+
+		if (prelaunched)
+		{
+			WLog_Print(logger_CallInLogonUser, WLOG_DEBUG,
+				"using prelaunched greeter session - sessionId=%lu",
+				currentSession->getSessionId());
+		}
+		else
+		{
+			currentSession = APP_CONTEXT.getSessionStore()->createSession();
+		}
+
 		currentSession->setModuleConfigName(greeter);
 
 		currentSession->setUserName(mUserName);
@@ -267,7 +275,7 @@ namespace freerds
 		sprintf(winStationName, "RDP-Tcp#%d", mConnectionId);
 		currentSession->setWinStationName(winStationName);
 
-		if (!currentSession->generateAuthEnvBlockAndModify())
+		if (!prelaunched && !currentSession->generateAuthEnvBlockAndModify())
 		{
 			WLog_Print(logger_CallInLogonUser, WLOG_ERROR,
 				"generateEnvBlockAndModify failed for user %s with domain %s",
@@ -284,7 +292,7 @@ namespace freerds
 
 		currentSession->setAuthSession(true);
 
-		if (!currentSession->startModule(greeter))
+		if (!prelaunched && !currentSession->startModule(greeter))
 		{
 			WLog_Print(logger_CallInLogonUser, WLOG_ERROR, "could not start greeter");
 			mResult = 1;// will report error with answer
@@ -310,4 +318,10 @@ namespace freerds
 
 		return 0;
 	}
+
+	bool CallInLogonUser::getOrderingKey(UINT32* key)
+	{
+		*key = (UINT32) mConnectionId;
+		return true;
+	}
 }
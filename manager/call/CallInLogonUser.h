@@ -39,6 +39,7 @@ namespace freerds
 		virtual int decodeRequest();
 		virtual int encodeResponse();
 		virtual int doStuff();
+		virtual bool getOrderingKey(UINT32* key);
 
 	private:
 
@@ -48,15 +48,7 @@ namespace freerds
 
 	int CallInPing::decodeRequest()
 	{
-		BYTE* buffer;
-		UINT32 length;
-
-		buffer = (BYTE*) mEncodedRequest.data();
-		length = (UINT32) mEncodedRequest.size();
-
-		freerds_rpc_msg_unpack(m_RequestId, &m_Request, buffer, length);
-
-		freerds_rpc_msg_free(m_RequestId, &m_Request);
+		unpackRequest(m_RequestId, &m_Request);
 
 		WLog_Print(logger_CallInPing, WLOG_DEBUG,
 			"request: heartbeatId=%lu",
@@ -88,4 +80,9 @@ namespace freerds
 	{
 		return 0;
 	}
+
+	bool CallInPing::isBlocking()
+	{
+		return false;
+	}
 }
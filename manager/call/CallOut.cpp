@@ -25,10 +25,11 @@
 
 #include <string>
 #include <winpr/handle.h>
+#include <winpr/interlocked.h>
 
 namespace freerds
 {
-	CallOut::CallOut():mAnswer(NULL)
+	CallOut::CallOut():mAnswer(NULL), mRefCount(1)
 	{
 		initAnswerHandle();
 	};
@@ -80,5 +81,16 @@ namespace freerds
 	{
 		mErrorDescription = error;
 	}
+
+	void CallOut::addRef()
+	{
+		InterlockedIncrement(&mRefCount);
+	}
+
+	void CallOut::release()
+	{
+		if (InterlockedDecrement(&mRefCount) == 0)
+			delete this;
+	}
 }
 
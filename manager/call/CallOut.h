@@ -23,8 +23,19 @@
 #include <call/Call.h>
 #include <winpr/synch.h>
 
+#define CALLOUT_RESULT_SUCCESS		0
+#define CALLOUT_RESULT_FAILED		1
+#define CALLOUT_RESULT_NOTFOUND		2
+#define CALLOUT_RESULT_TIMEOUT		3
+
 namespace freerds
 {
+	/**
+	 * Outgoing calls are reference counted. The creator holds the first
+	 * reference and takes another one for the rpc engine before queueing
+	 * the call, the engine drops it once the call has its result. A caller
+	 * that stops waiting early therefore only drops its own reference.
+	 */
 	class CallOut: public Call
 	{
 	public:
@@ -45,8 +56,12 @@ namespace freerds
 		void setResult(uint32_t result);
 		void setErrorDescription(std::string error);
 
+		void addRef();
+		void release();
+
 	private:
 		HANDLE mAnswer;
+		LONG mRefCount;
 	};
 }
 
@@ -26,12 +26,16 @@
 #include <winpr/wlog.h>
 #include <winpr/pipe.h>
 #include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include <call/CallIn.h>
 #include <call/CallFactory.h>
 
 #include <session/ApplicationContext.h>
 
+#include <utils/CSGuard.h>
+
 #define CLIENT_DISCONNECTED	2
 #define CLIENT_ERROR		-1
 #define CLIENT_SUCCESS		0
@@ -42,15 +46,26 @@ namespace freerds
 
 	RpcEngine::RpcEngine()
 	: m_PacketLength(0), m_HeaderRead(0), m_PayloadRead(0), m_NextOutCall(1),
-	  m_hClientPipe(0), m_hServerPipe(0), m_hServerThread(0)
+	  m_hClientPipe(0), m_hServerPipe(0), m_hServerThread(0),
+	  m_Generation(0), m_WorkerCount(0),
+	  m_WheelTick(0), m_OutstandingCallOuts(0), m_ExpiredCallOuts(0)
 	{
 		m_HeaderBuffer = (BYTE*) &m_Header;
+		m_Decoder = freerds_rpc_decoder_new();
 		m_hStopEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
+		m_hWorkSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+
+		if (!InitializeCriticalSectionAndSpinCount(&m_WorkCSection, 0x00000400))
+		{
+			WLog_Print(logger_RPCEngine, WLOG_FATAL, "cannot init RpcEngine critical section!");
+		}
 	}
 
 	RpcEngine::~RpcEngine()
 	{
-
+		freerds_rpc_decoder_free(m_Decoder);
+		CloseHandle(m_hWorkSemaphore);
+		DeleteCriticalSection(&m_WorkCSection);
 	}
 
 	HANDLE RpcEngine::createServerPipe(const char* endpoint)
@@ -94,9 +109,216 @@ namespace freerds
 			m_hServerThread = NULL;
 		}
 
+		failPendingCalls();
+		failQueuedCalls();
+		stopWorkers();
+
 		return CLIENT_SUCCESS;
 	}
 
+	int RpcEngine::startWorkers()
+	{
+		long workerCount;
+
+		if (m_WorkerCount)
+			return CLIENT_SUCCESS;
+
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("rpc.workers", &workerCount))
+			workerCount = RPC_ENGINE_DEFAULT_WORKERS;
+
+		if (workerCount < 1)
+			workerCount = 1;
+
+		if (workerCount > RPC_ENGINE_MAX_WORKERS)
+			workerCount = RPC_ENGINE_MAX_WORKERS;
+
+		while (m_WorkerCount < (DWORD) workerCount)
+		{
+			HANDLE hThread = CreateThread(NULL, 0,
+					(LPTHREAD_START_ROUTINE) RpcEngine::workerThread, (void*) this,
+					0, NULL);
+
+			if (!hThread)
+				break;
+
+			m_hWorkerThreads[m_WorkerCount++] = hThread;
+		}
+
+		if (!m_WorkerCount)
+		{
+			WLog_Print(logger_RPCEngine, WLOG_ERROR, "could not start any call worker");
+			return CLIENT_ERROR;
+		}
+
+		WLog_Print(logger_RPCEngine, WLOG_DEBUG, "started %d call workers", m_WorkerCount);
+
+		return CLIENT_SUCCESS;
+	}
+
+	void RpcEngine::stopWorkers()
+	{
+		DWORD index;
+		RpcWorkItem* item;
+		TOrderedCallMap::iterator it;
+		std::list<RpcWorkItem*>::iterator itItem;
+
+		for (index = 0; index < m_WorkerCount; index++)
+		{
+			WaitForSingleObject(m_hWorkerThreads[index], INFINITE);
+			CloseHandle(m_hWorkerThreads[index]);
+		}
+
+		m_WorkerCount = 0;
+
+		for (itItem = m_WorkQueue.begin(); itItem != m_WorkQueue.end(); itItem++)
+		{
+			delete (*itItem)->callIn;
+			delete (*itItem);
+		}
+
+		m_WorkQueue.clear();
+
+		for (it = m_OrderedCalls.begin(); it != m_OrderedCalls.end(); it++)
+		{
+			for (itItem = it->second.begin(); itItem != it->second.end(); itItem++)
+			{
+				delete (*itItem)->callIn;
+				delete (*itItem);
+			}
+		}
+
+		m_OrderedCalls.clear();
+
+		m_CompletedCalls.lockQueue();
+
+		while ((item = m_CompletedCalls.getElementLockFree()))
+		{
+			delete item->callIn;
+			delete item;
+		}
+
+		m_CompletedCalls.unlockQueue();
+	}
+
+	void* RpcEngine::workerThread(void* arg)
+	{
+		DWORD status;
+		HANDLE events[2];
+		RpcWorkItem* item;
+		RpcEngine* engine = (RpcEngine*) arg;
+
+		events[0] = engine->m_hStopEvent;
+		events[1] = engine->m_hWorkSemaphore;
+
+		while (1)
+		{
+			status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+			if (status != (WAIT_OBJECT_0 + 1))
+				break;
+
+			item = NULL;
+
+			EnterCriticalSection(&engine->m_WorkCSection);
+
+			if (!engine->m_WorkQueue.empty())
+			{
+				item = engine->m_WorkQueue.front();
+				engine->m_WorkQueue.pop_front();
+			}
+
+			LeaveCriticalSection(&engine->m_WorkCSection);
+
+			if (!item)
+				continue;
+
+			item->callIn->doStuff();
+			item->callIn->encodeResponse();
+
+			engine->completeCallIn(item);
+		}
+
+		return NULL;
+	}
+
+	int RpcEngine::dispatchCallIn(CallIn* callIn)
+	{
+		RpcWorkItem* item = new RpcWorkItem;
+
+		item->callIn = callIn;
+		item->generation = m_Generation;
+		item->ordered = callIn->getOrderingKey(&item->orderingKey);
+
+		CSGuard guard(&m_WorkCSection);
+
+		/**
+		 * Calls sharing an ordering key run one after the other in the
+		 * order they were received, the next one is queued on completion.
+		 */
+
+		if (item->ordered)
+		{
+			TOrderedCallMap::iterator it = m_OrderedCalls.find(item->orderingKey);
+
+			if (it != m_OrderedCalls.end())
+			{
+				it->second.push_back(item);
+				return CLIENT_SUCCESS;
+			}
+
+			m_OrderedCalls[item->orderingKey] = std::list<RpcWorkItem*>();
+		}
+
+		m_WorkQueue.push_back(item);
+		ReleaseSemaphore(m_hWorkSemaphore, 1, NULL);
+
+		return CLIENT_SUCCESS;
+	}
+
+	void RpcEngine::completeCallIn(RpcWorkItem* item)
+	{
+		if (item->ordered)
+		{
+			CSGuard guard(&m_WorkCSection);
+			TOrderedCallMap::iterator it = m_OrderedCalls.find(item->orderingKey);
+
+			if (it != m_OrderedCalls.end())
+			{
+				if (it->second.empty())
+				{
+					m_OrderedCalls.erase(it);
+				}
+				else
+				{
+					m_WorkQueue.push_back(it->second.front());
+					it->second.pop_front();
+					ReleaseSemaphore(m_hWorkSemaphore, 1, NULL);
+				}
+			}
+		}
+
+		m_CompletedCalls.addElement(item);
+	}
+
+	void RpcEngine::sendCompletedCalls()
+	{
+		RpcWorkItem* item;
+
+		m_CompletedCalls.resetEventAndLockQueue();
+
+		while ((item = m_CompletedCalls.getElementLockFree()))
+		{
+			/* responses for a previous freerds connection are dropped */
+			if (item->generation == m_Generation)
+				send(item->callIn);
+
+			delete item->callIn;
+			delete item;
+		}
+
+		m_CompletedCalls.unlockQueue();
+	}
+
 	int RpcEngine::createServerPipe(void)
 	{
 		m_hServerPipe = createServerPipe("\\\\.\\pipe\\FreeRDS_Manager");
@@ -136,6 +358,7 @@ namespace freerds
 			}
 
 			engine->resetStatus();
+			engine->failPendingCalls();
 			APP_CONTEXT.rpcDisconnected();
 		}
 
@@ -180,6 +403,7 @@ namespace freerds
 			}
 
 			m_hClientPipe = m_hServerPipe;
+			m_Generation++;
 
 			dwPipeMode = PIPE_WAIT;
 			SetNamedPipeHandleState(m_hClientPipe, &dwPipeMode, NULL, NULL);
@@ -253,24 +477,9 @@ namespace freerds
 		callID = m_Header.callId;
 		callType = m_Header.msgType;
 
-		payload.assign((const char*) m_PayloadBuffer, (size_t) m_PayloadRead);
-
 		if (FDSAPI_IS_RESPONSE_ID(callType))
 		{
-			CallOut* foundCallOut = 0;
-			std::list<CallOut*>::iterator it;
-
-			for (it = m_AnswerWaitingQueue.begin(); it != m_AnswerWaitingQueue.end(); it++)
-			{
-				CallOut* currentCallOut = (CallOut*)(*it);
-
-				if (currentCallOut->getTag() == callID)
-				{
-					foundCallOut = currentCallOut;
-					m_AnswerWaitingQueue.remove(foundCallOut);
-					break;
-				}
-			}
+			CallOut* foundCallOut = removePendingCall(callID);
 
 			if (!foundCallOut)
 			{
@@ -281,18 +490,22 @@ namespace freerds
 			{
 				if (m_Header.status == FDSAPI_STATUS_SUCCESS)
 				{
+					// waiters may decode the response again, it keeps a copy
+					payload.assign((const char*) m_PayloadBuffer, (size_t) m_PayloadRead);
 					foundCallOut->setEncodedeResponse(payload);
 					foundCallOut->decodeResponse();
-					foundCallOut->setResult(0);
+					foundCallOut->setResult(CALLOUT_RESULT_SUCCESS);
 				}
 				else if (m_Header.status == FDSAPI_STATUS_FAILED)
 				{
-					foundCallOut->setResult(1);
+					foundCallOut->setResult(CALLOUT_RESULT_FAILED);
 				}
 				else if (m_Header.status == FDSAPI_STATUS_NOTFOUND)
 				{
-					foundCallOut->setResult(2);
+					foundCallOut->setResult(CALLOUT_RESULT_NOTFOUND);
 				}
+
+				foundCallOut->release();
 			}
 		}
 		else
@@ -311,12 +524,19 @@ namespace freerds
 			{
 				CallIn* createdCallIn = (CallIn*) createdCall;
 
-				createdCallIn->setEncodedRequest(payload);
+				// decoded right away, strings are borrowed from m_PayloadBuffer
+				createdCallIn->setRequestBuffer(m_Decoder, m_PayloadBuffer, m_PayloadRead);
 				createdCallIn->setTag(callID);
 
 				WLog_Print(logger_RPCEngine, WLOG_TRACE, "call upacked for callType=%d and callID=%d",callType,callID);
 
 				createdCallIn->decodeRequest();
+
+				if (createdCallIn->isBlocking() && (startWorkers() == CLIENT_SUCCESS))
+				{
+					return dispatchCallIn(createdCallIn);
+				}
+
 				createdCallIn->doStuff();
 				createdCallIn->encodeResponse();
 
@@ -428,18 +648,23 @@ namespace freerds
 		DWORD nCount;
 		SignalingQueue<Call*>* outgoingQueue = APP_CONTEXT.getRpcOutgoingQueue();
 		HANDLE queueHandle = outgoingQueue->getSignalHandle();
-		HANDLE events[3];
+		HANDLE completedHandle = m_CompletedCalls.getSignalHandle();
+		HANDLE events[4];
 
 		nCount = 0;
 		events[nCount++] = m_hStopEvent;
 		events[nCount++] = m_hClientPipe;
 		events[nCount++] = queueHandle;
+		events[nCount++] = completedHandle;
 
 		int retValue = 0;
 
 		while (1)
 		{
-			status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+			status = WaitForMultipleObjects(nCount, events, FALSE,
+					m_PendingCalls.empty() ? INFINITE : RPC_ENGINE_WHEEL_TICK);
+
+			expirePendingCalls();
 
 			if (WaitForSingleObject(m_hStopEvent, 0) == WAIT_OBJECT_0)
 			{
@@ -474,6 +699,11 @@ namespace freerds
 
 				outgoingQueue->unlockQueue();
 			}
+
+			if (WaitForSingleObject(completedHandle, 0) == WAIT_OBJECT_0)
+			{
+				sendCompletedCalls();
+			}
 		}
 
 		return retValue;
@@ -490,13 +720,14 @@ namespace freerds
 
 			if (send(call) == CLIENT_SUCCESS)
 			{
-				m_AnswerWaitingQueue.push_back(callOut);
+				addPendingCall(callOut);
 				return CLIENT_SUCCESS;
 			}
 			else
 			{
 				WLog_Print(logger_RPCEngine, WLOG_ERROR, "error sending call, informing call");
-				callOut->setResult(1);
+				callOut->setResult(CALLOUT_RESULT_FAILED);
+				callOut->release();
 				return CLIENT_ERROR;
 			}
 		}
@@ -509,4 +740,156 @@ namespace freerds
 
 		return 0;
 	}
+
+	void RpcEngine::addPendingCall(CallOut* callOut)
+	{
+		long timeout;
+		UINT64 now;
+		RpcPendingCall pendingCall;
+
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("rpc.callout.timeout", &timeout))
+			timeout = RPC_ENGINE_DEFAULT_CALL_TIMEOUT;
+
+		if (timeout < 1)
+			timeout = 1;
+
+		now = GetTickCount64();
+
+		/* m_WheelTick is the last tick whose slot has been expired */
+
+		if (m_PendingCalls.empty())
+			m_WheelTick = (now / RPC_ENGINE_WHEEL_TICK) - 1;
+
+		pendingCall.callOut = callOut;
+		pendingCall.deadline = now + (timeout * 1000);
+
+		m_PendingCalls[callOut->getTag()] = pendingCall;
+		m_DeadlineWheel[(pendingCall.deadline / RPC_ENGINE_WHEEL_TICK) % RPC_ENGINE_WHEEL_SLOTS].push_back(callOut->getTag());
+
+		InterlockedIncrement(&m_OutstandingCallOuts);
+	}
+
+	CallOut* RpcEngine::removePendingCall(UINT32 tag)
+	{
+		CallOut* callOut;
+		TPendingCallMap::iterator it = m_PendingCalls.find(tag);
+
+		/* the tag stays in its wheel slot and is skipped when the slot expires */
+
+		if (it == m_PendingCalls.end())
+			return NULL;
+
+		callOut = it->second.callOut;
+		m_PendingCalls.erase(it);
+
+		InterlockedDecrement(&m_OutstandingCallOuts);
+
+		return callOut;
+	}
+
+	void RpcEngine::expirePendingCalls()
+	{
+		UINT64 now;
+		UINT64 nowTick;
+		UINT32 slotCount = 0;
+
+		if (m_PendingCalls.empty())
+			return;
+
+		now = GetTickCount64();
+		nowTick = now / RPC_ENGINE_WHEEL_TICK;
+
+		while (((m_WheelTick + 1) < nowTick) && (slotCount++ < RPC_ENGINE_WHEEL_SLOTS))
+		{
+			std::list<UINT32>& slot = m_DeadlineWheel[++m_WheelTick % RPC_ENGINE_WHEEL_SLOTS];
+			std::list<UINT32>::iterator it = slot.begin();
+
+			while (it != slot.end())
+			{
+				TPendingCallMap::iterator itCall = m_PendingCalls.find(*it);
+
+				if ((itCall != m_PendingCalls.end()) && (itCall->second.deadline > now))
+				{
+					/* deadline is more than one wheel revolution away */
+					it++;
+					continue;
+				}
+
+				if (itCall != m_PendingCalls.end())
+				{
+					CallOut* callOut = itCall->second.callOut;
+
+					WLog_Print(logger_RPCEngine, WLOG_ERROR,
+						"call %u with callType=%lu timed out",
+						*it, callOut->getCallType());
+
+					m_PendingCalls.erase(itCall);
+
+					InterlockedDecrement(&m_OutstandingCallOuts);
+					InterlockedIncrement(&m_ExpiredCallOuts);
+
+					callOut->setResult(CALLOUT_RESULT_TIMEOUT);
+					callOut->release();
+				}
+
+				it = slot.erase(it);
+			}
+		}
+
+		m_WheelTick = nowTick - 1;
+	}
+
+	void RpcEngine::failPendingCalls()
+	{
+		int index;
+		TPendingCallMap::iterator it;
+
+		for (it = m_PendingCalls.begin(); it != m_PendingCalls.end(); it++)
+		{
+			it->second.callOut->setResult(CALLOUT_RESULT_FAILED);
+			it->second.callOut->release();
+		}
+
+		m_PendingCalls.clear();
+
+		for (index = 0; index < RPC_ENGINE_WHEEL_SLOTS; index++)
+			m_DeadlineWheel[index].clear();
+
+		InterlockedExchange(&m_OutstandingCallOuts, 0);
+	}
+
+	void RpcEngine::failQueuedCalls()
+	{
+		Call* call;
+		SignalingQueue<Call*>* outgoingQueue = APP_CONTEXT.getRpcOutgoingQueue();
+
+		/* calls that were never sent, the engine holds a reference on each */
+
+		outgoingQueue->resetEventAndLockQueue();
+
+		while ((call = outgoingQueue->getElementLockFree()))
+		{
+			if (call->getDerivedType() == 2)
+			{
+				((CallOut*) call)->setResult(CALLOUT_RESULT_FAILED);
+				((CallOut*) call)->release();
+			}
+			else
+			{
+				delete call;
+			}
+		}
+
+		outgoingQueue->unlockQueue();
+	}
+
+	LONG RpcEngine::getOutstandingCallOuts()
+	{
+		return m_OutstandingCallOuts;
+	}
+
+	LONG RpcEngine::getExpiredCallOuts()
+	{
+		return m_ExpiredCallOuts;
+	}
 }
@@ -24,15 +24,46 @@
 
 #include <freerds/rpc.h>
 
+#include <map>
 #include <list>
 
+#include <boost/unordered_map.hpp>
+
 #include <call/Call.h>
+#include <call/CallIn.h>
 #include <call/CallOut.h>
 
+#include <utils/SignalingQueue.h>
+
 #define PIPE_BUFFER_SIZE	0xFFFF
 
+#define RPC_ENGINE_DEFAULT_WORKERS	4
+#define RPC_ENGINE_MAX_WORKERS		32
+
+#define RPC_ENGINE_WHEEL_SLOTS		64
+#define RPC_ENGINE_WHEEL_TICK		1000
+#define RPC_ENGINE_DEFAULT_CALL_TIMEOUT	30
+
 namespace freerds
 {
+	struct RpcWorkItem
+	{
+		CallIn* callIn;
+		UINT32 generation;
+		bool ordered;
+		UINT32 orderingKey;
+	};
+
+	typedef std::map<UINT32, std::list<RpcWorkItem*> > TOrderedCallMap;
+
+	struct RpcPendingCall
+	{
+		CallOut* callOut;
+		UINT64 deadline;
+	};
+
+	typedef boost::unordered_map<UINT32, RpcPendingCall> TPendingCallMap;
+
 	class RpcEngine
 	{
 	public:
@@ -46,6 +77,9 @@ namespace freerds
 		int serveClient();
 		void resetStatus();
 
+		LONG getOutstandingCallOuts();
+		LONG getExpiredCallOuts();
+
 	private:
 		int createServerPipe(void);
 		HANDLE createServerPipe(const char* endpoint);
@@ -58,6 +92,17 @@ namespace freerds
 		int sendError(UINT32 callId, UINT32 msgType);
 		int sendInternal(FDSAPI_MSG_HEADER* header, BYTE* buffer);
 		int processOutgoingCall(Call* call);
+		int startWorkers();
+		void stopWorkers();
+		static void* workerThread(void* arg);
+		int dispatchCallIn(CallIn* callIn);
+		void completeCallIn(RpcWorkItem* item);
+		void sendCompletedCalls();
+		void addPendingCall(CallOut* callOut);
+		CallOut* removePendingCall(UINT32 tag);
+		void expirePendingCalls();
+		void failPendingCalls();
+		void failQueuedCalls();
 
 	private:
 		HANDLE m_hClientPipe;
@@ -69,13 +114,27 @@ namespace freerds
 
 		DWORD m_PayloadRead;
 		BYTE m_PayloadBuffer[PIPE_BUFFER_SIZE];
+		rdsRpcDecoder* m_Decoder;
 
 		DWORD m_HeaderRead;
 		BYTE* m_HeaderBuffer;
 		FDSAPI_MSG_HEADER m_Header;
 
 		UINT32 m_NextOutCall;
-		std::list<CallOut*> m_AnswerWaitingQueue;
+		TPendingCallMap m_PendingCalls;
+		std::list<UINT32> m_DeadlineWheel[RPC_ENGINE_WHEEL_SLOTS];
+		UINT64 m_WheelTick;
+		LONG m_OutstandingCallOuts;
+		LONG m_ExpiredCallOuts;
+
+		UINT32 m_Generation;
+		DWORD m_WorkerCount;
+		HANDLE m_hWorkerThreads[RPC_ENGINE_MAX_WORKERS];
+		HANDLE m_hWorkSemaphore;
+		CRITICAL_SECTION m_WorkCSection;
+		std::list<RpcWorkItem*> m_WorkQueue;
+		TOrderedCallMap m_OrderedCalls;
+		SignalingQueue<RpcWorkItem*> m_CompletedCalls;
 	};
 }
 
@@ -42,16 +42,17 @@ namespace freerds
 		}
 		else
 		{
-			CallOutLogOffUserSession logoffSession;
+			CallOutLogOffUserSession* logoffSession = new CallOutLogOffUserSession();
 
-			logoffSession.setConnectionId(connectionId);
+			logoffSession->setConnectionId(connectionId);
+			logoffSession->addRef();
 
-			APP_CONTEXT.getRpcOutgoingQueue()->addElement(&logoffSession);
-			WaitForSingleObject(logoffSession.getAnswerHandle(),INFINITE);
+			APP_CONTEXT.getRpcOutgoingQueue()->addElement(logoffSession);
+			WaitForSingleObject(logoffSession->getAnswerHandle(),INFINITE);
 
-			if (logoffSession.getResult() == 0)
+			if (logoffSession->getResult() == 0)
 			{
-				if (logoffSession.isLoggedOff())
+				if (logoffSession->isLoggedOff())
 				{
 					stopSession();
 					APP_CONTEXT.getConnectionStore()->removeConnection(connectionId);
@@ -64,8 +65,10 @@ namespace freerds
 			else
 			{
 				// report error
-				WLog_Print(logger_EndSessionTask, WLOG_ERROR, "CallOutLogOffUserSession reported error %d!", logoffSession.getResult());
+				WLog_Print(logger_EndSessionTask, WLOG_ERROR, "CallOutLogOffUserSession reported error %d!", logoffSession->getResult());
 			}
+
+			logoffSession->release();
 		}
 	}
 
@@ -87,5 +90,15 @@ namespace freerds
 			WLog_Print(logger_EndSessionTask, WLOG_ERROR, "session for id %d was not found!", m_SessionId);
 		}
 	}
-}
 
+	int TaskEndSession::getPriority()
+	{
+		return TASK_PRIORITY_LOW;
+	}
+
+	UINT32 TaskEndSession::getOrderingKey()
+	{
+		/* runs after, never alongside, a module shutdown of the session */
+		return m_SessionId;
+	}
+}
@@ -34,28 +34,34 @@ namespace freerds
 
 	void TaskSwitchTo::run()
 	{
-		CallOutSwitchTo switchToCall;
+		bool switched = false;
+		CallOutSwitchTo* switchToCall = new CallOutSwitchTo();
 
-		switchToCall.setServiceEndpoint(m_ServiceEndpoint);
-		switchToCall.setConnectionId(m_ConnectionId);
+		switchToCall->setServiceEndpoint(m_ServiceEndpoint);
+		switchToCall->setConnectionId(m_ConnectionId);
+		switchToCall->addRef();
 
-		APP_CONTEXT.getRpcOutgoingQueue()->addElement(&switchToCall);
-		WaitForSingleObject(switchToCall.getAnswerHandle(), INFINITE);
+		APP_CONTEXT.getRpcOutgoingQueue()->addElement(switchToCall);
+		WaitForSingleObject(switchToCall->getAnswerHandle(), INFINITE);
 
-		if (switchToCall.getResult() != 0) {
-			WLog_Print(logger_taskSwitchTo, WLOG_ERROR, "TaskSwitchTo answer: RPC error %d!", switchToCall.getResult());
-			return cleanUpOnError();
+		if (switchToCall->getResult() != 0) {
+			WLog_Print(logger_taskSwitchTo, WLOG_ERROR, "TaskSwitchTo answer: RPC error %d!", switchToCall->getResult());
 		}
-
-		if (switchToCall.decodeResponse()) {
-			//
+		else if (switchToCall->decodeResponse()) {
 			WLog_Print(logger_taskSwitchTo, WLOG_ERROR, "TaskSwitchTo: decoding of switchto answer failed!");
-			return cleanUpOnError();
 		}
-		if (!switchToCall.isSuccess()) {
+		else if (!switchToCall->isSuccess()) {
 			WLog_Print(logger_taskSwitchTo, WLOG_ERROR, "TaskSwitchTo: switching in FreeRDS failed!");
-			return cleanUpOnError();
 		}
+		else {
+			switched = true;
+		}
+
+		switchToCall->release();
+
+		if (!switched)
+			return cleanUpOnError();
+
 		SessionPtr currentSession;
 
 		if (m_OldSessionId != 0)
@@ -133,5 +139,15 @@ namespace freerds
 			connection->setAbout2SwitchSessionId(0);
 		}
 	}
-}
 
+	int TaskSwitchTo::getPriority()
+	{
+		return TASK_PRIORITY_HIGH;
+	}
+
+	UINT32 TaskSwitchTo::getOrderingKey()
+	{
+		/* the session switched away from is stopped at the end */
+		return m_OldSessionId;
+	}
+}
@@ -30,6 +30,8 @@ namespace freerds
 	{
 	public:
 		virtual void run();
+		virtual int getPriority();
+		virtual UINT32 getOrderingKey();
 
 		void setConnectionId(UINT32 connectionId);
 		void setServiceEndpoint(std::string serviceEndpoint);
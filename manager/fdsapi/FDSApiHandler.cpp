@@ -30,6 +30,7 @@
 #include <winpr/wtsapi.h>
 
 #include <call/CallOutVirtualChannelOpen.h>
+#include <call/RpcEngine.h>
 #include <call/TaskSwitchTo.h>
 
 namespace freerds
@@ -101,7 +102,9 @@ namespace freerds
 		bool isReconnectAllowed;
 		bool isNewSession;
 
-		if (!propertyManager->getPropertyBool("session.reconnect", isReconnectAllowed))
+		PropertySetPtr properties = propertyManager->resolveProperties(username);
+
+		if (!properties->getPropertyBool(PROPERTY_KEY_SESSION_RECONNECT, isReconnectAllowed))
 		{
 			isReconnectAllowed = true;
 		}
@@ -136,6 +139,7 @@ namespace freerds
 		// Switch to the user session.
 		userSession->setUserName(username);
 		userSession->setDomain(domain);
+		userSession->setProperties(properties);
 		userSession->setClientDisplayWidth(authSession->getClientDisplayWidth());
 		userSession->setClientDisplayHeight(authSession->getClientDisplayHeight());
 		userSession->setClientDisplayColorDepth(authSession->getClientDisplayColorDepth());
@@ -153,7 +157,7 @@ namespace freerds
 
 		std::string moduleConfigName;
 
-		if (!propertyManager->getPropertyString("module", moduleConfigName))
+		if (!properties->getPropertyString(PROPERTY_KEY_MODULE, moduleConfigName))
 		{
 			moduleConfigName = "X11";
 		}
@@ -206,27 +210,50 @@ namespace freerds
 		const INT32 sessionId,
 		const std::string& virtualName)
 	{
+		long timeout;
 		UINT32 channelPort = 0;
-		CallOutVirtualChannelOpen openCall;
+		CallOutVirtualChannelOpen* openCall = new CallOutVirtualChannelOpen();
 		ConnectionStore* connectionStore = APP_CONTEXT.getConnectionStore();
 		UINT32 connectionId = connectionStore->getConnectionIdForSessionId(sessionId);
 
-		openCall.setConnectionId(connectionId);
-		openCall.setChannelName(virtualName);
+		openCall->setConnectionId(connectionId);
+		openCall->setChannelName(virtualName);
+		openCall->addRef();
+
+		APP_CONTEXT.getRpcOutgoingQueue()->addElement(openCall);
+
+		/**
+		 * This runs on an rpc dispatch worker, which the FDSApi server
+		 * joins when it stops. The engine expires the call after the
+		 * callout timeout, a call that never left the queue is given up
+		 * here a little later (the engine owns its own reference).
+		 */
+
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("rpc.callout.timeout", &timeout))
+			timeout = RPC_ENGINE_DEFAULT_CALL_TIMEOUT;
 
-		APP_CONTEXT.getRpcOutgoingQueue()->addElement(&openCall);
-		WaitForSingleObject(openCall.getAnswerHandle(), INFINITE);
+		if (timeout < 1)
+			timeout = 1;
 
-		if (openCall.getResult() == 0)
+		if (WaitForSingleObject(openCall->getAnswerHandle(), (timeout + 5) * 1000) != WAIT_OBJECT_0)
 		{
-			_return = openCall.getChannelGuid();
-			channelPort = openCall.getChannelPort();
+			WLog_Print(logger_FDSApiHandler, WLOG_ERROR,
+				"opening virtual channel %s for session %d timed out",
+				virtualName.c_str(), sessionId);
+			_return = "";
+		}
+		else if (openCall->getResult() == 0)
+		{
+			_return = openCall->getChannelGuid();
+			channelPort = openCall->getChannelPort();
 		}
 		else
 		{
 			_return = "";
 		}
 
+		openCall->release();
+
 		return channelPort;
 	}
 
@@ -289,31 +316,73 @@ namespace freerds
 		return false;
 	}
 
+	class EnumerateSessionsVisitor : public SessionVisitor
+	{
+	public:
+		EnumerateSessionsVisitor(TSessionInfoList& list) : mList(list) {};
+
+		virtual bool visit(const SessionPtr& session)
+		{
+			mList.push_back(TSessionInfo());
+			mList.back().sessionId = session->getSessionId();
+			mList.back().winStationName = session->getWinStationName();
+			mList.back().connectState = session->getConnectState();
+			return true;
+		}
+
+	private:
+		TSessionInfoList& mList;
+	};
+
 	void FDSApiHandler::enumerateSessions(
 		TReturnEnumerateSessions& _return,
 		const std::string& authToken,
 		const INT32 Version)
 	{
-		DWORD count;
-		DWORD index;
+		SessionStore* sessionStore = APP_CONTEXT.getSessionStore();
+		EnumerateSessionsVisitor visitor(_return.sessionInfoList);
+
+		_return.sessionInfoList.clear();
+		_return.sessionInfoList.reserve(sessionStore->getSessionCount());
+
+		sessionStore->visitSessions(visitor);
+
+		_return.returnValue = true;
+	}
 
+	void FDSApiHandler::enumerateSessionChanges(
+		TReturnEnumerateSessionChanges& _return,
+		const std::string& authToken,
+		const UINT32 sequence)
+	{
 		SessionStore* sessionStore = APP_CONTEXT.getSessionStore();
-		std::list<SessionPtr> sessions = sessionStore->getAllSessions();
+		SessionChanges changes;
 
-		count = sessions.size();
-		TSessionInfoList list(count);
+		sessionStore->getSessionChanges(sequence, changes);
 
-		std::list<SessionPtr>::iterator session = sessions.begin();
+		_return.sequence = changes.sequence;
+		_return.reset = changes.reset;
+		_return.changeList.clear();
+		_return.changeList.reserve(changes.sessions.size() + changes.removed.size());
 
-		for (index = 0; index < count; index++)
+		for (std::list<SessionPtr>::iterator it = changes.sessions.begin(); it != changes.sessions.end(); it++)
 		{
-			list.at(index).sessionId = (*session)->getSessionId();
-			list.at(index).winStationName = (*session)->getWinStationName();
-			list.at(index).connectState = (*session)->getConnectState();
-			session++;
+			_return.changeList.push_back(TSessionChange());
+			_return.changeList.back().sessionId = (*it)->getSessionId();
+			_return.changeList.back().removed = false;
+			_return.changeList.back().connectState = (*it)->getConnectState();
+			_return.changeList.back().winStationName = (*it)->getWinStationName();
+			_return.changeList.back().userName = (*it)->getUserName();
+			_return.changeList.back().domain = (*it)->getDomain();
 		}
 
-		_return.sessionInfoList = list;
+		for (std::list<UINT32>::iterator it = changes.removed.begin(); it != changes.removed.end(); it++)
+		{
+			_return.changeList.push_back(TSessionChange());
+			_return.changeList.back().sessionId = *it;
+			_return.changeList.back().removed = true;
+			_return.changeList.back().connectState = WTSDown;
+		}
 
 		_return.returnValue = true;
 	}
@@ -34,6 +34,7 @@
 namespace freerds {
 
 typedef std::vector<class TSessionInfo>  TSessionInfoList;
+typedef std::vector<class TSessionChange>  TSessionChangeList;
 
 class TClientDisplay {
 public:
@@ -49,6 +50,16 @@ public:
 	std::string winStationName;
 };
 
+class TSessionChange {
+public:
+	INT32 sessionId;
+	bool removed;
+	INT32 connectState;
+	std::string winStationName;
+	std::string userName;
+	std::string domain;
+};
+
 class TSessionInfoValue {
 public:
 	bool boolValue;
@@ -64,6 +75,14 @@ public:
 	TSessionInfoList sessionInfoList;
 };
 
+class TReturnEnumerateSessionChanges {
+public:
+	bool returnValue;
+	UINT32 sequence;
+	bool reset;
+	TSessionChangeList changeList;
+};
+
 class TReturnQuerySessionInformation {
 public:
 	bool returnValue;
@@ -89,6 +108,7 @@ namespace freerds
 		virtual bool logoffSession(const std::string& authToken, const INT32 sessionId, const bool wait);
 		virtual bool shutdownSystem(const std::string& authToken, const INT32 shutdownFlag);
 		virtual void enumerateSessions(TReturnEnumerateSessions& _return, const std::string& authToken, const INT32 Version);
+		virtual void enumerateSessionChanges(TReturnEnumerateSessionChanges& _return, const std::string& authToken, const UINT32 sequence);
 		virtual void querySessionInformation(TReturnQuerySessionInformation& _return, const std::string& authToken, const INT32 sessionId, const INT32 infoClass);
 	};
 }
@@ -807,6 +807,194 @@ static void FDSAPI_FreeAuthenticateUserResponse(FDSAPI_AUTHENTICATE_USER_RESPONS
 }
 
 
+/* SUBSCRIBE_SESSION_EVENTS */
+
+static UINT32 FDSAPI_SizeOfSubscribeSessionEventsRequest(FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST* subscribeSessionEventsRequest)
+{
+	return 2 * FDSAPI_SizeOfUINT32();
+}
+
+static BOOL FDSAPI_DecodeSubscribeSessionEventsRequest(wStream* s, FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST* subscribeSessionEventsRequest)
+{
+	if (!FDSAPI_DecodeUINT32(s, &subscribeSessionEventsRequest->sessionId)) return FALSE;
+	if (!FDSAPI_DecodeUINT32(s, &subscribeSessionEventsRequest->eventMask)) return FALSE;
+
+	return TRUE;
+}
+
+static void FDSAPI_EncodeSubscribeSessionEventsRequest(wStream* s, FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST* subscribeSessionEventsRequest)
+{
+	FDSAPI_EncodeUINT32(s, subscribeSessionEventsRequest->sessionId);
+	FDSAPI_EncodeUINT32(s, subscribeSessionEventsRequest->eventMask);
+}
+
+static void FDSAPI_FreeSubscribeSessionEventsRequest(FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST* subscribeSessionEventsRequest)
+{
+}
+
+static UINT32 FDSAPI_SizeOfSubscribeSessionEventsResponse(FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE* subscribeSessionEventsResponse)
+{
+	return FDSAPI_SizeOfBOOL();
+}
+
+static BOOL FDSAPI_DecodeSubscribeSessionEventsResponse(wStream* s, FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE* subscribeSessionEventsResponse)
+{
+	if (!FDSAPI_DecodeBOOL(s, &subscribeSessionEventsResponse->result)) return FALSE;
+
+	return TRUE;
+}
+
+static void FDSAPI_EncodeSubscribeSessionEventsResponse(wStream* s, FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE* subscribeSessionEventsResponse)
+{
+	FDSAPI_EncodeBOOL(s, subscribeSessionEventsResponse->result);
+}
+
+static void FDSAPI_FreeSubscribeSessionEventsResponse(FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE* subscribeSessionEventsResponse)
+{
+}
+
+
+/* ENUMERATE_SESSION_CHANGES */
+
+static UINT32 FDSAPI_SizeOfEnumerateSessionChangesRequest(FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST* enumerateSessionChangesRequest)
+{
+	return FDSAPI_SizeOfUINT32();
+}
+
+static BOOL FDSAPI_DecodeEnumerateSessionChangesRequest(wStream* s, FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST* enumerateSessionChangesRequest)
+{
+	if (!FDSAPI_DecodeUINT32(s, &enumerateSessionChangesRequest->sequence)) return FALSE;
+
+	return TRUE;
+}
+
+static void FDSAPI_EncodeEnumerateSessionChangesRequest(wStream* s, FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST* enumerateSessionChangesRequest)
+{
+	FDSAPI_EncodeUINT32(s, enumerateSessionChangesRequest->sequence);
+}
+
+static void FDSAPI_FreeEnumerateSessionChangesRequest(FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST* enumerateSessionChangesRequest)
+{
+}
+
+static UINT32 FDSAPI_SizeOfEnumerateSessionChangesResponse(FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE* enumerateSessionChangesResponse)
+{
+	UINT32 size = FDSAPI_SizeOfBOOL();
+
+	if (enumerateSessionChangesResponse->result)
+	{
+		UINT32 i;
+
+		size += (2 * FDSAPI_SizeOfUINT32()) + FDSAPI_SizeOfBOOL();
+
+		for (i = 0; i < enumerateSessionChangesResponse->cChanges; i++)
+		{
+			FDSAPI_SESSION_CHANGE* pChange = &enumerateSessionChangesResponse->pChanges[i];
+
+			size += (2 * FDSAPI_SizeOfUINT32()) + FDSAPI_SizeOfBOOL();
+			size += FDSAPI_SizeOfString(pChange->winStationName);
+			size += FDSAPI_SizeOfString(pChange->userName);
+			size += FDSAPI_SizeOfString(pChange->domain);
+		}
+	}
+
+	return size;
+}
+
+static BOOL FDSAPI_DecodeEnumerateSessionChangesResponse(wStream* s, FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE* enumerateSessionChangesResponse)
+{
+	if (!FDSAPI_DecodeBOOL(s, &enumerateSessionChangesResponse->result)) return FALSE;
+
+	if (enumerateSessionChangesResponse->result)
+	{
+		if (!FDSAPI_DecodeUINT32(s, &enumerateSessionChangesResponse->sequence)) return FALSE;
+		if (!FDSAPI_DecodeBOOL(s, &enumerateSessionChangesResponse->reset)) return FALSE;
+		if (!FDSAPI_DecodeUINT32(s, &enumerateSessionChangesResponse->cChanges)) return FALSE;
+
+		if (enumerateSessionChangesResponse->cChanges > 0)
+		{
+			UINT32 i;
+
+			/* every entry takes at least 15 bytes on the wire */
+			if (Stream_GetRemainingLength(s) / 15 < enumerateSessionChangesResponse->cChanges)
+			{
+				enumerateSessionChangesResponse->cChanges = 0;
+				return FALSE;
+			}
+
+			/* zeroed, so that a truncated message can be freed */
+			enumerateSessionChangesResponse->pChanges = (FDSAPI_SESSION_CHANGE*)
+				calloc(enumerateSessionChangesResponse->cChanges, sizeof(FDSAPI_SESSION_CHANGE));
+
+			if (enumerateSessionChangesResponse->pChanges == NULL)
+			{
+				enumerateSessionChangesResponse->cChanges = 0;
+				return FALSE;
+			}
+
+			for (i = 0; i < enumerateSessionChangesResponse->cChanges; i++)
+			{
+				FDSAPI_SESSION_CHANGE* pChange = &enumerateSessionChangesResponse->pChanges[i];
+
+				if (!FDSAPI_DecodeUINT32(s, &pChange->sessionId)) return FALSE;
+				if (!FDSAPI_DecodeBOOL(s, &pChange->removed)) return FALSE;
+				if (!FDSAPI_DecodeUINT32(s, &pChange->connectState)) return FALSE;
+				if (!FDSAPI_DecodeString(s, &pChange->winStationName)) return FALSE;
+				if (!FDSAPI_DecodeString(s, &pChange->userName)) return FALSE;
+				if (!FDSAPI_DecodeString(s, &pChange->domain)) return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static void FDSAPI_EncodeEnumerateSessionChangesResponse(wStream* s, FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE* enumerateSessionChangesResponse)
+{
+	FDSAPI_EncodeBOOL(s, enumerateSessionChangesResponse->result);
+
+	if (enumerateSessionChangesResponse->result)
+	{
+		UINT32 i;
+
+		FDSAPI_EncodeUINT32(s, enumerateSessionChangesResponse->sequence);
+		FDSAPI_EncodeBOOL(s, enumerateSessionChangesResponse->reset);
+		FDSAPI_EncodeUINT32(s, enumerateSessionChangesResponse->cChanges);
+
+		for (i = 0; i < enumerateSessionChangesResponse->cChanges; i++)
+		{
+			FDSAPI_SESSION_CHANGE* pChange = &enumerateSessionChangesResponse->pChanges[i];
+
+			FDSAPI_EncodeUINT32(s, pChange->sessionId);
+			FDSAPI_EncodeBOOL(s, pChange->removed);
+			FDSAPI_EncodeUINT32(s, pChange->connectState);
+			FDSAPI_EncodeString(s, pChange->winStationName);
+			FDSAPI_EncodeString(s, pChange->userName);
+			FDSAPI_EncodeString(s, pChange->domain);
+		}
+	}
+}
+
+static void FDSAPI_FreeEnumerateSessionChangesResponse(FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE* enumerateSessionChangesResponse)
+{
+	UINT32 i;
+
+	if (enumerateSessionChangesResponse->pChanges == NULL)
+		return;
+
+	for (i = 0; i < enumerateSessionChangesResponse->cChanges; i++)
+	{
+		FDSAPI_SESSION_CHANGE* pChange = &enumerateSessionChangesResponse->pChanges[i];
+
+		FDSAPI_FreeString(pChange->winStationName);
+		FDSAPI_FreeString(pChange->userName);
+		FDSAPI_FreeString(pChange->domain);
+	}
+
+	free((void*)enumerateSessionChangesResponse->pChanges);
+}
+
+
 /* SESSION_EVENT */
 
 static UINT32 FDSAPI_SizeOfSessionEvent(FDSAPI_SESSION_EVENT* sessionEvent)
@@ -833,6 +1021,30 @@ static void FDSAPI_FreeSessionEvent(FDSAPI_SESSION_EVENT* sessionEvent)
 }
 
 
+/* SESSION_CHANGES */
+
+static UINT32 FDSAPI_SizeOfSessionChanges(FDSAPI_SESSION_CHANGES* sessionChanges)
+{
+	return FDSAPI_SizeOfUINT32();
+}
+
+static BOOL FDSAPI_DecodeSessionChanges(wStream* s, FDSAPI_SESSION_CHANGES* sessionChanges)
+{
+	if (!FDSAPI_DecodeUINT32(s, &sessionChanges->sequence)) return FALSE;
+
+	return TRUE;
+}
+
+static void FDSAPI_EncodeSessionChanges(wStream *s, FDSAPI_SESSION_CHANGES* sessionChanges)
+{
+	FDSAPI_EncodeUINT32(s, sessionChanges->sequence);
+}
+
+static void FDSAPI_FreeSessionChanges(FDSAPI_SESSION_CHANGES* sessionChanges)
+{
+}
+
+
 /* Message encoder/decoder */
 
 static wStream* FDSAPI_AllocateStream(FDSAPI_MESSAGE* msg)
@@ -925,10 +1137,30 @@ static wStream* FDSAPI_AllocateStream(FDSAPI_MESSAGE* msg)
 			size += FDSAPI_SizeOfAuthenticateUserResponse(&msg->u.authenticateUserResponse);
 			break;
 
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID:
+			size += FDSAPI_SizeOfSubscribeSessionEventsRequest(&msg->u.subscribeSessionEventsRequest);
+			break;
+
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID:
+			size += FDSAPI_SizeOfSubscribeSessionEventsResponse(&msg->u.subscribeSessionEventsResponse);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID:
+			size += FDSAPI_SizeOfEnumerateSessionChangesRequest(&msg->u.enumerateSessionChangesRequest);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID:
+			size += FDSAPI_SizeOfEnumerateSessionChangesResponse(&msg->u.enumerateSessionChangesResponse);
+			break;
+
 		case FDSAPI_SESSION_EVENT_ID:
 			size += FDSAPI_SizeOfSessionEvent(&msg->u.sessionEvent);
 			break;
 
+		case FDSAPI_SESSION_CHANGES_ID:
+			size += FDSAPI_SizeOfSessionChanges(&msg->u.sessionChanges);
+			break;
+
 		default:
 			return NULL;
 	}
@@ -1030,10 +1262,30 @@ BOOL FDSAPI_DecodeMessage(wStream* s, FDSAPI_MESSAGE* msg)
 			result = FDSAPI_DecodeAuthenticateUserResponse(s, &msg->u.authenticateUserResponse);
 			break;
 
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID:
+			result = FDSAPI_DecodeSubscribeSessionEventsRequest(s, &msg->u.subscribeSessionEventsRequest);
+			break;
+
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID:
+			result = FDSAPI_DecodeSubscribeSessionEventsResponse(s, &msg->u.subscribeSessionEventsResponse);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID:
+			result = FDSAPI_DecodeEnumerateSessionChangesRequest(s, &msg->u.enumerateSessionChangesRequest);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID:
+			result = FDSAPI_DecodeEnumerateSessionChangesResponse(s, &msg->u.enumerateSessionChangesResponse);
+			break;
+
 		case FDSAPI_SESSION_EVENT_ID:
 			result = FDSAPI_DecodeSessionEvent(s, &msg->u.sessionEvent);
 			break;
 
+		case FDSAPI_SESSION_CHANGES_ID:
+			result = FDSAPI_DecodeSessionChanges(s, &msg->u.sessionChanges);
+			break;
+
 		default:
 			break;
 	}
@@ -1137,10 +1389,30 @@ wStream* FDSAPI_EncodeMessage(FDSAPI_MESSAGE* msg)
 			FDSAPI_EncodeAuthenticateUserResponse(s, &msg->u.authenticateUserResponse);
 			break;
 
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID:
+			FDSAPI_EncodeSubscribeSessionEventsRequest(s, &msg->u.subscribeSessionEventsRequest);
+			break;
+
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID:
+			FDSAPI_EncodeSubscribeSessionEventsResponse(s, &msg->u.subscribeSessionEventsResponse);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID:
+			FDSAPI_EncodeEnumerateSessionChangesRequest(s, &msg->u.enumerateSessionChangesRequest);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID:
+			FDSAPI_EncodeEnumerateSessionChangesResponse(s, &msg->u.enumerateSessionChangesResponse);
+			break;
+
 		case FDSAPI_SESSION_EVENT_ID:
 			FDSAPI_EncodeSessionEvent(s, &msg->u.sessionEvent);
 			break;
 
+		case FDSAPI_SESSION_CHANGES_ID:
+			FDSAPI_EncodeSessionChanges(s, &msg->u.sessionChanges);
+			break;
+
 		default:
 			/* Free the stream. */
 			Stream_Free(s, TRUE);
@@ -1241,10 +1513,30 @@ void FDSAPI_FreeMessage(FDSAPI_MESSAGE* msg)
 			FDSAPI_FreeAuthenticateUserResponse(&msg->u.authenticateUserResponse);
 			break;
 
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID:
+			FDSAPI_FreeSubscribeSessionEventsRequest(&msg->u.subscribeSessionEventsRequest);
+			break;
+
+		case FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID:
+			FDSAPI_FreeSubscribeSessionEventsResponse(&msg->u.subscribeSessionEventsResponse);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID:
+			FDSAPI_FreeEnumerateSessionChangesRequest(&msg->u.enumerateSessionChangesRequest);
+			break;
+
+		case FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID:
+			FDSAPI_FreeEnumerateSessionChangesResponse(&msg->u.enumerateSessionChangesResponse);
+			break;
+
 		case FDSAPI_SESSION_EVENT_ID:
 			FDSAPI_FreeSessionEvent(&msg->u.sessionEvent);
 			break;
 
+		case FDSAPI_SESSION_CHANGES_ID:
+			FDSAPI_FreeSessionChanges(&msg->u.sessionChanges);
+			break;
+
 		default:
 			break;
 	}
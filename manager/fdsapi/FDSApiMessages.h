@@ -43,8 +43,24 @@
 #define FDSAPI_QUERY_SESSION_INFORMATION_RESPONSE_ID		18
 #define FDSAPI_AUTHENTICATE_USER_REQUEST_ID			19
 #define FDSAPI_AUTHENTICATE_USER_RESPONSE_ID			20
+#define FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID		21
+#define FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID		22
+#define FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID		23
+#define FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID		24
 
 #define FDSAPI_SESSION_EVENT_ID					50
+#define FDSAPI_SESSION_CHANGES_ID				51
+
+/**
+ * Subscriptions, the mask holds one bit per WTS_SESSION_* state change.
+ * FDSAPI_SESSION_EVENT_CHANGES asks for FDSAPI_SESSION_CHANGES messages,
+ * it is not part of the default subscription since older clients do not
+ * know the message.
+ */
+#define FDSAPI_SESSION_ANY					0xFFFFFFFF
+#define FDSAPI_SESSION_EVENT_ALL				0x7FFFFFFF
+#define FDSAPI_SESSION_EVENT_CHANGES				0x80000000
+#define FDSAPI_SESSION_EVENT_BIT(_stateChange)			(1 << (_stateChange))
 
 /**
  * TODO: For now, we only define a single message which represents an event
@@ -65,6 +81,17 @@ typedef struct
 }
 FDSAPI_SESSION_INFO;
 
+typedef struct
+{
+	UINT32 sessionId;
+	BOOL removed;
+	UINT32 connectState;
+	const char* winStationName;
+	const char* userName;
+	const char* domain;
+}
+FDSAPI_SESSION_CHANGE;
+
 typedef enum
 {
 	FDSAPI_SESSION_INFO_VALUE_BOOL,
@@ -227,13 +254,62 @@ typedef struct
 }
 FDSAPI_AUTHENTICATE_USER_RESPONSE;
 
+/**
+ *
+ * FDSAPI_SUBSCRIBE_SESSION_EVENTS
+ *
+ * Replaces the set of session events the server delivers to the client.
+ * The sessionId is either a single session or FDSAPI_SESSION_ANY. Clients
+ * which never subscribe receive every event, an eventMask of 0 silences
+ * the connection.
+ *
+ */
+typedef struct
+{
+	UINT32 sessionId;
+	UINT32 eventMask;
+}
+FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST;
+
+typedef struct
+{
+	BOOL result;
+}
+FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE;
+
+/**
+ *
+ * FDSAPI_ENUMERATE_SESSION_CHANGES
+ *
+ * Returns the sessions which were created, changed or removed after the
+ * given change sequence, along with the current sequence. A sequence of 0
+ * or one the server no longer has the history for yields the complete
+ * session table with reset set, the client then drops what it has cached.
+ *
+ */
+typedef struct
+{
+	UINT32 sequence;
+}
+FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST;
+
+typedef struct
+{
+	BOOL result;
+	UINT32 sequence;
+	BOOL reset;
+	UINT32 cChanges;
+	FDSAPI_SESSION_CHANGE* pChanges;
+}
+FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE;
+
 
 /**
  *
  * FDSAPI_SESSION_EVENT
  *
- * Broadcast from the server to all clients whenever a session undergoes a
- * state change (e.g., WTSActive to WTSDisconnected).  The client uses this
+ * Sent from the server to the subscribed clients whenever a session undergoes
+ * a state change (e.g., WTSActive to WTSDisconnected).  The client uses this
  * message to complete a call to WTSWaitSystemEvent or to notify the client
  * process of session events that have been registered for via a call to
  * WTSRegisterNotification.
@@ -246,6 +322,22 @@ typedef struct
 }
 FDSAPI_SESSION_EVENT;
 
+/**
+ *
+ * FDSAPI_SESSION_CHANGES
+ *
+ * Sent to clients subscribed with FDSAPI_SESSION_EVENT_CHANGES whenever the
+ * session table moves to a new change sequence. It carries no session
+ * data, a client catches up with FDSAPI_ENUMERATE_SESSION_CHANGES once
+ * it actually needs the table.
+ *
+ */
+typedef struct
+{
+	UINT32 sequence;
+}
+FDSAPI_SESSION_CHANGES;
+
 typedef struct
 {
 	UINT16 messageId;
@@ -273,9 +365,14 @@ typedef struct
 		FDSAPI_QUERY_SESSION_INFORMATION_RESPONSE querySessionInformationResponse;
 		FDSAPI_AUTHENTICATE_USER_REQUEST authenticateUserRequest;
 		FDSAPI_AUTHENTICATE_USER_RESPONSE authenticateUserResponse;
+		FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST subscribeSessionEventsRequest;
+		FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE subscribeSessionEventsResponse;
+		FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST enumerateSessionChangesRequest;
+		FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE enumerateSessionChangesResponse;
 
 		/* Events */
 		FDSAPI_SESSION_EVENT sessionEvent;
+		FDSAPI_SESSION_CHANGES sessionChanges;
 	} u;
 }
 FDSAPI_MESSAGE;
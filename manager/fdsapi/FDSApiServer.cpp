@@ -25,6 +25,8 @@
 
 #include <freerds/rpc.h>
 
+#include <utils/CSGuard.h>
+
 #include <session/ApplicationContext.h>
 
 #include "FDSApiHandler.h"
@@ -40,11 +42,20 @@ namespace freerds
 
 	int FDSApiServer::RpcConnectionAccepted(rdsRpcClient* rpcClient)
 	{
+		FDSApiServer* server = (FDSApiServer*) rpcClient->custom;
+
+		// until told otherwise a client gets every event, as it always did
+		server->subscribeSessionEvents(rpcClient, FDSAPI_SESSION_ANY, FDSAPI_SESSION_EVENT_ALL);
+
 		return 0;
 	}
 
 	int FDSApiServer::RpcConnectionClosed(rdsRpcClient* rpcClient)
 	{
+		FDSApiServer* server = (FDSApiServer*) rpcClient->custom;
+
+		server->unsubscribeSessionEvents(rpcClient);
+
 		return 0;
 	}
 
@@ -162,6 +173,58 @@ namespace freerds
 				break;
 			}
 
+			case FDSAPI_ENUMERATE_SESSION_CHANGES_REQUEST_ID:
+			{
+				TReturnEnumerateSessionChanges apiReturn;
+
+				WLog_Print(logger_FDSApiServer, WLOG_DEBUG, "calling FDSAPIHandler::enumerateSessionChanges");
+
+				FDSApiHandler->enumerateSessionChanges(
+						apiReturn,
+						authToken,
+						requestMsg.u.enumerateSessionChangesRequest.sequence);
+
+				responseMsg.messageId = FDSAPI_ENUMERATE_SESSION_CHANGES_RESPONSE_ID;
+				responseMsg.requestId = requestMsg.requestId;
+
+				responseMsg.u.enumerateSessionChangesResponse.result = FALSE;
+
+				if (apiReturn.returnValue)
+				{
+					size_t count = apiReturn.changeList.size();
+					FDSAPI_SESSION_CHANGE* pChanges;
+
+					pChanges = (FDSAPI_SESSION_CHANGE*) calloc(count ? count : 1, sizeof(FDSAPI_SESSION_CHANGE));
+
+					if (pChanges)
+					{
+						for (size_t i = 0; i < count; i++)
+						{
+							TSessionChange& change = apiReturn.changeList.at(i);
+
+							pChanges[i].sessionId = change.sessionId;
+							pChanges[i].removed = change.removed ? TRUE : FALSE;
+							pChanges[i].connectState = change.connectState;
+
+							if (!change.removed)
+							{
+								pChanges[i].winStationName = _strdup(change.winStationName.c_str());
+								pChanges[i].userName = _strdup(change.userName.c_str());
+								pChanges[i].domain = _strdup(change.domain.c_str());
+							}
+						}
+
+						responseMsg.u.enumerateSessionChangesResponse.result = TRUE;
+						responseMsg.u.enumerateSessionChangesResponse.sequence = apiReturn.sequence;
+						responseMsg.u.enumerateSessionChangesResponse.reset = apiReturn.reset ? TRUE : FALSE;
+						responseMsg.u.enumerateSessionChangesResponse.cChanges = count;
+						responseMsg.u.enumerateSessionChangesResponse.pChanges = pChanges;
+					}
+				}
+
+				break;
+			}
+
 			case FDSAPI_QUERY_SESSION_INFORMATION_REQUEST_ID:
 			{
 				TReturnQuerySessionInformation apiReturn;
@@ -294,6 +357,22 @@ namespace freerds
 				break;
 			}
 
+			case FDSAPI_SUBSCRIBE_SESSION_EVENTS_REQUEST_ID:
+			{
+				FDSApiServer* server = (FDSApiServer*) rpcClient->custom;
+
+				responseMsg.messageId = FDSAPI_SUBSCRIBE_SESSION_EVENTS_RESPONSE_ID;
+				responseMsg.requestId = requestMsg.requestId;
+
+				server->subscribeSessionEvents(rpcClient,
+						requestMsg.u.subscribeSessionEventsRequest.sessionId,
+						requestMsg.u.subscribeSessionEventsRequest.eventMask);
+
+				responseMsg.u.subscribeSessionEventsResponse.result = TRUE;
+
+				break;
+			}
+
 			default:
 				break;
 			}
@@ -351,10 +430,10 @@ namespace freerds
 	{
 		wStream* s;
 		FDSAPI_MESSAGE msg;
+		UINT32 eventBit = FDSAPI_SESSION_EVENT_BIT(stateChange);
+		UINT32 sessions[2] = { FDSAPI_SESSION_ANY, sessionId };
+		int count = 0;
 
-		WLog_Print(logger_FDSApiServer, WLOG_DEBUG, "sessionId=%u, stateChange=%u", sessionId, stateChange);
-
-		// Broadcast a FDSAPI_SESSION_EVENT message to every client.
 		ZeroMemory(&msg, sizeof(msg));
 		msg.messageId = FDSAPI_SESSION_EVENT_ID;
 		msg.u.sessionEvent.sessionId = sessionId;
@@ -362,10 +441,96 @@ namespace freerds
 
 		s = FDSAPI_EncodeMessage(&msg);
 
-		if (s)
+		if (!s)
+			return;
+
+		{
+			// closing clients unsubscribe under this lock before they are freed
+			CSGuard guard(&m_CSection);
+
+			for (int index = 0; index < ((sessionId != FDSAPI_SESSION_ANY) ? 2 : 1); index++)
+			{
+				std::map<UINT32, TSubscriberMap>::iterator it = m_Subscribers.find(sessions[index]);
+
+				if (it == m_Subscribers.end())
+					continue;
+
+				for (TSubscriberMap::iterator subscriber = it->second.begin(); subscriber != it->second.end(); subscriber++)
+				{
+					if (!(subscriber->second & eventBit))
+						continue;
+
+					freerds_rpc_client_send_message(subscriber->first, Stream_Buffer(s), Stream_Length(s));
+					count++;
+				}
+			}
+		}
+
+		WLog_Print(logger_FDSApiServer, WLOG_DEBUG, "sessionId=%u, stateChange=%u, subscribers=%d",
+			sessionId, stateChange, count);
+
+		Stream_Free(s, TRUE);
+	}
+
+	void FDSApiServer::fireSessionChange(UINT32 sequence)
+	{
+		wStream* s;
+		FDSAPI_MESSAGE msg;
+
+		ZeroMemory(&msg, sizeof(msg));
+		msg.messageId = FDSAPI_SESSION_CHANGES_ID;
+		msg.u.sessionChanges.sequence = sequence;
+
+		s = FDSAPI_EncodeMessage(&msg);
+
+		if (!s)
+			return;
+
+		{
+			CSGuard guard(&m_CSection);
+
+			// the change feed is not tied to a session, only ANY subscriptions get it
+			std::map<UINT32, TSubscriberMap>::iterator it = m_Subscribers.find(FDSAPI_SESSION_ANY);
+
+			if (it != m_Subscribers.end())
+			{
+				for (TSubscriberMap::iterator subscriber = it->second.begin(); subscriber != it->second.end(); subscriber++)
+				{
+					if (subscriber->second & FDSAPI_SESSION_EVENT_CHANGES)
+						freerds_rpc_client_send_message(subscriber->first, Stream_Buffer(s), Stream_Length(s));
+				}
+			}
+		}
+
+		Stream_Free(s, TRUE);
+	}
+
+	void FDSApiServer::subscribeSessionEvents(rdsRpcClient* rpcClient, UINT32 sessionId, UINT32 eventMask)
+	{
+		CSGuard guard(&m_CSection);
+
+		std::map<rdsRpcClient*, UINT32>::iterator it = m_SubscribedSessions.find(rpcClient);
+
+		if (it != m_SubscribedSessions.end())
 		{
-			freerds_rpc_server_broadcast_message(m_RpcServer, Stream_Buffer(s), Stream_Length(s));
+			m_Subscribers[it->second].erase(rpcClient);
+
+			if (m_Subscribers[it->second].empty())
+				m_Subscribers.erase(it->second);
+
+			m_SubscribedSessions.erase(it);
 		}
+
+		if (!eventMask)
+			return;
+
+		m_Subscribers[sessionId][rpcClient] = eventMask;
+		m_SubscribedSessions[rpcClient] = sessionId;
+	}
+
+	void FDSApiServer::unsubscribeSessionEvents(rdsRpcClient* rpcClient)
+	{
+		subscribeSessionEvents(rpcClient, FDSAPI_SESSION_ANY, 0);
 	}
 
 	void FDSApiServer::startFDSApi()
@@ -377,6 +542,11 @@ namespace freerds
 	{
 		WLog_Print(logger_FDSApiServer, WLOG_INFO, "Stopping FDSApiServer ...");
 		freerds_rpc_server_stop(m_RpcServer);
+
+		// closed clients unsubscribe themselves, this only catches stragglers
+		CSGuard guard(&m_CSection);
+		m_Subscribers.clear();
+		m_SubscribedSessions.clear();
 	}
 }
 
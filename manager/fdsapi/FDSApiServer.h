@@ -28,6 +28,8 @@
 
 #include <freerds/rpc.h>
 
+#include <map>
+
 #include <boost/shared_ptr.hpp>
 
 #include "FDSApiHandler.h"
@@ -48,6 +50,10 @@ namespace freerds
 		CRITICAL_SECTION* getCritSection();
 
 		void fireSessionEvent(UINT32 sessionId, UINT32 stateChange);
+		void fireSessionChange(UINT32 sequence);
+
+		void subscribeSessionEvents(rdsRpcClient* rpcClient, UINT32 sessionId, UINT32 eventMask);
+		void unsubscribeSessionEvents(rdsRpcClient* rpcClient);
 
 	private:
 		static int RpcConnectionAccepted(rdsRpcClient* rpcClient);
@@ -60,6 +66,11 @@ namespace freerds
 		static shared_ptr<FDSApiHandler> m_FDSApiHandler;
 
 		rdsRpcServer* m_RpcServer;
+
+		// subscribed clients with their event mask, indexed by session id
+		typedef std::map<rdsRpcClient*, UINT32> TSubscriberMap;
+		std::map<UINT32, TSubscriberMap> m_Subscribers;
+		std::map<rdsRpcClient*, UINT32> m_SubscribedSessions;
 	};
 }
 
@@ -39,6 +39,7 @@
 #define FREERDS_PID_FILE	"freerds-manager.pid"
 
 static HANDLE g_TermEvent = NULL;
+static HANDLE g_ReloadEvent = NULL;
 
 void shutdown(int signal)
 {
@@ -48,6 +49,12 @@ void shutdown(int signal)
 		SetEvent(g_TermEvent);
 }
 
+void reload(int signal)
+{
+	if (g_ReloadEvent)
+		SetEvent(g_ReloadEvent);
+}
+
 COMMAND_LINE_ARGUMENT_A freerds_session_manager_args[] =
 {
 	{ "kill", COMMAND_LINE_VALUE_FLAG, "", NULL, NULL, -1, NULL, "kill daemon" },
@@ -277,11 +284,13 @@ int main(int argc, char** argv)
 	WLog_DBG("main", "started");
 
 	g_TermEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	g_ReloadEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
 #ifndef _WIN32
 	signal(SIGINT, shutdown);
 	signal(SIGKILL, shutdown);
 	signal(SIGTERM, shutdown);
+	signal(SIGHUP, reload);
 
 	/*
 	 * Ignore SIGPIPE - This can occur normally due to the use of
@@ -291,7 +300,6 @@ int main(int argc, char** argv)
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	APP_CONTEXT.startRPCEngine();
 	APP_CONTEXT.loadModulesFromPath(APP_CONTEXT.getLibraryPath());
 
 	APP_CONTEXT.getPropertyManager()->loadProperties(APP_CONTEXT.getSystemConfigPath() + "/config.ini");
@@ -300,13 +308,36 @@ int main(int argc, char** argv)
 	APP_CONTEXT.startTaskExecutor();
 	APP_CONTEXT.startSessionTimoutMonitor();
 
-	WaitForSingleObject(g_TermEvent, INFINITE);
+	// sessions of a previous instance have to be back before freerds reconnects
+	APP_CONTEXT.restoreSessions();
+
+	APP_CONTEXT.startSessionPrelaunch();
+	APP_CONTEXT.startRPCEngine();
+
+	HANDLE events[2];
+
+	events[0] = g_TermEvent;
+	events[1] = g_ReloadEvent;
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == (WAIT_OBJECT_0 + 1))
+	{
+		// SIGHUP, swap in a fresh configuration snapshot
+		APP_CONTEXT.getPropertyManager()->reloadProperties(APP_CONTEXT.getSystemConfigPath() + "/config.ini");
+	}
+
+	APP_CONTEXT.closeSessionJournal();
+
 	CloseHandle(g_TermEvent);
 	g_TermEvent = NULL;
+	CloseHandle(g_ReloadEvent);
+	g_ReloadEvent = NULL;
 
 	APP_CONTEXT.stopTaskExecutor();
 	APP_CONTEXT.stopRPCEngine();
 
+	// modules stop their own helpers, sessions keep running for the next start
+	APP_CONTEXT.getModuleManager()->exitModules();
+
 	DeleteFileA(pid_file);
 
 	return 0;
@@ -22,6 +22,7 @@
 #endif
 
 #include "Module.h"
+#include <winpr/crt.h>
 #include <winpr/wlog.h>
 #include <winpr/library.h>
 
@@ -29,7 +30,8 @@ namespace freerds
 {
 	static wLog* logger_Module = WLog_Get("freerds.Module");
 
-	Module::Module() : mfpNew(0), mfpFree(0), mfpStart(0), mfpStop(0)
+	Module::Module() : mfpNew(0), mfpFree(0), mfpStart(0), mfpStop(0),
+		mfpGetState(0), mfpAdopt(0), mfpExit(0)
 	{
 
 	}
@@ -59,6 +61,15 @@ namespace freerds
 		mfpNew = entrypoints->New;
 		mfpStart = entrypoints->Start;
 		mfpStop = entrypoints->Stop;
+
+		if (entrypoints->GetState && entrypoints->Adopt)
+		{
+			mfpGetState = entrypoints->GetState;
+			mfpAdopt = entrypoints->Adopt;
+		}
+
+		mfpExit = entrypoints->Exit;
+
 		mModuleName = std::string(entrypoints->Name);
 
 		return 0;
@@ -100,5 +111,41 @@ namespace freerds
 	{
 		return mfpStop(context);
 	}
-}
 
+	bool Module::canAdopt()
+	{
+		return (mfpGetState != 0);
+	}
+
+	bool Module::getState(RDS_MODULE_COMMON* context, RDS_MODULE_STATE* state)
+	{
+		ZeroMemory(state, sizeof(RDS_MODULE_STATE));
+
+		if (!mfpGetState)
+			return false;
+
+		return (mfpGetState(context, state) == 0);
+	}
+
+	std::string Module::adopt(RDS_MODULE_COMMON* context, RDS_MODULE_STATE* state)
+	{
+		char* pipeName;
+		std::string pipeNameStr;
+
+		if (!mfpAdopt)
+			return pipeNameStr;
+
+		pipeName = mfpAdopt(context, state);
+
+		if (pipeName)
+			pipeNameStr.assign(pipeName);
+
+		return pipeNameStr;
+	}
+
+	void Module::exit()
+	{
+		if (mfpExit)
+			mfpExit();
+	}
+}
@@ -43,12 +43,22 @@ namespace freerds
 		std::string start(RDS_MODULE_COMMON* context);
 		int stop(RDS_MODULE_COMMON* context);
 
+		bool canAdopt();
+		bool getState(RDS_MODULE_COMMON* context, RDS_MODULE_STATE* state);
+		std::string adopt(RDS_MODULE_COMMON* context, RDS_MODULE_STATE* state);
+
+		void exit();
+
 	private:
 		pRdsModuleNew mfpNew;
 		pRdsModuleFree mfpFree;
 
 		pRdsModuleStart mfpStart;
 		pRdsModuleStop mfpStop;
+
+		pRdsModuleGetState mfpGetState;
+		pRdsModuleAdopt mfpAdopt;
+		pRdsModuleExit mfpExit;
 		std::string mModuleFile;
 		std::string mModuleName;
 	};
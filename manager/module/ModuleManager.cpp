@@ -202,4 +202,12 @@ namespace freerds
 			return NULL;
 		}
 	}
+
+	void ModuleManager::exitModules()
+	{
+		std::map<std::string, Module*>::iterator it;
+
+		for (it = mModulesMap.begin(); it != mModulesMap.end(); it++)
+			it->second->exit();
+	}
 }
@@ -39,6 +39,7 @@ namespace freerds
 		int loadModulesFromPathAndEnv(std::string path, std::string pattern);
 
 		Module* getModule(std::string moduleName);
+		void exitModules();
 
 	private:
 		char pathSeparator;
@@ -39,10 +39,12 @@ namespace freerds
 
 		if (connectionId != 0)
 		{
-			CallOutLogOffUserSession logoffSession;
-			logoffSession.setConnectionId(connectionId);
-			APP_CONTEXT.getRpcOutgoingQueue()->addElement(&logoffSession);
-			WaitForSingleObject(logoffSession.getAnswerHandle(), 5000);
+			CallOutLogOffUserSession* logoffSession = new CallOutLogOffUserSession();
+			logoffSession->setConnectionId(connectionId);
+			logoffSession->addRef();
+			APP_CONTEXT.getRpcOutgoingQueue()->addElement(logoffSession);
+			WaitForSingleObject(logoffSession->getAnswerHandle(), 5000);
+			logoffSession->release();
 
 			APP_CONTEXT.getConnectionStore()->removeConnection(connectionId);
 		}
@@ -66,5 +68,14 @@ namespace freerds
 			WLog_Print(logger_TaskModuleShutdown, WLOG_ERROR, "session for id %d was not found!", m_SessionId);
 		}
 	}
-}
 
+	int TaskModuleShutdown::getPriority()
+	{
+		return TASK_PRIORITY_LOW;
+	}
+
+	UINT32 TaskModuleShutdown::getOrderingKey()
+	{
+		return m_SessionId;
+	}
+}
@@ -28,6 +28,8 @@ namespace freerds
 	{
 	public:
 		virtual void run();
+		virtual int getPriority();
+		virtual UINT32 getOrderingKey();
 		void setSessionId(UINT32 sessionId);
 
 	private:
@@ -22,10 +22,13 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/file.h>
 #include <winpr/path.h>
 #include <winpr/library.h>
 #include <winpr/environment.h>
 
+#include <signal.h>
+
 #include <list>
 #include <utils/StringHelpers.h>
 
@@ -33,8 +36,12 @@
 
 #include <session/TaskSessionTimeout.h>
 
+#define FREERDS_SESSION_JOURNAL_FILE	"freerds-manager.sessions"
+
 namespace freerds
 {
+	static wLog* logger_ApplicationContext = WLog_Get("freerds.ApplicationContext");
+
 	ApplicationContext::ApplicationContext()
 	{
 		wLogLayout* layout;
@@ -44,6 +51,9 @@ namespace freerds
 		configureExecutableSearchPath();
 
 		setupTestingPropValues();
+
+		mSessionTimeout = TaskSessionTimeoutPtr(new TaskSessionTimeout());
+		mSessionPrelaunch = TaskSessionPrelaunchPtr(new TaskSessionPrelaunch());
 	}
 
 	ApplicationContext::~ApplicationContext()
@@ -229,6 +239,11 @@ namespace freerds
 		return &mConnectionStore;
 	}
 
+	SessionJournal* ApplicationContext::getSessionJournal()
+	{
+		return &mSessionJournal;
+	}
+
 	PropertyManager* ApplicationContext::getPropertyManager()
 	{
 		return &mPropertyManager;
@@ -310,14 +325,205 @@ namespace freerds
 	}
 
 	void ApplicationContext::startSessionTimoutMonitor(){
-		TaskSessionTimeoutPtr task(new TaskSessionTimeout());
-		addTask(task);
+		addTask(mSessionTimeout);
+	}
+
+	void ApplicationContext::armSessionTimeout(UINT32 sessionId, PropertySetPtr properties) {
+		mSessionTimeout->armSession(sessionId, properties);
+	}
+
+	void ApplicationContext::cancelSessionTimeout(UINT32 sessionId) {
+		mSessionTimeout->cancelSession(sessionId);
+	}
+
+	void ApplicationContext::startSessionPrelaunch() {
+		addTask(mSessionPrelaunch);
+	}
+
+	SessionPtr ApplicationContext::claimPrelaunchedGreeter(std::string configName) {
+		return mSessionPrelaunch->claimGreeter(configName);
 	}
 
 	bool ApplicationContext::addTask(TaskPtr task) {
 		return mTaskExecutor.addTask(task);
 	}
 
+	static bool isJournalRecordValid(const SessionJournalRecord& record)
+	{
+		// writers never fill a field completely, the terminator is always there
+		return memchr(record.userName, '\0', sizeof(record.userName)) &&
+			memchr(record.domain, '\0', sizeof(record.domain)) &&
+			memchr(record.winStationName, '\0', sizeof(record.winStationName)) &&
+			memchr(record.moduleConfigName, '\0', sizeof(record.moduleConfigName)) &&
+			memchr(record.moduleName, '\0', sizeof(record.moduleName)) &&
+			memchr(record.pipeName, '\0', sizeof(record.pipeName)) &&
+			(record.moduleState.processCount <= RDS_MODULE_MAX_PROCESSES);
+	}
+
+	static UINT64 getProcessStartTime(DWORD pid)
+	{
+		int field;
+		FILE* file;
+		char* token;
+		char* context = NULL;
+		char buf[1024];
+		UINT64 startTime = 0;
+
+		sprintf_s(buf, sizeof(buf), "/proc/%d/stat", (int) pid);
+		file = fopen(buf, "r");
+
+		if (!file)
+			return 0;
+
+		if (!fgets(buf, sizeof(buf), file))
+			buf[0] = '\0';
+
+		fclose(file);
+
+		/* the command name may contain spaces, the fields after it do not */
+		token = strrchr(buf, ')');
+
+		if (!token)
+			return 0;
+
+		/* the state is field 3, the start time field 22 */
+		token = strtok_r(token + 1, " ", &context);
+
+		for (field = 3; token && (field < 22); field++)
+			token = strtok_r(NULL, " ", &context);
+
+		if (token)
+			startTime = strtoull(token, NULL, 10);
+
+		return startTime;
+	}
+
+	/**
+	 * Processes of a journaled session that is not adopted would run on
+	 * unsupervised. Those still started at the journaled time are the
+	 * session's own and are terminated, a pid that was reused or has no
+	 * start time recorded is only logged.
+	 */
+	static void terminateJournaledProcesses(const SessionJournalRecord& record)
+	{
+		UINT32 index;
+		UINT32 count = record.moduleState.processCount;
+
+		if (count > RDS_MODULE_MAX_PROCESSES)
+			count = RDS_MODULE_MAX_PROCESSES;
+
+		for (index = 0; index < count; index++)
+		{
+			DWORD pid = record.moduleState.processIds[index];
+			UINT64 startTime = record.moduleState.processStartTimes[index];
+
+			if (!pid)
+				continue;
+
+			if (startTime && (getProcessStartTime(pid) == startTime))
+			{
+				WLog_Print(logger_ApplicationContext, WLOG_WARN, "terminating process %lu of session %lu",
+					(unsigned long) pid, (unsigned long) record.sessionId);
+				kill((pid_t) pid, SIGTERM);
+			}
+			else if (getProcessStartTime(pid))
+			{
+				WLog_Print(logger_ApplicationContext, WLOG_WARN,
+					"process %lu of session %lu cannot be identified, not terminating it",
+					(unsigned long) pid, (unsigned long) record.sessionId);
+			}
+		}
+	}
+
+	void ApplicationContext::restoreSessions()
+	{
+		int restored = 0;
+		std::string journalPath = std::string(FREERDS_PID_PATH) + "/" + FREERDS_SESSION_JOURNAL_FILE;
+
+		if (!PathFileExistsA(FREERDS_PID_PATH))
+			CreateDirectoryA(FREERDS_PID_PATH, NULL);
+
+		if (!mSessionJournal.open(journalPath))
+			return;
+
+		std::list<SessionJournalRecord> records = mSessionJournal.getRecords();
+
+		for (std::list<SessionJournalRecord>::iterator it = records.begin(); it != records.end(); ++it)
+		{
+			SessionJournalRecord& record = *it;
+			SessionPtr session;
+
+			if (!isJournalRecordValid(record))
+			{
+				WLog_Print(logger_ApplicationContext, WLOG_WARN, "journal record of session %lu is damaged",
+					(unsigned long) record.sessionId);
+				mSessionJournal.removeSession(record.sessionId);
+				terminateJournaledProcesses(record);
+				continue;
+			}
+
+			session = mSessionStore.restoreSession(record.sessionId);
+
+			if (!session)
+			{
+				mSessionJournal.removeSession(record.sessionId);
+				terminateJournaledProcesses(record);
+				continue;
+			}
+
+			session->setAuthSession(record.authSession != 0);
+			session->setUserName(record.userName);
+			session->setDomain(record.domain);
+			session->setWinStationName(record.winStationName);
+			session->setModuleConfigName(record.moduleConfigName);
+			session->setClientDisplayWidth(record.displayWidth);
+			session->setClientDisplayHeight(record.displayHeight);
+			session->setClientDisplayColorDepth(record.displayColorDepth);
+
+			if (!session->adoptModule(record))
+			{
+				WLog_Print(logger_ApplicationContext, WLOG_WARN,
+					"cannot adopt session %lu of user %s (module %s, %lu processes)",
+					(unsigned long) record.sessionId, record.userName, record.moduleName,
+					(unsigned long) record.moduleState.processCount);
+				mSessionStore.removeSession(record.sessionId);
+				terminateJournaledProcesses(record);
+				continue;
+			}
+
+			// the prelaunch task does not know about old greeters, it starts fresh ones
+			if (record.connectState == WTSIdle)
+			{
+				session->stopModule();
+				mSessionStore.removeSession(record.sessionId);
+				continue;
+			}
+
+			session->setConnectState((WTS_CONNECTSTATE_CLASS) record.connectState);
+
+			if (record.connectionId)
+			{
+				ConnectionPtr connection = mConnectionStore.getOrCreateConnection(record.connectionId);
+
+				connection->setSessionId(record.sessionId);
+				connection->getClientInformation()->with = record.displayWidth;
+				connection->getClientInformation()->height = record.displayHeight;
+				connection->getClientInformation()->colordepth = record.displayColorDepth;
+			}
+
+			restored++;
+		}
+
+		WLog_Print(logger_ApplicationContext, WLOG_INFO, "restored %d of %d journaled sessions",
+			restored, (int) records.size());
+	}
+
+	void ApplicationContext::closeSessionJournal()
+	{
+		// sessions torn down during shutdown must stay journaled for the next start
+		mSessionJournal.close();
+	}
+
 	void ApplicationContext::rpcDisconnected()
 	{
 		getConnectionStore()->reset();
@@ -329,6 +535,10 @@ namespace freerds
 		{
 			SessionPtr currentSession = (*iterator);
 
+			// prelaunched greeters are not bound to a connection yet
+			if (currentSession->getConnectState() == WTSIdle)
+				continue;
+
 			if (currentSession->isAuthSession())
 			{
 				currentSession->stopModule();
@@ -26,7 +26,10 @@
 #include <utils/SignalingQueue.h>
 
 #include <session/SessionStore.h>
+#include <session/SessionJournal.h>
 #include <session/ConnectionStore.h>
+#include <session/TaskSessionTimeout.h>
+#include <session/TaskSessionPrelaunch.h>
 
 #include <call/CallOut.h>
 #include <task/Executor.h>
@@ -46,6 +49,7 @@ namespace freerds
 	public:
 		SessionStore* getSessionStore();
 		ConnectionStore* getConnectionStore();
+		SessionJournal* getSessionJournal();
 		PropertyManager* getPropertyManager();
 		ModuleManager* getModuleManager();
 		FDSApiServer* getFDSApiServer();
@@ -56,8 +60,15 @@ namespace freerds
 		void startTaskExecutor();
 		void stopTaskExecutor();
 		void startSessionTimoutMonitor();
+		void armSessionTimeout(UINT32 sessionId, PropertySetPtr properties);
+		void cancelSessionTimeout(UINT32 sessionId);
+		void startSessionPrelaunch();
+		SessionPtr claimPrelaunchedGreeter(std::string configName);
 		bool addTask(TaskPtr task);
 
+		void restoreSessions();
+		void closeSessionJournal();
+
 		std::string getHomePath();
 		std::string getLibraryPath();
 		std::string getExecutablePath();
@@ -86,6 +97,9 @@ namespace freerds
 		wLog* mWLogRoot;
 
 		Executor mTaskExecutor;
+		TaskSessionTimeoutPtr mSessionTimeout;
+		TaskSessionPrelaunchPtr mSessionPrelaunch;
+		SessionJournal mSessionJournal;
 		SessionStore mSessionStore;
 		ConnectionStore mConnectionStore;
 
@@ -68,6 +68,11 @@ namespace freerds
 
 	void Connection::setSessionId(UINT32 sessionId) {
 		m_SessionId = sessionId;
+
+		if (sessionId)
+			APP_CONTEXT.getSessionJournal()->setConnection(sessionId, m_ConnectionId);
+		else
+			APP_CONTEXT.getSessionJournal()->removeConnection(m_ConnectionId);
 	}
 
 	UINT32 Connection::getSessionId() {
@@ -89,7 +94,7 @@ namespace freerds
 
 		std::string authModule;
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyString("auth.module", authModule)) {
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyString(PROPERTY_KEY_AUTH_MODULE, authModule)) {
 			authModule = "PAM";
 		}
 
@@ -24,6 +24,7 @@
 #include "ConnectionStore.h"
 #include <winpr/wlog.h>
 #include <utils/CSGuard.h>
+#include <session/ApplicationContext.h>
 
 namespace freerds
 {
@@ -73,6 +74,7 @@ namespace freerds
 	{
 		CSGuard guard(&m_CSection);
 		m_ConnectionMap.erase(connectionId);
+		APP_CONTEXT.getSessionJournal()->removeConnection(connectionId);
 		return 0;
 	}
 
@@ -101,6 +103,7 @@ namespace freerds
 	{
 		CSGuard guard(&m_CSection);
 		m_ConnectionMap.clear();
+		APP_CONTEXT.getSessionJournal()->clearConnections();
 	}
 }
 
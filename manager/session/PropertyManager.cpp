@@ -28,162 +28,345 @@
 
 #include "PropertyManager.h"
 
+#ifndef _WIN32
+#include <pwd.h>
+#include <grp.h>
+#endif
+
 #include <winpr/wlog.h>
 
 #include <session/ApplicationContext.h>
+#include <utils/CSGuard.h>
 
 namespace freerds
 {
+	static wLog* logger_PropertyManager = WLog_Get("freerds.PropertyManager");
+
+	static const char* wellKnownKeys[] =
+	{
+		"module",
+		"auth.module",
+		"auth.greeter",
+		"session.reconnect",
+		"session.timeout"
+	};
+
 	PropertyManager::PropertyManager()
+	: mGeneration(0)
 	{
+		if (!InitializeCriticalSectionAndSpinCount(&mCSection, 0x00000400))
+		{
+			WLog_Print(logger_PropertyManager, WLOG_FATAL, "cannot init PropertyManager critical section!");
+		}
+
+		if (!InitializeCriticalSectionAndSpinCount(&mSnapshotLock, 0x00000400))
+		{
+			WLog_Print(logger_PropertyManager, WLOG_FATAL, "cannot init PropertyManager snapshot critical section!");
+		}
+
 		ini = IniFile_New();
+
+		for (size_t index = 0; index < (sizeof(wellKnownKeys) / sizeof(wellKnownKeys[0])); index++)
+		{
+			mKeyIndex[wellKnownKeys[index]] = (PropertyKey) mKeyNames.size();
+			mKeyNames.push_back(wellKnownKeys[index]);
+		}
+
+		rebuildSnapshot();
 	};
 
 	PropertyManager::~PropertyManager()
 	{
 		IniFile_Free(ini);
+		DeleteCriticalSection(&mSnapshotLock);
+		DeleteCriticalSection(&mCSection);
 	};
 
-	int PropertyManager::getKeyValueInt(const char* section, const char* key)
+	void PropertyManager::rebuildSnapshot()
 	{
-		int intVal;
+		/**
+		 * Called with mCSection held. Readers only ever take a reference to
+		 * the current snapshot, so the new one is built without blocking
+		 * them and published with a single pointer swap.
+		 */
 
-		if (!ini)
-			return FALSE;
+		LONG generation = InterlockedIncrement(&mGeneration);
+		PropertySnapshotPtr snapshot(new PropertySnapshot(ini, mKeyNames, generation));
 
-		intVal = IniFile_GetKeyValueInt(ini, section, key);
+		CSGuard guard(&mSnapshotLock);
+		mSnapshot = snapshot;
+	}
 
-		if (intVal < 0)
-			return -1;
+	PropertySnapshotPtr PropertyManager::getSnapshot()
+	{
+		CSGuard guard(&mSnapshotLock);
+		return mSnapshot;
+	}
 
-		return intVal;
+	LONG PropertyManager::getGeneration()
+	{
+		return mGeneration;
 	}
 
-	const char* PropertyManager::getKeyValueString(const char* section, const char* key)
+	PropertyKey PropertyManager::internKey(std::string path)
 	{
-		const char* strVal;
+		CSGuard guard(&mCSection);
 
-		if (!ini)
-			return FALSE;
+		TPropertyKeyMap::iterator iter = mKeyIndex.find(path);
+
+		if (iter != mKeyIndex.end())
+			return iter->second;
+
+		PropertyKey key = (PropertyKey) mKeyNames.size();
 
-		strVal = IniFile_GetKeyValueString(ini, section, key);
+		mKeyNames.push_back(path);
+		mKeyIndex[path] = key;
 
-		if (!strVal)
-			return NULL;
+		rebuildSnapshot();
 
-		return strVal;
+		return key;
 	}
 
-	BOOL PropertyManager::getPropertyBool(std::string path, BOOL* value)
+	std::string PropertyManager::getKeyName(PropertyKey key)
 	{
-		int intVal;
+		CSGuard guard(&mCSection);
 
-		if (!ini)
-			return FALSE;
+		if (key >= mKeyNames.size())
+			return std::string();
 
-		intVal = IniFile_GetKeyValueInt(ini, "global", path.c_str());
+		return mKeyNames[key];
+	}
 
-		if (intVal < 0)
-			return FALSE;
+	std::vector<std::string> PropertyManager::getUserGroups(std::string username)
+	{
+		std::vector<std::string> groups;
+#ifndef _WIN32
+		int count = 32;
+		char buffer[4096];
+		struct passwd pwd;
+		struct passwd* pwdResult = NULL;
 
-		*value = (!intVal) ? FALSE : TRUE;
+		if (username.empty())
+			return groups;
 
-		return TRUE;
+		if (getpwnam_r(username.c_str(), &pwd, buffer, sizeof(buffer), &pwdResult) || !pwdResult)
+			return groups;
+
+		std::vector<gid_t> gids(count);
+
+		if (getgrouplist(username.c_str(), pwd.pw_gid, &gids[0], &count) < 0)
+		{
+			gids.resize(count);
+
+			if (getgrouplist(username.c_str(), pwd.pw_gid, &gids[0], &count) < 0)
+				return groups;
+		}
+
+		for (int index = 0; index < count; index++)
+		{
+			struct group grp;
+			struct group* grpResult = NULL;
+
+			if (!getgrgid_r(gids[index], &grp, buffer, sizeof(buffer), &grpResult) && grpResult)
+				groups.push_back(grp.gr_name);
+		}
+#endif
+		return groups;
 	}
 
-	BOOL PropertyManager::getPropertyBool(std::string path, bool &value)
+	PropertySetPtr PropertyManager::resolveProperties(std::string username)
+	{
+		std::vector<std::string> groups;
+		PropertySnapshotPtr snapshot = getSnapshot();
+
+		// group lookups may hit NSS, skip them unless they can matter
+		if (snapshot->hasGroupSections())
+			groups = getUserGroups(username);
+
+		return PropertySetPtr(new PropertySet(snapshot, username, groups));
+	}
+
+	int PropertyManager::getKeyValueInt(const char* section, const char* key)
 	{
 		int intVal;
 
+		CSGuard guard(&mCSection);
+
 		if (!ini)
 			return FALSE;
 
-		intVal = IniFile_GetKeyValueInt(ini, "global", path.c_str());
+		intVal = IniFile_GetKeyValueInt(ini, section, key);
 
 		if (intVal < 0)
+			return -1;
+
+		return intVal;
+	}
+
+	BOOL PropertyManager::getPropertyBool(std::string path, BOOL* value)
+	{
+		bool boolVal;
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
+
+		if (!(property = snapshot->find(path)) || !property->getBool(boolVal))
 			return FALSE;
 
-		value = (!intVal) ? false : true;
+		*value = boolVal ? TRUE : FALSE;
 
 		return TRUE;
 	}
 
-	BOOL PropertyManager::getPropertyNumber(std::string path, long* value)
+	BOOL PropertyManager::getPropertyBool(std::string path, bool &value)
 	{
-		int intVal;
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
 
-		if (!ini)
+		if (!(property = snapshot->find(path)))
 			return FALSE;
 
-		intVal = IniFile_GetKeyValueInt(ini, "global", path.c_str());
+		return property->getBool(value);
+	}
 
-		if (intVal < 0)
-			return FALSE;
+	BOOL PropertyManager::getPropertyNumber(std::string path, long* value)
+	{
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
 
-		*value = intVal;
+		if (!(property = snapshot->find(path)))
+			return FALSE;
 
-		return TRUE;
+		return property->getNumber(value);
 	}
 
 	BOOL PropertyManager::getPropertyString(std::string path, std::string &value)
 	{
-		const char* strVal;
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
 
-		if (!ini)
+		if (!(property = snapshot->find(path)))
 			return FALSE;
 
-		strVal = IniFile_GetKeyValueString(ini, "global", path.c_str());
+		return property->getString(value);
+	}
+
+	BOOL PropertyManager::getPropertyBool(PropertyKey key, bool &value)
+	{
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
 
-		if (!strVal)
+		if (!(property = snapshot->find(key)))
 			return FALSE;
 
-		value = strVal;
+		return property->getBool(value);
+	}
 
-		return TRUE;
+	BOOL PropertyManager::getPropertyNumber(PropertyKey key, long* value)
+	{
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
+
+		if (!(property = snapshot->find(key)))
+			return FALSE;
+
+		return property->getNumber(value);
+	}
+
+	BOOL PropertyManager::getPropertyString(PropertyKey key, std::string &value)
+	{
+		const PropertyValue* property;
+		PropertySnapshotPtr snapshot = getSnapshot();
+
+		if (!(property = snapshot->find(key)))
+			return FALSE;
+
+		return property->getString(value);
 	}
 
 	int PropertyManager::setPropertyBool(std::string path, bool value)
 	{
+		CSGuard guard(&mCSection);
+
 		if (!ini)
 			return 0;
 
 		IniFile_SetKeyValueInt(ini, "global", path.c_str(), value ? 1 : 0);
+		rebuildSnapshot();
 
 		return 0;
 	}
 
 	int PropertyManager::setPropertyNumber(std::string path, long value)
 	{
+		CSGuard guard(&mCSection);
+
 		if (!ini)
 			return 0;
 
 		IniFile_SetKeyValueInt(ini, "global", path.c_str(), value);
+		rebuildSnapshot();
 
 		return 0;
 	}
 
 	int PropertyManager::setPropertyString(std::string path, std::string value)
 	{
-		int status;
+		CSGuard guard(&mCSection);
 
 		if (!ini)
 			return 0;
 
-		status = IniFile_SetKeyValueString(ini, "global", path.c_str(), value.c_str());
+		IniFile_SetKeyValueString(ini, "global", path.c_str(), value.c_str());
+		rebuildSnapshot();
 
 		return 0;
 	}
 
 	int PropertyManager::loadProperties(std::string filename)
 	{
+		CSGuard guard(&mCSection);
+
 		if (IniFile_ReadFile(ini, filename.c_str()) < 0)
 			return 0;
 
+		rebuildSnapshot();
+
+		return 0;
+	}
+
+	int PropertyManager::reloadProperties(std::string filename)
+	{
+		wIniFile* newIni = IniFile_New();
+
+		/**
+		 * Parse into a fresh ini first so a broken file leaves the
+		 * running configuration untouched.
+		 */
+
+		if (!newIni || (IniFile_ReadFile(newIni, filename.c_str()) < 0))
+		{
+			WLog_Print(logger_PropertyManager, WLOG_ERROR, "reload of %s failed, keeping current configuration", filename.c_str());
+			if (newIni)
+				IniFile_Free(newIni);
+			return -1;
+		}
+
+		CSGuard guard(&mCSection);
+
+		IniFile_Free(ini);
+		ini = newIni;
+
+		rebuildSnapshot();
+
+		WLog_Print(logger_PropertyManager, WLOG_INFO, "reloaded %s (generation %d)", filename.c_str(), mGeneration);
+
 		return 0;
 	}
 
 	int PropertyManager::saveProperties(std::string filename)
 	{
+		CSGuard guard(&mCSection);
+
 		if (!ini)
 			return 0;
 
@@ -28,19 +28,44 @@
 
 #include <winpr/crt.h>
 #include <winpr/ini.h>
+#include <winpr/synch.h>
 
 #include <string>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include "PropertySnapshot.h"
+
+/* keys interned by the PropertyManager constructor, in this order */
+#define PROPERTY_KEY_MODULE			0
+#define PROPERTY_KEY_AUTH_MODULE		1
+#define PROPERTY_KEY_AUTH_GREETER		2
+#define PROPERTY_KEY_SESSION_RECONNECT		3
+#define PROPERTY_KEY_SESSION_TIMEOUT		4
 
 namespace freerds
 {
+	typedef boost::unordered_map<std::string, PropertyKey> TPropertyKeyMap;
+
 	class PropertyManager
 	{
 	public:
 		PropertyManager();
 		~PropertyManager();
 
+		PropertyKey internKey(std::string path);
+		std::string getKeyName(PropertyKey key);
+
+		LONG getGeneration();
+		PropertySnapshotPtr getSnapshot();
+		PropertySetPtr resolveProperties(std::string username);
+
+		BOOL getPropertyBool(PropertyKey key, bool &value);
+		BOOL getPropertyNumber(PropertyKey key, long* value);
+		BOOL getPropertyString(PropertyKey key, std::string &value);
+
 		int getKeyValueInt(const char* section, const char* key);
-		const char* getKeyValueString(const char* section, const char* key);
 
 		BOOL getPropertyBool(std::string path, BOOL* value);
 		BOOL getPropertyBool(std::string path, bool &value);
@@ -53,9 +78,21 @@ namespace freerds
 
 		int saveProperties(std::string filename);
 		int loadProperties(std::string filename);
+		int reloadProperties(std::string filename);
 
 	private:
+		void rebuildSnapshot();
+		std::vector<std::string> getUserGroups(std::string username);
+
 		wIniFile* ini;
+		CRITICAL_SECTION mCSection;
+		CRITICAL_SECTION mSnapshotLock;
+
+		std::vector<std::string> mKeyNames;
+		TPropertyKeyMap mKeyIndex;
+
+		LONG volatile mGeneration;
+		PropertySnapshotPtr mSnapshot;
 	};
 }
 
@@ -0,0 +1,265 @@
+/**
+ * Immutable, pre-parsed view of the manager configuration
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "PropertySnapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <session/ApplicationContext.h>
+
+namespace freerds
+{
+	PropertyValue::PropertyValue()
+	: mNumber(0), mHasNumber(false), mBool(false), mHasBool(false)
+	{
+	}
+
+	PropertyValue::PropertyValue(const char* value)
+	: mString(value ? value : ""), mNumber(0), mHasNumber(false), mBool(false), mHasBool(false)
+	{
+		char* end = NULL;
+		const char* str = mString.c_str();
+
+		mNumber = strtol(str, &end, 10);
+
+		if (end != str)
+		{
+			mHasNumber = true;
+			mHasBool = true;
+			mBool = (mNumber != 0);
+		}
+		else if (!_stricmp(str, "true") || !_stricmp(str, "yes") || !_stricmp(str, "on"))
+		{
+			mHasBool = true;
+			mBool = true;
+		}
+		else if (!_stricmp(str, "false") || !_stricmp(str, "no") || !_stricmp(str, "off"))
+		{
+			mHasBool = true;
+			mBool = false;
+		}
+	}
+
+	BOOL PropertyValue::getBool(bool& value) const
+	{
+		if (!mHasBool)
+			return FALSE;
+
+		value = mBool;
+		return TRUE;
+	}
+
+	BOOL PropertyValue::getNumber(long* value) const
+	{
+		if (!mHasNumber)
+			return FALSE;
+
+		*value = mNumber;
+		return TRUE;
+	}
+
+	BOOL PropertyValue::getString(std::string& value) const
+	{
+		value = mString;
+		return TRUE;
+	}
+
+	PropertySnapshot::PropertySnapshot(wIniFile* ini, const std::vector<std::string>& keyNames, LONG generation)
+	: mGeneration(generation), mGlobal(NULL), mHasGroupSections(false), mKeyNames(keyNames)
+	{
+		int sectionCount = 0;
+		char** sectionNames = NULL;
+
+		if (ini)
+			sectionNames = IniFile_GetSectionNames(ini, &sectionCount);
+
+		for (int section = 0; section < sectionCount; section++)
+		{
+			int keyCount = 0;
+			char** sectionKeys = IniFile_GetSectionKeyNames(ini, sectionNames[section], &keyCount);
+			TPropertyMap& values = mSections[sectionNames[section]];
+
+			if (!strncmp(sectionNames[section], "group.", 6))
+				mHasGroupSections = true;
+
+			for (int key = 0; key < keyCount; key++)
+			{
+				values[sectionKeys[key]] = PropertyValue(
+					IniFile_GetKeyValueString(ini, sectionNames[section], sectionKeys[key]));
+			}
+
+			free(sectionKeys);
+		}
+
+		free(sectionNames);
+
+		// element addresses of the maps are stable from here on
+		mGlobal = &mSections["global"];
+
+		mKeyed.resize(mKeyNames.size(), NULL);
+
+		for (size_t key = 0; key < mKeyNames.size(); key++)
+			mKeyed[key] = find(mKeyNames[key]);
+	}
+
+	LONG PropertySnapshot::getGeneration() const
+	{
+		return mGeneration;
+	}
+
+	const std::vector<std::string>& PropertySnapshot::getKeyNames() const
+	{
+		return mKeyNames;
+	}
+
+	const PropertyValue* PropertySnapshot::find(PropertyKey key) const
+	{
+		if (key >= mKeyed.size())
+			return NULL;
+
+		return mKeyed[key];
+	}
+
+	const PropertyValue* PropertySnapshot::find(const std::string& path) const
+	{
+		TPropertyMap::const_iterator iter = mGlobal->find(path);
+
+		if (iter == mGlobal->end())
+			return NULL;
+
+		return &iter->second;
+	}
+
+	const TPropertyMap* PropertySnapshot::getSection(const std::string& section) const
+	{
+		TPropertySectionMap::const_iterator iter = mSections.find(section);
+
+		if (iter == mSections.end())
+			return NULL;
+
+		return &iter->second;
+	}
+
+	bool PropertySnapshot::hasGroupSections() const
+	{
+		return mHasGroupSections;
+	}
+
+	PropertySet::PropertySet(PropertySnapshotPtr snapshot, const std::string& username,
+			const std::vector<std::string>& groups)
+	: mSnapshot(snapshot), mUsername(username)
+	{
+		const TPropertyMap* section;
+		const PropertyValue* legacy;
+
+		// session.timeout.<name> of configs without user sections, the sections win over it
+		if (username.size() && ((legacy = mSnapshot->find("session.timeout." + username)) != NULL))
+			mOverrides["session.timeout"] = *legacy;
+
+		// later sections win, so the user section is applied last
+		for (std::vector<std::string>::const_iterator it = groups.begin(); it != groups.end(); it++)
+		{
+			if ((section = mSnapshot->getSection("group." + *it)) != NULL)
+			{
+				for (TPropertyMap::const_iterator value = section->begin(); value != section->end(); value++)
+					mOverrides[value->first] = value->second;
+			}
+		}
+
+		if (username.size() && ((section = mSnapshot->getSection("user." + username)) != NULL))
+		{
+			for (TPropertyMap::const_iterator value = section->begin(); value != section->end(); value++)
+				mOverrides[value->first] = value->second;
+		}
+
+		const std::vector<std::string>& keyNames = mSnapshot->getKeyNames();
+
+		mKeyed.resize(keyNames.size(), NULL);
+
+		for (size_t key = 0; key < keyNames.size(); key++)
+			mKeyed[key] = find(keyNames[key]);
+	}
+
+	LONG PropertySet::getGeneration()
+	{
+		return mSnapshot->getGeneration();
+	}
+
+	std::string PropertySet::getUserName()
+	{
+		return mUsername;
+	}
+
+	const PropertyValue* PropertySet::find(PropertyKey key)
+	{
+		if (key < mKeyed.size())
+			return mKeyed[key];
+
+		// interned after this set was resolved
+		return find(APP_CONTEXT.getPropertyManager()->getKeyName(key));
+	}
+
+	const PropertyValue* PropertySet::find(const std::string& path)
+	{
+		TPropertyMap::const_iterator iter = mOverrides.find(path);
+
+		if (iter != mOverrides.end())
+			return &iter->second;
+
+		return mSnapshot->find(path);
+	}
+
+	BOOL PropertySet::getPropertyBool(PropertyKey key, bool& value)
+	{
+		const PropertyValue* property = find(key);
+		return property ? property->getBool(value) : FALSE;
+	}
+
+	BOOL PropertySet::getPropertyNumber(PropertyKey key, long* value)
+	{
+		const PropertyValue* property = find(key);
+		return property ? property->getNumber(value) : FALSE;
+	}
+
+	BOOL PropertySet::getPropertyString(PropertyKey key, std::string& value)
+	{
+		const PropertyValue* property = find(key);
+		return property ? property->getString(value) : FALSE;
+	}
+
+	BOOL PropertySet::getPropertyBool(const std::string& path, bool& value)
+	{
+		const PropertyValue* property = find(path);
+		return property ? property->getBool(value) : FALSE;
+	}
+
+	BOOL PropertySet::getPropertyNumber(const std::string& path, long* value)
+	{
+		const PropertyValue* property = find(path);
+		return property ? property->getNumber(value) : FALSE;
+	}
+
+	BOOL PropertySet::getPropertyString(const std::string& path, std::string& value)
+	{
+		const PropertyValue* property = find(path);
+		return property ? property->getString(value) : FALSE;
+	}
+}
@@ -0,0 +1,121 @@
+/**
+ * Immutable, pre-parsed view of the manager configuration
+ *
+ * A PropertySnapshot is built from the ini file whenever the
+ * configuration changes and is never modified afterwards, so
+ * lookups need no locking. A PropertySet is the view of one
+ * snapshot for a single user, with the [user.<name>] and
+ * [group.<name>] overrides already merged in.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROPERTYSNAPSHOT_H_
+#define PROPERTYSNAPSHOT_H_
+
+#include <winpr/crt.h>
+#include <winpr/ini.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace freerds
+{
+	typedef UINT32 PropertyKey;
+
+	class PropertyValue
+	{
+	public:
+		PropertyValue();
+		PropertyValue(const char* value);
+
+		BOOL getBool(bool& value) const;
+		BOOL getNumber(long* value) const;
+		BOOL getString(std::string& value) const;
+
+	private:
+		std::string mString;
+		long mNumber;
+		bool mHasNumber;
+		bool mBool;
+		bool mHasBool;
+	};
+
+	typedef boost::unordered_map<std::string, PropertyValue> TPropertyMap;
+	typedef std::map<std::string, TPropertyMap> TPropertySectionMap;
+
+	class PropertySnapshot
+	{
+	public:
+		PropertySnapshot(wIniFile* ini, const std::vector<std::string>& keyNames, LONG generation);
+
+		LONG getGeneration() const;
+		const std::vector<std::string>& getKeyNames() const;
+
+		const PropertyValue* find(PropertyKey key) const;
+		const PropertyValue* find(const std::string& path) const;
+		const TPropertyMap* getSection(const std::string& section) const;
+		bool hasGroupSections() const;
+
+	private:
+		PropertySnapshot(const PropertySnapshot&);
+		PropertySnapshot& operator=(const PropertySnapshot&);
+
+		LONG mGeneration;
+		TPropertySectionMap mSections;
+		const TPropertyMap* mGlobal;
+		bool mHasGroupSections;
+		std::vector<std::string> mKeyNames;
+		std::vector<const PropertyValue*> mKeyed;
+	};
+
+	typedef boost::shared_ptr<const PropertySnapshot> PropertySnapshotPtr;
+
+	class PropertySet
+	{
+	public:
+		PropertySet(PropertySnapshotPtr snapshot, const std::string& username,
+				const std::vector<std::string>& groups);
+
+		LONG getGeneration();
+		std::string getUserName();
+
+		BOOL getPropertyBool(PropertyKey key, bool& value);
+		BOOL getPropertyNumber(PropertyKey key, long* value);
+		BOOL getPropertyString(PropertyKey key, std::string& value);
+
+		BOOL getPropertyBool(const std::string& path, bool& value);
+		BOOL getPropertyNumber(const std::string& path, long* value);
+		BOOL getPropertyString(const std::string& path, std::string& value);
+
+	private:
+		PropertySet(const PropertySet&);
+		PropertySet& operator=(const PropertySet&);
+
+		const PropertyValue* find(PropertyKey key);
+		const PropertyValue* find(const std::string& path);
+
+		PropertySnapshotPtr mSnapshot;
+		std::string mUsername;
+		TPropertyMap mOverrides;
+		std::vector<const PropertyValue*> mKeyed;
+	};
+
+	typedef boost::shared_ptr<PropertySet> PropertySetPtr;
+}
+
+#endif /* PROPERTYSNAPSHOT_H_ */
@@ -36,6 +36,7 @@
 #include <module/AuthModule.h>
 #include <fdsapi/FDSApiServer.h>
 #include <session/ApplicationContext.h>
+#include <utils/CSGuard.h>
 
 namespace freerds
 {
@@ -63,6 +64,7 @@ namespace freerds
 	{
 		// Mark the session as down.
 		setConnectState(WTSDown);
+		APP_CONTEXT.getSessionJournal()->removeSession(m_SessionId);
 
 		// Fire a session terminated event.
 		FDSApiServer* FDSApiServer = APP_CONTEXT.getFDSApiServer();
@@ -77,16 +79,63 @@ namespace freerds
 	void Session::setDomain(std::string domainName)
 	{
 		mDomain = domainName;
+		APP_CONTEXT.getSessionStore()->updateSessionUser(m_SessionId, mUsername, mDomain);
+		writeJournal();
 	}
 
 	std::string Session::getUserName()
 	{
+		CSGuard guard(&mCSection);
 		return mUsername;
 	}
 
 	void Session::setUserName(std::string username)
 	{
-		mUsername = username;
+		{
+			CSGuard guard(&mCSection);
+			mUsername = username;
+		}
+
+		APP_CONTEXT.getSessionStore()->updateSessionUser(m_SessionId, username, mDomain);
+		writeJournal();
+	}
+
+	PropertySetPtr Session::getProperties()
+	{
+		std::string username;
+		PropertySetPtr properties;
+		PropertyManager* propertyManager = APP_CONTEXT.getPropertyManager();
+
+		{
+			CSGuard guard(&mCSection);
+
+			// resolved once, again only after a reload or a user change
+			if (mProperties && (mProperties->getGeneration() == propertyManager->getGeneration()) &&
+					(mProperties->getUserName() == mUsername))
+			{
+				return mProperties;
+			}
+
+			username = mUsername;
+		}
+
+		// group lookups may go to NSS, so not under the session lock
+		properties = propertyManager->resolveProperties(username);
+
+		{
+			CSGuard guard(&mCSection);
+
+			if (mUsername == username)
+				mProperties = properties;
+		}
+
+		return properties;
+	}
+
+	void Session::setProperties(PropertySetPtr properties)
+	{
+		CSGuard guard(&mCSection);
+		mProperties = properties;
 	}
 
 	std::string Session::getWinStationName()
@@ -96,7 +145,11 @@ namespace freerds
 
 	void Session::setWinStationName(std::string winStationName)
 	{
+		if (mWinStationName == winStationName)
+			return;
+
 		mWinStationName = winStationName;
+		APP_CONTEXT.getSessionStore()->markSessionChanged(m_SessionId);
 	}
 
 	UINT32 Session::getSessionId()
@@ -202,6 +255,7 @@ namespace freerds
 	void Session::setAuthSession(bool authSession)
 	{
 		mAuthSession = authSession;
+		writeJournal();
 	}
 
 	bool Session::generateUserToken()
@@ -329,7 +383,7 @@ namespace freerds
 		std::string configBaseName = std::string("module.") + mModuleConfigName;
 		std::string queryString = configBaseName+std::string(".modulename");
 
-		if (!APP_CONTEXT.getPropertyManager()->getPropertyString(queryString,mModuleName)) {
+		if (!getProperties()->getPropertyString(queryString,mModuleName)) {
 			WLog_Print(logger_Session, WLOG_ERROR, "startModule failed, Property %s not found.", queryString.c_str());
 			return false;
 		}
@@ -342,17 +396,7 @@ namespace freerds
 			return false;
 		}
 
-		mCurrentModuleContext = currentModule->newContext();
-		mCurrentModuleContext->sessionId = m_SessionId;
-
-		mCurrentModuleContext->userName = _strdup(mUsername.c_str());
-
-		mCurrentModuleContext->userToken = mUserToken;
-		mCurrentModuleContext->envBlock = dupEnv(mpEnvBlock);
-		mCurrentModuleContext->baseConfigPath = _strdup(configBaseName.c_str());
-
-		mCurrentModuleContext->desktopWidth = (int) getClientDisplayWidth();
-		mCurrentModuleContext->desktopHeight = (int) getClientDisplayHeight();
+		mCurrentModuleContext = newModuleContext(currentModule, configBaseName);
 
 		pName = currentModule->start(mCurrentModuleContext);
 
@@ -371,6 +415,124 @@ namespace freerds
 		}
 	}
 
+	bool Session::adoptModule(const SessionJournalRecord& record)
+	{
+		std::string pName;
+		RDS_MODULE_STATE state = record.moduleState;
+
+		if (mSessionStarted)
+		{
+			WLog_Print(logger_Session, WLOG_ERROR, "adoptModule failed, session has already be started, stop first.");
+			return false;
+		}
+
+		mModuleName = record.moduleName;
+
+		Module* currentModule = APP_CONTEXT.getModuleManager()->getModule(mModuleName);
+
+		if (!currentModule || !currentModule->canAdopt())
+		{
+			WLog_Print(logger_Session, WLOG_ERROR, "adoptModule failed, module %s cannot adopt sessions", mModuleName.c_str());
+			return false;
+		}
+
+		if (mAuthSession)
+		{
+			if (!generateAuthEnvBlockAndModify())
+				return false;
+		}
+		else if (!generateUserToken() || !generateEnvBlockAndModify())
+		{
+			WLog_Print(logger_Session, WLOG_ERROR, "adoptModule failed, cannot log on user %s", mUsername.c_str());
+			return false;
+		}
+
+		mCurrentModuleContext = newModuleContext(currentModule, std::string("module.") + mModuleConfigName);
+
+		pName = currentModule->adopt(mCurrentModuleContext, &state);
+
+		if (pName.length() == 0)
+		{
+			currentModule->freeContext(mCurrentModuleContext);
+			mCurrentModuleContext = NULL;
+			return false;
+		}
+
+		mPipeName = pName;
+		mSessionStarted = true;
+
+		return true;
+	}
+
+	RDS_MODULE_COMMON* Session::newModuleContext(Module* module, std::string configBaseName)
+	{
+		RDS_MODULE_COMMON* context = module->newContext();
+
+		context->sessionId = m_SessionId;
+
+		context->userName = _strdup(mUsername.c_str());
+
+		context->userToken = mUserToken;
+		context->envBlock = dupEnv(mpEnvBlock);
+		context->baseConfigPath = _strdup(configBaseName.c_str());
+
+		context->desktopWidth = (int) getClientDisplayWidth();
+		context->desktopHeight = (int) getClientDisplayHeight();
+
+		return context;
+	}
+
+	static bool copyJournalString(char* field, size_t size, const std::string& value)
+	{
+		if (value.length() >= size)
+			return false;
+
+		memcpy(field, value.c_str(), value.length() + 1);
+
+		return true;
+	}
+
+	void Session::writeJournal()
+	{
+		SessionJournalRecord record;
+
+		if (!mSessionStarted || !mCurrentModuleContext)
+			return;
+
+		Module* currentModule = APP_CONTEXT.getModuleManager()->getModule(mModuleName);
+
+		if (!currentModule || !currentModule->canAdopt())
+			return;
+
+		ZeroMemory(&record, sizeof(record));
+
+		record.sessionId = m_SessionId;
+		record.connectState = mCurrentState;
+		record.authSession = mAuthSession ? 1 : 0;
+		record.displayWidth = mClientDisplayWidth;
+		record.displayHeight = mClientDisplayHeight;
+		record.displayColorDepth = mClientDisplayColorDepth;
+
+		if (!currentModule->getState(mCurrentModuleContext, &record.moduleState))
+			return;
+
+		// a truncated user or pipe name would be adopted as a different identity
+		if (!copyJournalString(record.userName, sizeof(record.userName), mUsername) ||
+				!copyJournalString(record.domain, sizeof(record.domain), mDomain) ||
+				!copyJournalString(record.winStationName, sizeof(record.winStationName), mWinStationName) ||
+				!copyJournalString(record.moduleConfigName, sizeof(record.moduleConfigName), mModuleConfigName) ||
+				!copyJournalString(record.moduleName, sizeof(record.moduleName), mModuleName) ||
+				!copyJournalString(record.pipeName, sizeof(record.pipeName), mPipeName))
+		{
+			WLog_Print(logger_Session, WLOG_WARN, "session %lu is not journaled, a name is too long for the journal",
+				(unsigned long) m_SessionId);
+			APP_CONTEXT.getSessionJournal()->removeSession(m_SessionId);
+			return;
+		}
+
+		APP_CONTEXT.getSessionJournal()->writeSession(record);
+	}
+
 	bool Session::stopModule()
 	{
 		if (!mSessionStarted)
@@ -394,6 +556,8 @@ namespace freerds
 		mPipeName.clear();
 		setConnectState(WTSDown);
 
+		APP_CONTEXT.getSessionJournal()->removeSession(m_SessionId);
+
 		return true;
 	}
 
@@ -414,10 +578,19 @@ namespace freerds
 		if (mCurrentState != state)
 		{
 			UINT32 stateChange = getStateChange(mCurrentState, state);
+			WTS_CONNECTSTATE_CLASS oldState = mCurrentState;
 
 			mCurrentState = state;
 			mCurrentStateChangeTime = boost::date_time::second_clock<boost::posix_time::ptime>::universal_time();
 
+			APP_CONTEXT.getSessionStore()->updateSessionState(m_SessionId, state);
+			writeJournal();
+
+			if (state == WTSDisconnected)
+				APP_CONTEXT.armSessionTimeout(m_SessionId, getProperties());
+			else if (oldState == WTSDisconnected)
+				APP_CONTEXT.cancelSessionTimeout(m_SessionId);
+
 			if ((state != WTSConnected) && (state != WTSActive))
 			{
 				// Clear out the client information.
@@ -32,9 +32,13 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "Connection.h"
+#include "PropertySnapshot.h"
+#include "SessionJournal.h"
 
 namespace freerds
 {
+	class Module;
+
 	class Session
 	{
 	public:
@@ -79,9 +83,13 @@ namespace freerds
 		void setAuthSession(bool authSession);
 		int authenticate(std::string username, std::string domain, std::string password);
 
+		PropertySetPtr getProperties();
+		void setProperties(PropertySetPtr properties);
+
 		void setModuleConfigName(std::string configName);
 		std::string getModuleConfigName();
 		bool startModule(std::string & pipeName);
+		bool adoptModule(const SessionJournalRecord& record);
 		bool stopModule();
 
 		WTS_CONNECTSTATE_CLASS getConnectState();
@@ -93,6 +101,8 @@ namespace freerds
 	private:
 
 		char* dupEnv(char* orgBlock);
+		RDS_MODULE_COMMON* newModuleContext(Module* module, std::string configBaseName);
+		void writeJournal();
 
 		UINT32 m_SessionId;
 		bool mAuthSession;
@@ -117,6 +127,7 @@ namespace freerds
 		HANDLE mUserToken;
 		char* mpEnvBlock;
 
+		PropertySetPtr mProperties;
 		std::string mModuleConfigName;
 		std::string mModuleName;
 		RDS_MODULE_COMMON* mCurrentModuleContext;
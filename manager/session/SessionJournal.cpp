@@ -0,0 +1,336 @@
+/**
+ * Memory-mapped journal of the running sessions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SessionJournal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <winpr/wlog.h>
+#include <winpr/interlocked.h>
+
+#include <utils/CSGuard.h>
+
+namespace freerds
+{
+	static wLog* logger_SessionJournal = WLog_Get("freerds.SessionJournal");
+
+	SessionJournal::SessionJournal()
+	: mFd(-1), mHeader(NULL), mRecords(NULL), mSize(0)
+	{
+		if (!InitializeCriticalSectionAndSpinCount(&mCSection, 0x00000400))
+		{
+			 WLog_Print(logger_SessionJournal, WLOG_FATAL, "cannot init SessionJournal critical section!");
+		}
+	}
+
+	SessionJournal::~SessionJournal()
+	{
+		close();
+		DeleteCriticalSection(&mCSection);
+	}
+
+	bool SessionJournal::open(std::string filename)
+	{
+		SessionJournalHeader header;
+		void* mapping;
+
+		CSGuard guard(&mCSection);
+
+		if (mHeader)
+			return true;
+
+		mFd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+		if (mFd < 0)
+		{
+			WLog_Print(logger_SessionJournal, WLOG_ERROR, "cannot open %s, sessions will not survive a restart",
+				filename.c_str());
+			return false;
+		}
+
+		mSize = sizeof(SessionJournalHeader) + (SESSION_JOURNAL_SLOTS * sizeof(SessionJournalRecord));
+
+		ZeroMemory(&header, sizeof(header));
+
+		bool reset = (pread(mFd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) ||
+				(header.magic != SESSION_JOURNAL_MAGIC) || (header.version != SESSION_JOURNAL_VERSION) ||
+				(header.recordSize != sizeof(SessionJournalRecord)) || (header.recordCount != SESSION_JOURNAL_SLOTS);
+
+		if (reset && header.magic)
+			WLog_Print(logger_SessionJournal, WLOG_WARN, "discarding incompatible journal %s", filename.c_str());
+
+		// a fresh or incompatible journal starts over as a zeroed file
+		if ((reset && (ftruncate(mFd, 0) != 0)) || (ftruncate(mFd, mSize) != 0))
+		{
+			WLog_Print(logger_SessionJournal, WLOG_ERROR, "cannot size %s", filename.c_str());
+			::close(mFd);
+			mFd = -1;
+			return false;
+		}
+
+		mapping = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+
+		if (mapping == MAP_FAILED)
+		{
+			WLog_Print(logger_SessionJournal, WLOG_ERROR, "cannot map %s", filename.c_str());
+			::close(mFd);
+			mFd = -1;
+			return false;
+		}
+
+		mHeader = (SessionJournalHeader*) mapping;
+		mRecords = (SessionJournalRecord*) &mHeader[1];
+
+		mHeader->magic = SESSION_JOURNAL_MAGIC;
+		mHeader->version = SESSION_JOURNAL_VERSION;
+		mHeader->recordSize = sizeof(SessionJournalRecord);
+		mHeader->recordCount = SESSION_JOURNAL_SLOTS;
+
+		mSlots.clear();
+		mFreeSlots.clear();
+		mSessionConnections.clear();
+		mConnectionSessions.clear();
+
+		// walk backwards so that low slots are handed out first
+		for (UINT32 slot = SESSION_JOURNAL_SLOTS; slot > 0; slot--)
+		{
+			SessionJournalRecord* record = &mRecords[slot - 1];
+
+			if (record->sequence & 1)
+			{
+				// the previous manager died in the middle of this write
+				WLog_Print(logger_SessionJournal, WLOG_WARN, "dropping torn journal record of session %lu",
+					(unsigned long) record->sessionId);
+				clearSlot(slot - 1);
+			}
+
+			if (record->sessionId && (mSlots.find(record->sessionId) == mSlots.end()))
+			{
+				mSlots[record->sessionId] = slot - 1;
+
+				if (record->connectionId)
+				{
+					mSessionConnections[record->sessionId] = record->connectionId;
+					mConnectionSessions[record->connectionId] = record->sessionId;
+				}
+			}
+			else if (record->sessionId)
+			{
+				clearSlot(slot - 1);
+			}
+
+			if (!record->sessionId)
+				mFreeSlots.push_back(slot - 1);
+		}
+
+		return true;
+	}
+
+	void SessionJournal::close()
+	{
+		CSGuard guard(&mCSection);
+
+		if (mHeader)
+		{
+			munmap(mHeader, mSize);
+			mHeader = NULL;
+			mRecords = NULL;
+		}
+
+		if (mFd >= 0)
+		{
+			::close(mFd);
+			mFd = -1;
+		}
+
+		mSlots.clear();
+		mFreeSlots.clear();
+		mSessionConnections.clear();
+		mConnectionSessions.clear();
+	}
+
+	std::list<SessionJournalRecord> SessionJournal::getRecords()
+	{
+		std::list<SessionJournalRecord> records;
+
+		CSGuard guard(&mCSection);
+
+		if (!mHeader)
+			return records;
+
+		for (std::map<UINT32, UINT32>::iterator it = mSlots.begin(); it != mSlots.end(); it++)
+			records.push_back(mRecords[it->second]);
+
+		return records;
+	}
+
+	void SessionJournal::writeSession(const SessionJournalRecord& record)
+	{
+		UINT32 slot;
+
+		CSGuard guard(&mCSection);
+
+		if (!mHeader || !record.sessionId)
+			return;
+
+		std::map<UINT32, UINT32>::iterator it = mSlots.find(record.sessionId);
+
+		if (it != mSlots.end())
+		{
+			slot = it->second;
+		}
+		else
+		{
+			if (mFreeSlots.empty())
+			{
+				WLog_Print(logger_SessionJournal, WLOG_ERROR, "journal full, session %lu will not survive a restart",
+					(unsigned long) record.sessionId);
+				return;
+			}
+
+			slot = mFreeSlots.back();
+			mFreeSlots.pop_back();
+			mSlots[record.sessionId] = slot;
+		}
+
+		SessionJournalRecord current = record;
+		it = mSessionConnections.find(record.sessionId);
+		current.connectionId = (it != mSessionConnections.end()) ? it->second : 0;
+
+		writeSlot(slot, current);
+	}
+
+	void SessionJournal::removeSession(UINT32 sessionId)
+	{
+		CSGuard guard(&mCSection);
+
+		std::map<UINT32, UINT32>::iterator it = mSessionConnections.find(sessionId);
+
+		if (it != mSessionConnections.end())
+		{
+			mConnectionSessions.erase(it->second);
+			mSessionConnections.erase(it);
+		}
+
+		if (!mHeader)
+			return;
+
+		it = mSlots.find(sessionId);
+
+		if (it == mSlots.end())
+			return;
+
+		clearSlot(it->second);
+		mFreeSlots.push_back(it->second);
+		mSlots.erase(it);
+	}
+
+	void SessionJournal::setConnection(UINT32 sessionId, UINT32 connectionId)
+	{
+		CSGuard guard(&mCSection);
+
+		// a connection is bound to one session at a time
+		std::map<UINT32, UINT32>::iterator it = mConnectionSessions.find(connectionId);
+
+		if ((it != mConnectionSessions.end()) && (it->second != sessionId))
+		{
+			mSessionConnections.erase(it->second);
+			writeConnection(it->second, 0);
+		}
+
+		it = mSessionConnections.find(sessionId);
+
+		if ((it != mSessionConnections.end()) && (it->second != connectionId))
+			mConnectionSessions.erase(it->second);
+
+		mSessionConnections[sessionId] = connectionId;
+		mConnectionSessions[connectionId] = sessionId;
+		writeConnection(sessionId, connectionId);
+	}
+
+	void SessionJournal::removeConnection(UINT32 connectionId)
+	{
+		CSGuard guard(&mCSection);
+
+		std::map<UINT32, UINT32>::iterator it = mConnectionSessions.find(connectionId);
+
+		if (it == mConnectionSessions.end())
+			return;
+
+		mSessionConnections.erase(it->second);
+		writeConnection(it->second, 0);
+		mConnectionSessions.erase(it);
+	}
+
+	void SessionJournal::clearConnections()
+	{
+		CSGuard guard(&mCSection);
+
+		for (std::map<UINT32, UINT32>::iterator it = mSessionConnections.begin(); it != mSessionConnections.end(); it++)
+			writeConnection(it->first, 0);
+
+		mSessionConnections.clear();
+		mConnectionSessions.clear();
+	}
+
+	void SessionJournal::writeConnection(UINT32 sessionId, UINT32 connectionId)
+	{
+		SessionJournalRecord record;
+
+		if (!mHeader)
+			return;
+
+		std::map<UINT32, UINT32>::iterator it = mSlots.find(sessionId);
+
+		if ((it == mSlots.end()) || (mRecords[it->second].connectionId == connectionId))
+			return;
+
+		record = mRecords[it->second];
+		record.connectionId = connectionId;
+		writeSlot(it->second, record);
+	}
+
+	void SessionJournal::writeSlot(UINT32 slot, const SessionJournalRecord& record)
+	{
+		SessionJournalRecord* target = &mRecords[slot];
+		LONG sequence = target->sequence | 1;
+
+		/**
+		 * A crash between the two sequence updates leaves an odd
+		 * sequence behind, the next manager drops such a record
+		 * instead of adopting a half written one.
+		 */
+		InterlockedExchange(&target->sequence, sequence);
+		CopyMemory(((BYTE*) target) + sizeof(LONG), ((const BYTE*) &record) + sizeof(LONG),
+				sizeof(SessionJournalRecord) - sizeof(LONG));
+		InterlockedExchange(&target->sequence, sequence + 1);
+	}
+
+	void SessionJournal::clearSlot(UINT32 slot)
+	{
+		SessionJournalRecord record;
+
+		ZeroMemory(&record, sizeof(record));
+		writeSlot(slot, record);
+	}
+}
@@ -0,0 +1,111 @@
+/**
+ * Memory-mapped journal of the running sessions
+ *
+ * Every session with a started module owns a fixed size slot in a
+ * file under the pid directory, rewritten on each state change. When
+ * the session manager is restarted it reads the slots back and adopts
+ * the module processes instead of orphaning them. The file lives on
+ * tmpfs on most systems, so it does not outlive a reboot.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SESSIONJOURNAL_H_
+#define SESSIONJOURNAL_H_
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerds/module.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SESSION_JOURNAL_MAGIC		0x4A534452 /* RDSJ */
+#define SESSION_JOURNAL_VERSION		1
+#define SESSION_JOURNAL_SLOTS		8192
+
+namespace freerds
+{
+	struct SessionJournalHeader
+	{
+		UINT32 magic;
+		UINT32 version;
+		UINT32 recordSize;
+		UINT32 recordCount;
+	};
+
+	struct SessionJournalRecord
+	{
+		/* odd while the slot is being written */
+		LONG sequence;
+
+		/* 0 marks a free slot */
+		UINT32 sessionId;
+		UINT32 connectionId;
+		UINT32 connectState;
+		UINT32 authSession;
+
+		UINT32 displayWidth;
+		UINT32 displayHeight;
+		UINT32 displayColorDepth;
+
+		RDS_MODULE_STATE moduleState;
+
+		char userName[64];
+		char domain[64];
+		char winStationName[32];
+		char moduleConfigName[64];
+		char moduleName[32];
+		char pipeName[128];
+	};
+
+	class SessionJournal
+	{
+	public:
+		SessionJournal();
+		~SessionJournal();
+
+		bool open(std::string filename);
+		void close();
+
+		std::list<SessionJournalRecord> getRecords();
+
+		void writeSession(const SessionJournalRecord& record);
+		void removeSession(UINT32 sessionId);
+
+		void setConnection(UINT32 sessionId, UINT32 connectionId);
+		void removeConnection(UINT32 connectionId);
+		void clearConnections();
+
+	private:
+		void writeConnection(UINT32 sessionId, UINT32 connectionId);
+		void writeSlot(UINT32 slot, const SessionJournalRecord& record);
+		void clearSlot(UINT32 slot);
+
+		int mFd;
+		SessionJournalHeader* mHeader;
+		SessionJournalRecord* mRecords;
+		size_t mSize;
+
+		std::map<UINT32, UINT32> mSlots;
+		std::vector<UINT32> mFreeSlots;
+		std::map<UINT32, UINT32> mSessionConnections;
+		std::map<UINT32, UINT32> mConnectionSessions;
+		CRITICAL_SECTION mCSection;
+	};
+}
+
+#endif /* SESSIONJOURNAL_H_ */
@@ -25,7 +25,8 @@
 
 #include "SessionStore.h"
 
-#include <utils/CSGuard.h>
+#include <utils/RWGuard.h>
+#include <session/ApplicationContext.h>
 
 namespace freerds
 {
@@ -33,24 +34,28 @@ namespace freerds
 
 	SessionStore::SessionStore()
 	{
-		if (!InitializeCriticalSectionAndSpinCount(&m_CSection, 0x00000400))
+		if (pthread_rwlock_init(&m_RWLock, NULL) != 0)
 		{
-			 WLog_Print(logger_SessionStore, WLOG_FATAL, "cannot init SessionStore critical section!");
+			 WLog_Print(logger_SessionStore, WLOG_FATAL, "cannot init SessionStore lock!");
 		}
 		m_NextSessionId = 1;
+		m_ChangeSequence = 0;
+		m_ChangeFloor = 0;
 	}
 
 	SessionStore::~SessionStore()
 	{
-		DeleteCriticalSection(&m_CSection);
+		pthread_rwlock_destroy(&m_RWLock);
 	}
 
 	SessionPtr SessionStore::getSession(UINT32 sessionId)
 	{
-		CSGuard guard(&m_CSection);
+		ReadGuard guard(&m_RWLock);
 
-		if (m_SessionMap.find(sessionId) != m_SessionMap.end()) {
-			return m_SessionMap[sessionId];
+		TSessionMap::iterator iter = m_SessionMap.find(sessionId);
+
+		if (iter != m_SessionMap.end()) {
+			return iter->second;
 		}
 
 		return SessionPtr();
@@ -58,65 +63,175 @@ namespace freerds
 
 	SessionPtr SessionStore::createSession()
 	{
-		CSGuard guard(&m_CSection);
-		SessionPtr session(new Session(m_NextSessionId++));
-		m_SessionMap[session->getSessionId()] = session;
+		SessionPtr session;
+		SessionIndexEntry entry;
+		UINT32 sequence;
+
+		{
+			WriteGuard guard(&m_RWLock);
+
+			session = SessionPtr(new Session(m_NextSessionId++));
+			m_SessionMap[session->getSessionId()] = session;
+
+			entry.state = session->getConnectState();
+			m_IndexEntries[session->getSessionId()] = entry;
+			m_UserIndex[entry.userKey][session->getSessionId()] = session;
+			m_StateIndex[entry.state][session->getSessionId()] = session;
+
+			sequence = recordChange(session->getSessionId());
+		}
+
+		notifyChange(sequence);
 		return session;
 	}
 
-	SessionPtr SessionStore::getFirstSessionUserName(std::string username,std::string domain)
+	SessionPtr SessionStore::restoreSession(UINT32 sessionId)
 	{
-		CSGuard guard(&m_CSection);
-
 		SessionPtr session;
-		TSessionMap::iterator iter;
+		SessionIndexEntry entry;
+		UINT32 sequence;
 
-		for (iter = m_SessionMap.begin(); iter != m_SessionMap.end(); iter++)
 		{
-			if ((iter->second->getUserName().compare(username) == 0) &&
-					(iter->second->getDomain().compare(domain) == 0))
-			{
-				session = iter->second;
-				break;
-			}
+			WriteGuard guard(&m_RWLock);
+
+			if (!sessionId || (m_SessionMap.find(sessionId) != m_SessionMap.end()))
+				return session;
+
+			// keep the id of a journaled session from being handed out again
+			if (sessionId >= m_NextSessionId)
+				m_NextSessionId = sessionId + 1;
+
+			session = SessionPtr(new Session(sessionId));
+			m_SessionMap[sessionId] = session;
+
+			entry.state = session->getConnectState();
+			m_IndexEntries[sessionId] = entry;
+			m_UserIndex[entry.userKey][sessionId] = session;
+			m_StateIndex[entry.state][sessionId] = session;
+
+			sequence = recordChange(sessionId);
 		}
 
+		notifyChange(sequence);
 		return session;
 	}
 
+	SessionPtr SessionStore::getFirstSessionUserName(std::string username,std::string domain)
+	{
+		ReadGuard guard(&m_RWLock);
+
+		TSessionUserIndex::iterator iter = m_UserIndex.find(TSessionUserKey(username, domain));
+
+		if ((iter != m_UserIndex.end()) && !iter->second.empty()) {
+			return iter->second.begin()->second;
+		}
+
+		return SessionPtr();
+	}
+
 	SessionPtr SessionStore::getFirstDisconnectedSessionUserName(
 			std::string username, std::string domain)
 	{
-		CSGuard guard(&m_CSection);
+		ReadGuard guard(&m_RWLock);
 
+		TSessionUserIndex::iterator iter = m_UserIndex.find(TSessionUserKey(username, domain));
+
+		if (iter == m_UserIndex.end())
+			return SessionPtr();
+
+		for (TSessionMap::iterator it = iter->second.begin(); it != iter->second.end(); it++)
+		{
+			TSessionIndexEntryMap::const_iterator itEntry = m_IndexEntries.find(it->first);
+
+			if ((itEntry != m_IndexEntries.end()) && (itEntry->second.state == WTSDisconnected)) {
+				return it->second;
+			}
+		}
+
+		return SessionPtr();
+	}
+
+	SessionPtr SessionStore::claimDisconnectedSessionUserName(
+			std::string username, std::string domain)
+	{
 		SessionPtr session;
-		TSessionMap::iterator iter;
+		UINT32 sequence = 0;
 
-		for (iter = m_SessionMap.begin(); iter != m_SessionMap.end();iter++)
 		{
-			if((iter->second->getUserName().compare(username) == 0) &&
-					(iter->second->getDomain().compare(domain) == 0))
+			WriteGuard guard(&m_RWLock);
+
+			TSessionUserIndex::iterator iter = m_UserIndex.find(TSessionUserKey(username, domain));
+
+			if (iter == m_UserIndex.end())
+				return SessionPtr();
+
+			/**
+			 * Logons run concurrently, the session is moved to the active
+			 * index while the store is locked so that only one of them can
+			 * reconnect it.
+			 */
+
+			for (TSessionMap::iterator it = iter->second.begin(); it != iter->second.end(); it++)
 			{
-				if (iter->second->getConnectState() == WTSDisconnected) {
-					session = iter->second;
+				SessionIndexEntry& entry = m_IndexEntries[it->first];
+
+				if (entry.state == WTSDisconnected) {
+					session = it->second;
+					sequence = moveSessionState(entry, session, WTSActive);
 					break;
 				}
 			}
 		}
 
+		notifyChange(sequence);
+
+		if (session)
+			session->setConnectState(WTSActive);
+
 		return session;
 	}
 
 	int SessionStore::removeSession(UINT32 sessionId)
 	{
-		CSGuard guard(&m_CSection);
-		m_SessionMap.erase(sessionId);
+		/* the last reference is dropped after unlocking, ~Session updates the store */
+		SessionPtr session = getSession(sessionId);
+		UINT32 sequence = 0;
+
+		{
+			WriteGuard guard(&m_RWLock);
+
+			TSessionIndexEntryMap::iterator iter = m_IndexEntries.find(sessionId);
+
+			if (iter != m_IndexEntries.end())
+			{
+				TSessionUserIndex::iterator itUser = m_UserIndex.find(iter->second.userKey);
+
+				if (itUser != m_UserIndex.end())
+				{
+					itUser->second.erase(sessionId);
+
+					if (itUser->second.empty())
+						m_UserIndex.erase(itUser);
+				}
+
+				m_StateIndex[iter->second.state].erase(sessionId);
+				m_IndexEntries.erase(iter);
+			}
+
+			if (m_SessionMap.erase(sessionId))
+			{
+				sequence = recordChange(sessionId);
+				pruneRemovedSessions();
+			}
+		}
+
+		notifyChange(sequence);
 		return 0;
 	}
 
 	std::list<SessionPtr> SessionStore::getAllSessions()
 	{
-		CSGuard guard(&m_CSection);
+		ReadGuard guard(&m_RWLock);
 		std::list<SessionPtr> list;
 
 		for (TSessionMap::const_iterator it = m_SessionMap.begin(); it != m_SessionMap.end(); ++it) {
@@ -125,5 +240,218 @@ namespace freerds
 
 		return list;
 	}
-}
 
+	std::list<SessionPtr> SessionStore::getSessionsByState(WTS_CONNECTSTATE_CLASS state)
+	{
+		ReadGuard guard(&m_RWLock);
+		std::list<SessionPtr> list;
+
+		TSessionStateIndex::iterator iter = m_StateIndex.find(state);
+
+		if (iter == m_StateIndex.end())
+			return list;
+
+		for (TSessionMap::const_iterator it = iter->second.begin(); it != iter->second.end(); ++it) {
+			list.push_back(it->second);
+		}
+
+		return list;
+	}
+
+	size_t SessionStore::getSessionCount()
+	{
+		ReadGuard guard(&m_RWLock);
+		return m_SessionMap.size();
+	}
+
+	void SessionStore::visitSessions(SessionVisitor& visitor)
+	{
+		ReadGuard guard(&m_RWLock);
+
+		for (TSessionMap::const_iterator it = m_SessionMap.begin(); it != m_SessionMap.end(); ++it)
+		{
+			if (!visitor.visit(it->second))
+				break;
+		}
+	}
+
+	void SessionStore::visitSessions(WTS_CONNECTSTATE_CLASS state, SessionVisitor& visitor)
+	{
+		ReadGuard guard(&m_RWLock);
+
+		TSessionStateIndex::iterator iter = m_StateIndex.find(state);
+
+		if (iter == m_StateIndex.end())
+			return;
+
+		for (TSessionMap::const_iterator it = iter->second.begin(); it != iter->second.end(); ++it)
+		{
+			if (!visitor.visit(it->second))
+				break;
+		}
+	}
+
+	void SessionStore::updateSessionUser(UINT32 sessionId, std::string username, std::string domain)
+	{
+		UINT32 sequence;
+
+		{
+			WriteGuard guard(&m_RWLock);
+
+			TSessionIndexEntryMap::iterator iter = m_IndexEntries.find(sessionId);
+
+			if (iter == m_IndexEntries.end())
+				return;
+
+			TSessionUserKey userKey(username, domain);
+
+			if (iter->second.userKey == userKey)
+				return;
+
+			SessionPtr session = m_SessionMap[sessionId];
+			TSessionUserIndex::iterator itUser = m_UserIndex.find(iter->second.userKey);
+
+			if (itUser != m_UserIndex.end())
+			{
+				itUser->second.erase(sessionId);
+
+				if (itUser->second.empty())
+					m_UserIndex.erase(itUser);
+			}
+
+			iter->second.userKey = userKey;
+			m_UserIndex[userKey][sessionId] = session;
+
+			sequence = recordChange(sessionId);
+		}
+
+		notifyChange(sequence);
+	}
+
+	void SessionStore::updateSessionState(UINT32 sessionId, WTS_CONNECTSTATE_CLASS state)
+	{
+		UINT32 sequence;
+
+		{
+			WriteGuard guard(&m_RWLock);
+
+			TSessionIndexEntryMap::iterator iter = m_IndexEntries.find(sessionId);
+
+			if (iter == m_IndexEntries.end())
+				return;
+
+			sequence = moveSessionState(iter->second, m_SessionMap[sessionId], state);
+		}
+
+		notifyChange(sequence);
+	}
+
+	void SessionStore::markSessionChanged(UINT32 sessionId)
+	{
+		UINT32 sequence;
+
+		{
+			WriteGuard guard(&m_RWLock);
+
+			if (m_SessionMap.find(sessionId) == m_SessionMap.end())
+				return;
+
+			sequence = recordChange(sessionId);
+		}
+
+		notifyChange(sequence);
+	}
+
+	UINT32 SessionStore::getChangeSequence()
+	{
+		ReadGuard guard(&m_RWLock);
+		return m_ChangeSequence;
+	}
+
+	void SessionStore::getSessionChanges(UINT32 sequence, SessionChanges& changes)
+	{
+		ReadGuard guard(&m_RWLock);
+
+		changes.sessions.clear();
+		changes.removed.clear();
+		changes.sequence = m_ChangeSequence;
+
+		/**
+		 * A sequence from before the oldest tombstone may have missed a
+		 * removal, one from the future was handed out by an earlier
+		 * manager instance. Both get the whole table.
+		 */
+		changes.reset = (!sequence || (sequence < m_ChangeFloor) || (sequence > m_ChangeSequence));
+
+		if (changes.reset)
+		{
+			for (TSessionMap::const_iterator it = m_SessionMap.begin(); it != m_SessionMap.end(); ++it)
+				changes.sessions.push_back(it->second);
+
+			return;
+		}
+
+		for (TSessionChangeLog::const_iterator it = m_ChangeLog.upper_bound(sequence); it != m_ChangeLog.end(); ++it)
+		{
+			TSessionMap::const_iterator itSession = m_SessionMap.find(it->second);
+
+			if (itSession != m_SessionMap.end())
+				changes.sessions.push_back(itSession->second);
+			else
+				changes.removed.push_back(it->second);
+		}
+	}
+
+	UINT32 SessionStore::moveSessionState(SessionIndexEntry& entry, const SessionPtr& session,
+			WTS_CONNECTSTATE_CLASS state)
+	{
+		if (entry.state == state)
+			return 0;
+
+		m_StateIndex[entry.state].erase(session->getSessionId());
+		entry.state = state;
+		m_StateIndex[state][session->getSessionId()] = session;
+
+		return recordChange(session->getSessionId());
+	}
+
+	UINT32 SessionStore::recordChange(UINT32 sessionId)
+	{
+		TSessionChangeLog::iterator iter = m_SessionChanges.find(sessionId);
+
+		if (iter != m_SessionChanges.end())
+			m_ChangeLog.erase(iter->second);
+
+		m_ChangeSequence++;
+		m_ChangeLog[m_ChangeSequence] = sessionId;
+		m_SessionChanges[sessionId] = m_ChangeSequence;
+
+		return m_ChangeSequence;
+	}
+
+	void SessionStore::pruneRemovedSessions()
+	{
+		TSessionChangeLog::iterator iter = m_ChangeLog.begin();
+
+		// every live session has an entry, the remainder are tombstones
+		while ((m_SessionChanges.size() - m_SessionMap.size() > SESSION_STORE_MAX_REMOVED) &&
+				(iter != m_ChangeLog.end()))
+		{
+			if (m_SessionMap.find(iter->second) != m_SessionMap.end())
+			{
+				iter++;
+				continue;
+			}
+
+			m_ChangeFloor = iter->first;
+			m_SessionChanges.erase(iter->second);
+			m_ChangeLog.erase(iter++);
+		}
+	}
+
+	void SessionStore::notifyChange(UINT32 sequence)
+	{
+		if (sequence)
+			APP_CONTEXT.getFDSApiServer()->fireSessionChange(sequence);
+	}
+}
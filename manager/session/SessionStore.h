@@ -26,13 +26,56 @@
 #include <list>
 #include <string>
 
-#include <winpr/synch.h>
+#include <pthread.h>
+
+/* removed sessions remembered for clients catching up on changes */
+#define SESSION_STORE_MAX_REMOVED	1024
 
 namespace freerds
 {
 	typedef std::map<UINT32, SessionPtr> TSessionMap;
 	typedef std::pair<UINT32, SessionPtr> TSessionPair;
 
+	typedef std::pair<std::string, std::string> TSessionUserKey;
+	typedef std::map<TSessionUserKey, TSessionMap> TSessionUserIndex;
+	typedef std::map<WTS_CONNECTSTATE_CLASS, TSessionMap> TSessionStateIndex;
+
+	struct SessionIndexEntry
+	{
+		TSessionUserKey userKey;
+		WTS_CONNECTSTATE_CLASS state;
+	};
+
+	typedef std::map<UINT32, SessionIndexEntry> TSessionIndexEntryMap;
+
+	/**
+	 * Every session carries the sequence of its latest change, removed
+	 * sessions are kept as tombstones until SESSION_STORE_MAX_REMOVED
+	 * newer ones pile up. A client which saw sequence N needs only the
+	 * entries above N to bring its copy of the table up to date.
+	 */
+	typedef std::map<UINT32, UINT32> TSessionChangeLog;
+
+	struct SessionChanges
+	{
+		UINT32 sequence;
+		bool reset;
+		std::list<SessionPtr> sessions;
+		std::list<UINT32> removed;
+	};
+
+	/**
+	 * Visitors are called with the store read-locked, they must not
+	 * modify the store or change the user or state of a session.
+	 * Returning false from visit() stops the iteration.
+	 */
+	class SessionVisitor
+	{
+	public:
+		virtual ~SessionVisitor() {};
+		virtual bool visit(const SessionPtr& session) = 0;
+	};
+
 	class SessionStore
 	{
 	public:
@@ -42,14 +85,41 @@ namespace freerds
 		SessionPtr getSession(UINT32 sessionId);
 		SessionPtr getFirstSessionUserName(std::string username, std::string domain);
 		SessionPtr getFirstDisconnectedSessionUserName(std::string username, std::string domain);
+		SessionPtr claimDisconnectedSessionUserName(std::string username, std::string domain);
 		SessionPtr createSession();
+		SessionPtr restoreSession(UINT32 sessionId);
 		std::list<SessionPtr> getAllSessions();
+		std::list<SessionPtr> getSessionsByState(WTS_CONNECTSTATE_CLASS state);
+		size_t getSessionCount();
+		void visitSessions(SessionVisitor& visitor);
+		void visitSessions(WTS_CONNECTSTATE_CLASS state, SessionVisitor& visitor);
 		int removeSession(UINT32 sessionId);
 
+		void updateSessionUser(UINT32 sessionId, std::string username, std::string domain);
+		void updateSessionState(UINT32 sessionId, WTS_CONNECTSTATE_CLASS state);
+		void markSessionChanged(UINT32 sessionId);
+
+		UINT32 getChangeSequence();
+		void getSessionChanges(UINT32 sequence, SessionChanges& changes);
+
 	private:
+		UINT32 moveSessionState(SessionIndexEntry& entry, const SessionPtr& session,
+				WTS_CONNECTSTATE_CLASS state);
+		UINT32 recordChange(UINT32 sessionId);
+		void pruneRemovedSessions();
+		void notifyChange(UINT32 sequence);
+
 		TSessionMap m_SessionMap;
+		TSessionUserIndex m_UserIndex;
+		TSessionStateIndex m_StateIndex;
+		TSessionIndexEntryMap m_IndexEntries;
 		UINT32 m_NextSessionId;
-		CRITICAL_SECTION m_CSection;
+		UINT32 m_ChangeSequence;
+		UINT32 m_ChangeFloor;
+		// sequence to session id and back, one entry per session
+		TSessionChangeLog m_ChangeLog;
+		TSessionChangeLog m_SessionChanges;
+		pthread_rwlock_t m_RWLock;
 	};
 }
 
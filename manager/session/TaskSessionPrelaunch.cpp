@@ -0,0 +1,207 @@
+/**
+ * Task keeping a pool of prelaunched greeter sessions
+ *
+ * Nothing about a greeter session is user specific until the user has
+ * authenticated, so greeters are started ahead of time and handed to
+ * the next failed logon instead of being started on its call path.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/wlog.h>
+
+#include "TaskSessionPrelaunch.h"
+#include <session/ApplicationContext.h>
+#include <utils/CSGuard.h>
+
+/* pick up config reloads and replace greeters that went away */
+#define PRELAUNCH_RECHECK_INTERVAL	30000
+#define PRELAUNCH_RETRY_INTERVAL	5000
+
+namespace freerds
+{
+	static wLog* logger_TaskSessionPrelaunch = WLog_Get("freerds.TaskSessionPrelaunch");
+
+	TaskSessionPrelaunch::TaskSessionPrelaunch()
+	{
+		if (!InitializeCriticalSectionAndSpinCount(&mCSection, 0x00000400))
+		{
+			WLog_Print(logger_TaskSessionPrelaunch, WLOG_FATAL, "cannot init TaskSessionPrelaunch critical section!");
+		}
+
+		mhRefill = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	TaskSessionPrelaunch::~TaskSessionPrelaunch()
+	{
+		CloseHandle(mhRefill);
+		DeleteCriticalSection(&mCSection);
+	}
+
+	bool TaskSessionPrelaunch::isThreaded() {
+		return true;
+	};
+
+	long TaskSessionPrelaunch::getTarget()
+	{
+		long target;
+
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("session.prelaunch.greeter", &target) || (target < 0))
+			return 0;
+
+		return target;
+	}
+
+	SessionPtr TaskSessionPrelaunch::claimGreeter(std::string configName)
+	{
+		SessionPtr session;
+
+		CSGuard guard(&mCSection);
+
+		for (std::list<SessionPtr>::iterator it = mGreeters.begin(); it != mGreeters.end(); it++)
+		{
+			if ((*it)->getModuleConfigName() == configName)
+			{
+				session = *it;
+				mGreeters.erase(it);
+				SetEvent(mhRefill);
+				break;
+			}
+		}
+
+		return session;
+	}
+
+	SessionPtr TaskSessionPrelaunch::launchGreeter(std::string configName)
+	{
+		long xres;
+		long yres;
+		std::string pipeName;
+		std::string configBaseName = std::string("module.") + configName;
+		SessionStore* sessionStore = APP_CONTEXT.getSessionStore();
+		SessionPtr session = sessionStore->createSession();
+
+		session->setModuleConfigName(configName);
+		session->setAuthSession(true);
+
+		// no client yet, start at the module's default resolution
+		if (!session->getProperties()->getPropertyNumber(configBaseName + ".xres", &xres) || (xres <= 0))
+			xres = 1024;
+
+		if (!session->getProperties()->getPropertyNumber(configBaseName + ".yres", &yres) || (yres <= 0))
+			yres = 768;
+
+		session->setClientDisplayWidth((UINT32) xres);
+		session->setClientDisplayHeight((UINT32) yres);
+
+		if (!session->generateAuthEnvBlockAndModify() || !session->startModule(pipeName))
+		{
+			WLog_Print(logger_TaskSessionPrelaunch, WLOG_ERROR, "could not prelaunch greeter %s", configName.c_str());
+			sessionStore->removeSession(session->getSessionId());
+			return SessionPtr();
+		}
+
+		// idle until a connection claims it
+		session->setConnectState(WTSIdle);
+
+		WLog_Print(logger_TaskSessionPrelaunch, WLOG_DEBUG, "prelaunched greeter session %d", session->getSessionId());
+
+		return session;
+	}
+
+	bool TaskSessionPrelaunch::refill()
+	{
+		size_t pooled;
+		std::string greeter;
+		std::list<SessionPtr> stale;
+		long target = getTarget();
+
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyString(PROPERTY_KEY_AUTH_GREETER, greeter)) {
+			greeter = "Qt";
+		}
+
+		{
+			CSGuard guard(&mCSection);
+
+			// drop greeters for an old configuration or above the target
+			for (std::list<SessionPtr>::iterator it = mGreeters.begin(); it != mGreeters.end(); )
+			{
+				if (((*it)->getModuleConfigName() != greeter) || ((*it)->getConnectState() != WTSIdle))
+				{
+					stale.push_back(*it);
+					it = mGreeters.erase(it);
+				}
+				else
+				{
+					it++;
+				}
+			}
+
+			while (mGreeters.size() > (size_t) target)
+			{
+				stale.push_back(mGreeters.back());
+				mGreeters.pop_back();
+			}
+
+			pooled = mGreeters.size();
+		}
+
+		for (std::list<SessionPtr>::iterator it = stale.begin(); it != stale.end(); it++)
+		{
+			(*it)->stopModule();
+			APP_CONTEXT.getSessionStore()->removeSession((*it)->getSessionId());
+		}
+
+		for (; pooled < (size_t) target; pooled++)
+		{
+			if (WaitForSingleObject(mhStop, 0) == WAIT_OBJECT_0)
+				return true;
+
+			SessionPtr session = launchGreeter(greeter);
+
+			if (!session)
+				return false;
+
+			CSGuard guard(&mCSection);
+			mGreeters.push_back(session);
+		}
+
+		return true;
+	}
+
+	void TaskSessionPrelaunch::run()
+	{
+		DWORD status;
+		DWORD waitTime;
+		HANDLE events[2];
+
+		events[0] = mhStop;
+		events[1] = mhRefill;
+
+		for (;;)
+		{
+			waitTime = refill() ? PRELAUNCH_RECHECK_INTERVAL : PRELAUNCH_RETRY_INTERVAL;
+
+			status = WaitForMultipleObjects(2, events, FALSE, waitTime);
+
+			if (status == WAIT_OBJECT_0) {
+				// shutdown
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ * Task keeping a pool of prelaunched greeter sessions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TASK_SESSION_PRELAUNCH_
+#define __TASK_SESSION_PRELAUNCH_
+
+#include <task/Task.h>
+#include <session/Session.h>
+
+#include <list>
+#include <string>
+
+namespace freerds
+{
+	class TaskSessionPrelaunch: public Task
+	{
+	public:
+		TaskSessionPrelaunch();
+		virtual ~TaskSessionPrelaunch();
+
+		virtual void run();
+		virtual bool isThreaded();
+
+		SessionPtr claimGreeter(std::string configName);
+
+	private:
+		long getTarget();
+		bool refill();
+		SessionPtr launchGreeter(std::string configName);
+
+		CRITICAL_SECTION mCSection;
+		HANDLE mhRefill;
+		std::list<SessionPtr> mGreeters;
+	};
+
+	typedef boost::shared_ptr<TaskSessionPrelaunch> TaskSessionPrelaunchPtr;
+}
+
+#endif /* __TASK_SESSION_PRELAUNCH_ */
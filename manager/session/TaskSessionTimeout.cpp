@@ -22,65 +22,168 @@
 #endif
 
 #include <winpr/wlog.h>
+#include <winpr/sysinfo.h>
 
 #include "TaskSessionTimeout.h"
 #include <call/TaskEndSession.h>
 #include <session/ApplicationContext.h>
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <utils/CSGuard.h>
 
 namespace freerds
 {
 	static wLog* logger_TaskSessionTimeout = WLog_Get("freerds.TaskSessionTimeout");
 
+	TaskSessionTimeout::TaskSessionTimeout()
+	{
+		if (!InitializeCriticalSectionAndSpinCount(&mCSection, 0x00000400))
+		{
+			WLog_Print(logger_TaskSessionTimeout, WLOG_FATAL, "cannot init TaskSessionTimeout critical section!");
+		}
+
+		mhChanged = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	TaskSessionTimeout::~TaskSessionTimeout()
+	{
+		CloseHandle(mhChanged);
+		DeleteCriticalSection(&mCSection);
+	}
+
 	bool TaskSessionTimeout::isThreaded() {
 		return true;
 	};
 
-	void TaskSessionTimeout::run()
+	long TaskSessionTimeout::getTimeout(PropertySetPtr properties)
 	{
 		long timeout;
+
+		if (properties->getPropertyNumber(PROPERTY_KEY_SESSION_TIMEOUT, &timeout))
+			return timeout;
+
+		WLog_Print(logger_TaskSessionTimeout, WLOG_INFO, "session.timeout was not found for user %s, using value of 0", properties->getUserName().c_str());
+
+		return 0;
+	}
+
+	void TaskSessionTimeout::armSession(UINT32 sessionId, PropertySetPtr properties)
+	{
+		UINT64 deadline;
+		long timeout = getTimeout(properties);
+
+		/* a negative timeout keeps disconnected sessions forever */
+		if (timeout < 0)
+		{
+			cancelSession(sessionId);
+			return;
+		}
+
+		deadline = GetTickCount64() + ((UINT64) timeout * 60 * 1000);
+
+		CSGuard guard(&mCSection);
+
+		TSessionDeadlineIndex::iterator iter = mSessionDeadlines.find(sessionId);
+
+		if (iter != mSessionDeadlines.end())
+		{
+			mDeadlines.erase(iter->second);
+			mSessionDeadlines.erase(iter);
+		}
+
+		mSessionDeadlines[sessionId] = mDeadlines.insert(std::make_pair(deadline, sessionId));
+
+		SetEvent(mhChanged);
+	}
+
+	void TaskSessionTimeout::cancelSession(UINT32 sessionId)
+	{
+		CSGuard guard(&mCSection);
+
+		TSessionDeadlineIndex::iterator iter = mSessionDeadlines.find(sessionId);
+
+		if (iter != mSessionDeadlines.end())
+		{
+			mDeadlines.erase(iter->second);
+			mSessionDeadlines.erase(iter);
+		}
+	}
+
+	DWORD TaskSessionTimeout::getWaitTime()
+	{
+		UINT64 now;
+		UINT64 deadline;
+
+		CSGuard guard(&mCSection);
+
+		if (mDeadlines.empty())
+			return INFINITE;
+
+		now = GetTickCount64();
+		deadline = mDeadlines.begin()->first;
+
+		if (deadline <= now)
+			return 0;
+
+		if ((deadline - now) >= INFINITE)
+			return INFINITE - 1;
+
+		return (DWORD) (deadline - now);
+	}
+
+	void TaskSessionTimeout::expireSessions()
+	{
+		UINT64 now = GetTickCount64();
+		std::list<UINT32> expired;
+
+		{
+			CSGuard guard(&mCSection);
+
+			while (!mDeadlines.empty() && (mDeadlines.begin()->first <= now))
+			{
+				expired.push_back(mDeadlines.begin()->second);
+				mSessionDeadlines.erase(mDeadlines.begin()->second);
+				mDeadlines.erase(mDeadlines.begin());
+			}
+		}
+
+		for (std::list<UINT32>::iterator it = expired.begin(); it != expired.end(); it++)
+		{
+			SessionPtr currentSession = APP_CONTEXT.getSessionStore()->getSession(*it);
+
+			if (!currentSession || (currentSession->getConnectState() != WTSDisconnected))
+				continue;
+
+			WLog_Print(logger_TaskSessionTimeout, WLOG_INFO, "Session with sessionId %d from user %s is stopped after its disconnect timeout.", currentSession->getSessionId(), currentSession->getUserName().c_str());
+
+			TaskEndSessionPtr task = TaskEndSessionPtr(new TaskEndSession());
+			task->setSessionId(currentSession->getSessionId());
+			APP_CONTEXT.addTask(task);
+		}
+	}
+
+	void TaskSessionTimeout::run()
+	{
 		DWORD status;
-		boost::posix_time::ptime myEpoch(boost::gregorian::date(1970,boost::gregorian::Jan, 1));
+		HANDLE events[2];
+
+		/**
+		 * Deadlines are armed when a session becomes disconnected and
+		 * cancelled when it leaves that state, the thread only wakes up
+		 * for the earliest deadline or when a new one is armed.
+		 */
+
+		events[0] = mhStop;
+		events[1] = mhChanged;
 
 		for (;;)
 		{
-			status = WaitForSingleObject(mhStop,10 * 1000);
+			status = WaitForMultipleObjects(2, events, FALSE, getWaitTime());
 
 			if (status == WAIT_OBJECT_0) {
 				// shutdown
 				return;
 			}
 
-			if (status == WAIT_TIMEOUT)
-			{
-				// check all session if they need to be disconnected.
-				std::list<SessionPtr> allSessions = APP_CONTEXT.getSessionStore()->getAllSessions();
-				boost::posix_time::ptime currentTime = boost::date_time::second_clock<boost::posix_time::ptime>::universal_time();
-				std::list<SessionPtr>::iterator iterator;
-
-				for (iterator = allSessions.begin(); iterator != allSessions.end(); ++iterator)
-				{
-					SessionPtr currentSession = (*iterator);
-
-					if (currentSession->getConnectState() == WTSDisconnected)
-					{
-						//currentSession->getUserName()
-						if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("session.timeout", &timeout)) {
-							WLog_Print(logger_TaskSessionTimeout, WLOG_INFO, "session.timeout was not found for session %d, using value of 0", currentSession->getSessionId());
-							timeout = 0;
-						}
-
-						if ((timeout >= 0) &&(((currentTime - currentSession->getConnectStateChangeTime()).ticks()) / ((boost::posix_time::time_duration::ticks_per_second() * 60)) >= timeout)) {
-							// shutdown current Session
-							WLog_Print(logger_TaskSessionTimeout, WLOG_INFO, "Session with sessionId %d from user %s is stopped after %d minutes after the disconnect. ",currentSession->getSessionId(),currentSession->getUserName().c_str(),timeout);
-							TaskEndSessionPtr task = TaskEndSessionPtr(new TaskEndSession());
-							task->setSessionId(currentSession->getSessionId());
-							APP_CONTEXT.addTask(task);
-						}
-					}
-				}
-			}
+			expireSessions();
 		}
 	}
 }
-
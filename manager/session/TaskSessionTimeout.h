@@ -21,16 +21,37 @@
 #define __TASK_SESSION_TIMEOUT_
 
 #include <task/Task.h>
+#include <session/PropertySnapshot.h>
+
+#include <map>
+#include <string>
 
 namespace freerds
 {
+	typedef std::multimap<UINT64, UINT32> TSessionDeadlineMap;
+	typedef std::map<UINT32, TSessionDeadlineMap::iterator> TSessionDeadlineIndex;
+
 	class TaskSessionTimeout: public Task
 	{
 	public:
+		TaskSessionTimeout();
+		virtual ~TaskSessionTimeout();
+
 		virtual void run();
 		virtual bool isThreaded();
 
+		void armSession(UINT32 sessionId, PropertySetPtr properties);
+		void cancelSession(UINT32 sessionId);
+
 	private:
+		long getTimeout(PropertySetPtr properties);
+		DWORD getWaitTime();
+		void expireSessions();
+
+		CRITICAL_SECTION mCSection;
+		HANDLE mhChanged;
+		TSessionDeadlineMap mDeadlines;
+		TSessionDeadlineIndex mSessionDeadlines;
 	};
 
 	typedef boost::shared_ptr<TaskSessionTimeout> TaskSessionTimeoutPtr;
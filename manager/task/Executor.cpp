@@ -24,13 +24,13 @@
 #include "Executor.h"
 
 #include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 #include <winpr/wlog.h>
 
 #include <utils/CSGuard.h>
 #include <session/ApplicationContext.h>
 
-#include <functional>
-
 namespace freerds
 {
 	static wLog* logger_Executor = WLog_Get("freerds.Executor");
@@ -38,16 +38,16 @@ namespace freerds
 	Executor::Executor()
 	{
 		m_hStopEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
-		m_hTaskThreadStarted = CreateEvent(NULL,TRUE,FALSE,NULL);
 		m_hStopThreads = CreateEvent(NULL,TRUE,FALSE,NULL);
+		m_hTaskSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
 
 		if (!InitializeCriticalSectionAndSpinCount(&m_CSection, 0x00000400))
 		{
 			WLog_Print(logger_Executor, WLOG_FATAL, "cannot init Executor critical section!");
 		}
 
-		m_hServerThread = NULL;
 		m_Running = false;
+		m_NextWorker = 0;
 	}
 
 	Executor::~Executor()
@@ -56,6 +56,7 @@ namespace freerds
 
 	int Executor::start()
 	{
+		long workerCount;
 		CSGuard guard(&m_CSection);
 
 		if (m_Running)
@@ -64,11 +65,53 @@ namespace freerds
 			return 1;
 		}
 
-		m_hServerThread = CreateThread(NULL, 0,
-				(LPTHREAD_START_ROUTINE) Executor::execThread, (void*) this,
-				CREATE_SUSPENDED, NULL);
+		if (!APP_CONTEXT.getPropertyManager()->getPropertyNumber("executor.workers", &workerCount))
+			workerCount = EXECUTOR_DEFAULT_WORKERS;
+
+		if (workerCount < 1)
+			workerCount = 1;
+
+		if (workerCount > EXECUTOR_MAX_WORKERS)
+			workerCount = EXECUTOR_MAX_WORKERS;
+
+		ResetEvent(m_hStopEvent);
+		ResetEvent(m_hStopThreads);
+
+		while (m_Workers.size() < (size_t) workerCount)
+		{
+			ExecutorWorker* worker = new ExecutorWorker;
+
+			worker->executor = this;
+			worker->index = (DWORD) m_Workers.size();
+			worker->refCount = 2;
+			worker->stopped = false;
+			InitializeCriticalSectionAndSpinCount(&worker->lock, 0x00000400);
+
+			worker->hThread = CreateThread(NULL, 0,
+					(LPTHREAD_START_ROUTINE) Executor::workerThread, (void*) worker,
+					CREATE_SUSPENDED, NULL);
+
+			if (!worker->hThread)
+			{
+				worker->refCount = 1;
+				releaseWorker(worker);
+				break;
+			}
+
+			m_Workers.push_back(worker);
+		}
+
+		if (m_Workers.empty())
+		{
+			WLog_Print(logger_Executor, WLOG_ERROR, "could not start any Executor worker!");
+			return 1;
+		}
+
+		for (size_t index = 0; index < m_Workers.size(); index++)
+			ResumeThread(m_Workers[index]->hThread);
+
+		WLog_Print(logger_Executor, WLOG_DEBUG, "started %d Executor workers", (int) m_Workers.size());
 
-		ResumeThread(m_hServerThread);
 		m_Running = true;
 
 		return 0;
@@ -76,108 +119,273 @@ namespace freerds
 
 	int Executor::stop()
 	{
-		CSGuard guard(&m_CSection);
+		UINT64 deadline;
+		std::list<HANDLE> threads;
+		std::vector<ExecutorWorker*> workers;
 
-		m_Running = false;
-
-		if (m_hServerThread)
 		{
+			CSGuard guard(&m_CSection);
+
+			if (!m_Running)
+			{
+				WLog_Print(logger_Executor, WLOG_ERROR, "Executor was not started before.");
+				return 1;
+			}
+
+			m_Running = false;
+
+			for (size_t index = 0; index < m_Workers.size(); index++)
+				m_Workers[index]->stopped = true;
+
 			SetEvent(m_hStopEvent);
-			WaitForSingleObject(m_hServerThread, INFINITE);
-			CloseHandle(m_hServerThread);
-			m_hServerThread = NULL;
-		}
-		else
-		{
-			WLog_Print(logger_Executor, WLOG_ERROR, "Executor was not started before.");
-			return 1;
+			SetEvent(m_hStopThreads);
+
+			threads.insert(threads.end(), m_TaskThreadList.begin(), m_TaskThreadList.end());
+			m_TaskThreadList.clear();
+
+			/* workers still running see an empty pool in takeTask */
+			workers.swap(m_Workers);
 		}
 
-		return 0;
+		/**
+		 * Workers finish the task they are running and exit, queued tasks
+		 * are dropped. All threads share one shutdown deadline, threads
+		 * still running a task after it are left behind and free their
+		 * worker themselves once the task returns.
+		 */
+
+		deadline = GetTickCount64() + EXECUTOR_SHUTDOWN_TIMEOUT;
+
+		for (size_t index = 0; index < workers.size(); index++)
+			threads.push_back(workers[index]->hThread);
+
+		bool joined = joinThreads(threads, deadline);
+
+		for (size_t index = 0; index < workers.size(); index++)
+			releaseWorker(workers[index]);
+
+		while (WaitForSingleObject(m_hTaskSemaphore, 0) == WAIT_OBJECT_0);
+
+		return joined ? 0 : 1;
 	}
 
-	void Executor::runExecutor()
+	void Executor::releaseWorker(ExecutorWorker* worker)
 	{
-		DWORD status;
-		DWORD nCount;
-		HANDLE queueHandle = m_Tasks.getSignalHandle();
-		HANDLE events[2];
+		/* one reference for the executor, one for the worker thread */
+		if (InterlockedDecrement(&worker->refCount) > 0)
+			return;
 
-		nCount = 0;
-		events[nCount++] = m_hStopEvent;
-		events[nCount++] = queueHandle;
+		DeleteCriticalSection(&worker->lock);
+		delete worker;
+	}
 
-		while (1)
+	bool Executor::joinThreads(std::list<HANDLE>& threads, UINT64 deadline)
+	{
+		bool joined = true;
+		std::list<HANDLE>::iterator it;
+
+		for (it = threads.begin(); it != threads.end(); it++)
 		{
-			status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+			UINT64 now = GetTickCount64();
+			DWORD timeout = (now < deadline) ? (DWORD) (deadline - now) : 0;
 
-			if (WaitForSingleObject(m_hStopEvent, 0) == WAIT_OBJECT_0)
+			if (WaitForSingleObject(*it, timeout) != WAIT_OBJECT_0)
 			{
-				SetEvent(m_hStopThreads);
-				// shut down all threads
-				m_TaskThreadList.remove_if(std::bind1st(std::mem_fun(&Executor::waitThreadHandles),this));
-				break;
+				WLog_Print(logger_Executor, WLOG_ERROR, "Executor thread did not stop in time");
+				joined = false;
 			}
 
-			if (WaitForSingleObject(queueHandle, 0) == WAIT_OBJECT_0)
+			/* detaches a thread that is still running */
+			CloseHandle(*it);
+		}
+
+		return joined;
+	}
+
+	bool Executor::addTask(TaskPtr task)
+	{
+		CSGuard guard(&m_CSection);
+
+		if (!m_Running)
+			return false;
+
+		if (task->isThreaded())
+			return startThreadedTask(task);
+
+		int priority = task->getPriority();
+
+		if ((priority < 0) || (priority >= TASK_PRIORITY_COUNT))
+			priority = TASK_PRIORITY_NORMAL;
+
+		UINT32 key = task->getOrderingKey();
+		DWORD next = key ? key : (DWORD) InterlockedIncrement(&m_NextWorker);
+		ExecutorWorker* worker = m_Workers[next % m_Workers.size()];
+
+		EnterCriticalSection(&worker->lock);
+		worker->queues[priority].push_back(task);
+		LeaveCriticalSection(&worker->lock);
+
+		ReleaseSemaphore(m_hTaskSemaphore, 1, NULL);
+
+		return true;
+	}
+
+	bool Executor::startThreadedTask(TaskPtr task)
+	{
+		HANDLE taskThread;
+		TaskPtr* taskptr = new TaskPtr(task);
+
+		/* threaded tasks are long running services and get their own thread */
+
+		task->setStopHandle(m_hStopThreads);
+
+		taskThread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) Executor::execTask, (void*) taskptr,
+				0, NULL);
+
+		if (!taskThread)
+		{
+			WLog_Print(logger_Executor, WLOG_ERROR, "could not start Task thread");
+			delete taskptr;
+			return false;
+		}
+
+		m_TaskThreadList.push_back(taskThread);
+
+		return true;
+	}
+
+	TaskPtr Executor::takeTask(ExecutorWorker* worker)
+	{
+		TaskPtr task;
+		CSGuard guard(&m_CSection);
+		size_t count = m_Workers.size();
+
+		/**
+		 * Higher priorities are served first across all workers. Within a
+		 * priority a worker takes the oldest task of its own deque and
+		 * otherwise steals the newest task from another worker. The
+		 * executor lock keeps start and stop from resizing the pool
+		 * during the scan, worker locks are taken inside it as in addTask.
+		 */
+
+		if (worker->stopped)
+			return task;
+
+		for (int priority = 0; priority < TASK_PRIORITY_COUNT; priority++)
+		{
+			for (size_t offset = 0; offset < count; offset++)
 			{
-				m_Tasks.resetEventAndLockQueue();
-				TaskPtr currentTask = m_Tasks.getElementLockFree();
+				ExecutorWorker* victim = m_Workers[(worker->index + offset) % count];
+				std::deque<TaskPtr>& queue = victim->queues[priority];
 
-				while (currentTask)
+				EnterCriticalSection(&victim->lock);
+
+				if (!queue.empty())
 				{
-					if (!currentTask->isThreaded())
+					if (victim == worker)
 					{
-						currentTask->run();
-						currentTask.reset();
+						task = queue.front();
+						queue.pop_front();
 					}
 					else
 					{
-						// start Task as thread
-
-						currentTask->setHandles(m_hStopThreads, m_hTaskThreadStarted);
-
-						HANDLE taskThread = CreateThread(NULL, 0,
-								(LPTHREAD_START_ROUTINE) Executor::execTask, (void*) &currentTask,
-								CREATE_SUSPENDED, NULL);
-
-						ResumeThread(taskThread);
-						m_TaskThreadList.push_back(taskThread);
-						WaitForSingleObject(m_hTaskThreadStarted, INFINITE);
-						ResetEvent(m_hTaskThreadStarted);
-						currentTask.reset();
+						task = queue.back();
+						queue.pop_back();
 					}
-					currentTask = m_Tasks.getElementLockFree();
-					m_TaskThreadList.remove_if(std::bind1st(std::mem_fun(&Executor::checkThreadHandles),this));
 				}
 
-				m_Tasks.unlockQueue();
+				LeaveCriticalSection(&victim->lock);
+
+				if (task)
+					return task;
 			}
 		}
+
+		return task;
 	}
 
-	bool Executor::addTask(TaskPtr task)
+	void Executor::runWorker(ExecutorWorker* worker)
 	{
-		CSGuard guard(&m_CSection);
+		DWORD status;
+		HANDLE events[2];
 
-		if (m_Running) {
-			m_Tasks.addElement(task);
-			return true;
-		} else {
-			return false;
+		events[0] = m_hStopEvent;
+		events[1] = m_hTaskSemaphore;
+
+		while (1)
+		{
+			status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+			if ((status != (WAIT_OBJECT_0 + 1)) || worker->stopped)
+				break;
+
+			TaskPtr currentTask = takeTask(worker);
+
+			if (currentTask)
+				runTask(currentTask);
 		}
 	}
 
-	void* Executor::execThread(void* arg)
+	void Executor::runTask(TaskPtr task)
 	{
-		Executor* executor;
+		UINT32 key = task->getOrderingKey();
+
+		if (!key)
+		{
+			task->run();
+			return;
+		}
 
-		executor = (Executor*) arg;
-		WLog_Print(logger_Executor, WLOG_DEBUG, "started Executor thread");
+		/**
+		 * Tasks of a key that is already running are parked behind it and
+		 * run by the same worker afterwards, in the order they were taken.
+		 */
 
-		executor->runExecutor();
+		{
+			CSGuard guard(&m_CSection);
+			TOrderedTaskMap::iterator it = m_OrderedTasks.find(key);
+
+			if (it != m_OrderedTasks.end())
+			{
+				it->second.push_back(task);
+				return;
+			}
 
-		WLog_Print(logger_Executor, WLOG_DEBUG, "stopped Executor thread");
+			m_OrderedTasks[key];
+		}
+
+		while (task)
+		{
+			task->run();
+			task.reset();
+
+			CSGuard guard(&m_CSection);
+			TOrderedTaskMap::iterator it = m_OrderedTasks.find(key);
+
+			if (!m_Running || it->second.empty())
+			{
+				m_OrderedTasks.erase(it);
+			}
+			else
+			{
+				task = it->second.front();
+				it->second.pop_front();
+			}
+		}
+	}
+
+	void* Executor::workerThread(void* arg)
+	{
+		ExecutorWorker* worker;
+
+		worker = (ExecutorWorker*) arg;
+		WLog_Print(logger_Executor, WLOG_DEBUG, "started Executor worker %d", worker->index);
+
+		worker->executor->runWorker(worker);
+
+		WLog_Print(logger_Executor, WLOG_DEBUG, "stopped Executor worker %d", worker->index);
+		releaseWorker(worker);
 		return NULL;
 	}
 
@@ -185,7 +393,7 @@ namespace freerds
 	{
 		TaskPtr* taskptr = static_cast<TaskPtr*>(arg);
 		TaskPtr task = *taskptr;
-		task->informStarted();
+		delete taskptr;
 
 		WLog_Print(logger_Executor, WLOG_TRACE, "started Task thread");
 
@@ -194,20 +402,4 @@ namespace freerds
 		WLog_Print(logger_Executor, WLOG_TRACE, "stopped Task thread");
 		return NULL;
 	}
-
-	bool Executor::checkThreadHandles(const HANDLE value) const
-	{
-		if (WaitForSingleObject(value,0) == WAIT_OBJECT_0)
-			return true;
-
-		return false;
-	}
-
-	bool Executor::waitThreadHandles(const HANDLE value) const
-	{
-		if (WaitForSingleObject(value, INFINITE) == WAIT_OBJECT_0)
-			return true;
-
-		return false;
-	}
 }
@@ -20,16 +20,34 @@
 #ifndef __EXECUTOR_H_
 #define __EXECUTOR_H_
 
+#include <map>
 #include <list>
+#include <deque>
+#include <vector>
 
 #include "Task.h"
 
-#include <utils/SignalingQueue.h>
-
-#define PIPE_BUFFER_SIZE	0xFFFF
+#define EXECUTOR_DEFAULT_WORKERS	4
+#define EXECUTOR_MAX_WORKERS		32
+#define EXECUTOR_SHUTDOWN_TIMEOUT	10000
 
 namespace freerds
 {
+	class Executor;
+
+	struct ExecutorWorker
+	{
+		Executor* executor;
+		DWORD index;
+		HANDLE hThread;
+		LONG refCount;
+		bool stopped;
+		CRITICAL_SECTION lock;
+		std::deque<TaskPtr> queues[TASK_PRIORITY_COUNT];
+	};
+
+	typedef std::map<UINT32, std::deque<TaskPtr> > TOrderedTaskMap;
+
 	class Executor
 	{
 	public:
@@ -39,29 +57,31 @@ namespace freerds
 		int start();
 		int stop();
 
-		void runExecutor();
-
 		bool addTask(TaskPtr task);
 
 	private:
-		static void* execThread(void* arg);
+		static void* workerThread(void* arg);
 		static void* execTask(void* arg);
 
-		bool checkThreadHandles(const HANDLE value) const;
-		bool waitThreadHandles(const HANDLE value) const;
+		void runWorker(ExecutorWorker* worker);
+		TaskPtr takeTask(ExecutorWorker* worker);
+		void runTask(TaskPtr task);
+		static void releaseWorker(ExecutorWorker* worker);
+		bool startThreadedTask(TaskPtr task);
+		bool joinThreads(std::list<HANDLE>& threads, UINT64 deadline);
 
 	private:
 		HANDLE m_hStopEvent;
-		HANDLE m_hServerThread;
-
 		HANDLE m_hStopThreads;
-		HANDLE m_hTaskThreadStarted;
+		HANDLE m_hTaskSemaphore;
 
 		bool m_Running;
+		LONG m_NextWorker;
 
+		std::vector<ExecutorWorker*> m_Workers;
 		std::list<HANDLE> m_TaskThreadList;
+		TOrderedTaskMap m_OrderedTasks;
 		CRITICAL_SECTION m_CSection;
-		SignalingQueue<TaskPtr> m_Tasks;
 	};
 }
 
@@ -24,26 +24,32 @@
 
 #include <boost/shared_ptr.hpp>
 
+#define TASK_PRIORITY_HIGH	0
+#define TASK_PRIORITY_NORMAL	1
+#define TASK_PRIORITY_LOW	2
+#define TASK_PRIORITY_COUNT	3
+
 namespace freerds
 {
 	class Task
 	{
 	public:
-		Task():mhStop(0),mhStarted(0) {};
+		Task():mhStop(0) {};
 		virtual ~Task() {};
 		virtual void run() = 0;
 		virtual bool isThreaded() {
 			return false;
 		}
-		void setHandles(HANDLE stopHandle,HANDLE startedHandle) {
-			mhStop = stopHandle;
-			mhStarted = startedHandle;
+		virtual int getPriority() {
+			return TASK_PRIORITY_NORMAL;
 		}
-		void informStarted() {
-			SetEvent(mhStarted);
+		/* tasks with the same non zero key never run at the same time */
+		virtual UINT32 getOrderingKey() {
+			return 0;
+		}
+		void setStopHandle(HANDLE stopHandle) {
+			mhStop = stopHandle;
 		}
-	private:
-		HANDLE mhStarted;
 	protected:
 		HANDLE mhStop;
 	};
@@ -0,0 +1,57 @@
+/**
+ * Guard objects for reader-writer locks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RWGUARD_H_
+#define __RWGUARD_H_
+
+#include <pthread.h>
+
+class ReadGuard
+{
+public:
+	ReadGuard(pthread_rwlock_t* rwlock) {
+		mRWLock = rwlock;
+		pthread_rwlock_rdlock(mRWLock);
+	};
+
+	~ReadGuard() {
+		pthread_rwlock_unlock(mRWLock);
+	}
+
+private:
+	pthread_rwlock_t * mRWLock;
+
+};
+
+class WriteGuard
+{
+public:
+	WriteGuard(pthread_rwlock_t* rwlock) {
+		mRWLock = rwlock;
+		pthread_rwlock_wrlock(mRWLock);
+	};
+
+	~WriteGuard() {
+		pthread_rwlock_unlock(mRWLock);
+	}
+
+private:
+	pthread_rwlock_t * mRWLock;
+
+};
+
+
+#endif /* __RWGUARD_H_ */
@@ -20,11 +20,35 @@
 #ifndef SIGNALINGQUEUE_H_
 #define SIGNALINGQUEUE_H_
 
-#include <list>
 #include <winpr/synch.h>
+#include <winpr/interlocked.h>
 
+#define SIGNALINGQUEUE_POOL_SIZE	1024
+
+/**
+ * Multi-producer single-consumer queue.
+ *
+ * Producers link nodes in with an atomic exchange on the head, the
+ * consumer unlinks them from the tail without taking a lock. Nodes come
+ * from a fixed per-queue pool managed as a tagged free stack, and only
+ * fall back to the heap when the pool is exhausted. The signal event is
+ * set once per drain cycle, by the first producer after the consumer
+ * called resetEventAndLockQueue.
+ *
+ * The lock only serialises consumers, a queue is expected to be drained
+ * by one thread at a time.
+ */
 template<typename QueueElement> class SignalingQueue
 {
+private:
+	struct Node
+	{
+		QueueElement element;
+		Node* volatile next;
+		LONG poolIndex;
+		LONG nextFree;
+	};
+
 public:
 	SignalingQueue()
 	{
@@ -34,10 +58,32 @@ public:
 		}
 
 		mSignalHandle = CreateEvent(NULL,TRUE,FALSE,NULL);
+		mSignaled = 0;
+
+		mPool = new Node[SIGNALINGQUEUE_POOL_SIZE];
+		mFreeTop = 0;
+
+		for (LONG index = 0; index < SIGNALINGQUEUE_POOL_SIZE; index++)
+		{
+			mPool[index].poolIndex = index + 1;
+			releaseNode(&mPool[index]);
+		}
+
+		mStub.next = NULL;
+		mStub.poolIndex = 0;
+		mHead = &mStub;
+		mTail = &mStub;
 	}
 
 	~SignalingQueue()
 	{
+		while (getElementLockFree() != QueueElement());
+
+		if (mTail != &mStub)
+			releaseNode(mTail);
+
+		delete [] mPool;
+
 		CloseHandle(mSignalHandle);
 		DeleteCriticalSection(&mCSection);
 	}
@@ -49,10 +95,22 @@ public:
 
 	void addElement(QueueElement element)
 	{
-		EnterCriticalSection(&mCSection);
-		mlist.push_back(element);
-		SetEvent(mSignalHandle);
-		LeaveCriticalSection(&mCSection);
+		Node* node = acquireNode();
+		Node* prev;
+
+		node->element = element;
+		node->next = NULL;
+
+		do
+		{
+			prev = (Node*) mHead;
+		}
+		while (InterlockedCompareExchangePointer((PVOID volatile*) &mHead, node, prev) != prev);
+
+		prev->next = node;
+
+		if (InterlockedCompareExchange(&mSignaled, 1, 0) == 0)
+			SetEvent(mSignalHandle);
 	}
 
 	void lockQueue()
@@ -63,16 +121,28 @@ public:
 	void resetEventAndLockQueue()
 	{
 		ResetEvent(mSignalHandle);
+		InterlockedExchange(&mSignaled, 0);
 		EnterCriticalSection(&mCSection);
 	}
 
 	QueueElement getElementLockFree()
 	{
 		QueueElement element;
-		if (mlist.empty())
+		Node* tail = mTail;
+		Node* next = tail->next;
+
+		/* an element whose producer has not linked it yet is picked up on the next signal */
+
+		if (!next)
 			return QueueElement();
-		element = mlist.front();
-		mlist.pop_front();
+
+		element = next->element;
+		next->element = QueueElement();
+		mTail = next;
+
+		if (tail != &mStub)
+			releaseNode(tail);
+
 		return element;
 	}
 
@@ -82,9 +152,67 @@ public:
 	}
 
 private:
+	static LONGLONG nextTag(LONGLONG top)
+	{
+		/* the upper half counts free stack updates to rule out ABA */
+		return (LONGLONG) ((((ULONGLONG) top >> 32) + 1) << 32);
+	}
+
+	Node* acquireNode()
+	{
+		LONGLONG top;
+		LONGLONG newTop;
+		LONG index;
+
+		do
+		{
+			top = mFreeTop;
+			index = (LONG) (top & 0xFFFFFFFF);
+
+			if (!index)
+			{
+				Node* node = new Node;
+				node->poolIndex = 0;
+				return node;
+			}
+
+			newTop = nextTag(top) | (ULONG) mPool[index - 1].nextFree;
+		}
+		while (InterlockedCompareExchange64(&mFreeTop, newTop, top) != top);
+
+		return &mPool[index - 1];
+	}
+
+	void releaseNode(Node* node)
+	{
+		LONGLONG top;
+		LONGLONG newTop;
+
+		if (!node->poolIndex)
+		{
+			delete node;
+			return;
+		}
+
+		do
+		{
+			top = mFreeTop;
+			node->nextFree = (LONG) (top & 0xFFFFFFFF);
+			newTop = nextTag(top) | (ULONG) node->poolIndex;
+		}
+		while (InterlockedCompareExchange64(&mFreeTop, newTop, top) != top);
+	}
+
 	HANDLE mSignalHandle;
 	CRITICAL_SECTION mCSection;
-	std::list<QueueElement> mlist;
+	LONG volatile mSignaled;
+
+	Node* volatile mHead;
+	Node* mTail;
+	Node mStub;
+
+	Node* mPool;
+	LONGLONG volatile mFreeTop;
 };
 
 #endif /* SIGNALINGQUEUE_H_ */
@@ -0,0 +1,122 @@
+/**
+ * FreeRDS: FreeRDP Remote Desktop Services (RDS)
+ * Benchmark session module
+ *
+ * A session module that starts no process. It hands back an endpoint
+ * name right away so that logon load tests only measure the manager.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/wlog.h>
+
+#include <freerds/module.h>
+#include <freerds/backend.h>
+
+#include "bench_module.h"
+
+struct rds_module_bench
+{
+	RDS_MODULE_COMMON commonModule;
+
+	wLog* log;
+	char* pipeName;
+};
+typedef struct rds_module_bench rdsModuleBench;
+
+RDS_MODULE_COMMON* bench_rds_module_new(void)
+{
+	rdsModuleBench* bench = (rdsModuleBench*) calloc(1, sizeof(rdsModuleBench));
+
+	if (!bench)
+		return NULL;
+
+	bench->log = WLog_Get("com.freerds.module.bench");
+
+	return (RDS_MODULE_COMMON*) bench;
+}
+
+void bench_rds_module_free(RDS_MODULE_COMMON* module)
+{
+	rdsModuleBench* bench = (rdsModuleBench*) module;
+
+	if (!bench)
+		return;
+
+	free(bench->pipeName);
+	free(bench);
+}
+
+char* bench_rds_module_start(RDS_MODULE_COMMON* module)
+{
+	rdsModuleBench* bench = (rdsModuleBench*) module;
+
+	if (!bench->pipeName)
+	{
+		bench->pipeName = (char*) malloc(256);
+
+		if (!bench->pipeName)
+			return NULL;
+
+		freerds_named_pipe_get_endpoint_name(bench->commonModule.sessionId, "Bench", bench->pipeName, 256);
+	}
+
+	WLog_Print(bench->log, WLOG_DEBUG, "RdsModuleStart: SessionId: %d", (int) bench->commonModule.sessionId);
+
+	return bench->pipeName;
+}
+
+int bench_rds_module_stop(RDS_MODULE_COMMON* module)
+{
+	rdsModuleBench* bench = (rdsModuleBench*) module;
+
+	WLog_Print(bench->log, WLOG_DEBUG, "RdsModuleStop: SessionId: %d", (int) bench->commonModule.sessionId);
+
+	return 0;
+}
+
+int bench_rds_module_get_state(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state)
+{
+	state->instance = module->sessionId;
+	state->processCount = 0;
+
+	return 0;
+}
+
+char* bench_rds_module_adopt(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state)
+{
+	/* there is no process behind a bench session, so it can always be adopted */
+	return bench_rds_module_start(module);
+}
+
+int RdsModuleEntry(RDS_MODULE_ENTRY_POINTS* pEntryPoints)
+{
+	pEntryPoints->Version = 1;
+	pEntryPoints->Name = "Bench";
+
+	pEntryPoints->New = bench_rds_module_new;
+	pEntryPoints->Free = bench_rds_module_free;
+
+	pEntryPoints->Start = bench_rds_module_start;
+	pEntryPoints->Stop = bench_rds_module_stop;
+
+	pEntryPoints->GetState = bench_rds_module_get_state;
+	pEntryPoints->Adopt = bench_rds_module_adopt;
+
+	return 0;
+}
@@ -103,6 +103,10 @@ struct _rdpScreenInfoRec
 	int sizeInBytes;
 	char* pfbMemory;
 
+	int maxWidth;
+	int maxHeight;
+	int segmentSize;
+
 	int dpi;
 	Pixel blackPixel;
 	Pixel whitePixel;
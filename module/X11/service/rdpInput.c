@@ -41,6 +41,10 @@ extern rdpScreenInfoRec g_rdpScreen;
 
 static int g_old_button_mask = 0;
 
+static int g_motion_pending = 0;
+static int g_motion_x = 0;
+static int g_motion_y = 0;
+
 #define MIN_KEY_CODE 8
 #define MAX_KEY_CODE 255
 #define NO_OF_KEYS ((MAX_KEY_CODE - MIN_KEY_CODE) + 1)
@@ -857,11 +861,35 @@ static void rdpEnqueueMotion(int x, int y)
 #endif
 }
 
+/**
+ * Pointer motion is only recorded when it arrives and injected when the
+ * pending input has been drained, or right before a button or key event
+ * so that events are never reordered.
+ */
+void PtrFlushMotionEvent(void)
+{
+	static int sx = 0;
+	static int sy = 0;
+
+	if (!g_motion_pending)
+		return;
+
+	g_motion_pending = 0;
+
+	if ((sx != g_motion_x) || (sy != g_motion_y))
+		rdpEnqueueMotion(g_motion_x, g_motion_y);
+
+	sx = g_motion_x;
+	sy = g_motion_y;
+}
+
 static void rdpEnqueueButton(int type, int buttons)
 {
 	ValuatorMask mask;
 	int valuators[MAX_VALUATORS] = { 0 };
 
+	PtrFlushMotionEvent();
+
 	valuator_mask_set_range(&mask, 0, 0, valuators);
 
 #if (XORG_VERSION_CURRENT >= XORG_VERSION(1,11,0))
@@ -909,6 +937,8 @@ static void rdpEnqueueKey(int type, int scancode)
 	static int last_type;
 	static int last_scancode;
 
+	PtrFlushMotionEvent();
+
 	if ((type == KeyPress) && (type == last_type) && (scancode == last_scancode))
 	{
 		rdpEnqueueKey(KeyRelease, scancode);
@@ -952,16 +982,11 @@ static void rdpEnqueueKey(int type, int scancode)
 
 void PtrAddMotionEvent(int x, int y)
 {
-	static int sx = 0;
-	static int sy = 0;
-
 	rdpWriteLog("%s: x=%d, y=%d", __FUNCTION__, x, y);
 
-	if ((sx != x) || (sy != y))
-		rdpEnqueueMotion(x, y);
-
-	sx = x;
-	sy = y;
+	g_motion_pending = 1;
+	g_motion_x = x;
+	g_motion_y = y;
 }
 
 void PtrAddButtonEvent(int buttonMask)
@@ -36,6 +36,7 @@ void rdpSpriteMoveCursor(DeviceIntPtr pDev, ScreenPtr pScr, int x, int y);
 Bool rdpSpriteDeviceCursorInitialize(DeviceIntPtr pDev, ScreenPtr pScr);
 void rdpSpriteDeviceCursorCleanup(DeviceIntPtr pDev, ScreenPtr pScr);
 void PtrAddMotionEvent(int x, int y);
+void PtrFlushMotionEvent(void);
 void PtrAddButtonEvent(int buttonMask);
 void KbdAddScancodeEvent(DWORD flags, DWORD scancode, DWORD keyboardType);
 void KbdAddVirtualKeyCodeEvent(DWORD flags, DWORD vkcode);
@@ -538,6 +538,22 @@ int ddxProcessArgument(int argc, char** argv, int i)
 		return 2;
 	}
 
+	if (strcmp(argv[i], "-maxgeometry") == 0)
+	{
+		if (i + 1 >= argc)
+		{
+			UseMsg();
+		}
+
+		if (sscanf(argv[i + 1], "%dx%d", &g_rdpScreen.maxWidth, &g_rdpScreen.maxHeight) != 2)
+		{
+			DEBUG_OUT("Invalid maximum geometry %s\n", argv[i + 1]);
+			UseMsg();
+		}
+
+		return 2;
+	}
+
 	if (strcmp(argv[i], "-depth") == 0)
 	{
 		if (i + 1 >= argc)
@@ -734,6 +750,7 @@ void ddxUseMsg(void)
 	ErrorF("\n");
 	ErrorF("X11rdp specific options\n");
 	ErrorF("-geometry WxH          set framebuffer width & height\n");
+	ErrorF("-maxgeometry WxH       reserve framebuffer memory for resizing up to WxH\n");
 	ErrorF("-depth D               set framebuffer depth\n");
 	ErrorF("\n");
 	exit(1);
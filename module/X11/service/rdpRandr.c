@@ -25,6 +25,7 @@
 #include "rdpModes.h"
 #include "rdpRandr.h"
 #include "rdpScreen.h"
+#include "rdpUpdate.h"
 
 #include <stdio.h>
 #include <sys/shm.h>
@@ -81,6 +82,7 @@ Bool rdpRRGetInfo(ScreenPtr pScreen, Rotation* pRotations)
 Bool rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 mmWidth, CARD32 mmHeight)
 {
 	BoxRec box;
+	int segmentId;
 	WindowPtr pRoot;
 	PixmapPtr screenPixmap;
 	rdpRandRInfoPtr randr;
@@ -109,7 +111,7 @@ Bool rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 m
 
 	pRoot = pScreen->root;
 
-	rdp_detach_framebuffer();
+	segmentId = g_rdpScreen.segmentId;
 
 	g_rdpScreen.width = width;
 	g_rdpScreen.height = height;
@@ -128,11 +130,18 @@ Bool rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 m
 	screenInfo.height = height;
 #endif
 
-	if (g_rdpScreen.pfbMemory)
-		rdpScreenFrameBufferFree();
-
 	rdpScreenFrameBufferAlloc();
 
+	if (g_rdpScreen.segmentId == segmentId)
+	{
+		/* the segment was reused, tell freerds about the new geometry only */
+		rdp_resize_framebuffer();
+	}
+	else
+	{
+		rdp_detach_framebuffer();
+	}
+
 	screenPixmap = pScreen->GetScreenPixmap(pScreen);
 
 	if (screenPixmap)
@@ -77,6 +77,8 @@ int rdpScreenPixelToMM(int pixels)
 int rdpScreenFrameBufferAlloc()
 {
 	int shmmin;
+	int segmentSize;
+	int maxScanline;
 
 	shmmin = get_min_shared_memory_segment_size();
 
@@ -94,10 +96,31 @@ int rdpScreenFrameBufferAlloc()
 			g_rdpScreen.sizeInBytes = shmmin;
 	}
 
+	if (g_rdpScreen.pfbMemory)
+	{
+		/* the current segment is large enough, only the geometry changes */
+		if (g_rdpScreen.sizeInBytes <= g_rdpScreen.segmentSize)
+			return 0;
+
+		rdpScreenFrameBufferFree();
+	}
+
+	/* size the segment for the maximum geometry so that resizing can reuse it */
+	segmentSize = g_rdpScreen.sizeInBytes;
+
+	if ((g_rdpScreen.maxWidth > 0) && (g_rdpScreen.maxHeight > 0))
+	{
+		maxScanline = g_rdpScreen.maxWidth * g_rdpScreen.bytesPerPixel;
+		maxScanline += (maxScanline % 16);
+
+		if ((maxScanline * g_rdpScreen.maxHeight) > segmentSize)
+			segmentSize = maxScanline * g_rdpScreen.maxHeight;
+	}
+
 	if (!g_rdpScreen.pfbMemory)
 	{
 		/* allocate shared memory segment */
-		g_rdpScreen.segmentId = shmget(IPC_PRIVATE, g_rdpScreen.sizeInBytes,
+		g_rdpScreen.segmentId = shmget(IPC_PRIVATE, segmentSize,
 				IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
 		/* attach the shared memory segment */
@@ -112,7 +135,9 @@ int rdpScreenFrameBufferAlloc()
 		/* mark the shared memory segment for automatic deletion */
 		shmctl(g_rdpScreen.segmentId, IPC_RMID, 0);
 
-		ZeroMemory(g_rdpScreen.pfbMemory, g_rdpScreen.sizeInBytes);
+		ZeroMemory(g_rdpScreen.pfbMemory, segmentSize);
+
+		g_rdpScreen.segmentSize = segmentSize;
 	}
 
 	return 0;
@@ -123,6 +148,7 @@ int rdpScreenFrameBufferFree()
 	/* detach shared memory segment */
 	shmdt(g_rdpScreen.pfbMemory);
 	g_rdpScreen.pfbMemory = NULL;
+	g_rdpScreen.segmentSize = 0;
 
 	return 0;
 }
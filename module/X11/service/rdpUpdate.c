@@ -29,6 +29,7 @@
 
 #include <freerds/backend.h>
 
+#include "rdpInput.h"
 #include "rdpScreen.h"
 
 #include "rdpUpdate.h"
@@ -39,6 +40,8 @@
 #define LLOGLN(_level, _args) \
 		do { if (_level < LOG_LEVEL) { ErrorF _args ; ErrorF("\n"); } } while (0)
 
+#define RDP_MAX_MESSAGES_PER_CHECK 64
+
 static int g_clientfd = -1;
 static rdsBackendService* g_service;
 static int g_connected = 0;
@@ -277,6 +280,18 @@ int rdp_detach_framebuffer()
 	return 0;
 }
 
+int rdp_resize_framebuffer()
+{
+	/* re-announce the attached segment with the current geometry */
+	if (g_rdpScreen.fbAttached)
+	{
+		g_rdpScreen.fbAttached = 0;
+		rdp_attach_framebuffer();
+	}
+
+	return 0;
+}
+
 int rdp_send_update(RDS_MSG_COMMON* msg)
 {
 	int status;
@@ -634,13 +649,20 @@ int rdp_check(void)
 
 	if (service->hClientPipe)
 	{
-		if (WaitForSingleObject(service->hClientPipe, 0) == WAIT_OBJECT_0)
+		int count = 0;
+
+		/* drain what is pending so consecutive pointer motion collapses */
+		while ((count++ < RDP_MAX_MESSAGES_PER_CHECK) &&
+				(WaitForSingleObject(service->hClientPipe, 0) == WAIT_OBJECT_0))
 		{
 			if (freerds_transport_receive((rdsBackend*) service) < 0)
 			{
 				rds_service_disconnect(service);
+				break;
 			}
 		}
+
+		PtrFlushMotionEvent();
 	}
 	else
 	{
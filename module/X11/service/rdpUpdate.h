@@ -31,6 +31,7 @@ UINT32 rdp_dstblt_rop(int opcode);
 int rdp_init(void);
 int rdp_check(void);
 int rdp_detach_framebuffer();
+int rdp_resize_framebuffer();
 int rdp_set_clip(int x, int y, int width, int height);
 int rdp_reset_clip(void);
 void rdp_send_area_update(int x, int y, int width, int height);
@@ -30,6 +30,8 @@
 #include <unistd.h>
 
 #ifndef WIN32
+#include <pwd.h>
+#include <errno.h>
 #include <limits.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -37,11 +39,18 @@
 #include <sys/stat.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
 #include <winpr/pipe.h>
 #include <winpr/path.h>
 #include <winpr/shell.h>
 #include <winpr/synch.h>
 #include <winpr/thread.h>
+#include <winpr/sspicli.h>
 #include <winpr/wlog.h>
 #include <winpr/environment.h>
 
@@ -57,10 +66,105 @@ RDS_MODULE_STATUS_CALLBACKS g_Status;
 #define X11_UNIX_SOCKET_FORMAT "/tmp/.X11-unix/X%d"
 #define X11_DISPLAY_MAX 1024
 
+#define X11_POOL_MAX 32
+#define X11_POOL_MAX_CONFIGS 8
+#define X11_POOL_MAX_RESOLUTIONS 8
+#define X11_POOL_CHECK_INTERVAL 5000
+
 #define USE_IMPERSONATION 1
 
 static wLog* gModuleLog;
 
+static CRITICAL_SECTION g_DisplayLock;
+static BOOL g_DisplayReserved[X11_DISPLAY_MAX + 1];
+
+/**
+ * Pre-spawned Xrds server pool
+ *
+ * A module configuration opts in by setting <config>.poolSize to the number
+ * of idle servers to keep around. <config>.poolResolutions is an optional
+ * comma separated list of initial geometries ("1024x768,1280x1024"), it
+ * defaults to <config>.xres x <config>.yres. A claimed server whose geometry
+ * differs from the client's is resized through RandR when freerds sends the
+ * client capabilities, so an exact match only saves that resize.
+ *
+ * Pooled servers are started before any user is known. They run as the
+ * unprivileged account named by <config>.poolUser with an environment of
+ * their own, never as root and never with the manager's environment. Without
+ * a poolUser (or with one that maps to root) the configuration is not pooled.
+ *
+ * A claimed server keeps running as the pool user for the whole session, so
+ * it is only handed to sessions that may share that uid: greeter sessions,
+ * which carry no user token, and sessions of the pool user itself. Every
+ * other session starts an Xrds of its own under the session user's token.
+ * Pooling is therefore meant for greeter and single-user configurations.
+ */
+
+struct rds_x11_pool_server
+{
+	char* baseConfigPath;
+	UINT32 displayNum;
+	int width;
+	int height;
+	STARTUPINFO X11StartupInfo;
+	PROCESS_INFORMATION X11ProcessInformation;
+};
+typedef struct rds_x11_pool_server rdsX11PoolServer;
+
+struct rds_x11_pool
+{
+	CRITICAL_SECTION lock;
+	HANDLE thread;
+	HANDLE stopEvent;
+	HANDLE refillEvent;
+
+	int serverCount;
+	rdsX11PoolServer servers[X11_POOL_MAX];
+
+	int configCount;
+	char* configs[X11_POOL_MAX_CONFIGS];
+};
+typedef struct rds_x11_pool rdsX11Pool;
+
+static rdsX11Pool g_Pool;
+
+#define X11_SUPERVISOR_MAX_EVENTS 32
+
+typedef struct rds_module_x11 rdsModuleX11;
+
+/**
+ * Module-wide process supervisor
+ *
+ * Every session process is watched through a pidfd registered with a single
+ * epoll instance, so nothing runs until a process actually exits. When the
+ * first process of a session exits the remaining ones are sent SIGTERM, and
+ * once all of them are gone the manager is told to shut the session down.
+ * Kernels without pidfd support fall back to the per-session monitoring thread.
+ * An eventfd in the same epoll set wakes the thread when the module exits.
+ */
+
+struct rds_x11_watch
+{
+	int pidfd;
+	const char* name;
+	rdsModuleX11* x11;
+	PROCESS_INFORMATION* pi;
+	struct rds_x11_watch* next;
+};
+typedef struct rds_x11_watch rdsX11Watch;
+
+struct rds_x11_supervisor
+{
+	CRITICAL_SECTION lock;
+	int epollfd;
+	int stopfd;
+	HANDLE thread;
+	rdsX11Watch* retired;
+};
+typedef struct rds_x11_supervisor rdsX11Supervisor;
+
+static rdsX11Supervisor g_Supervisor;
+
 struct rds_module_x11
 {
 	RDS_MODULE_COMMON commonModule;
@@ -75,8 +179,11 @@ struct rds_module_x11
 	STARTUPINFO WMStartupInfo;
 	PROCESS_INFORMATION WMProcessInformation;
 	UINT32 displayNum;
+
+	int watchCount;
+	BOOL terminating;
+	rdsX11Watch* watches[3];
 };
-typedef struct rds_module_x11 rdsModuleX11;
 
 void x11_rds_module_reset_process_informations(STARTUPINFO* si, PROCESS_INFORMATION* pi)
 {
@@ -124,123 +231,955 @@ void monitoring_thread(void* arg)
 			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: CS process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
 			break;
 		}
-		if (waitpid(x11->WMProcessInformation.dwProcessId, &status, WNOHANG) != 0)
+		if (waitpid(x11->WMProcessInformation.dwProcessId, &status, WNOHANG) != 0)
+		{
+			ret = clean_up_process(&(x11->WMProcessInformation));
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: WM process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+			break;
+		}
+		if (WaitForSingleObject(x11->monitorStopEvent, 200) == WAIT_OBJECT_0)
+		{
+			// monitorStopEvent triggered
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: monitor stop event", x11->commonModule.sessionId);
+			return;
+		}
+	}
+
+	if (x11->CSProcessInformation.hProcess)
+	{
+		kill(x11->CSProcessInformation.dwProcessId, SIGTERM);
+		if (waitpid(x11->CSProcessInformation.dwProcessId, &status, 0) != 0)
+		{
+			ret = clean_up_process(&(x11->CSProcessInformation));
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: CS process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+		}
+	}
+
+	if (x11->WMProcessInformation.hProcess)
+	{
+		kill(x11->WMProcessInformation.dwProcessId, SIGTERM);
+		if (waitpid(x11->WMProcessInformation.dwProcessId, &status, 0) != 0)
+		{
+			ret = clean_up_process(&(x11->WMProcessInformation));
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: WM process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+		}
+	}
+
+	if (x11->X11ProcessInformation.hProcess)
+	{
+		kill(x11->X11ProcessInformation.dwProcessId, SIGTERM);
+		if (waitpid(x11->X11ProcessInformation.dwProcessId, &status, 0) != 0)
+		{
+			ret = clean_up_process(&(x11->X11ProcessInformation));
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: X11 process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+		}
+	}
+
+	g_Status.shutdown(x11->commonModule.sessionId);
+	return;
+}
+
+#ifdef __linux__
+
+static int x11_pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+	return syscall(__NR_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* must be called with the supervisor lock held */
+static void x11_rds_supervisor_retire(rdsX11Watch* watch)
+{
+	int index;
+	rdsModuleX11* x11 = watch->x11;
+
+	for (index = 0; index < 3; index++)
+	{
+		if (x11->watches[index] == watch)
+		{
+			x11->watches[index] = NULL;
+			x11->watchCount--;
+		}
+	}
+
+	epoll_ctl(g_Supervisor.epollfd, EPOLL_CTL_DEL, watch->pidfd, NULL);
+	close(watch->pidfd);
+	watch->pidfd = -1;
+	watch->x11 = NULL;
+
+	if (!g_Supervisor.thread)
+	{
+		free(watch);
+		return;
+	}
+
+	/* an event for this watch may still be pending in the current epoll batch,
+	 * so it is only freed by the supervisor thread before its next wait */
+	watch->next = g_Supervisor.retired;
+	g_Supervisor.retired = watch;
+}
+
+static void x11_rds_supervisor_dispatch(rdsX11Watch* watch)
+{
+	int ret;
+	int index;
+	int status;
+	BOOL shutdown = FALSE;
+	UINT32 sessionId = 0;
+	rdsModuleX11* x11;
+
+	EnterCriticalSection(&g_Supervisor.lock);
+
+	x11 = watch->x11;
+
+	if (!x11)
+	{
+		LeaveCriticalSection(&g_Supervisor.lock);
+		return;
+	}
+
+	waitpid(watch->pi->dwProcessId, &status, WNOHANG);
+	ret = clean_up_process(watch->pi);
+	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: %s process exited with %d (supervisor)",
+			x11->commonModule.sessionId, watch->name, ret);
+
+	x11_rds_supervisor_retire(watch);
+
+	if (!x11->terminating)
+	{
+		x11->terminating = TRUE;
+
+		for (index = 0; index < 3; index++)
+		{
+			if (x11->watches[index])
+				kill(x11->watches[index]->pi->dwProcessId, SIGTERM);
+		}
+	}
+
+	if (x11->watchCount == 0)
+	{
+		shutdown = TRUE;
+		sessionId = x11->commonModule.sessionId;
+	}
+
+	LeaveCriticalSection(&g_Supervisor.lock);
+
+	if (shutdown)
+		g_Status.shutdown(sessionId);
+}
+
+static void* x11_rds_supervisor_thread(void* arg)
+{
+	int index;
+	int count;
+	rdsX11Watch* watch;
+	struct epoll_event events[X11_SUPERVISOR_MAX_EVENTS];
+
+	while (1)
+	{
+		EnterCriticalSection(&g_Supervisor.lock);
+		watch = g_Supervisor.retired;
+		g_Supervisor.retired = NULL;
+		LeaveCriticalSection(&g_Supervisor.lock);
+
+		while (watch)
+		{
+			rdsX11Watch* next = watch->next;
+			free(watch);
+			watch = next;
+		}
+
+		count = epoll_wait(g_Supervisor.epollfd, events, X11_SUPERVISOR_MAX_EVENTS, -1);
+
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_Print(gModuleLog, WLOG_ERROR, "supervisor epoll_wait failed: %d", errno);
+			break;
+		}
+
+		for (index = 0; index < count; index++)
+		{
+			/* the stop eventfd is registered without a watch */
+			if (!events[index].data.ptr)
+				return NULL;
+
+			x11_rds_supervisor_dispatch((rdsX11Watch*) events[index].data.ptr);
+		}
+	}
+
+	return NULL;
+}
+
+static void x11_rds_supervisor_init()
+{
+	struct epoll_event event;
+
+	InitializeCriticalSection(&g_Supervisor.lock);
+	g_Supervisor.retired = NULL;
+	g_Supervisor.thread = NULL;
+	g_Supervisor.stopfd = -1;
+	g_Supervisor.epollfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (g_Supervisor.epollfd < 0)
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "epoll_create1 failed, using monitoring threads");
+		return;
+	}
+
+	g_Supervisor.stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if ((g_Supervisor.stopfd < 0) ||
+		(epoll_ctl(g_Supervisor.epollfd, EPOLL_CTL_ADD, g_Supervisor.stopfd, &event) < 0))
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "cannot create supervisor stop event, using monitoring threads");
+		return;
+	}
+
+	g_Supervisor.thread = CreateThread(NULL, 0,
+			(LPTHREAD_START_ROUTINE) x11_rds_supervisor_thread, NULL, 0, NULL);
+}
+
+static void x11_rds_supervisor_exit()
+{
+	UINT64 value = 1;
+	rdsX11Watch* watch;
+
+	if (g_Supervisor.thread)
+	{
+		if (write(g_Supervisor.stopfd, &value, sizeof(value)) == sizeof(value))
+			WaitForSingleObject(g_Supervisor.thread, INFINITE);
+
+		CloseHandle(g_Supervisor.thread);
+	}
+
+	/* watches retired from now on are freed right away */
+	EnterCriticalSection(&g_Supervisor.lock);
+
+	g_Supervisor.thread = NULL;
+	watch = g_Supervisor.retired;
+	g_Supervisor.retired = NULL;
+
+	if (g_Supervisor.stopfd >= 0)
+		close(g_Supervisor.stopfd);
+
+	if (g_Supervisor.epollfd >= 0)
+		close(g_Supervisor.epollfd);
+
+	g_Supervisor.stopfd = -1;
+	g_Supervisor.epollfd = -1;
+
+	while (watch)
+	{
+		rdsX11Watch* next = watch->next;
+		free(watch);
+		watch = next;
+	}
+
+	LeaveCriticalSection(&g_Supervisor.lock);
+}
+
+static void x11_rds_supervisor_remove(rdsModuleX11* x11)
+{
+	int index;
+
+	EnterCriticalSection(&g_Supervisor.lock);
+
+	for (index = 0; index < 3; index++)
+	{
+		if (x11->watches[index])
+			x11_rds_supervisor_retire(x11->watches[index]);
+	}
+
+	LeaveCriticalSection(&g_Supervisor.lock);
+}
+
+static BOOL x11_rds_supervisor_add(rdsModuleX11* x11)
+{
+	int index;
+	int pidfd;
+	rdsX11Watch* watch;
+	struct epoll_event event;
+	PROCESS_INFORMATION* processes[3];
+	static const char* names[3] = { "X11", "CS", "WM" };
+
+	if (!g_Supervisor.thread)
+		return FALSE;
+
+	processes[0] = &(x11->X11ProcessInformation);
+	processes[1] = &(x11->CSProcessInformation);
+	processes[2] = &(x11->WMProcessInformation);
+
+	EnterCriticalSection(&g_Supervisor.lock);
+
+	x11->watchCount = 0;
+	x11->terminating = FALSE;
+
+	for (index = 0; index < 3; index++)
+	{
+		pidfd = x11_pidfd_open(processes[index]->dwProcessId);
+
+		if (pidfd < 0)
+			break;
+
+		watch = (rdsX11Watch*) calloc(1, sizeof(rdsX11Watch));
+
+		if (!watch)
+		{
+			close(pidfd);
+			break;
+		}
+
+		watch->pidfd = pidfd;
+		watch->name = names[index];
+		watch->x11 = x11;
+		watch->pi = processes[index];
+
+		x11->watches[index] = watch;
+		x11->watchCount++;
+
+		ZeroMemory(&event, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = watch;
+
+		if (epoll_ctl(g_Supervisor.epollfd, EPOLL_CTL_ADD, pidfd, &event) < 0)
+			break;
+	}
+
+	LeaveCriticalSection(&g_Supervisor.lock);
+
+	if (index < 3)
+	{
+		WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: cannot supervise processes (%d), using monitoring thread",
+				x11->commonModule.sessionId, errno);
+		x11_rds_supervisor_remove(x11);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+#else
+
+static void x11_rds_supervisor_init() { }
+static void x11_rds_supervisor_exit() { }
+static void x11_rds_supervisor_remove(rdsModuleX11* x11) { }
+static BOOL x11_rds_supervisor_add(rdsModuleX11* x11) { return FALSE; }
+
+#endif
+
+RDS_MODULE_COMMON* x11_rds_module_new(void)
+{
+	rdsModuleX11* module = (rdsModuleX11*) calloc(1, sizeof(rdsModuleX11));
+	return (RDS_MODULE_COMMON*) module;
+}
+
+void x11_rds_module_free(RDS_MODULE_COMMON* module)
+{
+	rdsModuleX11* moduleCon = (rdsModuleX11*) module;
+
+	if (moduleCon->commonModule.authToken)
+		free(moduleCon->commonModule.authToken);
+
+	if (moduleCon->commonModule.baseConfigPath)
+		free(moduleCon->commonModule.baseConfigPath);
+
+	free(module);
+}
+
+static int x11_rds_wait_process(PROCESS_INFORMATION* pi, int* ret)
+{
+	int status = waitpid(pi->dwProcessId, ret, WNOHANG);
+
+	/* adopted processes are not our children, all we can do is probe them */
+	if ((status < 0) && (errno == ECHILD))
+		status = (kill(pi->dwProcessId, 0) == 0) ? 0 : -1;
+
+	return status;
+}
+
+int x11_rds_stop_process(PROCESS_INFORMATION *pi)
+{
+	int ret = 0, status = 0;
+	int wait = 10;
+
+	/* check if child is still alive */
+	status = x11_rds_wait_process(pi, &ret);
+
+	if (status == 0)
+	{
+		kill(pi->dwProcessId, SIGTERM);
+
+		while (wait > 0)
+		{
+			status = x11_rds_wait_process(pi, &ret);
+
+			if (status != 0)
+				break;
+
+			usleep(500000);
+			wait--;
+		}
+
+		if (status == 0)
+			kill(pi->dwProcessId, SIGKILL);
+	}
+	clean_up_process(pi);
+
+	return ret;
+}
+
+unsigned int detect_free_display()
+{
+	struct stat tstats;
+	unsigned int i = 0;
+	char buf[256];
+	char buf2[256];
+
+	EnterCriticalSection(&g_DisplayLock);
+
+	for (i = X11_DISPLAY_OFFSET; i <= X11_DISPLAY_MAX; i++)
+	{
+		if (g_DisplayReserved[i])
+			continue;
+
+		snprintf(buf,256, X11_LOCKFILE_FORMAT, i);
+		snprintf(buf2,256, X11_UNIX_SOCKET_FORMAT, i);
+
+		if(stat (buf, &tstats) != 0 && stat(buf2, &tstats) != 0)
+		{
+			break;
+		}
+	}
+
+	/* the lock file only shows up once Xrds is running, so keep the display
+	 * reserved until the server is stopped again */
+	if (i <= X11_DISPLAY_MAX)
+		g_DisplayReserved[i] = TRUE;
+
+	LeaveCriticalSection(&g_DisplayLock);
+
+	return i;
+}
+
+void release_display(unsigned int displayNum)
+{
+	char buf[256];
+
+	if (displayNum > X11_DISPLAY_MAX)
+		return;
+
+	/* clean up in case x server wasn't shut down cleanly */
+
+	snprintf(buf,256, X11_LOCKFILE_FORMAT, displayNum);
+	DeleteFileA(buf);
+
+	snprintf(buf,256, X11_UNIX_SOCKET_FORMAT, displayNum);
+	DeleteFileA(buf);
+
+	EnterCriticalSection(&g_DisplayLock);
+	g_DisplayReserved[displayNum] = FALSE;
+	LeaveCriticalSection(&g_DisplayLock);
+}
+
+/**
+ * Starts Xrds on the given display and waits until its pipe is available.
+ * Returns the pipe name on success, the caller has to free it.
+ */
+char* x11_rds_start_server(char* baseConfigPath, HANDLE userToken, char* envBlock, UINT32 displayNum,
+		int width, int height, STARTUPINFO* si, PROCESS_INFORMATION* pi)
+{
+	BOOL status;
+	long maxXRes = 0;
+	long maxYRes = 0;
+	char* filename;
+	char* pipeName;
+	char commandLine[256];
+
+	pipeName = (char*) malloc(256);
+	freerds_named_pipe_get_endpoint_name(displayNum, "X11", pipeName, 256);
+
+	filename = GetNamedPipeUnixDomainSocketFilePathA(pipeName);
+
+	if (PathFileExistsA(filename))
+		DeleteFileA(filename);
+
+	free(filename);
+
+	sprintf_s(commandLine, sizeof(commandLine), "%s :%d -geometry %dx%d -depth %d -dpi 96",
+			"Xrds", (int) displayNum, width, height, 24);
+
+	/* let Xrds reserve framebuffer memory so RandR resizes can stay in place */
+	if (getPropertyNumberWrapper(baseConfigPath, &g_Config, "maxXRes", &maxXRes) &&
+			getPropertyNumberWrapper(baseConfigPath, &g_Config, "maxYRes", &maxYRes) &&
+			(maxXRes > 0) && (maxYRes > 0))
+	{
+		int length = strlen(commandLine);
+
+		sprintf_s(&commandLine[length], sizeof(commandLine) - length, " -maxgeometry %dx%d",
+				(int) maxXRes, (int) maxYRes);
+	}
+
+	x11_rds_module_reset_process_informations(si, pi);
+
+	status = CreateProcessAsUserA(userToken, NULL, commandLine,
+			NULL, NULL, FALSE, 0, envBlock, NULL, si, pi);
+
+	if (!status)
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR , "problem starting Xrds (status %d - cmd %s)",
+				status, commandLine);
+		free(pipeName);
+		return NULL;
+	}
+
+	WLog_Print(gModuleLog, WLOG_DEBUG, "Xrds Process started: %d (pid %d - cmd %s)",
+			status, pi->dwProcessId, commandLine);
+
+	if (!WaitNamedPipeA(pipeName, 5 * 1000))
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "WaitNamedPipe failure: %s\n", pipeName);
+		x11_rds_stop_process(pi);
+		free(pipeName);
+		return NULL;
+	}
+
+	return pipeName;
+}
+
+static int x11_rds_pool_parse_resolutions(char* baseConfigPath, int* widths, int* heights)
+{
+	int count = 0;
+	long xres = 0;
+	long yres = 0;
+	char* token;
+	char* context = NULL;
+	char resolutions[256];
+
+	if (getPropertyStringWrapper(baseConfigPath, &g_Config, "poolResolutions", resolutions, sizeof(resolutions)))
+	{
+		token = strtok_r(resolutions, ",", &context);
+
+		while (token && (count < X11_POOL_MAX_RESOLUTIONS))
+		{
+			if (sscanf(token, " %dx%d", &widths[count], &heights[count]) == 2)
+			{
+				if ((widths[count] > 0) && (heights[count] > 0))
+					count++;
+			}
+
+			token = strtok_r(NULL, ",", &context);
+		}
+	}
+
+	if (count > 0)
+		return count;
+
+	if (!getPropertyNumberWrapper(baseConfigPath, &g_Config, "xres", &xres))
+		xres = 1024;
+
+	if (!getPropertyNumberWrapper(baseConfigPath, &g_Config, "yres", &yres))
+		yres = 768;
+
+	widths[0] = (int) xres;
+	heights[0] = (int) yres;
+
+	return 1;
+}
+
+static void x11_rds_pool_discard(rdsX11PoolServer* server)
+{
+	x11_rds_stop_process(&(server->X11ProcessInformation));
+	release_display(server->displayNum);
+	free(server->baseConfigPath);
+	server->baseConfigPath = NULL;
+}
+
+/* must be called with the pool lock held */
+static void x11_rds_pool_remove(int index)
+{
+	g_Pool.serverCount--;
+
+	if (index < g_Pool.serverCount)
+		g_Pool.servers[index] = g_Pool.servers[g_Pool.serverCount];
+}
+
+static void x11_rds_pool_reap()
+{
+	int index;
+	int status;
+	rdsX11PoolServer server;
+
+	EnterCriticalSection(&g_Pool.lock);
+
+	for (index = 0; index < g_Pool.serverCount; )
+	{
+		if (waitpid(g_Pool.servers[index].X11ProcessInformation.dwProcessId, &status, WNOHANG) == 0)
+		{
+			index++;
+			continue;
+		}
+
+		WLog_Print(gModuleLog, WLOG_ERROR, "pooled Xrds on display %d exited",
+				g_Pool.servers[index].displayNum);
+
+		server = g_Pool.servers[index];
+		x11_rds_pool_remove(index);
+
+		clean_up_process(&(server.X11ProcessInformation));
+		release_display(server.displayNum);
+		free(server.baseConfigPath);
+	}
+
+	LeaveCriticalSection(&g_Pool.lock);
+}
+
+/**
+ * Resolves the pool user of a configuration to its uid, root is refused.
+ */
+static BOOL x11_rds_pool_uid(char* baseConfigPath, uid_t* uid)
+{
+	char buffer[1024];
+	char poolUser[256];
+	struct passwd pwd;
+	struct passwd* pwnam = NULL;
+
+	if (!getPropertyStringWrapper(baseConfigPath, &g_Config, "poolUser", poolUser, sizeof(poolUser)))
+		return FALSE;
+
+	if ((getpwnam_r(poolUser, &pwd, buffer, sizeof(buffer), &pwnam) != 0) || !pwnam || (pwnam->pw_uid == 0))
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "%s: pool user %s is unknown or root", baseConfigPath, poolUser);
+		return FALSE;
+	}
+
+	*uid = pwnam->pw_uid;
+
+	return TRUE;
+}
+
+/**
+ * Builds the token and the environment pooled servers of a configuration
+ * run with. The token only carries the pool user's uid and gid: WinPR's
+ * LogonUserA does not authenticate on this platform, it is the way to get
+ * a token for CreateProcessAsUserA, and a service logon is requested as
+ * nobody logs on interactively here.
+ */
+static BOOL x11_rds_pool_token(char* baseConfigPath, HANDLE* userToken, char** envBlock)
+{
+	uid_t uid;
+	char* path;
+	char buffer[1024];
+	struct passwd pwd;
+	struct passwd* pwnam = NULL;
+
+	if (!x11_rds_pool_uid(baseConfigPath, &uid))
+		return FALSE;
+
+	if ((getpwuid_r(uid, &pwd, buffer, sizeof(buffer), &pwnam) != 0) || !pwnam)
+		return FALSE;
+
+	if (!LogonUserA(pwnam->pw_name, NULL, NULL, LOGON32_LOGON_SERVICE, LOGON32_PROVIDER_DEFAULT, userToken))
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "%s: no token for pool user %s", baseConfigPath, pwnam->pw_name);
+		return FALSE;
+	}
+
+	*envBlock = NULL;
+	path = getenv("PATH");
+
+	SetEnvironmentVariableEBA(envBlock, "USER", pwnam->pw_name);
+	SetEnvironmentVariableEBA(envBlock, "LOGNAME", pwnam->pw_name);
+	SetEnvironmentVariableEBA(envBlock, "HOME", pwnam->pw_dir);
+	SetEnvironmentVariableEBA(envBlock, "SHELL", pwnam->pw_shell);
+	SetEnvironmentVariableEBA(envBlock, "PATH", path ? path : "/usr/local/bin:/usr/bin:/bin");
+
+	return TRUE;
+}
+
+/**
+ * Whether a session may take over a pooled server of its configuration,
+ * see the pool description above.
+ */
+static BOOL x11_rds_pool_may_claim(rdsModuleX11* x11)
+{
+	uid_t uid;
+	char buffer[1024];
+	struct passwd pwd;
+	struct passwd* pwnam = NULL;
+
+	if (!x11_rds_pool_uid(x11->commonModule.baseConfigPath, &uid))
+		return FALSE;
+
+	if (!x11->commonModule.userToken)
+		return TRUE;
+
+	if (!x11->commonModule.userName)
+		return FALSE;
+
+	if ((getpwnam_r(x11->commonModule.userName, &pwd, buffer, sizeof(buffer), &pwnam) != 0) || !pwnam)
+		return FALSE;
+
+	return (pwnam->pw_uid == uid) ? TRUE : FALSE;
+}
+
+static void x11_rds_pool_fill(char* baseConfigPath)
+{
+	int index;
+	int count;
+	int best;
+	int total;
+	long poolSize = 0;
+	int idle[X11_POOL_MAX_RESOLUTIONS];
+	int widths[X11_POOL_MAX_RESOLUTIONS];
+	int heights[X11_POOL_MAX_RESOLUTIONS];
+	rdsX11PoolServer server;
+	char* pipeName;
+	char* envBlock = NULL;
+	HANDLE userToken = NULL;
+
+	if (!getPropertyNumberWrapper(baseConfigPath, &g_Config, "poolSize", &poolSize) || (poolSize <= 0))
+		return;
+
+	count = x11_rds_pool_parse_resolutions(baseConfigPath, widths, heights);
+
+	while (WaitForSingleObject(g_Pool.stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		total = 0;
+		ZeroMemory(idle, sizeof(idle));
+
+		EnterCriticalSection(&g_Pool.lock);
+
+		for (index = 0; index < g_Pool.serverCount; index++)
+		{
+			int resolution;
+
+			if (strcmp(g_Pool.servers[index].baseConfigPath, baseConfigPath) != 0)
+				continue;
+
+			total++;
+
+			for (resolution = 0; resolution < count; resolution++)
+			{
+				if ((g_Pool.servers[index].width == widths[resolution]) &&
+						(g_Pool.servers[index].height == heights[resolution]))
+					idle[resolution]++;
+			}
+		}
+
+		LeaveCriticalSection(&g_Pool.lock);
+
+		if (total >= poolSize)
+			break;
+
+		best = 0;
+
+		for (index = 1; index < count; index++)
+		{
+			if (idle[index] < idle[best])
+				best = index;
+		}
+
+		ZeroMemory(&server, sizeof(server));
+		server.width = widths[best];
+		server.height = heights[best];
+		server.displayNum = detect_free_display();
+
+		if (server.displayNum > X11_DISPLAY_MAX)
 		{
-			ret = clean_up_process(&(x11->WMProcessInformation));
-			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: WM process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+			WLog_Print(gModuleLog, WLOG_ERROR, "no free display for the Xrds pool");
 			break;
 		}
-		if (WaitForSingleObject(x11->monitorStopEvent, 200) == WAIT_OBJECT_0)
+
+		if (!userToken && !x11_rds_pool_token(baseConfigPath, &userToken, &envBlock))
 		{
-			// monitorStopEvent triggered
-			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: monitor stop event", x11->commonModule.sessionId);
-			return;
+			release_display(server.displayNum);
+			break;
 		}
-	}
 
-	if (x11->CSProcessInformation.hProcess)
-	{
-		kill(x11->CSProcessInformation.dwProcessId, SIGTERM);
-		if (waitpid(x11->CSProcessInformation.dwProcessId, &status, 0) != 0)
+		pipeName = x11_rds_start_server(baseConfigPath, userToken, envBlock,
+				server.displayNum, server.width, server.height,
+				&(server.X11StartupInfo), &(server.X11ProcessInformation));
+
+		if (!pipeName)
 		{
-			ret = clean_up_process(&(x11->CSProcessInformation));
-			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: CS process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+			release_display(server.displayNum);
+			break;
 		}
-	}
 
-	if (x11->WMProcessInformation.hProcess)
-	{
-		kill(x11->WMProcessInformation.dwProcessId, SIGTERM);
-		if (waitpid(x11->WMProcessInformation.dwProcessId, &status, 0) != 0)
+		free(pipeName);
+
+		server.baseConfigPath = _strdup(baseConfigPath);
+
+		EnterCriticalSection(&g_Pool.lock);
+
+		if (g_Pool.serverCount < X11_POOL_MAX)
 		{
-			ret = clean_up_process(&(x11->WMProcessInformation));
-			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: WM process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+			g_Pool.servers[g_Pool.serverCount++] = server;
+			server.baseConfigPath = NULL;
 		}
-	}
 
-	if (x11->X11ProcessInformation.hProcess)
-	{
-		kill(x11->X11ProcessInformation.dwProcessId, SIGTERM);
-		if (waitpid(x11->X11ProcessInformation.dwProcessId, &status, 0) != 0)
+		LeaveCriticalSection(&g_Pool.lock);
+
+		if (server.baseConfigPath)
 		{
-			ret = clean_up_process(&(x11->X11ProcessInformation));
-			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: X11 process exited with %d (monitoring thread)", x11->commonModule.sessionId, ret);
+			x11_rds_pool_discard(&server);
+			break;
 		}
+
+		WLog_Print(gModuleLog, WLOG_DEBUG, "%s: pooled Xrds ready on display %d (%dx%d)",
+				baseConfigPath, server.displayNum, server.width, server.height);
 	}
 
-	g_Status.shutdown(x11->commonModule.sessionId);
-	return;
-}
+	if (userToken)
+		CloseHandle(userToken);
 
-RDS_MODULE_COMMON* x11_rds_module_new(void)
-{
-	rdsModuleX11* module = (rdsModuleX11*) calloc(1, sizeof(rdsModuleX11));
-	return (RDS_MODULE_COMMON*) module;
+	free(envBlock);
 }
 
-void x11_rds_module_free(RDS_MODULE_COMMON* module)
+static void* x11_rds_pool_thread(void* arg)
 {
-	rdsModuleX11* moduleCon = (rdsModuleX11*) module;
+	int index;
+	int count;
+	HANDLE events[2];
+	char* configs[X11_POOL_MAX_CONFIGS];
 
-	if (moduleCon->commonModule.authToken)
-		free(moduleCon->commonModule.authToken);
+	events[0] = g_Pool.stopEvent;
+	events[1] = g_Pool.refillEvent;
 
-	if (moduleCon->commonModule.baseConfigPath)
-		free(moduleCon->commonModule.baseConfigPath);
+	while (WaitForMultipleObjects(2, events, FALSE, X11_POOL_CHECK_INTERVAL) != WAIT_OBJECT_0)
+	{
+		x11_rds_pool_reap();
 
-	free(module);
+		EnterCriticalSection(&g_Pool.lock);
+		count = g_Pool.configCount;
+		CopyMemory(configs, g_Pool.configs, sizeof(configs));
+		LeaveCriticalSection(&g_Pool.lock);
+
+		for (index = 0; index < count; index++)
+			x11_rds_pool_fill(configs[index]);
+	}
+
+	return NULL;
 }
 
-int x11_rds_stop_process(PROCESS_INFORMATION *pi)
+/**
+ * Remembers a module configuration that is in use so the pool thread keeps
+ * idle servers for it, and kicks off a refill.
+ */
+static void x11_rds_pool_register(char* baseConfigPath)
 {
-	int ret = 0, status = 0;
-	int wait = 10;
+	int index;
+	BOOL found = FALSE;
+	long poolSize = 0;
+	char poolUser[256];
 
-	/* check if child is still alive */
-	status = waitpid(pi->dwProcessId, &ret, WNOHANG);
+	if (!baseConfigPath)
+		return;
 
-	if (status == 0)
+	if (!getPropertyNumberWrapper(baseConfigPath, &g_Config, "poolSize", &poolSize) || (poolSize <= 0))
+		return;
+
+	if (!getPropertyStringWrapper(baseConfigPath, &g_Config, "poolUser", poolUser, sizeof(poolUser)))
 	{
-		kill(pi->dwProcessId, SIGTERM);
+		WLog_Print(gModuleLog, WLOG_WARN, "%s: poolSize is set without a poolUser, not pooling", baseConfigPath);
+		return;
+	}
 
-		while (wait > 0)
+	EnterCriticalSection(&g_Pool.lock);
+
+	for (index = 0; index < g_Pool.configCount; index++)
+	{
+		if (strcmp(g_Pool.configs[index], baseConfigPath) == 0)
 		{
-			status = waitpid(pi->dwProcessId, &ret, WNOHANG);
+			found = TRUE;
+			break;
+		}
+	}
 
-			if (status != 0)
-				break;
+	if (!found && (g_Pool.configCount < X11_POOL_MAX_CONFIGS))
+		g_Pool.configs[g_Pool.configCount++] = _strdup(baseConfigPath);
 
-			usleep(500000);
-			wait--;
-		}
+	if (!g_Pool.thread && (WaitForSingleObject(g_Pool.stopEvent, 0) != WAIT_OBJECT_0))
+		g_Pool.thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) x11_rds_pool_thread, NULL, 0, NULL);
 
-		if (status == 0)
-			kill(pi->dwProcessId, SIGKILL);
-	}
-	clean_up_process(pi);
+	LeaveCriticalSection(&g_Pool.lock);
 
-	return ret;
+	SetEvent(g_Pool.refillEvent);
 }
 
-unsigned int detect_free_display()
+/**
+ * Hands out an idle server of the given configuration, preferring one that
+ * already has the requested geometry.
+ */
+static BOOL x11_rds_pool_claim(char* baseConfigPath, int width, int height, rdsX11PoolServer* claimed)
 {
-	struct stat tstats;
-	unsigned int i = 0;
-	char buf[256];
-	char buf2[256];
+	int index;
+	int status;
+	int match;
+	rdsX11PoolServer server;
 
-	for (i = X11_DISPLAY_OFFSET; i <= X11_DISPLAY_MAX; i++)
+	if (!baseConfigPath)
+		return FALSE;
+
+	EnterCriticalSection(&g_Pool.lock);
+
+	while (1)
 	{
-		snprintf(buf,256, X11_LOCKFILE_FORMAT, i);
-		snprintf(buf2,256, X11_UNIX_SOCKET_FORMAT, i);
+		match = -1;
 
-		if(stat (buf, &tstats) != 0 && stat(buf2, &tstats) != 0)
+		for (index = 0; index < g_Pool.serverCount; index++)
+		{
+			if (strcmp(g_Pool.servers[index].baseConfigPath, baseConfigPath) != 0)
+				continue;
+
+			if ((g_Pool.servers[index].width == width) && (g_Pool.servers[index].height == height))
+			{
+				match = index;
+				break;
+			}
+
+			if (match < 0)
+				match = index;
+		}
+
+		if (match < 0)
+			break;
+
+		server = g_Pool.servers[match];
+		x11_rds_pool_remove(match);
+
+		if (waitpid(server.X11ProcessInformation.dwProcessId, &status, WNOHANG) == 0)
 		{
+			*claimed = server;
 			break;
 		}
+
+		clean_up_process(&(server.X11ProcessInformation));
+		release_display(server.displayNum);
+		free(server.baseConfigPath);
 	}
 
-	return i;
+	LeaveCriticalSection(&g_Pool.lock);
+
+	SetEvent(g_Pool.refillEvent);
+
+	if (match < 0)
+		return FALSE;
+
+	free(claimed->baseConfigPath);
+	claimed->baseConfigPath = NULL;
+
+	return TRUE;
 }
 
 static char *trim_string(char *string)
@@ -291,10 +1230,9 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 	DWORD SessionId;
 	char envstr[256];
 	char* envstrp;
-	char* filename;
 	char* pipeName;
 	rdsModuleX11* x11;
-	char commandLine[256];
+	rdsX11PoolServer pooled;
 	char currentDir[256];
 	char* lpCurrentDir;
 	char startupname[256];
@@ -303,31 +1241,43 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 	int i;
 
 	x11 = (rdsModuleX11*) module;
-	x11->monitorStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	SessionId = x11->commonModule.sessionId;
-	x11->displayNum = detect_free_display();
 
-	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, using display %d", SessionId, x11->displayNum);
-	pipeName = (char*) malloc(256);
-	freerds_named_pipe_get_endpoint_name(x11->displayNum, "X11", pipeName, 256);
+	x11_rds_pool_register(x11->commonModule.baseConfigPath);
 
-	filename = GetNamedPipeUnixDomainSocketFilePathA(pipeName);
+	if (x11_rds_pool_may_claim(x11) && x11_rds_pool_claim(x11->commonModule.baseConfigPath,
+			module->desktopWidth, module->desktopHeight, &pooled))
+	{
+		x11->displayNum = pooled.displayNum;
+		x11->X11StartupInfo = pooled.X11StartupInfo;
+		x11->X11ProcessInformation = pooled.X11ProcessInformation;
 
-	if (PathFileExistsA(filename))
+		WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, claimed pooled Xrds on display %d (%dx%d, client %dx%d)",
+				SessionId, x11->displayNum, pooled.width, pooled.height,
+				module->desktopWidth, module->desktopHeight);
+
+		pipeName = (char*) malloc(256);
+		freerds_named_pipe_get_endpoint_name(x11->displayNum, "X11", pipeName, 256);
+	}
+	else
 	{
-		DeleteFileA(filename);
-		status = 1;
+		x11->displayNum = detect_free_display();
+
+		if (x11->displayNum > X11_DISPLAY_MAX)
+		{
+			WLog_Print(gModuleLog, WLOG_ERROR, "s %d, no free display", SessionId);
+			return NULL;
+		}
+
+		pipeName = NULL;
 	}
 
-	free(filename);
+	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, using display %d", SessionId, x11->displayNum);
 
 	sprintf_s(envstr, sizeof(envstr), ":%d", (int) (x11->displayNum));
 	SetEnvironmentVariableEBA(&x11->commonModule.envBlock, "DISPLAY", envstr);
 
-	sprintf_s(commandLine, sizeof(commandLine), "%s :%d -geometry %dx%d -depth %d -dpi 96",
-			"Xrds", (int) (x11->displayNum), module->desktopWidth, module->desktopHeight, 24);
-
 	/* Get the user's home directory. */
 	lpCurrentDir = NULL;
 	cchSize = sizeof(currentDir);
@@ -385,28 +1335,19 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 		}
 	}
 
-	x11_rds_module_reset_process_informations(&(x11->X11StartupInfo), &(x11->X11ProcessInformation));
-
-	status = CreateProcessAsUserA(x11->commonModule.userToken, NULL, commandLine,
-			NULL, NULL, FALSE, 0, x11->commonModule.envBlock, NULL,
-			&(x11->X11StartupInfo), &(x11->X11ProcessInformation));
-
-	if (!status)
+	if (!pipeName)
 	{
-		WLog_Print(gModuleLog, WLOG_ERROR , "s %d, problem starting Xrds (status %d - cmd %s)",
-		SessionId, status, commandLine);
-		free(pipeName);
-		return NULL;
-	}
-
-	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, Xrds Process started: %d (pid %d - cmd %s)",
-			SessionId, status, x11->X11ProcessInformation.dwProcessId, commandLine);
+		pipeName = x11_rds_start_server(x11->commonModule.baseConfigPath,
+				x11->commonModule.userToken, x11->commonModule.envBlock,
+				x11->displayNum, module->desktopWidth, module->desktopHeight,
+				&(x11->X11StartupInfo), &(x11->X11ProcessInformation));
 
-	if (!WaitNamedPipeA(pipeName, 5 * 1000))
-	{
-		WLog_Print(gModuleLog, WLOG_ERROR, "s %d: WaitNamedPipe failure: %s\n", SessionId, pipeName);
-		free(pipeName);
-		return NULL;
+		if (!pipeName)
+		{
+			WLog_Print(gModuleLog, WLOG_ERROR, "s %d, problem starting Xrds", SessionId);
+			release_display(x11->displayNum);
+			return NULL;
+		}
 	}
 
 	x11_rds_module_reset_process_informations(&(x11->CSStartupInfo), &(x11->CSProcessInformation));
@@ -430,6 +1371,7 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 	{
 		WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, problem starting %s (status %d)", SessionId, startupname, status);
 		x11_rds_stop_process(&(x11->X11ProcessInformation));
+		release_display(x11->displayNum);
 		free(pipeName);
 		return NULL;
 	}
@@ -458,14 +1400,19 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 		WLog_Print(gModuleLog, WLOG_DEBUG, "s %d, problem starting %s (status %d)", SessionId, startupname, status);
 		x11_rds_stop_process(&(x11->X11ProcessInformation));
 		x11_rds_stop_process(&(x11->CSProcessInformation));
+		release_display(x11->displayNum);
 		free(pipeName);
 		return NULL;
 	}
 
 	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: WM process started: %d (pid %d)", SessionId, status, x11->WMProcessInformation.dwProcessId);
 
-	/* Start the monitoring thread. */
-	x11->monitorThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) monitoring_thread, x11, 0, NULL);
+	if (!x11_rds_supervisor_add(x11))
+	{
+		/* Start the monitoring thread. */
+		x11->monitorStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		x11->monitorThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) monitoring_thread, x11, 0, NULL);
+	}
 
 	return pipeName;
 }
@@ -473,27 +1420,220 @@ char* x11_rds_module_start(RDS_MODULE_COMMON* module)
 int x11_rds_module_stop(RDS_MODULE_COMMON* module)
 {
 	int ret = 0;
-	char buf[256];
 	rdsModuleX11* x11 = (rdsModuleX11*) module;
 
 	WLog_Print(gModuleLog, WLOG_TRACE, "Stop called");
 
-	SetEvent(x11->monitorStopEvent);
-	WaitForSingleObject(x11->monitorThread, INFINITE);
+	if (x11->monitorThread)
+	{
+		SetEvent(x11->monitorStopEvent);
+		WaitForSingleObject(x11->monitorThread, INFINITE);
+		CloseHandle(x11->monitorThread);
+		CloseHandle(x11->monitorStopEvent);
+		x11->monitorThread = NULL;
+		x11->monitorStopEvent = NULL;
+	}
+	else
+	{
+		x11_rds_supervisor_remove(x11);
+	}
 
 	ret = x11_rds_stop_process(&(x11->WMProcessInformation));
 	ret = x11_rds_stop_process(&(x11->CSProcessInformation));
 	ret = x11_rds_stop_process(&(x11->X11ProcessInformation));
 
-	/* clean up in case x server wasn't shut down cleanly */
+	release_display(x11->displayNum);
 
-	snprintf(buf,256, X11_LOCKFILE_FORMAT, x11->displayNum);
-	DeleteFileA(buf);
+	return ret;
+}
 
-	snprintf(buf,256, X11_UNIX_SOCKET_FORMAT, x11->displayNum);
-	DeleteFileA(buf);
+/**
+ * Returns the start time of a process in clock ticks since boot,
+ * 0 if the process does not exist.
+ */
+static UINT64 x11_process_start_time(DWORD pid)
+{
+	int field;
+	FILE* file;
+	char* token;
+	char* context = NULL;
+	char buf[1024];
+	UINT64 startTime = 0;
 
-	return ret;
+	snprintf(buf, sizeof(buf), "/proc/%d/stat", (int) pid);
+	file = fopen(buf, "r");
+
+	if (!file)
+		return 0;
+
+	if (!fgets(buf, sizeof(buf), file))
+		buf[0] = '\0';
+
+	fclose(file);
+
+	/* the command name may contain spaces, the fields after it do not */
+	token = strrchr(buf, ')');
+
+	if (!token)
+		return 0;
+
+	/* the state is field 3, the start time field 22 */
+	token = strtok_r(token + 1, " ", &context);
+
+	for (field = 3; token && (field < 22); field++)
+		token = strtok_r(NULL, " ", &context);
+
+	if (token)
+		startTime = strtoull(token, NULL, 10);
+
+	return startTime;
+}
+
+int x11_rds_module_get_state(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state)
+{
+	int index;
+	rdsModuleX11* x11 = (rdsModuleX11*) module;
+
+	state->instance = x11->displayNum;
+	state->processCount = 3;
+	state->processIds[0] = x11->X11ProcessInformation.dwProcessId;
+	state->processIds[1] = x11->CSProcessInformation.dwProcessId;
+	state->processIds[2] = x11->WMProcessInformation.dwProcessId;
+
+	for (index = 0; index < 3; index++)
+		state->processStartTimes[index] = x11_process_start_time(state->processIds[index]);
+
+	return 0;
+}
+
+/**
+ * Takes over the processes of a session started by a previous instance of
+ * the session manager. Only the supervisor can watch processes that are not
+ * our children, so adoption fails on kernels without pidfd support.
+ */
+char* x11_rds_module_adopt(RDS_MODULE_COMMON* module, RDS_MODULE_STATE* state)
+{
+	int index;
+	int lockPid = 0;
+	FILE* lockFile;
+	char buf[256];
+	char* pipeName;
+	rdsModuleX11* x11 = (rdsModuleX11*) module;
+
+	if ((state->processCount != 3) || (state->instance > X11_DISPLAY_MAX))
+		return NULL;
+
+	/* a pid that was reused by another process has a different start time */
+	for (index = 0; index < 3; index++)
+	{
+		if (!state->processIds[index] || !state->processStartTimes[index] ||
+				(x11_process_start_time(state->processIds[index]) != state->processStartTimes[index]))
+		{
+			WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: process %d is gone, not adopting",
+					x11->commonModule.sessionId, (int) state->processIds[index]);
+			return NULL;
+		}
+	}
+
+	/* and the display still has to be served by our Xrds */
+	snprintf(buf, sizeof(buf), X11_LOCKFILE_FORMAT, (int) state->instance);
+	lockFile = fopen(buf, "r");
+
+	if (lockFile)
+	{
+		if (fscanf(lockFile, "%d", &lockPid) != 1)
+			lockPid = 0;
+
+		fclose(lockFile);
+	}
+
+	if (lockPid != (int) state->processIds[0])
+	{
+		WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: display %d is not owned by pid %d, not adopting",
+				x11->commonModule.sessionId, (int) state->instance, (int) state->processIds[0]);
+		return NULL;
+	}
+
+	EnterCriticalSection(&g_DisplayLock);
+
+	if (g_DisplayReserved[state->instance])
+	{
+		LeaveCriticalSection(&g_DisplayLock);
+		return NULL;
+	}
+
+	g_DisplayReserved[state->instance] = TRUE;
+
+	LeaveCriticalSection(&g_DisplayLock);
+
+	x11->displayNum = state->instance;
+
+	x11_rds_module_reset_process_informations(&(x11->X11StartupInfo), &(x11->X11ProcessInformation));
+	x11_rds_module_reset_process_informations(&(x11->CSStartupInfo), &(x11->CSProcessInformation));
+	x11_rds_module_reset_process_informations(&(x11->WMStartupInfo), &(x11->WMProcessInformation));
+
+	x11->X11ProcessInformation.dwProcessId = state->processIds[0];
+	x11->CSProcessInformation.dwProcessId = state->processIds[1];
+	x11->WMProcessInformation.dwProcessId = state->processIds[2];
+
+	if (!x11_rds_supervisor_add(x11))
+	{
+		WLog_Print(gModuleLog, WLOG_ERROR, "s %d: cannot supervise adopted processes",
+				x11->commonModule.sessionId);
+
+		/* the display is still in use by the orphaned server, only drop the reservation */
+		EnterCriticalSection(&g_DisplayLock);
+		g_DisplayReserved[x11->displayNum] = FALSE;
+		LeaveCriticalSection(&g_DisplayLock);
+
+		return NULL;
+	}
+
+	x11_rds_pool_register(x11->commonModule.baseConfigPath);
+
+	pipeName = (char*) malloc(256);
+	freerds_named_pipe_get_endpoint_name(x11->displayNum, "X11", pipeName, 256);
+
+	WLog_Print(gModuleLog, WLOG_DEBUG, "s %d: adopted display %d (X11 %d, CS %d, WM %d)",
+			x11->commonModule.sessionId, x11->displayNum, (int) state->processIds[0],
+			(int) state->processIds[1], (int) state->processIds[2]);
+
+	return pipeName;
+}
+
+void x11_rds_module_exit()
+{
+	HANDLE thread;
+	rdsX11PoolServer server;
+
+	EnterCriticalSection(&g_Pool.lock);
+	SetEvent(g_Pool.stopEvent);
+	thread = g_Pool.thread;
+	g_Pool.thread = NULL;
+	LeaveCriticalSection(&g_Pool.lock);
+
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	/* idle servers are not journaled, a new manager would never adopt them */
+	EnterCriticalSection(&g_Pool.lock);
+
+	while (g_Pool.serverCount > 0)
+	{
+		server = g_Pool.servers[g_Pool.serverCount - 1];
+		x11_rds_pool_remove(g_Pool.serverCount - 1);
+		x11_rds_pool_discard(&server);
+	}
+
+	while (g_Pool.configCount > 0)
+		free(g_Pool.configs[--g_Pool.configCount]);
+
+	LeaveCriticalSection(&g_Pool.lock);
+
+	x11_rds_supervisor_exit();
 }
 
 int RdsModuleEntry(RDS_MODULE_ENTRY_POINTS* pEntryPoints)
@@ -506,6 +1646,11 @@ int RdsModuleEntry(RDS_MODULE_ENTRY_POINTS* pEntryPoints)
 	pEntryPoints->Start = x11_rds_module_start;
 	pEntryPoints->Stop = x11_rds_module_stop;
 
+	pEntryPoints->GetState = x11_rds_module_get_state;
+	pEntryPoints->Adopt = x11_rds_module_adopt;
+
+	pEntryPoints->Exit = x11_rds_module_exit;
+
 	pEntryPoints->Name = "X11";
 
 	g_Status = pEntryPoints->status;
@@ -514,5 +1659,14 @@ int RdsModuleEntry(RDS_MODULE_ENTRY_POINTS* pEntryPoints)
 	WLog_Init();
 	gModuleLog = WLog_Get("com.freerds.module.x11");
 
+	InitializeCriticalSection(&g_DisplayLock);
+
+	x11_rds_supervisor_init();
+
+	ZeroMemory(&g_Pool, sizeof(g_Pool));
+	InitializeCriticalSection(&g_Pool.lock);
+	g_Pool.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	g_Pool.refillEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
 	return 0;
 }